@@ -15,16 +15,1312 @@
 */
 #include <peci.h>
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <sdbusplus/asio/object_server.hpp>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+
+namespace
+{
+constexpr const char* peciPath = "/com/intel/peci";
+constexpr const char* jobIntf = "com.intel.Protocol.PECI.Raw.Job";
+
+// Number of commands a job runs before yielding back to the D-Bus event loop.
+// Each chunk is reported in one Results signal.
+constexpr size_t jobChunkSize = 16;
+
+// How long a finished job stays on D-Bus so clients can read its final state
+constexpr std::chrono::seconds jobLinger(60);
+
+// Jobs a single D-Bus sender may have at once, including finished jobs that
+// are still lingering, so one client cannot fill the bus with job objects
+constexpr size_t maxJobsPerSender = 16;
+
+// D-Bus will time out after too long, so set a deadline for when to abort the
+// PECI commands (at 25s, it mostly times out, at 24s it doesn't, so use 23s to
+// be safe)
+constexpr int peciTimeout = 23;
+
+// Raw commands are formatted as [addr, write length, read length, data...]
+void validateRawCmd(const std::vector<uint8_t>& rawCmd)
+{
+    if (rawCmd.size() < 3)
+    {
+        throw std::invalid_argument("Command Length too short");
+    }
+    if (rawCmd.size() - 3 < rawCmd[1])
+    {
+        throw std::invalid_argument("Command shorter than its write length");
+    }
+}
+
+// Open PECI devices keyed by device path.  A session stays open while
+// requests keep arriving and is closed after a short idle period, so the
+// device is not held away from other processes that lock it directly.  A
+// session that has been open for maxHold is closed once its command is done
+// even if more are coming, and the pool rests long enough for a process
+// polling for the device to get it before the scheduler runs any more
+// commands.
+class SessionPool
+{
+  public:
+    explicit SessionPool(boost::asio::io_context& io) : io(io) {}
+
+    ~SessionPool()
+    {
+        for (auto& [dev, session] : sessions)
+        {
+            peci_Unlock(session->fd);
+        }
+    }
+
+    SessionPool(const SessionPool&) = delete;
+    SessionPool& operator=(const SessionPool&) = delete;
+
+    // Returns an open file descriptor for the device or -1 if the device
+    // could not be locked.  Each successful acquire must be paired with a
+    // release.
+    int acquire(const std::string& peciDev)
+    {
+        auto it = sessions.find(peciDev);
+        if (it != sessions.end())
+        {
+            it->second->idleTimer.cancel();
+            return it->second->fd;
+        }
+        int fd = -1;
+        if (peci_LockDev(peciDev.c_str(), &fd, PECI_TIMEOUT_MS) !=
+            PECI_CC_SUCCESS)
+        {
+            return -1;
+        }
+        sessions.emplace(peciDev, std::make_unique<Session>(io, fd));
+        return fd;
+    }
+
+    void release(const std::string& peciDev)
+    {
+        auto it = sessions.find(peciDev);
+        if (it == sessions.end())
+        {
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now - it->second->opened >= maxHold)
+        {
+            peci_Unlock(it->second->fd);
+            sessions.erase(it);
+            restUntil = now + rest;
+            return;
+        }
+        it->second->idleTimer.expires_after(sessionIdle);
+        it->second->idleTimer.async_wait(
+            [this, peciDev](const boost::system::error_code& ec) {
+                if (ec == boost::asio::error::operation_aborted)
+                {
+                    return;
+                }
+                auto it = sessions.find(peciDev);
+                if (it != sessions.end())
+                {
+                    peci_Unlock(it->second->fd);
+                    sessions.erase(it);
+                }
+            });
+    }
+
+    // No command may be run before this time
+    std::chrono::steady_clock::time_point restingUntil() const
+    {
+        return restUntil;
+    }
+
+  private:
+    // Other processes poll for the device every PECI_TIMEOUT_RESOLUTION_MS,
+    // so don't hold an idle session longer than one poll period
+    static constexpr std::chrono::milliseconds sessionIdle{
+        PECI_TIMEOUT_RESOLUTION_MS};
+    // A process that starts waiting for the device just after a session
+    // opened gets it well within the PECI_TIMEOUT_MS it waits, as the rest
+    // spans two of its polls
+    static constexpr std::chrono::milliseconds maxHold{PECI_TIMEOUT_MS / 2};
+    static constexpr std::chrono::milliseconds rest{
+        2 * PECI_TIMEOUT_RESOLUTION_MS};
+
+    struct Session
+    {
+        Session(boost::asio::io_context& io, int fd) :
+            fd(fd), opened(std::chrono::steady_clock::now()), idleTimer(io)
+        {}
+        int fd;
+        std::chrono::steady_clock::time_point opened;
+        boost::asio::steady_timer idleTimer;
+    };
+
+    boost::asio::io_context& io;
+    std::map<std::string, std::unique_ptr<Session>> sessions;
+    std::chrono::steady_clock::time_point restUntil;
+};
+
+// Holds a pooled session for the duration of a request
+class SessionGuard
+{
+  public:
+    SessionGuard(SessionPool& pool, const std::string& peciDev) :
+        fd(pool.acquire(peciDev)), pool(pool), peciDev(peciDev)
+    {}
+
+    ~SessionGuard()
+    {
+        if (fd >= 0)
+        {
+            pool.release(peciDev);
+        }
+    }
+
+    SessionGuard(const SessionGuard&) = delete;
+    SessionGuard& operator=(const SessionGuard&) = delete;
+
+    const int fd;
+
+  private:
+    SessionPool& pool;
+    std::string peciDev;
+};
+
+// Learned bus time of each raw command shape, used to predict whether a
+// command still fits before a deadline instead of finding out afterwards.
+// Shapes are keyed by target, PECI command code and write and read lengths,
+// and each keeps an exponentially weighted mean and mean deviation in the
+// style of TCP's round trip estimator.
+class CommandLatency
+{
+  public:
+    void add(const uint8_t* rawCmd, std::chrono::microseconds took)
+    {
+        auto now = std::chrono::steady_clock::now();
+        int64_t us = std::max<int64_t>(took.count(), 0);
+        auto it = shapes.find(shape(rawCmd));
+        if (it == shapes.end() && shapes.size() < maxShapes)
+        {
+            it = shapes.emplace(shape(rawCmd), Ewma()).first;
+        }
+        if (it != shapes.end())
+        {
+            learn(it->second, us, now);
+        }
+        learn(overall, us, now);
+    }
+
+    // Conservative estimate for one command: its mean plus its deviation.
+    // Shapes that have not run yet use the mean of all commands.
+    std::chrono::microseconds estimate(const uint8_t* rawCmd) const
+    {
+        return estimate(rawCmd, std::chrono::steady_clock::now());
+    }
+
+    // Estimated time for a batch, and how many of its commands are expected
+    // to finish within the budget
+    std::pair<std::chrono::microseconds, uint32_t>
+        estimate(const std::vector<std::vector<uint8_t>>& rawCmds,
+                 std::chrono::microseconds budget) const
+    {
+        auto now = std::chrono::steady_clock::now();
+        std::chrono::microseconds total(0);
+        uint32_t fit = 0;
+        for (const std::vector<uint8_t>& rawCmd : rawCmds)
+        {
+            total += estimate(rawCmd.data(), now);
+            if (total <= budget)
+            {
+                fit++;
+            }
+        }
+        return {total, fit};
+    }
+
+  private:
+    // Used until the first command has been timed
+    static constexpr std::chrono::microseconds defaultEstimate{2000};
+    // No command is expected to take longer than this, so one slow sample
+    // cannot stop a shape from ever fitting a fresh deadline again
+    static constexpr std::chrono::microseconds maxEstimate{1000000};
+    // A shape that has not run for this long moves halfway back to the mean
+    // of all commands, and again for every further period
+    static constexpr std::chrono::seconds decayPeriod{30};
+    // Commands of further shapes are only learned in the overall mean
+    static constexpr size_t maxShapes = 4096;
+
+    using Shape = std::tuple<uint8_t, uint8_t, uint8_t, uint8_t>;
+
+    struct Ewma
+    {
+        int64_t mean = -1;
+        int64_t dev = 0;
+        std::chrono::steady_clock::time_point sampled;
+    };
+
+    static Shape shape(const uint8_t* rawCmd)
+    {
+        // The command code is the first byte written
+        return {rawCmd[0], rawCmd[1] != 0 ? rawCmd[3] : 0, rawCmd[1],
+                rawCmd[2]};
+    }
+
+    static void learn(Ewma& ewma, int64_t us,
+                      std::chrono::steady_clock::time_point now)
+    {
+        ewma.sampled = now;
+        if (ewma.mean < 0)
+        {
+            ewma.mean = us;
+            ewma.dev = us / 2;
+            return;
+        }
+        int64_t err = us - ewma.mean;
+        ewma.mean += err / 8;
+        ewma.dev += (std::abs(err) - ewma.dev) / 4;
+    }
+
+    std::chrono::microseconds
+        estimate(const uint8_t* rawCmd,
+                 std::chrono::steady_clock::time_point now) const
+    {
+        int64_t us = overall.mean < 0 ? defaultEstimate.count()
+                                      : overall.mean + overall.dev;
+        auto it = shapes.find(shape(rawCmd));
+        if (it != shapes.end())
+        {
+            int64_t periods = (now - it->second.sampled) / decayPeriod;
+            if (periods < 62)
+            {
+                us += (it->second.mean + it->second.dev - us) /
+                      (int64_t{1} << periods);
+            }
+        }
+        return std::min(std::chrono::microseconds(us), maxEstimate);
+    }
+
+    std::map<Shape, Ewma> shapes;
+    Ewma overall;
+};
+
+EPECIStatus sendRawCmd(CommandLatency& latency, int peciFd,
+                       const uint8_t* rawCmd, uint8_t* resp)
+{
+    if (peciFd < 0)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    auto start = std::chrono::steady_clock::now();
+    EPECIStatus ret = peci_raw_seq(rawCmd[0], rawCmd[2], &rawCmd[3],
+                                   rawCmd[1], resp, rawCmd[2], peciFd);
+    latency.add(rawCmd, std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - start));
+    return ret;
+}
+
+// Returns true if the command is expected to finish before the deadline
+bool fitsDeadline(const CommandLatency& latency, const uint8_t* rawCmd,
+                  std::chrono::steady_clock::time_point deadline)
+{
+    if (std::chrono::steady_clock::now() + latency.estimate(rawCmd) <=
+        deadline)
+    {
+        return true;
+    }
+    std::cerr << "PECI command would not finish within the " << peciTimeout
+              << " second deadline.  Stopping early to avoid a timeout\n";
+    return false;
+}
+
+// Largest command table SendBulk accepts.  At about a millisecond per
+// command this is far more than fits before the D-Bus deadline.
+constexpr size_t maxBulkTable = 1024 * 1024;
+// Largest response buffer SendBulk fills.  A table of short commands with
+// long reads would otherwise make the daemon hold, and the client's memfd
+// grow to, up to 256 bytes of response for every 3 bytes of table.
+constexpr size_t maxBulkResponse = 1024 * 1024;
+
+// Reads exactly size bytes at offset, or throws
+void preadAll(int fd, uint8_t* data, size_t size, off_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t n = pread(fd, data, size, offset);
+        if (n <= 0)
+        {
+            throw std::invalid_argument("Failed to read command table");
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+        offset += n;
+    }
+}
+
+// Writes exactly size bytes at offset, or throws
+void pwriteAll(int fd, const uint8_t* data, size_t size, off_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t n = pwrite(fd, data, size, offset);
+        if (n <= 0)
+        {
+            throw std::invalid_argument("Failed to write responses");
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+        offset += n;
+    }
+}
+
+// Server-side PECI programs.  A program is a list of 4-byte instructions
+// [opcode, a, b, c] run against a table of raw commands in the Send layout,
+// so a protocol that loops on earlier responses, such as polling until the
+// completion code stops asking for a retry, finishes in one D-Bus call.
+// imm and target stand for b | c << 8.  Programs are verified before they
+// run, and are bounded by a step budget and the D-Bus deadline.  A program
+// runs in steps, each up to its next bus command or delay, so the scheduler
+// can interleave it with other work.
+class Program
+{
+  public:
+    enum Op : uint8_t
+    {
+        end = 0x00,   // stop and return resultDone
+        fail = 0x01,  // stop and return a, which must not be resultDone
+        send = 0x02,  // run command a, flag = it returned PECI_CC_SUCCESS
+        emit = 0x03,  // append the last response to the output
+        cmp = 0x04,   // flag = (response byte a & b) == c
+        jmp = 0x05,   // jump to instruction target
+        jt = 0x06,    // jump to target if flag is set
+        jf = 0x07,    // jump to target if flag is clear
+        set = 0x08,   // register a = imm
+        add = 0x09,   // register a += imm, as a signed 16-bit value
+        cmpr = 0x0a,  // flag = register a == imm
+        djnz = 0x0b,  // decrement register a, jump to target if not zero
+        load = 0x0c,  // register a = c (1-4) little-endian response bytes
+                      // from byte b
+        patch = 0x0d, // write the low c >> 4 (1-4) bytes of register
+                      // c & 0xf over write data byte b of command a
+        delay = 0x0e, // wait for imm milliseconds, at most maxDelayMs
+    };
+
+    // Results other than the operand of fail
+    static constexpr int32_t resultDone = 0;
+    static constexpr int32_t resultStepLimit = -1;
+    static constexpr int32_t resultDeadline = -2;
+    static constexpr int32_t resultOutputLimit = -3;
+
+    static constexpr size_t maxInstructions = 1024;
+    static constexpr uint32_t maxSteps = 65536;
+    static constexpr size_t maxOutputs = 4096;
+    static constexpr uint16_t maxDelayMs = 1000;
+    static constexpr size_t registerCount = 8;
+
+    // Where a step of the program stopped
+    enum class Stop
+    {
+        sent,  // it ran a bus command
+        delay, // it is waiting for delayTime() to pass
+        done,  // it stopped, see result()
+    };
+
+    Program(const std::vector<uint8_t>& code,
+            const std::vector<std::vector<uint8_t>>& rawCmds) :
+        code(code), rawCmds(rawCmds)
+    {
+        for (const std::vector<uint8_t>& rawCmd : rawCmds)
+        {
+            validateRawCmd(rawCmd);
+        }
+        if (code.empty() || code.size() % 4 != 0 ||
+            code.size() / 4 > maxInstructions)
+        {
+            throw std::invalid_argument("Invalid program length");
+        }
+        for (size_t pc = 0; pc < code.size(); pc += 4)
+        {
+            verify(&code[pc]);
+        }
+    }
+
+    // Runs the program up to and including its next bus command or delay,
+    // or until it stops
+    Stop resume(CommandLatency& latency, SessionPool& sessions,
+                const std::string& peciDev,
+                std::chrono::steady_clock::time_point deadline)
+    {
+        while (!status)
+        {
+            if (steps == maxSteps)
+            {
+                status = resultStepLimit;
+                break;
+            }
+            if (pc == code.size() / 4)
+            {
+                status = resultDone;
+                break;
+            }
+            const uint8_t* ins = &code[pc * 4];
+            uint8_t a = ins[1];
+            uint8_t b = ins[2];
+            uint8_t c = ins[3];
+            uint16_t imm = static_cast<uint16_t>(b | c << 8);
+            pc++;
+            steps++;
+
+            switch (ins[0])
+            {
+                case end:
+                    status = resultDone;
+                    break;
+                case fail:
+                    status = a;
+                    break;
+                case send:
+                    if (!fitsDeadline(latency, rawCmds[a].data(), deadline))
+                    {
+                        status = resultDeadline;
+                        break;
+                    }
+                    resp.fill(0);
+                    {
+                        SessionGuard session(sessions, peciDev);
+                        flag = sendRawCmd(latency, session.fd,
+                                          rawCmds[a].data(),
+                                          resp.data()) == PECI_CC_SUCCESS;
+                    }
+                    respLen = rawCmds[a][2];
+                    return Stop::sent;
+                case emit:
+                    if (output.size() == maxOutputs)
+                    {
+                        status = resultOutputLimit;
+                        break;
+                    }
+                    output.emplace_back(resp.begin(),
+                                        resp.begin() +
+                                            static_cast<ptrdiff_t>(respLen));
+                    break;
+                case cmp:
+                    flag = (resp[a] & b) == c;
+                    break;
+                case jmp:
+                    pc = imm;
+                    break;
+                case jt:
+                    pc = flag ? imm : pc;
+                    break;
+                case jf:
+                    pc = flag ? pc : imm;
+                    break;
+                case set:
+                    regs[a] = imm;
+                    break;
+                case add:
+                    regs[a] += static_cast<uint32_t>(static_cast<int16_t>(imm));
+                    break;
+                case cmpr:
+                    flag = regs[a] == imm;
+                    break;
+                case djnz:
+                    pc = --regs[a] != 0 ? imm : pc;
+                    break;
+                case load:
+                    regs[a] = 0;
+                    for (uint8_t i = 0; i < c; i++)
+                    {
+                        regs[a] |= static_cast<uint32_t>(resp[b + i])
+                                   << (8 * i);
+                    }
+                    break;
+                case patch:
+                    for (uint8_t i = 0; i < patchWidth(c); i++)
+                    {
+                        rawCmds[a][3U + b + i] =
+                            static_cast<uint8_t>(regs[c & 0xf] >> (8 * i));
+                    }
+                    break;
+                case delay:
+                    wait = std::chrono::milliseconds(imm);
+                    if (std::chrono::steady_clock::now() + wait > deadline)
+                    {
+                        status = resultDeadline;
+                        break;
+                    }
+                    return Stop::delay;
+            }
+        }
+        return Stop::done;
+    }
+
+    // How long the delay the program stopped at lasts
+    std::chrono::milliseconds delayTime() const
+    {
+        return wait;
+    }
+
+    // The result and emitted responses of a program that has stopped
+    std::tuple<int32_t, std::vector<std::vector<uint8_t>>> result()
+    {
+        return {status.value_or(resultDone), std::move(output)};
+    }
+
+  private:
+    static uint8_t patchWidth(uint8_t c)
+    {
+        return static_cast<uint8_t>(c >> 4);
+    }
+
+    void verify(const uint8_t* ins) const
+    {
+        uint8_t a = ins[1];
+        uint8_t b = ins[2];
+        uint8_t c = ins[3];
+        size_t target = static_cast<size_t>(b | c << 8);
+        bool ok = true;
+
+        switch (ins[0])
+        {
+            case end:
+            case emit:
+            case cmp:
+                break;
+            case fail:
+                ok = a != resultDone;
+                break;
+            case send:
+                ok = a < rawCmds.size();
+                break;
+            case jmp:
+            case jt:
+            case jf:
+                ok = target < code.size() / 4;
+                break;
+            case set:
+            case add:
+            case cmpr:
+                ok = a < registerCount;
+                break;
+            case djnz:
+                ok = a < registerCount && target < code.size() / 4;
+                break;
+            case load:
+                ok = a < registerCount && c >= 1 && c <= 4 && b + c <= 256;
+                break;
+            case patch:
+                ok = a < rawCmds.size() && (c & 0xf) < registerCount &&
+                     patchWidth(c) >= 1 && patchWidth(c) <= 4 &&
+                     b + patchWidth(c) <= rawCmds[a][1];
+                break;
+            case delay:
+                ok = target <= maxDelayMs;
+                break;
+            default:
+                ok = false;
+                break;
+        }
+        if (!ok)
+        {
+            throw std::invalid_argument("Invalid program instruction");
+        }
+    }
+
+    std::vector<uint8_t> code;
+    std::vector<std::vector<uint8_t>> rawCmds;
+    std::array<uint32_t, registerCount> regs{};
+    std::array<uint8_t, 256> resp{};
+    size_t respLen = 0;
+    bool flag = false;
+    size_t pc = 0;
+    uint32_t steps = 0;
+    std::chrono::milliseconds wait{0};
+    std::optional<int32_t> status;
+    std::vector<std::vector<uint8_t>> output;
+};
+
+// Scheduling classes for background jobs, highest priority first
+enum class Priority : uint8_t
+{
+    critical = 0, // thermal and other control loop traffic
+    normal = 1,
+    bulk = 2, // crashdump and other diagnostic batches
+};
+constexpr size_t priorityCount = 3;
+constexpr std::array<const char*, priorityCount> priorityNames = {
+    "Critical", "Normal", "Bulk"};
+
+// Work that the scheduler interleaves with other work one bus command at a
+// time
+class Task
+{
+  public:
+    Task(const std::string& client, Priority priority) :
+        client(client), priority(priority),
+        readySince(std::chrono::steady_clock::now())
+    {}
+    virtual ~Task() = default;
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    // Runs the next command of the task.  Returns false once the task has
+    // nothing left to run, or to wait outside the scheduler, in which case
+    // it sets waiting and submits itself again when it is ready.
+    virtual bool runNext() = 0;
+
+    const std::string client;
+    const Priority priority;
+    // When the next command of this task became ready to run, used to
+    // measure scheduling latency
+    std::chrono::steady_clock::time_point readySince;
+    // Called by the scheduler once runNext has returned false without
+    // setting waiting
+    std::function<void()> onDone;
+    bool waiting = false;
+};
+
+// A batch of raw commands that runs in the background and streams its
+// responses in chunks as Results signals instead of one reply at the end
+class RawPeciJob : public Task, public std::enable_shared_from_this<RawPeciJob>
+{
+  public:
+    RawPeciJob(boost::asio::io_context& io,
+               sdbusplus::asio::object_server& server, SessionPool& sessions,
+               CommandLatency& latency, uint64_t id,
+               const std::string& client, Priority priority,
+               const std::string& peciDev,
+               const std::vector<std::vector<uint8_t>>& rawCmds,
+               std::function<void(uint64_t)> release) :
+        Task(client, priority), server(server), sessions(sessions),
+        latency(latency), lingerTimer(io),
+        id(id), peciDev(peciDev), rawCmds(rawCmds),
+        release(std::move(release)),
+        objPath(std::string(peciPath) + "/job/" + std::to_string(id))
+    {}
+
+    ~RawPeciJob()
+    {
+        if (iface)
+        {
+            server.remove_interface(iface);
+        }
+    }
+
+    RawPeciJob(const RawPeciJob&) = delete;
+    RawPeciJob& operator=(const RawPeciJob&) = delete;
+
+    const std::string& path() const
+    {
+        return objPath;
+    }
+
+    void start()
+    {
+        iface = server.add_interface(objPath, jobIntf);
+        iface->register_property("Status", std::string("Running"));
+        iface->register_property("Priority",
+                                 static_cast<uint8_t>(priority));
+        iface->register_property("Total",
+                                 static_cast<uint32_t>(rawCmds.size()));
+        iface->register_property("Completed", static_cast<uint32_t>(0));
+        // Estimated bus time in microseconds for the commands not yet run
+        iface->register_property("EstimatedRemaining", estimateRemaining());
+        // Results(first command index, responses for this chunk)
+        iface->register_signal<uint32_t, std::vector<std::vector<uint8_t>>>(
+            "Results");
+        // Only the client that started the job may cancel it
+        iface->register_method(
+            "Cancel",
+            [weak{weak_from_this()}](sdbusplus::message_t& msg) {
+                if (auto self = weak.lock())
+                {
+                    if (msg.get_sender() != self->client)
+                    {
+                        throw std::invalid_argument(
+                            "Job belongs to another client");
+                    }
+                    self->cancelled = true;
+                }
+            });
+        iface->initialize();
+        chunkBuf.reserve(jobChunkSize * UINT8_MAX);
+        readySince = std::chrono::steady_clock::now();
+    }
+
+    bool runNext() override
+    {
+        if (cancelled)
+        {
+            flushResults();
+            finish("Cancelled");
+            return false;
+        }
+        if (next >= rawCmds.size())
+        {
+            finish("Completed");
+            return false;
+        }
+
+        // Responses of a chunk are read into one buffer that is sized when
+        // the job starts, so running a command does not allocate
+        size_t pos = chunkBuf.size();
+        chunkBuf.resize(pos + rawCmds[next][2]);
+        {
+            SessionGuard session(sessions, peciDev);
+            sendRawCmd(latency, session.fd, rawCmds[next].data(),
+                       chunkBuf.data() + pos);
+        }
+        next++;
+        chunkCount++;
+        readySince = std::chrono::steady_clock::now();
+
+        if (chunkCount >= jobChunkSize || next >= rawCmds.size())
+        {
+            flushResults();
+        }
+        if (next >= rawCmds.size())
+        {
+            finish("Completed");
+            return false;
+        }
+        return true;
+    }
+
+  private:
+    void flushResults()
+    {
+        if (chunkCount == 0)
+        {
+            return;
+        }
+        size_t first = next - chunkCount;
+        std::vector<std::vector<uint8_t>> results(chunkCount);
+        auto pos = chunkBuf.begin();
+        for (size_t i = 0; i < chunkCount; i++)
+        {
+            results[i].assign(pos, pos + rawCmds[first + i][2]);
+            pos += rawCmds[first + i][2];
+        }
+        sdbusplus::message_t msg = iface->new_signal("Results");
+        msg.append(static_cast<uint32_t>(first), results);
+        msg.signal_send();
+        chunkBuf.clear();
+        chunkCount = 0;
+        iface->set_property("Completed", static_cast<uint32_t>(next));
+        iface->set_property("EstimatedRemaining", estimateRemaining());
+    }
+
+    uint64_t estimateRemaining() const
+    {
+        std::chrono::microseconds total(0);
+        for (size_t i = next; i < rawCmds.size(); i++)
+        {
+            total += latency.estimate(rawCmds[i].data());
+        }
+        return static_cast<uint64_t>(total.count());
+    }
+
+    void finish(const std::string& status)
+    {
+        iface->set_property("Status", status);
+        lingerTimer.expires_after(jobLinger);
+        lingerTimer.async_wait(
+            [self{shared_from_this()}](const boost::system::error_code&) {
+                self->release(self->id);
+            });
+    }
+
+    sdbusplus::asio::object_server& server;
+    SessionPool& sessions;
+    CommandLatency& latency;
+    boost::asio::steady_timer lingerTimer;
+    uint64_t id;
+    std::string peciDev;
+    std::vector<std::vector<uint8_t>> rawCmds;
+    std::function<void(uint64_t)> release;
+    std::string objPath;
+    std::shared_ptr<sdbusplus::asio::dbus_interface> iface;
+    std::vector<uint8_t> chunkBuf;
+    size_t chunkCount = 0;
+    size_t next = 0;
+    bool cancelled = false;
+};
+
+// A Send batch run by the scheduler.  Each response is read straight into
+// its slot of the reply.  The reply is an array of byte arrays, so it needs
+// a vector per response rather than an arena; they are all sized before the
+// batch is queued so running a command does not allocate.  Commands that
+// are not expected to finish before the deadline are not run, and get
+// empty responses.
+class SendTask : public Task
+{
+  public:
+    SendTask(const std::string& client, SessionPool& sessions,
+             CommandLatency& latency, const std::string& peciDev,
+             const std::vector<std::vector<uint8_t>>& rawCmds,
+             std::chrono::steady_clock::time_point deadline) :
+        Task(client, Priority::normal), sessions(sessions), latency(latency),
+        peciDev(peciDev), rawCmds(rawCmds), deadline(deadline),
+        rawResp(rawCmds.size())
+    {
+        for (size_t i = 0; i < rawCmds.size(); i++)
+        {
+            validateRawCmd(rawCmds[i]);
+            rawResp[i].resize(rawCmds[i][2]);
+        }
+    }
+
+    bool runNext() override
+    {
+        // If the next command is not expected to finish in time, return
+        // early to avoid a D-Bus timeout
+        if (ran >= rawCmds.size() ||
+            !fitsDeadline(latency, rawCmds[ran].data(), deadline))
+        {
+            return false;
+        }
+        {
+            SessionGuard session(sessions, peciDev);
+            sendRawCmd(latency, session.fd, rawCmds[ran].data(),
+                       rawResp[ran].data());
+        }
+        ran++;
+        return ran < rawCmds.size();
+    }
+
+    // Responses of the commands that did not run are left empty
+    std::vector<std::vector<uint8_t>> responses()
+    {
+        for (size_t i = ran; i < rawResp.size(); i++)
+        {
+            rawResp[i].clear();
+        }
+        return std::move(rawResp);
+    }
+
+  private:
+    SessionPool& sessions;
+    CommandLatency& latency;
+    std::string peciDev;
+    const std::vector<std::vector<uint8_t>>& rawCmds;
+    std::chrono::steady_clock::time_point deadline;
+    std::vector<std::vector<uint8_t>> rawResp;
+    size_t ran = 0;
+};
+
+// A SendBulk command table run by the scheduler.  The command table holds
+// commands in the same layout as Send, back to back: [addr, write length,
+// read length, data...]...  Each response is written to respFd as
+// [EPECIStatus, read data...] in command order, and respFd is resized to fit
+// all of them.
+//
+// The client keeps both memfds and can change them at any time, so they are
+// never mapped.  The table is copied into private memory and only that copy
+// is validated and run, and the responses are written back with pwrite.
+class BulkTask : public Task
+{
+  public:
+    BulkTask(const std::string& client, SessionPool& sessions,
+             CommandLatency& latency, const std::string& peciDev, int cmdFd,
+             int respFd, std::chrono::steady_clock::time_point deadline) :
+        Task(client, Priority::normal), sessions(sessions), latency(latency),
+        peciDev(peciDev), respFd(respFd), deadline(deadline)
+    {
+        struct stat cmdStat = {};
+        if (fstat(cmdFd, &cmdStat) != 0 || cmdStat.st_size < 0 ||
+            static_cast<size_t>(cmdStat.st_size) > maxBulkTable)
+        {
+            throw std::invalid_argument("Invalid command table");
+        }
+        cmds.resize(static_cast<size_t>(cmdStat.st_size));
+        preadAll(cmdFd, cmds.data(), cmds.size(), 0);
+
+        // Validate the whole table and size the responses before touching
+        // the bus
+        size_t respSize = 0;
+        for (size_t p = 0; p < cmds.size();)
+        {
+            if (cmds.size() - p < 3 || cmds.size() - p - 3 < cmds[p + 1])
+            {
+                throw std::invalid_argument(
+                    "Truncated command in command table");
+            }
+            respSize += 1U + cmds[p + 2];
+            if (respSize > maxBulkResponse)
+            {
+                throw std::invalid_argument(
+                    "Command table responses too large");
+            }
+            p += 3U + cmds[p + 1];
+        }
+        if (ftruncate(respFd, static_cast<off_t>(respSize)) != 0)
+        {
+            throw std::invalid_argument("Failed to size response buffer");
+        }
+        resps.resize(respSize);
+    }
+
+    bool runNext() override
+    {
+        if (pos >= cmds.size() ||
+            !fitsDeadline(latency, &cmds[pos], deadline))
+        {
+            return false;
+        }
+        const uint8_t* rawCmd = &cmds[pos];
+        uint8_t* resp = &resps[respPos];
+        {
+            SessionGuard session(sessions, peciDev);
+            resp[0] = static_cast<uint8_t>(
+                sendRawCmd(latency, session.fd, rawCmd, &resp[1]));
+        }
+        pos += 3U + rawCmd[1];
+        respPos += 1U + rawCmd[2];
+        count++;
+        return pos < cmds.size();
+    }
+
+    // Writes the responses back to respFd.  Returns the number of commands
+    // that ran before the deadline.
+    uint32_t finish()
+    {
+        pwriteAll(respFd, resps.data(), respPos, 0);
+        return count;
+    }
+
+  private:
+    SessionPool& sessions;
+    CommandLatency& latency;
+    std::string peciDev;
+    int respFd;
+    std::chrono::steady_clock::time_point deadline;
+    std::vector<uint8_t> cmds;
+    std::vector<uint8_t> resps;
+    size_t pos = 0;
+    size_t respPos = 0;
+    uint32_t count = 0;
+};
+
+// Scheduling latency histogram with power of two microsecond buckets
+class LatencyStats
+{
+  public:
+    void add(std::chrono::microseconds wait)
+    {
+        uint64_t us = static_cast<uint64_t>(std::max<int64_t>(wait.count(), 0));
+        size_t bucket = 0;
+        while (bucket < buckets.size() - 1 && (uint64_t{1} << bucket) <= us)
+        {
+            bucket++;
+        }
+        buckets[bucket]++;
+        count++;
+        total += us;
+        max = std::max(max, us);
+    }
+
+    uint64_t average() const
+    {
+        return count ? total / count : 0;
+    }
+
+    // Upper bound of the bucket holding the given percentile
+    uint64_t percentile(uint64_t pct) const
+    {
+        uint64_t target = (count * pct + 99) / 100;
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < buckets.size(); bucket++)
+        {
+            seen += buckets[bucket];
+            if (seen >= target && seen != 0)
+            {
+                return std::min(uint64_t{1} << bucket, max);
+            }
+        }
+        return max;
+    }
+
+    uint64_t count = 0;
+    uint64_t total = 0;
+    uint64_t max = 0;
+
+  private:
+    std::array<uint64_t, 32> buckets{};
+};
+
+// Interleaves background jobs one command at a time.  The highest priority
+// class with work is served first, and clients within a class are served
+// round-robin so one caller's batch cannot monopolize the bus.  A lower
+// class that has been passed over too many times in a row is served once so
+// bulk work still makes progress under constant critical load.  Send,
+// SendBulk and RunProgram are scheduled the same way in the normal class, so
+// a large batch from one caller holds up others by at most one command at a
+// time.  Dispatch pauses while the session pool rests, so processes outside
+// the daemon get the device too.
+class Scheduler
+{
+  public:
+    Scheduler(boost::asio::io_context& io, SessionPool& sessions) :
+        io(io), sessions(sessions), restTimer(io)
+    {}
+
+    void submit(const std::shared_ptr<Task>& job)
+    {
+        ClassQueue& queue = queues[static_cast<size_t>(job->priority)];
+        auto& clientJobs = queue.clients[job->client];
+        if (clientJobs.empty())
+        {
+            queue.order.push_back(job->client);
+        }
+        clientJobs.push_back(job);
+        queue.jobs++;
+        schedule();
+    }
+
+    // Stats(class, queued jobs, commands run, average, p99 and max wait in
+    // microseconds)
+    using ClassStats = std::tuple<std::string, uint32_t, uint64_t, uint64_t,
+                                  uint64_t, uint64_t>;
+    std::vector<ClassStats> stats() const
+    {
+        std::vector<ClassStats> ret;
+        for (size_t c = 0; c < priorityCount; c++)
+        {
+            const ClassQueue& queue = queues[c];
+            ret.emplace_back(priorityNames[c], queue.jobs, queue.latency.count,
+                             queue.latency.average(),
+                             queue.latency.percentile(99), queue.latency.max);
+        }
+        return ret;
+    }
+
+  private:
+    // Number of consecutive times a class with work may be passed over
+    static constexpr uint32_t maxSkips = 8;
+
+    struct ClassQueue
+    {
+        // Clients with queued jobs in round-robin order
+        std::deque<std::string> order;
+        std::map<std::string, std::deque<std::shared_ptr<Task>>> clients;
+        uint32_t jobs = 0;
+        uint32_t skipped = 0;
+        LatencyStats latency;
+    };
+
+    void schedule()
+    {
+        if (posted)
+        {
+            return;
+        }
+        posted = true;
+        auto resting = sessions.restingUntil();
+        if (std::chrono::steady_clock::now() < resting)
+        {
+            restTimer.expires_at(resting);
+            restTimer.async_wait([this](const boost::system::error_code&) {
+                posted = false;
+                dispatch();
+            });
+            return;
+        }
+        boost::asio::post(io, [this]() {
+            posted = false;
+            dispatch();
+        });
+    }
+
+    std::optional<size_t> pickClass()
+    {
+        std::optional<size_t> chosen;
+        for (size_t c = 0; c < priorityCount; c++)
+        {
+            if (queues[c].order.empty())
+            {
+                continue;
+            }
+            if (!chosen || queues[c].skipped >= maxSkips)
+            {
+                chosen = c;
+            }
+        }
+        for (size_t c = 0; c < priorityCount; c++)
+        {
+            if (queues[c].order.empty() || c == chosen)
+            {
+                queues[c].skipped = 0;
+                continue;
+            }
+            queues[c].skipped++;
+        }
+        return chosen;
+    }
+
+    void dispatch()
+    {
+        std::optional<size_t> c = pickClass();
+        if (!c)
+        {
+            return;
+        }
+        ClassQueue& queue = queues[*c];
+        std::string client = std::move(queue.order.front());
+        queue.order.pop_front();
+        auto clientIt = queue.clients.find(client);
+        std::shared_ptr<Task> job = clientIt->second.front();
+
+        queue.latency.add(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - job->readySince));
+        if (!job->runNext())
+        {
+            clientIt->second.pop_front();
+            queue.jobs--;
+            if (!job->waiting && job->onDone)
+            {
+                job->onDone();
+            }
+            // The client's next job only becomes ready once this one is done
+            // or waiting
+            if (!clientIt->second.empty())
+            {
+                clientIt->second.front()->readySince =
+                    std::chrono::steady_clock::now();
+            }
+        }
+        if (clientIt->second.empty())
+        {
+            queue.clients.erase(clientIt);
+        }
+        else
+        {
+            queue.order.push_back(std::move(client));
+        }
+        schedule();
+    }
+
+    boost::asio::io_context& io;
+    SessionPool& sessions;
+    boost::asio::steady_timer restTimer;
+    std::array<ClassQueue, priorityCount> queues;
+    bool posted = false;
+};
+
+// A RunProgram program run by the scheduler, one step of the program per
+// turn.  A delay takes the task out of the scheduler until a timer fires, so
+// other tasks and D-Bus methods keep running meanwhile.
+class ProgramTask :
+    public Task,
+    public std::enable_shared_from_this<ProgramTask>
+{
+  public:
+    ProgramTask(boost::asio::io_context& io, Scheduler& scheduler,
+                const std::string& client, SessionPool& sessions,
+                CommandLatency& latency, const std::string& peciDev,
+                const std::vector<uint8_t>& code,
+                const std::vector<std::vector<uint8_t>>& rawCmds,
+                std::chrono::steady_clock::time_point deadline) :
+        Task(client, Priority::normal), scheduler(scheduler),
+        sessions(sessions), latency(latency), delayTimer(io),
+        peciDev(peciDev), program(code, rawCmds), deadline(deadline)
+    {}
+
+    bool runNext() override
+    {
+        waiting = false;
+        switch (program.resume(latency, sessions, peciDev, deadline))
+        {
+            case Program::Stop::sent:
+                return true;
+            case Program::Stop::delay:
+                waiting = true;
+                delayTimer.expires_after(program.delayTime());
+                delayTimer.async_wait(
+                    [self{shared_from_this()}](
+                        const boost::system::error_code&) {
+                        self->readySince = std::chrono::steady_clock::now();
+                        self->scheduler.submit(self);
+                    });
+                return false;
+            case Program::Stop::done:
+                break;
+        }
+        return false;
+    }
+
+    std::tuple<int32_t, std::vector<std::vector<uint8_t>>> result()
+    {
+        return program.result();
+    }
+
+  private:
+    Scheduler& scheduler;
+    SessionPool& sessions;
+    CommandLatency& latency;
+    boost::asio::steady_timer delayTimer;
+    std::string peciDev;
+    Program program;
+    std::chrono::steady_clock::time_point deadline;
+};
+
+// Runs a task through the scheduler and suspends the calling D-Bus method
+// until it is done, so other methods and jobs keep running meanwhile
+void runTask(boost::asio::io_context& io, Scheduler& scheduler,
+             const std::shared_ptr<Task>& task,
+             boost::asio::yield_context yield)
+{
+    boost::asio::steady_timer done(io);
+    done.expires_at(std::chrono::steady_clock::time_point::max());
+    task->onDone = [&done]() { done.cancel(); };
+    scheduler.submit(task);
+    boost::system::error_code ec;
+    done.async_wait(yield[ec]);
+    task->onDone = nullptr;
+}
+
+// Critical priority is reserved for callers running as root or as the
+// daemon's own user, so other clients cannot push control loop traffic aside
+bool mayUseCritical(sdbusplus::asio::connection& conn,
+                    boost::asio::yield_context yield,
+                    const std::string& sender)
+{
+    boost::system::error_code ec;
+    uint32_t uid = conn.yield_method_call<uint32_t>(
+        yield, ec, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+        "org.freedesktop.DBus", "GetConnectionUnixUser", sender);
+    return !ec && (uid == 0 || uid == getuid());
+}
+} // namespace
 
 int main()
 {
     boost::asio::io_context io;
     std::shared_ptr<sdbusplus::asio::connection> conn;
     std::shared_ptr<sdbusplus::asio::object_server> server;
+    SessionPool sessions(io);
+    CommandLatency latency;
+    Scheduler scheduler(io, sessions);
+    std::map<uint64_t, std::shared_ptr<RawPeciJob>> jobs;
+    uint64_t nextJobId = 0;
 
     // setup connection to dbus
     conn = std::make_shared<sdbusplus::asio::connection>(io);
@@ -34,50 +1330,145 @@ int main()
 
     // Send Raw PECI Interface
     std::shared_ptr<sdbusplus::asio::dbus_interface> ifaceRawPeci =
-        server->add_interface("/com/intel/peci", "com.intel.Protocol.PECI.Raw");
+        server->add_interface(peciPath, "com.intel.Protocol.PECI.Raw");
 
     // Send a Raw PECI command
     ifaceRawPeci->register_method(
-        "Send", [](const std::string& peciDev,
-                   const std::vector<std::vector<uint8_t>>& rawCmds) {
-            peci_SetDevName(const_cast<char*>(peciDev.c_str()));
-            // D-Bus will time out after too long, so set a deadline for when to
-            // abort the PECI commands (at 25s, it mostly times out, at 24s it
-            // doesn't, so use 23s to be safe)
-            constexpr int peciTimeout = 23;
+        "Send",
+        [&io, &sessions, &latency, &scheduler](
+            boost::asio::yield_context yield, sdbusplus::message_t& msg,
+            const std::string& peciDev,
+            const std::vector<std::vector<uint8_t>>& rawCmds) {
             std::chrono::steady_clock::time_point peciDeadline =
                 std::chrono::steady_clock::now() +
                 std::chrono::duration<int>(peciTimeout);
-            std::vector<std::vector<uint8_t>> rawResp;
-            rawResp.resize(rawCmds.size());
-            for (size_t i = 0; i < rawCmds.size(); i++)
-            {
-                const std::vector<uint8_t>& rawCmd = rawCmds[i];
-                // If the commands are taking too long, return early to avoid a
-                // D-Bus timeout
-                if (std::chrono::steady_clock::now() > peciDeadline)
-                {
-                    std::cerr << peciTimeout
-                              << " second deadline reached.  Aborting PECI "
-                                 "commands to avoid a timeout\n";
-                    break;
-                }
+            auto task = std::make_shared<SendTask>(msg.get_sender(), sessions,
+                                                   latency, peciDev, rawCmds,
+                                                   peciDeadline);
+            runTask(io, scheduler, task, yield);
+            return task->responses();
+        });
 
-                if (rawCmd.size() < 3)
-                {
-                    peci_SetDevName(NULL);
-                    throw std::invalid_argument("Command Length too short");
-                }
-                rawResp[i].resize(rawCmd[2]);
-                peci_raw(rawCmd[0], rawCmd[2], &rawCmd[3], rawCmd[1],
-                         rawResp[i].data(),
-                         static_cast<uint32_t>(rawResp[i].size()));
+    // Estimate how long a batch would take from the learned command
+    // latencies.  Returns the estimate in microseconds and how many of the
+    // commands Send is expected to complete before its deadline, so clients
+    // can size batches to fit.
+    ifaceRawPeci->register_method(
+        "EstimateSend",
+        [&latency](const std::vector<std::vector<uint8_t>>& rawCmds) {
+            for (const std::vector<uint8_t>& rawCmd : rawCmds)
+            {
+                validateRawCmd(rawCmd);
             }
-            peci_SetDevName(NULL);
-            return rawResp;
+            auto [total, fit] = latency.estimate(
+                rawCmds, std::chrono::seconds(peciTimeout));
+            return std::make_tuple(static_cast<uint64_t>(total.count()), fit);
+        });
+
+    // Start a Raw PECI batch in the background.  Responses are streamed as
+    // Results signals from the returned job object, so the batch is not
+    // bound by the D-Bus method timeout.
+    auto startSend = [&io, &server, &sessions, &latency, &scheduler, &jobs,
+                      &nextJobId](
+                         sdbusplus::message_t& msg, Priority priority,
+                         const std::string& peciDev,
+                         const std::vector<std::vector<uint8_t>>& rawCmds) {
+        for (const std::vector<uint8_t>& rawCmd : rawCmds)
+        {
+            validateRawCmd(rawCmd);
+        }
+        std::string sender = msg.get_sender();
+        if (std::ranges::count_if(jobs, [&sender](const auto& entry) {
+                return entry.second->client == sender;
+            }) >= static_cast<ptrdiff_t>(maxJobsPerSender))
+        {
+            throw std::invalid_argument("Too many jobs for this sender");
+        }
+        uint64_t id = nextJobId++;
+        auto job = std::make_shared<RawPeciJob>(
+            io, *server, sessions, latency, id, sender, priority, peciDev,
+            rawCmds, [&jobs](uint64_t doneId) { jobs.erase(doneId); });
+        jobs.emplace(id, job);
+        job->start();
+        scheduler.submit(job);
+        return sdbusplus::message::object_path(job->path());
+    };
+    ifaceRawPeci->register_method(
+        "StartSend",
+        [startSend](sdbusplus::message_t& msg, const std::string& peciDev,
+                    const std::vector<std::vector<uint8_t>>& rawCmds) {
+            return startSend(msg, Priority::bulk, peciDev, rawCmds);
+        });
+    // Same as StartSend with an explicit scheduling class: 0 (critical),
+    // 1 (normal) or 2 (bulk).  Only root and the daemon's own user may use
+    // the critical class.
+    ifaceRawPeci->register_method(
+        "StartSendWithPriority",
+        [startSend, &conn](boost::asio::yield_context yield,
+                           sdbusplus::message_t& msg,
+                           const std::string& peciDev, uint8_t priority,
+                           const std::vector<std::vector<uint8_t>>& rawCmds) {
+            if (priority >= priorityCount)
+            {
+                throw std::invalid_argument("Invalid priority");
+            }
+            if (static_cast<Priority>(priority) == Priority::critical &&
+                !mayUseCritical(*conn, yield, msg.get_sender()))
+            {
+                throw std::invalid_argument(
+                    "Critical priority is not permitted for this caller");
+            }
+            return startSend(msg, static_cast<Priority>(priority), peciDev,
+                             rawCmds);
+        });
+
+    // Send a packed table of Raw PECI commands through a memfd and receive
+    // the packed responses in a second memfd, avoiding marshalling large
+    // batches as D-Bus arrays
+    ifaceRawPeci->register_method(
+        "SendBulk",
+        [&io, &sessions, &latency, &scheduler](
+            boost::asio::yield_context yield, sdbusplus::message_t& msg,
+            const std::string& peciDev,
+            const sdbusplus::message::unix_fd& cmdFd,
+            const sdbusplus::message::unix_fd& respFd) {
+            std::chrono::steady_clock::time_point peciDeadline =
+                std::chrono::steady_clock::now() +
+                std::chrono::duration<int>(peciTimeout);
+            auto task = std::make_shared<BulkTask>(msg.get_sender(), sessions,
+                                                   latency, peciDev, cmdFd.fd,
+                                                   respFd.fd, peciDeadline);
+            runTask(io, scheduler, task, yield);
+            return task->finish();
+        });
+
+    // Run a program (see Program) against a table of Raw PECI commands.
+    // Returns the program's result and the responses it emitted.
+    ifaceRawPeci->register_method(
+        "RunProgram",
+        [&io, &sessions, &latency, &scheduler](
+            boost::asio::yield_context yield, sdbusplus::message_t& msg,
+            const std::string& peciDev, const std::vector<uint8_t>& code,
+            const std::vector<std::vector<uint8_t>>& rawCmds) {
+            std::chrono::steady_clock::time_point peciDeadline =
+                std::chrono::steady_clock::now() +
+                std::chrono::duration<int>(peciTimeout);
+            auto task = std::make_shared<ProgramTask>(
+                io, scheduler, msg.get_sender(), sessions, latency, peciDev,
+                code, rawCmds, peciDeadline);
+            runTask(io, scheduler, task, yield);
+            return task->result();
         });
     ifaceRawPeci->initialize();
 
+    // Scheduler observability
+    std::shared_ptr<sdbusplus::asio::dbus_interface> ifaceScheduler =
+        server->add_interface(peciPath,
+                              "com.intel.Protocol.PECI.Raw.Scheduler");
+    ifaceScheduler->register_method(
+        "GetStats", [&scheduler]() { return scheduler.stats(); });
+    ifaceScheduler->initialize();
+
     io.run();
 
     return 0;
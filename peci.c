@@ -13,12 +13,19 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 */
+#include "peci_arbiter.h"
+#include "peci_broker.h"
+#include "peci_trace.h"
+
 #include <errno.h>
 #include <fcntl.h>
 #include <peci.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <syslog.h>
 #include <time.h>
 #include <unistd.h>
@@ -28,10 +35,147 @@
 #include <linux/peci-ioctl.h>
 #pragma GCC diagnostic pop
 
-EPECIStatus peci_GetDIB_seq(uint8_t target, uint64_t* dib, int peci_fd);
-
-char* peci_device_list[2];
 #define DEV_NAME_SIZE 64
+
+// Device configurations are immutable once published, so commands only need
+// a single atomic load to find their device.  Configurations are interned by
+// name and never freed, so memory is bounded by the number of distinct
+// device names a process uses.
+struct peci_dev_config
+{
+    struct peci_dev_config* next;
+    const char* devices[2];
+    char name[DEV_NAME_SIZE];
+};
+
+// If the PECI device name is null try "/dev/peci-default",
+// if "/dev/peci-default" does not exist, fall back to "/dev/peci-0"
+static struct peci_dev_config peci_default_config = {
+    .devices = {"/dev/peci-default", "/dev/peci-0"},
+};
+
+static struct peci_dev_config* _Atomic peci_config = &peci_default_config;
+static __thread struct peci_dev_config* peci_thread_config;
+
+static pthread_mutex_t peci_config_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct peci_dev_config* peci_config_list;
+
+/*-------------------------------------------------------------------------
+ * This function returns the interned configuration for the PECI device
+ * name, or the default configuration if the name is null.
+ *------------------------------------------------------------------------*/
+static struct peci_dev_config* peci_InternDevName(const char* peci_dev)
+{
+    struct peci_dev_config* config = NULL;
+
+    if (peci_dev == NULL)
+    {
+        return &peci_default_config;
+    }
+
+    pthread_mutex_lock(&peci_config_lock);
+    for (config = peci_config_list; config != NULL; config = config->next)
+    {
+        if (strncmp(config->name, peci_dev, sizeof(config->name) - 1) == 0)
+        {
+            break;
+        }
+    }
+    if (config == NULL)
+    {
+        config = calloc(1, sizeof(*config));
+        if (config != NULL)
+        {
+            strncpy(config->name, peci_dev, sizeof(config->name) - 1);
+            config->devices[0] = config->name;
+            config->next = peci_config_list;
+            peci_config_list = config;
+        }
+    }
+    pthread_mutex_unlock(&peci_config_lock);
+    return config;
+}
+
+static pthread_once_t peci_init_once = PTHREAD_ONCE_INIT;
+
+/*-------------------------------------------------------------------------
+ * This function applies the PECI settings from the environment. It runs
+ * once, on first use of the library rather than when it is loaded, so
+ * processes that never issue a PECI command pay nothing for it.
+ *------------------------------------------------------------------------*/
+static void peci_InitOnce(void)
+{
+    // By default PECI_DEV is not defined in the environment, so the
+    // default device names are used
+    char* peci_dev = getenv("PECI_DEV");
+    if (peci_dev != NULL)
+    {
+        struct peci_dev_config* config = peci_InternDevName(peci_dev);
+        if (config != NULL)
+        {
+            atomic_store_explicit(&peci_config, config, memory_order_release);
+        }
+    }
+
+    // Send commands through the broker when PECI_BROKER names its socket
+    char* broker_path = getenv("PECI_BROKER");
+    if (broker_path != NULL &&
+        peci_broker_set_path(broker_path) != PECI_CC_SUCCESS)
+    {
+        syslog(LOG_ERR, "PECI failed to use broker %s\n", broker_path);
+    }
+
+    // Queue for the device with other processes when PECI_PRIORITY names a
+    // priority class
+    char* priority = getenv("PECI_PRIORITY");
+    const struct peci_dev_config* config =
+        atomic_load_explicit(&peci_config, memory_order_relaxed);
+    if (priority != NULL &&
+        peci_arb_set_env(priority, config->devices) != PECI_CC_SUCCESS)
+    {
+        syslog(LOG_ERR, "PECI failed to enable arbitration as %s\n",
+               priority);
+    }
+
+    // Record device locks for contention profiling when PECI_LOCKPROF is set
+    if (getenv("PECI_LOCKPROF") != NULL &&
+        peci_SetLockProfiling(true) != PECI_CC_SUCCESS)
+    {
+        syslog(LOG_ERR, "PECI failed to enable lock profiling\n");
+    }
+
+    // Record PECI traffic when PECI_TRACE names a trace file
+    char* trace_path = getenv("PECI_TRACE");
+    if (trace_path != NULL && peci_TraceStart(trace_path) != PECI_CC_SUCCESS)
+    {
+        syslog(LOG_ERR, "PECI failed to start trace to %s\n", trace_path);
+    }
+}
+
+static void peci_Init(void)
+{
+    pthread_once(&peci_init_once, peci_InitOnce);
+}
+
+/*-------------------------------------------------------------------------
+ * This function returns the device configuration for the calling thread
+ *------------------------------------------------------------------------*/
+static const struct peci_dev_config* peci_GetDevConfig(void)
+{
+    peci_Init();
+
+    if (peci_thread_config != NULL)
+    {
+        return peci_thread_config;
+    }
+    return atomic_load_explicit(&peci_config, memory_order_acquire);
+}
+
+const char* const* peci_dev_names(void)
+{
+    return peci_GetDevConfig()->devices;
+}
+
 /*-------------------------------------------------------------------------
  * This function sets the name of the PECI device file to use.
  * If the PECI device name is null try "/dev/peci-default",
@@ -39,36 +183,151 @@ char* peci_device_list[2];
  *------------------------------------------------------------------------*/
 void peci_SetDevName(char* peci_dev)
 {
-    static char peci_name_new[DEV_NAME_SIZE] = {0};
+    struct peci_dev_config* config = NULL;
+
+    // Apply the environment first so it can't override this name later
+    peci_Init();
+
+    config = peci_InternDevName(peci_dev);
 
-    if (peci_dev)
+    if (config == NULL)
     {
-        strncpy(peci_name_new, peci_dev, sizeof(peci_name_new));
-        peci_name_new[DEV_NAME_SIZE - 1] = '\0';
-        peci_device_list[0] = peci_name_new;
-        peci_device_list[1] = NULL;
-        syslog(LOG_INFO, "PECI set dev name to %s\n", peci_device_list[0]);
+        syslog(LOG_ERR, "PECI failed to set dev name to %s\n", peci_dev);
+        return;
+    }
+    atomic_store_explicit(&peci_config, config, memory_order_release);
+
+    if (config->devices[1] == NULL)
+    {
+        syslog(LOG_INFO, "PECI set dev name to %s\n", config->devices[0]);
     }
     else
     {
-        peci_device_list[0] = "/dev/peci-default";
-        peci_device_list[1] = "/dev/peci-0";
-        syslog(LOG_INFO, "PECI set dev names to %s, %s\n", peci_device_list[0],
-               peci_device_list[1]);
+        syslog(LOG_INFO, "PECI set dev names to %s, %s\n", config->devices[0],
+               config->devices[1]);
+    }
+}
+
+/*-------------------------------------------------------------------------
+ * This function sets the name of the PECI device file to use for commands
+ * issued by the calling thread, overriding peci_SetDevName. If the PECI
+ * device name is null, the thread goes back to the process-wide device.
+ *------------------------------------------------------------------------*/
+void peci_SetThreadDevName(const char* peci_dev)
+{
+    if (peci_dev == NULL)
+    {
+        peci_thread_config = NULL;
+        return;
+    }
+    peci_thread_config = peci_InternDevName(peci_dev);
+}
+
+/*-------------------------------------------------------------------------
+ * This function sends PECI commands through the broker listening on the
+ * Unix socket path instead of opening the PECI device. If the path is null
+ * the PECI device is used directly again.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_SetBroker(const char* path)
+{
+    // Apply the environment first so it can't override this setting later
+    peci_Init();
+
+    return peci_broker_set_path(path);
+}
+
+// Identity of the PECI device behind each descriptor locked by the process,
+// indexed by descriptor, so state kept per target is not shared between
+// buses.  Zero means the descriptor was not locked through the library.
+#define PECI_MAX_BOUND_FDS 1024
+static _Atomic uint64_t peci_fd_devices[PECI_MAX_BOUND_FDS];
+
+/*-------------------------------------------------------------------------
+ * This function identifies a device by the names it was opened with, for
+ * devices that cannot be examined directly, such as through the broker
+ *------------------------------------------------------------------------*/
+static uint64_t peci_DeviceNameId(const char* const* devices)
+{
+    // FNV-1a, with the top bit set so it never matches a device number
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (int i = 0; i < 2 && devices[i] != NULL; i++)
+    {
+        const char* name = devices[i];
+        do
+        {
+            hash = (hash ^ (uint8_t)*name) * 0x100000001b3ULL;
+        } while (*name++ != '\0');
+    }
+    return hash | (1ULL << 63);
+}
+
+static uint64_t peci_DeviceStatId(const struct stat* st)
+{
+    return S_ISCHR(st->st_mode) ? (uint64_t)st->st_rdev
+                                : ((uint64_t)st->st_dev << 32) ^ st->st_ino;
+}
+
+/*-------------------------------------------------------------------------
+ * This function identifies the device open on a descriptor from its file
+ * status, or returns zero if the descriptor is not valid
+ *------------------------------------------------------------------------*/
+static uint64_t peci_DeviceStat(int peci_fd)
+{
+    struct stat st;
+
+    if (fstat(peci_fd, &st) != 0)
+    {
+        return 0;
+    }
+    return peci_DeviceStatId(&st);
+}
+
+/*-------------------------------------------------------------------------
+ * This function identifies the device a lock of the list will open, as
+ * peci_DeviceStat will once it is open, or returns zero if there is none
+ *------------------------------------------------------------------------*/
+static uint64_t peci_DevicePathStat(const char* const* devices)
+{
+    struct stat st;
+
+    if (stat(devices[0], &st) != 0 &&
+        (errno != ENOENT || devices[1] == NULL || stat(devices[1], &st) != 0))
+    {
+        return 0;
+    }
+    return peci_DeviceStatId(&st);
+}
+
+/*-------------------------------------------------------------------------
+ * This function records the device behind a descriptor that was locked
+ *------------------------------------------------------------------------*/
+static void peci_DeviceBind(int peci_fd, uint64_t device)
+{
+    if (peci_fd >= 0 && peci_fd < PECI_MAX_BOUND_FDS)
+    {
+        atomic_store_explicit(&peci_fd_devices[peci_fd], device,
+                              memory_order_relaxed);
     }
 }
 
 /*-------------------------------------------------------------------------
- * This function initializes PECI device name when a shared library
- * is loaded, typically during program startup.
+ * This function returns the device behind a descriptor, or zero if it is
+ * not known. Descriptors locked by the library are looked up without a
+ * system call.
  *------------------------------------------------------------------------*/
-static void init(void) __attribute__((constructor));
-static void init(void)
+static uint64_t peci_DeviceOf(int peci_fd)
 {
-    // By default PECI_DEV is not defined in the environment,
-    // so this will call peci_SetDevName(NULL) and initialize
-    // PECI device name to defaults.
-    peci_SetDevName(getenv("PECI_DEV"));
+    if (peci_fd >= 0 && peci_fd < PECI_MAX_BOUND_FDS)
+    {
+        uint64_t device = atomic_load_explicit(&peci_fd_devices[peci_fd],
+                                               memory_order_relaxed);
+        if (device != 0)
+        {
+            return device;
+        }
+    }
+    return peci_DeviceStat(peci_fd);
 }
 
 /*-------------------------------------------------------------------------
@@ -76,34 +335,139 @@ static void init(void)
  *------------------------------------------------------------------------*/
 void peci_Unlock(int peci_fd)
 {
+    struct peci_arb_hold hold = peci_arb_unbind(peci_fd);
+    uint64_t lockId = peci_lockprof_unbind(peci_fd);
+
+    // Forget the device before the descriptor can be reused
+    peci_DeviceBind(peci_fd, 0);
+
     if (close(peci_fd) != 0)
     {
         syslog(LOG_ERR, "PECI device failed to unlock.\n");
     }
+    peci_lockprof_unlocked(lockId);
+    // The device is closed before the next waiter is let in to open it
+    peci_arb_release(&hold);
 }
 
 /*-------------------------------------------------------------------------
- * This function attempts to lock the peci interface with the specified
- * timeout and returns a file descriptor if successful.
+ * This function logs a lock that timed out, with how long it waited and,
+ * if a profiled process holds the device, who holds it
  *------------------------------------------------------------------------*/
-EPECIStatus peci_Lock(int* peci_fd, int timeout_ms)
+static EPECIStatus peci_LockBusy(uint64_t lockId, uint64_t device,
+                                 uint64_t start_ns)
+{
+    char holder[96];
+
+    peci_lockprof_holder(device, holder, sizeof(holder));
+    syslog(LOG_ERR, " >>> PECI Device Busy <<< waited %u ms%s%s\n",
+           (unsigned int)((peci_now_ns() - start_ns) / 1000000),
+           holder[0] != '\0' ? ", " : "", holder);
+    peci_lockprof_locked(lockId, -1, PECI_CC_DRIVER_ERR);
+    return PECI_CC_DRIVER_ERR;
+}
+
+/*-------------------------------------------------------------------------
+ * This function attempts to lock the first available device from the
+ * provided device list with the specified timeout and returns a file
+ * descriptor if successful.
+ *------------------------------------------------------------------------*/
+static EPECIStatus peci_LockDevList(const char* const* devices,
+                                    int* peci_fd, int timeout_ms)
 {
     struct timespec sRequest = {0};
     sRequest.tv_sec = 0;
     sRequest.tv_nsec = PECI_TIMEOUT_RESOLUTION_MS * 1000 * 1000;
     int timeout_count = 0;
-    char* peci_device = peci_device_list[0];
+    const char* peci_device = devices[0];
 
     if (NULL == peci_fd)
     {
         return PECI_CC_INVALID_REQ;
     }
 
+    if (atomic_load_explicit(&peci_sim_on, memory_order_relaxed))
+    {
+        *peci_fd = peci_sim_open();
+        if (*peci_fd == -1)
+        {
+            return PECI_CC_DRIVER_ERR;
+        }
+        peci_DeviceBind(*peci_fd, peci_DeviceNameId(devices));
+        return PECI_CC_SUCCESS;
+    }
+
+    if (atomic_load_explicit(&peci_broker_on, memory_order_relaxed))
+    {
+        // The broker owns the device, so the lock is a hold on it taken
+        // through the broker, once the broker itself has started
+        *peci_fd = peci_broker_open(devices);
+        while (-1 == *peci_fd && (errno == ENOENT || errno == ECONNREFUSED) &&
+               (timeout_ms == PECI_WAIT_FOREVER || timeout_count < timeout_ms))
+        {
+            nanosleep(&sRequest, NULL);
+            timeout_count += PECI_TIMEOUT_RESOLUTION_MS;
+            *peci_fd = peci_broker_open(devices);
+        }
+        if (-1 == *peci_fd)
+        {
+            syslog(LOG_ERR, "PECI broker unavailable\n");
+            return PECI_CC_DRIVER_ERR;
+        }
+        // Even without waiting, the broker gets one poll period to answer
+        int hold_ms = PECI_TIMEOUT_RESOLUTION_MS;
+        if (timeout_ms == PECI_WAIT_FOREVER)
+        {
+            hold_ms = -1;
+        }
+        else if (timeout_ms - timeout_count > hold_ms)
+        {
+            hold_ms = timeout_ms - timeout_count;
+        }
+        if (peci_broker_hold(*peci_fd, true, hold_ms) != PECI_CC_SUCCESS)
+        {
+            close(*peci_fd);
+            *peci_fd = -1;
+            syslog(LOG_ERR, " >>> PECI Device Busy <<< in the broker\n");
+            return PECI_CC_DRIVER_ERR;
+        }
+        peci_DeviceBind(*peci_fd, peci_DeviceNameId(devices));
+        return PECI_CC_SUCCESS;
+    }
+
+    // Wait for our turn in the cross-process queue first.  The wait counts
+    // against the timeout, and the device may still be held by a process
+    // that does not take part, so it is opened as before.
+    uint64_t device = 0;
+    if (atomic_load_explicit(&peci_lockprof_on, memory_order_relaxed))
+    {
+        // Profiled locks are matched to their device before it is open
+        device = peci_DevicePathStat(devices);
+    }
+    uint64_t lockId = peci_lockprof_wait(device);
+    uint64_t start_ns = peci_now_ns();
+    struct peci_arb_hold hold = {0};
+    if (atomic_load_explicit(&peci_arb_on, memory_order_relaxed))
+    {
+        if (peci_arb_acquire(devices, timeout_ms, &hold) != PECI_CC_SUCCESS)
+        {
+            *peci_fd = -1;
+            return peci_LockBusy(lockId, device, start_ns);
+        }
+        if (timeout_ms > 0)
+        {
+            uint64_t waited_ms = (peci_now_ns() - start_ns) / 1000000ULL;
+            timeout_ms = waited_ms >= (uint64_t)timeout_ms
+                             ? PECI_NO_WAIT
+                             : timeout_ms - (int)waited_ms;
+        }
+    }
+
     // Open the PECI driver with the specified timeout
     *peci_fd = open(peci_device, O_RDWR | O_CLOEXEC);
-    if (*peci_fd == -1 && errno == ENOENT && peci_device_list[1])
+    if (*peci_fd == -1 && errno == ENOENT && devices[1])
     {
-        peci_device = peci_device_list[1];
+        peci_device = devices[1];
         *peci_fd = open(peci_device, O_RDWR | O_CLOEXEC);
     }
     switch (timeout_ms)
@@ -127,12 +491,42 @@ EPECIStatus peci_Lock(int* peci_fd, int timeout_ms)
     }
     if (-1 == *peci_fd)
     {
-        syslog(LOG_ERR, " >>> PECI Device Busy <<< \n");
-        return PECI_CC_DRIVER_ERR;
+        peci_arb_release(&hold);
+        return peci_LockBusy(lockId, device, start_ns);
     }
+    peci_DeviceBind(*peci_fd, peci_DeviceStat(*peci_fd));
+    peci_arb_bind(*peci_fd, &hold);
+    peci_lockprof_locked(lockId, *peci_fd, PECI_CC_SUCCESS);
     return PECI_CC_SUCCESS;
 }
 
+/*-------------------------------------------------------------------------
+ * This function attempts to lock the peci interface with the specified
+ * timeout and returns a file descriptor if successful.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_Lock(int* peci_fd, int timeout_ms)
+{
+    return peci_LockDevList(peci_GetDevConfig()->devices, peci_fd, timeout_ms);
+}
+
+/*-------------------------------------------------------------------------
+ * This function attempts to lock the specified peci device with the
+ * specified timeout and returns a file descriptor if successful. The
+ * process-wide device name set by peci_SetDevName is not used or changed.
+ * If the device name is null, the default device names are used.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_LockDev(const char* peci_dev, int* peci_fd, int timeout_ms)
+{
+    const char* devices[2] = {peci_dev, NULL};
+
+    peci_Init();
+    if (peci_dev == NULL)
+    {
+        return peci_Lock(peci_fd, timeout_ms);
+    }
+    return peci_LockDevList(devices, peci_fd, timeout_ms);
+}
+
 /*-------------------------------------------------------------------------
  * This function closes the peci interface
  *------------------------------------------------------------------------*/
@@ -156,472 +550,2069 @@ static EPECIStatus peci_Open(int* peci_fd)
 }
 
 /*-------------------------------------------------------------------------
- * This function issues peci commands to peci driver
+ * This function records a completed peci command in the active trace
  *------------------------------------------------------------------------*/
-static EPECIStatus HW_peci_issue_cmd(unsigned int cmd, char* cmdPtr,
-                                     int peci_fd)
+static void peci_trace_cmd(unsigned int cmd, const char* req,
+                           const char* cmdPtr, uint64_t start_ns,
+                           EPECIStatus ret)
 {
-    if (cmdPtr == NULL)
-    {
-        return PECI_CC_INVALID_REQ;
-    }
+    const uint8_t* tx = NULL;
+    const uint8_t* rx = NULL;
+    size_t tx_len = 0;
+    size_t rx_len = 0;
 
-    if (ioctl(peci_fd, cmd, cmdPtr) != 0)
+    if (cmd == PECI_IOC_XFER)
     {
-        if (errno == ETIMEDOUT)
-        {
-            return PECI_CC_TIMEOUT;
-        }
-        return PECI_CC_DRIVER_ERR;
+        const struct peci_xfer_msg* msg = (const void*)cmdPtr;
+        tx = msg->tx_buf;
+        tx_len = msg->tx_len;
+        rx = msg->rx_buf;
+        rx_len = msg->rx_len;
     }
-
-    return PECI_CC_SUCCESS;
+    peci_trace_record(cmd, req, cmdPtr, _IOC_SIZE(cmd), tx, tx_len, rx,
+                      rx_len, start_ns, peci_now_ns(), ret);
 }
 
 /*-------------------------------------------------------------------------
- * Find the specified PCI bus number value
+ * This function issues an ioctl to the peci driver, or to the simulated
+ * device, and records it if tracing is on
  *------------------------------------------------------------------------*/
-EPECIStatus FindBusNumber(uint8_t u8Bus, uint8_t u8Cpu, uint8_t* pu8BusValue)
+static EPECIStatus peci_IssueIoctl(unsigned int cmd, char* cmdPtr, int peci_fd)
 {
-    uint8_t u8CpuBus0[] = {
-        PECI_PCI_BUS0_CPU0,
-        PECI_PCI_BUS0_CPU1,
-    };
-    uint8_t u8Bus0 = 0;
-    uint8_t u8Offset = 0;
     EPECIStatus ret = PECI_CC_SUCCESS;
-    uint8_t u8Reg[4] = {0};
-    uint8_t cc = 0;
+    char req[PECI_TRACE_MAX_MSG];
+    uint64_t start_ns = 0;
+    bool trace = false;
 
-    // First check for valid inputs
-    // Check cpu and bus numbers, only support buses [5:0]
-    if ((u8Bus > 5) || (u8Cpu >= (sizeof(u8CpuBus0) / sizeof(uint8_t))) ||
-        (pu8BusValue == NULL))
+    if (atomic_load_explicit(&peci_trace_on, memory_order_relaxed) &&
+        _IOC_SIZE(cmd) <= sizeof(req))
     {
-        return PECI_CC_INVALID_REQ;
+        trace = true;
+        memcpy(req, cmdPtr, _IOC_SIZE(cmd));
+        start_ns = peci_now_ns();
     }
 
-    // Get the Bus 0 value for the requested CPU
-    u8Bus0 = u8CpuBus0[u8Cpu];
-
-    // Next check that the bus numbers are valid
-    // CPUBUSNO_VALID register - Above registers valid? - B(0) D5 F0 offset
-    // D4h
-    ret = peci_RdPCIConfig(u8Cpu, u8Bus0, PECI_PCI_CPUBUSNO_DEV,
-                           PECI_PCI_CPUBUSNO_FUNC, PECI_PCI_CPUBUSNO_VALID,
-                           u8Reg, &cc);
-    if (ret != PECI_CC_SUCCESS)
+    if (atomic_load_explicit(&peci_sim_on, memory_order_relaxed))
     {
-        return ret;
+        ret = peci_sim_issue_cmd(cmd, cmdPtr);
     }
-    // BIOS will set bit 31 of CPUBUSNO_VALID when the bus numbers are valid
-    if ((u8Reg[3] & 0x80) == 0)
+    else if (atomic_load_explicit(&peci_broker_on, memory_order_relaxed))
     {
-        return PECI_CC_HW_ERR;
+        ret = peci_broker_issue_cmd(cmd, cmdPtr, peci_fd);
     }
-
-    // Bus numbers are valid so read the correct offset for the requested
-    // bus CPUBUSNO register - CPU Internal Bus Numbers [3:0] - B(0) D5 F0
-    // offset CCh CPUBUSNO_1 register - CPU Internal Bus Numbers [5:4] -
-    // B(0) D5 F0 offset D0h
-    u8Offset = u8Bus <= 3 ? PECI_PCI_CPUBUSNO : PECI_PCI_CPUBUSNO_1;
-    ret = peci_RdPCIConfig(u8Cpu, u8Bus0, PECI_PCI_CPUBUSNO_DEV,
-                           PECI_PCI_CPUBUSNO_FUNC, u8Offset, u8Reg, &cc);
-    if (ret != PECI_CC_SUCCESS)
+    else if (ioctl(peci_fd, cmd, cmdPtr) != 0)
     {
-        return ret;
+        ret = errno == ETIMEDOUT ? PECI_CC_TIMEOUT : PECI_CC_DRIVER_ERR;
     }
 
-    // Now return the bus value for the requested bus
-    *pu8BusValue = u8Reg[u8Bus % 4];
-
-    // Unused bus numbers are set to zero which is only valid for bus 0
-    // so, return an error for any other bus set to zero
-    if (*pu8BusValue == 0 && u8Bus != 0)
+    if (trace)
     {
-        return PECI_CC_CPU_NOT_PRESENT;
+        peci_trace_cmd(cmd, req, cmdPtr, start_ns, ret);
     }
-
-    return PECI_CC_SUCCESS;
+    return ret;
 }
 
+// Circuit breaker state of one client address
+struct peci_circuit
+{
+    uint32_t failures; // consecutive timeouts and driver errors
+    bool open;
+    bool probing;
+    uint32_t backoff_ms;
+    uint64_t nextProbe_ns;
+};
+
+static atomic_bool peci_breaker_on;
+static pthread_mutex_t peci_breaker_lock = PTHREAD_MUTEX_INITIALIZER;
+static PECICircuitBreakerConfig peci_breaker_config;
+
+// Circuits of the clients on one PECI device
+#define PECI_CIRCUIT_DEVICES 8
+
+struct peci_circuit_set
+{
+    uint64_t device; // zero if the set is free
+    struct peci_circuit circuits[MAX_CPUS];
+};
+
+static struct peci_circuit_set peci_circuit_sets[PECI_CIRCUIT_DEVICES];
+static unsigned int peci_circuit_evict;
+
 /*-------------------------------------------------------------------------
- * This function checks the CPU PECI interface
+ * This function finds the circuit for a target on a device, starting a
+ * closed one if the device has none. When every set is taken, the sets are
+ * reused in turn. The breaker lock must be held.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_Ping(uint8_t target)
+static struct peci_circuit* peci_CircuitFind(uint64_t device, uint8_t target)
 {
-    int peci_fd = -1;
-    EPECIStatus ret = PECI_CC_SUCCESS;
+    struct peci_circuit_set* set = NULL;
 
-    // The target address must be in the valid range
-    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    for (int i = 0; i < PECI_CIRCUIT_DEVICES; i++)
     {
-        return PECI_CC_INVALID_REQ;
+        if (peci_circuit_sets[i].device == device)
+        {
+            return &peci_circuit_sets[i].circuits[target - MIN_CLIENT_ADDR];
+        }
+        if (set == NULL && peci_circuit_sets[i].device == 0)
+        {
+            set = &peci_circuit_sets[i];
+        }
     }
-
-    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    if (set == NULL)
     {
-        return PECI_CC_DRIVER_ERR;
+        set = &peci_circuit_sets[peci_circuit_evict++ % PECI_CIRCUIT_DEVICES];
     }
-    ret = peci_Ping_seq(target, peci_fd);
-
-    peci_Close(peci_fd);
-    return ret;
+    memset(set, 0, sizeof(*set));
+    set->device = device;
+    return &set->circuits[target - MIN_CLIENT_ADDR];
 }
 
 /*-------------------------------------------------------------------------
- * This function allows sequential Ping with the provided
- * peci file descriptor.
+ * This function enables the circuit breaker with the provided settings, or
+ * disables it if config is null. All circuits start closed.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_Ping_seq(uint8_t target, int peci_fd)
+void peci_SetCircuitBreaker(const PECICircuitBreakerConfig* config)
 {
-    EPECIStatus ret = PECI_CC_SUCCESS;
-    struct peci_ping_msg cmd = {0};
-
-    // The target address must be in the valid range
-    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    pthread_mutex_lock(&peci_breaker_lock);
+    memset(peci_circuit_sets, 0, sizeof(peci_circuit_sets));
+    if (config != NULL)
     {
-        return PECI_CC_INVALID_REQ;
+        peci_breaker_config = *config;
+        if (peci_breaker_config.failureThreshold == 0)
+        {
+            peci_breaker_config.failureThreshold = 1;
+        }
+        if (peci_breaker_config.probeMinMs == 0)
+        {
+            peci_breaker_config.probeMinMs = PECI_TIMEOUT_RESOLUTION_MS;
+        }
+        if (peci_breaker_config.probeMaxMs < peci_breaker_config.probeMinMs)
+        {
+            peci_breaker_config.probeMaxMs = peci_breaker_config.probeMinMs;
+        }
     }
-
-    cmd.addr = target;
-    ret = HW_peci_issue_cmd(PECI_IOC_PING, (char*)&cmd, peci_fd);
-
-    return ret;
+    atomic_store_explicit(&peci_breaker_on, config != NULL,
+                          memory_order_relaxed);
+    pthread_mutex_unlock(&peci_breaker_lock);
 }
 
 /*-------------------------------------------------------------------------
- * This function gets PECI device information
+ * This function returns true if the circuit for the target is open on any
+ * PECI device
  *------------------------------------------------------------------------*/
-EPECIStatus peci_GetDIB(uint8_t target, uint64_t* dib)
+bool peci_CircuitOpen(uint8_t target)
 {
-    int peci_fd = -1;
-    EPECIStatus ret = PECI_CC_SUCCESS;
-
-    if (dib == NULL)
-    {
-        return PECI_CC_INVALID_REQ;
-    }
+    bool open = false;
 
-    // The target address must be in the valid range
     if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
     {
-        return PECI_CC_INVALID_REQ;
+        return false;
     }
 
-    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    pthread_mutex_lock(&peci_breaker_lock);
+    for (int i = 0; i < PECI_CIRCUIT_DEVICES; i++)
     {
-        return PECI_CC_DRIVER_ERR;
+        const struct peci_circuit_set* set = &peci_circuit_sets[i];
+        if (set->device != 0 && set->circuits[target - MIN_CLIENT_ADDR].open)
+        {
+            open = true;
+        }
     }
-    ret = peci_GetDIB_seq(target, dib, peci_fd);
-
-    peci_Close(peci_fd);
-    return ret;
+    pthread_mutex_unlock(&peci_breaker_lock);
+    return open;
 }
 
 /*-------------------------------------------------------------------------
- * This function allows sequential GetDIB with the provided
- * peci file descriptor.
+ * This function closes the circuit for the target on every PECI device,
+ * for example when the host is known to have powered on
  *------------------------------------------------------------------------*/
-EPECIStatus peci_GetDIB_seq(uint8_t target, uint64_t* dib, int peci_fd)
+void peci_ResetCircuit(uint8_t target)
 {
-    struct peci_get_dib_msg cmd = {0};
-    EPECIStatus ret = PECI_CC_SUCCESS;
-    cmd.addr = target;
-
-    if (dib == NULL)
-    {
-        return PECI_CC_INVALID_REQ;
-    }
-
-    // The target address must be in the valid range
     if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
     {
-        return PECI_CC_INVALID_REQ;
+        return;
     }
 
-    ret = HW_peci_issue_cmd(PECI_IOC_GET_DIB, (char*)&cmd, peci_fd);
-
-    if (ret == PECI_CC_SUCCESS)
+    pthread_mutex_lock(&peci_breaker_lock);
+    for (int i = 0; i < PECI_CIRCUIT_DEVICES; i++)
     {
-        *dib = cmd.dib;
+        memset(&peci_circuit_sets[i].circuits[target - MIN_CLIENT_ADDR], 0,
+               sizeof(struct peci_circuit));
     }
-
-    return ret;
+    pthread_mutex_unlock(&peci_breaker_lock);
 }
 
 /*-------------------------------------------------------------------------
- * This function get PECI Thermal temperature
- * Expressed in signed fixed point value of 1/64 degrees celsius
+ * This function decides whether a command may be sent to the target. While
+ * the circuit is open, commands fail fast except when a ping probe is due.
+ * One caller sends the probe, and if the target answers the circuit goes
+ * half open so the next failure opens it again straight away.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_GetTemp(uint8_t target, int16_t* temperature)
+static EPECIStatus peci_CircuitAdmit(uint64_t device, uint8_t target,
+                                     int peci_fd)
 {
-    int peci_fd = -1;
-    struct peci_get_temp_msg cmd = {0};
+    struct peci_circuit* circuit = NULL;
+    struct peci_ping_msg ping = {0};
+    EPECIStatus probe = PECI_CC_SUCCESS;
 
-    if (temperature == NULL)
+    pthread_mutex_lock(&peci_breaker_lock);
+    circuit = peci_CircuitFind(device, target);
+    if (!circuit->open)
     {
-        return PECI_CC_INVALID_REQ;
+        pthread_mutex_unlock(&peci_breaker_lock);
+        return PECI_CC_SUCCESS;
     }
-
-    // The target address must be in the valid range
-    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    if (circuit->probing || peci_now_ns() < circuit->nextProbe_ns)
     {
-        return PECI_CC_INVALID_REQ;
+        pthread_mutex_unlock(&peci_breaker_lock);
+        return PECI_CC_CIRCUIT_OPEN;
     }
+    circuit->probing = true;
+    pthread_mutex_unlock(&peci_breaker_lock);
 
-    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    ping.addr = target;
+    probe = peci_IssueIoctl(PECI_IOC_PING, (char*)&ping, peci_fd);
+
+    pthread_mutex_lock(&peci_breaker_lock);
+    // The set may have been reused while the lock was dropped
+    circuit = peci_CircuitFind(device, target);
+    circuit->probing = false;
+    if (probe == PECI_CC_SUCCESS)
     {
-        return PECI_CC_DRIVER_ERR;
+        circuit->open = false;
+        circuit->failures = peci_breaker_config.failureThreshold - 1;
+        syslog(LOG_INFO, "PECI client 0x%x answered, closing circuit\n",
+               target);
     }
-
-    cmd.addr = target;
-
-    EPECIStatus ret =
-        HW_peci_issue_cmd(PECI_IOC_GET_TEMP, (char*)&cmd, peci_fd);
-
-    if (ret == PECI_CC_SUCCESS)
+    else
     {
-        *temperature = cmd.temp_raw;
+        circuit->backoff_ms = circuit->backoff_ms * 2;
+        if (circuit->backoff_ms > peci_breaker_config.probeMaxMs)
+        {
+            circuit->backoff_ms = peci_breaker_config.probeMaxMs;
+        }
+        circuit->nextProbe_ns = peci_now_ns() +
+                                (uint64_t)circuit->backoff_ms * 1000000;
     }
+    pthread_mutex_unlock(&peci_breaker_lock);
 
-    peci_Close(peci_fd);
-
-    return ret;
+    return probe == PECI_CC_SUCCESS ? PECI_CC_SUCCESS : PECI_CC_CIRCUIT_OPEN;
 }
 
 /*-------------------------------------------------------------------------
- * This function provides read access to the package configuration
- * space within the processor.
+ * This function updates the circuit for the target with the result of a
+ * command, opening it after too many consecutive timeouts or driver errors
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdPkgConfig(uint8_t target, uint8_t u8Index, uint16_t u16Value,
-                             uint8_t u8ReadLen, uint8_t* pPkgConfig,
-                             uint8_t* cc)
+static void peci_CircuitUpdate(uint64_t device, uint8_t target,
+                               EPECIStatus ret)
 {
-    //  Default to domain ID 0
-    return peci_RdPkgConfig_dom(target, 0, u8Index, u16Value, u8ReadLen,
-                                pPkgConfig, cc);
+    pthread_mutex_lock(&peci_breaker_lock);
+    struct peci_circuit* circuit = peci_CircuitFind(device, target);
+    if (ret == PECI_CC_TIMEOUT || ret == PECI_CC_DRIVER_ERR)
+    {
+        if (++circuit->failures >= peci_breaker_config.failureThreshold &&
+            !circuit->open)
+        {
+            circuit->open = true;
+            circuit->backoff_ms = peci_breaker_config.probeMinMs;
+            circuit->nextProbe_ns = peci_now_ns() +
+                                    (uint64_t)circuit->backoff_ms * 1000000;
+            syslog(LOG_WARNING,
+                   "PECI client 0x%x not responding, opening circuit\n",
+                   target);
+        }
+    }
+    else
+    {
+        circuit->failures = 0;
+    }
+    pthread_mutex_unlock(&peci_breaker_lock);
 }
 
 /*-------------------------------------------------------------------------
- * This function provides read access to the package configuration
- * space within the processor in the specified domain.
+ * This function issues a peci command through the circuit breaker
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdPkgConfig_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8Index, uint16_t u16Value,
-    uint8_t u8ReadLen, uint8_t* pPkgConfig, uint8_t* cc)
+static EPECIStatus peci_IssueGuarded(unsigned int cmd, char* cmdPtr,
+                                     int peci_fd)
 {
-    int peci_fd = -1;
     EPECIStatus ret = PECI_CC_SUCCESS;
 
-    if (pPkgConfig == NULL || cc == NULL)
+    // Every PECI message starts with the client address
+    uint8_t target = (uint8_t)cmdPtr[0];
+    if (!atomic_load_explicit(&peci_breaker_on, memory_order_relaxed) ||
+        target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
     {
-        return PECI_CC_INVALID_REQ;
+        return peci_IssueIoctl(cmd, cmdPtr, peci_fd);
     }
 
-    // The target address must be in the valid range
-    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    // Circuits are kept per device, as each bus has its own clients
+    uint64_t device = peci_DeviceOf(peci_fd);
+    if (device == 0)
     {
-        return PECI_CC_INVALID_REQ;
+        return peci_IssueIoctl(cmd, cmdPtr, peci_fd);
     }
 
-    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    ret = peci_CircuitAdmit(device, target, peci_fd);
+    if (ret != PECI_CC_SUCCESS)
     {
-        return PECI_CC_DRIVER_ERR;
+        return ret;
     }
-    ret = peci_RdPkgConfig_seq_dom(target, domainId, u8Index, u16Value,
-                                   u8ReadLen, pPkgConfig, peci_fd, cc);
-
-    peci_Close(peci_fd);
+    ret = peci_IssueIoctl(cmd, cmdPtr, peci_fd);
+    peci_CircuitUpdate(device, target, ret);
     return ret;
 }
 
-/*-------------------------------------------------------------------------
- * This function allows sequential RdPkgConfig with the provided
- * peci file descriptor.
- *------------------------------------------------------------------------*/
-EPECIStatus peci_RdPkgConfig_seq(uint8_t target, uint8_t u8Index,
-                                 uint16_t u16Value, uint8_t u8ReadLen,
-                                 uint8_t* pPkgConfig, int peci_fd, uint8_t* cc)
+// Cached package config reads per client
+#define PECI_CACHE_ENTRIES 32
+
+struct peci_cache_entry
 {
-    //  Default to domain ID 0
-    return peci_RdPkgConfig_seq_dom(target, 0, u8Index, u16Value, u8ReadLen,
-                                    pPkgConfig, peci_fd, cc);
-}
+    bool valid;
+    uint64_t device; // see peci_DeviceOf
+    uint8_t domainId;
+    uint8_t index;
+    uint8_t rxLen;
+    uint16_t param;
+    uint8_t cc;
+    uint8_t data[4];
+    uint64_t expires_ns;
+};
+
+// Package config values that do not change until the host resets
+static const PECICacheRule peci_cache_builtin[] = {
+    {PECI_MBX_INDEX_CPU_ID, PECI_PKG_ID_CPU_ID, false, PECI_CACHE_UNTIL_RESET},
+    {PECI_MBX_INDEX_CPU_ID, PECI_PKG_ID_PLATFORM_ID, false,
+     PECI_CACHE_UNTIL_RESET},
+    {PECI_MBX_INDEX_CPU_ID, PECI_PKG_ID_MAX_THREAD_ID, false,
+     PECI_CACHE_UNTIL_RESET},
+    {PECI_MBX_INDEX_CPU_ID, PECI_PKG_ID_MICROCODE_REV, false,
+     PECI_CACHE_UNTIL_RESET},
+    {PECI_MBX_INDEX_CFG_TDP_LEVELS, 0, true, PECI_CACHE_UNTIL_RESET},
+    {PECI_MBX_INDEX_TDP, 0, true, PECI_CACHE_UNTIL_RESET},
+    {PECI_MBX_INDEX_TDP_HIGH, 0, true, PECI_CACHE_UNTIL_RESET},
+    {PECI_MBX_INDEX_TDP_UNITS, 0, true, PECI_CACHE_UNTIL_RESET},
+    {PECI_MBX_INDEX_TURBO_RATIO_LIMIT, 0, true, PECI_CACHE_UNTIL_RESET},
+};
+
+static atomic_bool peci_cache_on;
+static pthread_mutex_t peci_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static PECICacheRule* peci_cache_rules;
+static size_t peci_cache_rule_count;
+static struct peci_cache_entry peci_cache[MAX_CPUS][PECI_CACHE_ENTRIES];
 
 /*-------------------------------------------------------------------------
- * This function allows sequential RdPkgConfig with the provided
- * peci file descriptor in the specified domain.
+ * This function enables the package config cache with the provided rules,
+ * or disables it if config is null. The cache starts empty.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdPkgConfig_seq_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8Index, uint16_t u16Value,
-    uint8_t u8ReadLen, uint8_t* pPkgConfig, int peci_fd, uint8_t* cc)
+EPECIStatus peci_SetCache(const PECICacheConfig* config)
 {
-    struct peci_rd_pkg_cfg_msg cmd = {0};
-    EPECIStatus ret = PECI_CC_SUCCESS;
-
-    if (pPkgConfig == NULL || cc == NULL)
-    {
-        return PECI_CC_INVALID_REQ;
-    }
+    PECICacheRule* rules = NULL;
 
-    // The target address must be in the valid range
-    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    if (config != NULL && config->ruleCount > 0)
     {
-        return PECI_CC_INVALID_REQ;
+        if (config->rules == NULL)
+        {
+            return PECI_CC_INVALID_REQ;
+        }
+        rules = malloc(config->ruleCount * sizeof(*rules));
+        if (rules == NULL)
+        {
+            return PECI_CC_MEM_ERR;
+        }
+        memcpy(rules, config->rules, config->ruleCount * sizeof(*rules));
     }
 
-    // Per the PECI spec, the write length must be a byte, word, or dword
-    if (u8ReadLen != 1 && u8ReadLen != 2 && u8ReadLen != 4)
-    {
-        return PECI_CC_INVALID_REQ;
-    }
+    pthread_mutex_lock(&peci_cache_lock);
+    free(peci_cache_rules);
+    peci_cache_rules = rules;
+    peci_cache_rule_count = config != NULL ? config->ruleCount : 0;
+    memset(peci_cache, 0, sizeof(peci_cache));
+    atomic_store_explicit(&peci_cache_on, config != NULL, memory_order_relaxed);
+    pthread_mutex_unlock(&peci_cache_lock);
+    return PECI_CC_SUCCESS;
+}
 
-    // The PECI buffer must be large enough to hold the requested data
-    if (sizeof(cmd.pkg_config) < u8ReadLen)
+/*-------------------------------------------------------------------------
+ * This function drops the cached values of the target on the device, or on
+ * every device if device is zero
+ *------------------------------------------------------------------------*/
+static void peci_CacheDrop(uint64_t device, uint8_t target)
+{
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
     {
-        return PECI_CC_INVALID_REQ;
+        return;
     }
 
-    cmd.addr = target;
-    cmd.index = u8Index;  // RdPkgConfig index
-    cmd.param = u16Value; // Config parameter value
-    cmd.rx_len = u8ReadLen;
-    cmd.domain_id = domainId;
-
-    ret = HW_peci_issue_cmd(PECI_IOC_RD_PKG_CFG, (char*)&cmd, peci_fd);
-    *cc = cmd.cc;
-    if (ret == PECI_CC_SUCCESS)
+    pthread_mutex_lock(&peci_cache_lock);
+    struct peci_cache_entry* entries = peci_cache[target - MIN_CLIENT_ADDR];
+    for (int i = 0; i < PECI_CACHE_ENTRIES; i++)
     {
-        memcpy(pPkgConfig, cmd.pkg_config, u8ReadLen);
+        if (device == 0 || entries[i].device == device)
+        {
+            entries[i].valid = false;
+        }
     }
-
-    return ret;
+    pthread_mutex_unlock(&peci_cache_lock);
 }
 
 /*-------------------------------------------------------------------------
- * This function provides write access to the package configuration
- * space within the processor
+ * This function drops the cached values of the target on every device
  *------------------------------------------------------------------------*/
-EPECIStatus peci_WrPkgConfig(uint8_t target, uint8_t u8Index, uint16_t u16Param,
-                             uint32_t u32Value, uint8_t u8WriteLen, uint8_t* cc)
+void peci_CacheInvalidate(uint8_t target)
 {
-    //  Default to domain ID 0
-    return peci_WrPkgConfig_dom(target, 0, u8Index, u16Param, u32Value,
-                                u8WriteLen, cc);
+    peci_CacheDrop(0, target);
 }
 
 /*-------------------------------------------------------------------------
- * This function provides write access to the package configuration
- * space within the processor in the specified domain
+ * This function finds the rule for a package config read, checking the
+ * caller's rules before the built-in ones. The cache lock must be held.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_WrPkgConfig_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8Index, uint16_t u16Param,
-    uint32_t u32Value, uint8_t u8WriteLen, uint8_t* cc)
+static uint32_t peci_CacheTtl(const struct peci_rd_pkg_cfg_msg* msg)
 {
-    int peci_fd = -1;
-    EPECIStatus ret = PECI_CC_SUCCESS;
-
-    if (cc == NULL)
-    {
-        return PECI_CC_INVALID_REQ;
-    }
-
-    // The target address must be in the valid range
-    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    for (size_t i = 0; i < peci_cache_rule_count; i++)
     {
-        return PECI_CC_INVALID_REQ;
+        const PECICacheRule* rule = &peci_cache_rules[i];
+        if (rule->index == msg->index &&
+            (rule->anyParam || rule->param == msg->param))
+        {
+            return rule->ttlMs;
+        }
     }
-
-    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    for (size_t i = 0;
+         i < sizeof(peci_cache_builtin) / sizeof(peci_cache_builtin[0]); i++)
     {
-        return PECI_CC_DRIVER_ERR;
+        const PECICacheRule* rule = &peci_cache_builtin[i];
+        if (rule->index == msg->index &&
+            (rule->anyParam || rule->param == msg->param))
+        {
+            return rule->ttlMs;
+        }
     }
-    ret = peci_WrPkgConfig_seq_dom(target, domainId, u8Index, u16Param,
-                                   u32Value, u8WriteLen, peci_fd, cc);
-
-    peci_Close(peci_fd);
-    return ret;
+    return 0;
 }
 
 /*-------------------------------------------------------------------------
- * This function allows sequential WrPkgConfig with the provided
- * peci file descriptor.
+ * This function finds the cache slot for a package config read. The cache
+ * lock must be held.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_WrPkgConfig_seq(uint8_t target, uint8_t u8Index,
-                                 uint16_t u16Param, uint32_t u32Value,
-                                 uint8_t u8WriteLen, int peci_fd, uint8_t* cc)
+static struct peci_cache_entry*
+    peci_CacheFind(uint64_t device, const struct peci_rd_pkg_cfg_msg* msg)
 {
-    //  Default to domain ID 0
-    return peci_WrPkgConfig_seq_dom(target, 0, u8Index, u16Param, u32Value,
-                                    u8WriteLen, peci_fd, cc);
+    struct peci_cache_entry* entries = peci_cache[msg->addr - MIN_CLIENT_ADDR];
+
+    for (int i = 0; i < PECI_CACHE_ENTRIES; i++)
+    {
+        if (entries[i].valid && entries[i].device == device &&
+            entries[i].domainId == msg->domain_id &&
+            entries[i].index == msg->index &&
+            entries[i].param == msg->param && entries[i].rxLen == msg->rx_len)
+        {
+            return &entries[i];
+        }
+    }
+    return NULL;
 }
 
 /*-------------------------------------------------------------------------
- * This function allows sequential WrPkgConfig with the provided
- * peci file descriptor in the specified domain.
+ * This function answers a package config read from the cache. It returns
+ * true if the read was answered, and sets *ttlMs to how long the result of
+ * a read that was not answered may be cached.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_WrPkgConfig_seq_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8Index, uint16_t u16Param,
-    uint32_t u32Value, uint8_t u8WriteLen, int peci_fd, uint8_t* cc)
+static bool peci_CacheLookup(uint64_t device, unsigned int cmd, char* cmdPtr,
+                             uint32_t* ttlMs)
 {
-    struct peci_wr_pkg_cfg_msg cmd = {0};
-    EPECIStatus ret = PECI_CC_SUCCESS;
+    struct peci_rd_pkg_cfg_msg* msg = (struct peci_rd_pkg_cfg_msg*)cmdPtr;
+    bool hit = false;
 
-    if (cc == NULL)
+    *ttlMs = 0;
+    if (cmd != PECI_IOC_RD_PKG_CFG || msg->addr < MIN_CLIENT_ADDR ||
+        msg->addr > MAX_CLIENT_ADDR || msg->rx_len > sizeof(msg->pkg_config))
     {
-        return PECI_CC_INVALID_REQ;
+        return false;
     }
 
-    // The target address must be in the valid range
-    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    pthread_mutex_lock(&peci_cache_lock);
+    *ttlMs = peci_CacheTtl(msg);
+    struct peci_cache_entry* entry =
+        *ttlMs != 0 ? peci_CacheFind(device, msg) : NULL;
+    if (entry != NULL && peci_now_ns() < entry->expires_ns)
     {
-        return PECI_CC_INVALID_REQ;
+        msg->cc = entry->cc;
+        memcpy(msg->pkg_config, entry->data, msg->rx_len);
+        hit = true;
     }
+    pthread_mutex_unlock(&peci_cache_lock);
+    return hit;
+}
 
-    // Per the PECI spec, the write length must be a byte, word, or dword
-    if ((u8WriteLen != 1) && (u8WriteLen != 2) && (u8WriteLen != 4))
+/*-------------------------------------------------------------------------
+ * This function stores the result of a cacheable read. Any command that
+ * finds its target gone from the bus drops the target's cached values on
+ * the device, since the host may be resetting. Driver errors may be local,
+ * such as a descriptor that is not open, so they leave the cache alone.
+ *------------------------------------------------------------------------*/
+static void peci_CacheUpdate(uint64_t device, unsigned int cmd,
+                             const char* cmdPtr, EPECIStatus ret,
+                             uint32_t ttlMs)
+{
+    const struct peci_rd_pkg_cfg_msg* msg =
+        (const struct peci_rd_pkg_cfg_msg*)cmdPtr;
+    uint8_t target = (uint8_t)cmdPtr[0];
+
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
     {
-        return PECI_CC_INVALID_REQ;
+        return;
+    }
+    if (ret == PECI_CC_TIMEOUT || ret == PECI_CC_CPU_NOT_PRESENT ||
+        ret == PECI_CC_CIRCUIT_OPEN)
+    {
+        peci_CacheDrop(device, target);
+        return;
+    }
+    if (ttlMs == 0 || cmd != PECI_IOC_RD_PKG_CFG || ret != PECI_CC_SUCCESS ||
+        msg->cc != PECI_DEV_CC_SUCCESS)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&peci_cache_lock);
+    struct peci_cache_entry* entry = peci_CacheFind(device, msg);
+    if (entry == NULL)
+    {
+        // Take a free slot, or else the one closest to expiring
+        struct peci_cache_entry* entries = peci_cache[target - MIN_CLIENT_ADDR];
+        entry = &entries[0];
+        for (int i = 0; i < PECI_CACHE_ENTRIES && entry->valid; i++)
+        {
+            if (!entries[i].valid || entries[i].expires_ns < entry->expires_ns)
+            {
+                entry = &entries[i];
+            }
+        }
+    }
+    entry->valid = true;
+    entry->device = device;
+    entry->domainId = msg->domain_id;
+    entry->index = msg->index;
+    entry->param = msg->param;
+    entry->rxLen = msg->rx_len;
+    entry->cc = msg->cc;
+    memcpy(entry->data, msg->pkg_config, msg->rx_len);
+    entry->expires_ns = ttlMs == PECI_CACHE_UNTIL_RESET
+                            ? UINT64_MAX
+                            : peci_now_ns() + (uint64_t)ttlMs * 1000000;
+    pthread_mutex_unlock(&peci_cache_lock);
+}
+
+// A coalesced read, shared by every identical request issued while it is in
+// flight and, once it has succeeded, until it is older than the freshness
+// window
+struct peci_flight
+{
+    struct peci_flight* next;
+    unsigned int cmd;
+    uint64_t device;
+    uint8_t key[8];
+    // The message as returned by the driver
+    uint8_t msg[sizeof(struct peci_rd_pkg_cfg_msg)];
+    EPECIStatus ret;
+    bool done;
+    bool linked;
+    uint32_t refs;
+    uint64_t done_ns;
+};
+
+// Package config reads that have no side effects on the CPU, so one result
+// can answer several callers.  Anything else, such as mailbox reads that
+// step through a sequence, always goes to the bus.
+struct peci_coalesce_read
+{
+    uint8_t index;
+    uint16_t param;
+    bool anyParam;
+};
+
+static const struct peci_coalesce_read peci_coalesce_reads[] = {
+    {PECI_MBX_INDEX_CPU_ID, PECI_PKG_ID_CPU_ID, false},
+    {PECI_MBX_INDEX_CPU_ID, PECI_PKG_ID_PLATFORM_ID, false},
+    {PECI_MBX_INDEX_CPU_ID, PECI_PKG_ID_UNCORE_ID, false},
+    {PECI_MBX_INDEX_CPU_ID, PECI_PKG_ID_MAX_THREAD_ID, false},
+    {PECI_MBX_INDEX_CPU_ID, PECI_PKG_ID_MICROCODE_REV, false},
+    {PECI_MBX_INDEX_PKG_TEMP_READ, 0, true},
+    {PECI_MBX_INDEX_ENERGY_COUNTER, 0, true},
+    {PECI_MBX_INDEX_ENERGY_STATUS, 0, true},
+    {PECI_MBX_INDEX_MODULE_TEMP, 0, true},
+    {PECI_MBX_INDEX_DTS_MARGIN, 0, true},
+    {PECI_MBX_INDEX_CFG_TDP_LEVELS, 0, true},
+    {PECI_MBX_INDEX_DDR_DIMM_TEMP, 0, true},
+    {PECI_MBX_INDEX_TEMP_TARGET, 0, true},
+    {PECI_MBX_INDEX_DIMM_TEMP_READ, 0, true},
+    {PECI_MBX_INDEX_DRAM_IMC_TMP_READ, 0, true},
+    {PECI_MBX_INDEX_TDP, 0, true},
+    {PECI_MBX_INDEX_TDP_HIGH, 0, true},
+    {PECI_MBX_INDEX_TDP_UNITS, 0, true},
+    {PECI_MBX_INDEX_TIME_AVG_TEMP, 0, true},
+    {PECI_MBX_INDEX_TURBO_RATIO_LIMIT, 0, true},
+};
+
+static atomic_bool peci_coalesce_on;
+static pthread_mutex_t peci_coalesce_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t peci_coalesce_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t peci_coalesce_fresh_ns;
+static struct peci_flight* peci_flights;
+
+/*-------------------------------------------------------------------------
+ * This function unlinks a flight from the list and frees it once nobody is
+ * waiting on it
+ *------------------------------------------------------------------------*/
+static void peci_FlightUnlink(struct peci_flight** link)
+{
+    struct peci_flight* flight = *link;
+
+    *link = flight->next;
+    flight->linked = false;
+    if (flight->refs == 0)
+    {
+        free(flight);
+    }
+}
+
+/*-------------------------------------------------------------------------
+ * This function drops a reference to a flight, freeing it if it is the last
+ * one and the flight has been unlinked
+ *------------------------------------------------------------------------*/
+static void peci_FlightRelease(struct peci_flight* flight)
+{
+    if (--flight->refs == 0 && !flight->linked)
+    {
+        free(flight);
+    }
+}
+
+/*-------------------------------------------------------------------------
+ * This function enables coalescing of identical reads with the provided
+ * settings, or disables it if config is null
+ *------------------------------------------------------------------------*/
+void peci_SetCoalescing(const PECICoalesceConfig* config)
+{
+    pthread_mutex_lock(&peci_coalesce_lock);
+    peci_coalesce_fresh_ns =
+        config != NULL ? (uint64_t)config->freshnessMs * 1000000 : 0;
+    // Completed reads may be older than the new window, reads still in
+    // flight are dropped by their issuer
+    for (struct peci_flight** link = &peci_flights; *link != NULL;)
+    {
+        if ((*link)->done)
+        {
+            peci_FlightUnlink(link);
+        }
+        else
+        {
+            link = &(*link)->next;
+        }
+    }
+    atomic_store_explicit(&peci_coalesce_on, config != NULL,
+                          memory_order_relaxed);
+    pthread_mutex_unlock(&peci_coalesce_lock);
+}
+
+/*-------------------------------------------------------------------------
+ * This function returns true if the package config read is in the list of
+ * reads without side effects
+ *------------------------------------------------------------------------*/
+static bool peci_CoalesceIdempotent(uint8_t index, uint16_t param)
+{
+    for (size_t i = 0;
+         i < sizeof(peci_coalesce_reads) / sizeof(peci_coalesce_reads[0]); i++)
+    {
+        const struct peci_coalesce_read* read = &peci_coalesce_reads[i];
+        if (read->index == index && (read->anyParam || read->param == param))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*-------------------------------------------------------------------------
+ * This function returns true if the command is a read that can be shared
+ * between identical requests, and fills in the request fields that identify
+ * it. Package config reads are only shared if they have no side effects.
+ *------------------------------------------------------------------------*/
+static bool peci_CoalesceKey(unsigned int cmd, const char* cmdPtr,
+                             uint8_t key[8])
+{
+    memset(key, 0, 8);
+    switch (cmd)
+    {
+        case PECI_IOC_GET_TEMP:
+        {
+            const struct peci_get_temp_msg* msg =
+                (const struct peci_get_temp_msg*)cmdPtr;
+            key[0] = msg->addr;
+            return true;
+        }
+        case PECI_IOC_RD_PKG_CFG:
+        {
+            const struct peci_rd_pkg_cfg_msg* msg =
+                (const struct peci_rd_pkg_cfg_msg*)cmdPtr;
+            if (!peci_CoalesceIdempotent(msg->index, msg->param))
+            {
+                return false;
+            }
+            key[0] = msg->addr;
+            key[1] = msg->index;
+            memcpy(&key[2], &msg->param, sizeof(msg->param));
+            key[4] = msg->rx_len;
+            key[5] = msg->domain_id;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+/*-------------------------------------------------------------------------
+ * This function issues a read, or waits for an identical read that is
+ * already in flight and takes its result
+ *------------------------------------------------------------------------*/
+static EPECIStatus peci_IssueCoalesced(unsigned int cmd, char* cmdPtr,
+                                       int peci_fd, const uint8_t key[8],
+                                       uint64_t device)
+{
+    size_t msgLen = _IOC_SIZE(cmd);
+    struct peci_flight* flight = NULL;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    pthread_mutex_lock(&peci_coalesce_lock);
+    uint64_t now = peci_now_ns();
+    for (struct peci_flight** link = &peci_flights; *link != NULL;)
+    {
+        struct peci_flight* f = *link;
+        if (f->done && now - f->done_ns >= peci_coalesce_fresh_ns)
+        {
+            peci_FlightUnlink(link);
+            continue;
+        }
+        if (f->cmd == cmd && f->device == device &&
+            memcmp(f->key, key, sizeof(f->key)) == 0)
+        {
+            flight = f;
+            break;
+        }
+        link = &f->next;
+    }
+
+    if (flight != NULL)
+    {
+        flight->refs++;
+        while (!flight->done)
+        {
+            pthread_cond_wait(&peci_coalesce_cond, &peci_coalesce_lock);
+        }
+        memcpy(cmdPtr, flight->msg, msgLen);
+        ret = flight->ret;
+        peci_FlightRelease(flight);
+        pthread_mutex_unlock(&peci_coalesce_lock);
+        return ret;
+    }
+
+    flight = calloc(1, sizeof(*flight));
+    if (flight == NULL)
+    {
+        pthread_mutex_unlock(&peci_coalesce_lock);
+        return peci_IssueGuarded(cmd, cmdPtr, peci_fd);
+    }
+    flight->cmd = cmd;
+    flight->device = device;
+    memcpy(flight->key, key, sizeof(flight->key));
+    flight->refs = 1;
+    flight->linked = true;
+    flight->next = peci_flights;
+    peci_flights = flight;
+    pthread_mutex_unlock(&peci_coalesce_lock);
+
+    ret = peci_IssueGuarded(cmd, cmdPtr, peci_fd);
+
+    pthread_mutex_lock(&peci_coalesce_lock);
+    memcpy(flight->msg, cmdPtr, msgLen);
+    flight->ret = ret;
+    flight->done = true;
+    flight->done_ns = peci_now_ns();
+    // Only successful reads are reused after they complete
+    if (flight->linked &&
+        (ret != PECI_CC_SUCCESS || peci_coalesce_fresh_ns == 0 ||
+         !atomic_load_explicit(&peci_coalesce_on, memory_order_relaxed)))
+    {
+        struct peci_flight** link = &peci_flights;
+        while (*link != flight)
+        {
+            link = &(*link)->next;
+        }
+        peci_FlightUnlink(link);
+    }
+    peci_FlightRelease(flight);
+    pthread_cond_broadcast(&peci_coalesce_cond);
+    pthread_mutex_unlock(&peci_coalesce_lock);
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function issues peci commands to peci driver
+ *------------------------------------------------------------------------*/
+static EPECIStatus HW_peci_issue_cmd(unsigned int cmd, char* cmdPtr,
+                                     int peci_fd)
+{
+    EPECIStatus ret = PECI_CC_SUCCESS;
+    uint8_t key[8];
+    uint64_t device = 0;
+    uint32_t ttlMs = 0;
+
+    if (cmdPtr == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    bool cache = atomic_load_explicit(&peci_cache_on, memory_order_relaxed);
+    bool coalesce =
+        atomic_load_explicit(&peci_coalesce_on, memory_order_relaxed);
+    // Cached and shared results are only used for the same bus
+    if (cache || coalesce)
+    {
+        device = peci_DeviceOf(peci_fd);
+        cache = cache && device != 0;
+        coalesce = coalesce && device != 0;
+    }
+
+    if (cache && peci_CacheLookup(device, cmd, cmdPtr, &ttlMs))
+    {
+        return PECI_CC_SUCCESS;
+    }
+
+    if (coalesce && peci_CoalesceKey(cmd, cmdPtr, key))
+    {
+        ret = peci_IssueCoalesced(cmd, cmdPtr, peci_fd, key, device);
+    }
+    else
+    {
+        ret = peci_IssueGuarded(cmd, cmdPtr, peci_fd);
+    }
+
+    if (cache)
+    {
+        peci_CacheUpdate(device, cmd, cmdPtr, ret, ttlMs);
+    }
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * Find the specified PCI bus number value
+ *------------------------------------------------------------------------*/
+EPECIStatus FindBusNumber(uint8_t u8Bus, uint8_t u8Cpu, uint8_t* pu8BusValue)
+{
+    uint8_t u8CpuBus0[] = {
+        PECI_PCI_BUS0_CPU0,
+        PECI_PCI_BUS0_CPU1,
+    };
+    uint8_t u8Bus0 = 0;
+    uint8_t u8Offset = 0;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+    uint8_t u8Reg[4] = {0};
+    uint8_t cc = 0;
+
+    // First check for valid inputs
+    // Check cpu and bus numbers, only support buses [5:0]
+    if ((u8Bus > 5) || (u8Cpu >= (sizeof(u8CpuBus0) / sizeof(uint8_t))) ||
+        (pu8BusValue == NULL))
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // Get the Bus 0 value for the requested CPU
+    u8Bus0 = u8CpuBus0[u8Cpu];
+
+    // Next check that the bus numbers are valid
+    // CPUBUSNO_VALID register - Above registers valid? - B(0) D5 F0 offset
+    // D4h
+    ret = peci_RdPCIConfig(u8Cpu, u8Bus0, PECI_PCI_CPUBUSNO_DEV,
+                           PECI_PCI_CPUBUSNO_FUNC, PECI_PCI_CPUBUSNO_VALID,
+                           u8Reg, &cc);
+    if (ret != PECI_CC_SUCCESS)
+    {
+        return ret;
+    }
+    // BIOS will set bit 31 of CPUBUSNO_VALID when the bus numbers are valid
+    if ((u8Reg[3] & 0x80) == 0)
+    {
+        return PECI_CC_HW_ERR;
+    }
+
+    // Bus numbers are valid so read the correct offset for the requested
+    // bus CPUBUSNO register - CPU Internal Bus Numbers [3:0] - B(0) D5 F0
+    // offset CCh CPUBUSNO_1 register - CPU Internal Bus Numbers [5:4] -
+    // B(0) D5 F0 offset D0h
+    u8Offset = u8Bus <= 3 ? PECI_PCI_CPUBUSNO : PECI_PCI_CPUBUSNO_1;
+    ret = peci_RdPCIConfig(u8Cpu, u8Bus0, PECI_PCI_CPUBUSNO_DEV,
+                           PECI_PCI_CPUBUSNO_FUNC, u8Offset, u8Reg, &cc);
+    if (ret != PECI_CC_SUCCESS)
+    {
+        return ret;
+    }
+
+    // Now return the bus value for the requested bus
+    *pu8BusValue = u8Reg[u8Bus % 4];
+
+    // Unused bus numbers are set to zero which is only valid for bus 0
+    // so, return an error for any other bus set to zero
+    if (*pu8BusValue == 0 && u8Bus != 0)
+    {
+        return PECI_CC_CPU_NOT_PRESENT;
+    }
+
+    return PECI_CC_SUCCESS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function checks the CPU PECI interface
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_Ping(uint8_t target)
+{
+    int peci_fd = -1;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    ret = peci_Ping_seq(target, peci_fd);
+
+    peci_Close(peci_fd);
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function allows sequential Ping with the provided
+ * peci file descriptor.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_Ping_seq(uint8_t target, int peci_fd)
+{
+    EPECIStatus ret = PECI_CC_SUCCESS;
+    struct peci_ping_msg cmd = {0};
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    cmd.addr = target;
+    ret = HW_peci_issue_cmd(PECI_IOC_PING, (char*)&cmd, peci_fd);
+
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function gets PECI device information
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_GetDIB(uint8_t target, uint64_t* dib)
+{
+    int peci_fd = -1;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (dib == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    ret = peci_GetDIB_seq(target, dib, peci_fd);
+
+    peci_Close(peci_fd);
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function allows sequential GetDIB with the provided
+ * peci file descriptor.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_GetDIB_seq(uint8_t target, uint64_t* dib, int peci_fd)
+{
+    struct peci_get_dib_msg cmd = {0};
+    EPECIStatus ret = PECI_CC_SUCCESS;
+    cmd.addr = target;
+
+    if (dib == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    ret = HW_peci_issue_cmd(PECI_IOC_GET_DIB, (char*)&cmd, peci_fd);
+
+    if (ret == PECI_CC_SUCCESS)
+    {
+        *dib = cmd.dib;
+    }
+
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function get PECI Thermal temperature
+ * Expressed in signed fixed point value of 1/64 degrees celsius
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_GetTemp(uint8_t target, int16_t* temperature)
+{
+    int peci_fd = -1;
+
+    if (temperature == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+
+    EPECIStatus ret = peci_GetTemp_seq(target, temperature, peci_fd);
+
+    peci_Close(peci_fd);
+
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function allows sequential GetTemp with the provided
+ * peci file descriptor.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_GetTemp_seq(uint8_t target, int16_t* temperature,
+                             int peci_fd)
+{
+    struct peci_get_temp_msg cmd = {0};
+
+    if (temperature == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    cmd.addr = target;
+
+    EPECIStatus ret =
+        HW_peci_issue_cmd(PECI_IOC_GET_TEMP, (char*)&cmd, peci_fd);
+
+    if (ret == PECI_CC_SUCCESS)
+    {
+        *temperature = cmd.temp_raw;
+    }
+
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides read access to the package configuration
+ * space within the processor.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdPkgConfig(uint8_t target, uint8_t u8Index, uint16_t u16Value,
+                             uint8_t u8ReadLen, uint8_t* pPkgConfig,
+                             uint8_t* cc)
+{
+    //  Default to domain ID 0
+    return peci_RdPkgConfig_dom(target, 0, u8Index, u16Value, u8ReadLen,
+                                pPkgConfig, cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides read access to the package configuration
+ * space within the processor in the specified domain.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdPkgConfig_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8Index, uint16_t u16Value,
+    uint8_t u8ReadLen, uint8_t* pPkgConfig, uint8_t* cc)
+{
+    int peci_fd = -1;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (pPkgConfig == NULL || cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    ret = peci_RdPkgConfig_seq_dom(target, domainId, u8Index, u16Value,
+                                   u8ReadLen, pPkgConfig, peci_fd, cc);
+
+    peci_Close(peci_fd);
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function allows sequential RdPkgConfig with the provided
+ * peci file descriptor.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdPkgConfig_seq(uint8_t target, uint8_t u8Index,
+                                 uint16_t u16Value, uint8_t u8ReadLen,
+                                 uint8_t* pPkgConfig, int peci_fd, uint8_t* cc)
+{
+    //  Default to domain ID 0
+    return peci_RdPkgConfig_seq_dom(target, 0, u8Index, u16Value, u8ReadLen,
+                                    pPkgConfig, peci_fd, cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function allows sequential RdPkgConfig with the provided
+ * peci file descriptor in the specified domain.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdPkgConfig_seq_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8Index, uint16_t u16Value,
+    uint8_t u8ReadLen, uint8_t* pPkgConfig, int peci_fd, uint8_t* cc)
+{
+    struct peci_rd_pkg_cfg_msg cmd = {0};
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (pPkgConfig == NULL || cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // Per the PECI spec, the write length must be a byte, word, or dword
+    if (u8ReadLen != 1 && u8ReadLen != 2 && u8ReadLen != 4)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The PECI buffer must be large enough to hold the requested data
+    if (sizeof(cmd.pkg_config) < u8ReadLen)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    cmd.addr = target;
+    cmd.index = u8Index;  // RdPkgConfig index
+    cmd.param = u16Value; // Config parameter value
+    cmd.rx_len = u8ReadLen;
+    cmd.domain_id = domainId;
+
+    ret = HW_peci_issue_cmd(PECI_IOC_RD_PKG_CFG, (char*)&cmd, peci_fd);
+    *cc = cmd.cc;
+    if (ret == PECI_CC_SUCCESS)
+    {
+        memcpy(pPkgConfig, cmd.pkg_config, u8ReadLen);
+    }
+
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides write access to the package configuration
+ * space within the processor
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_WrPkgConfig(uint8_t target, uint8_t u8Index, uint16_t u16Param,
+                             uint32_t u32Value, uint8_t u8WriteLen, uint8_t* cc)
+{
+    //  Default to domain ID 0
+    return peci_WrPkgConfig_dom(target, 0, u8Index, u16Param, u32Value,
+                                u8WriteLen, cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides write access to the package configuration
+ * space within the processor in the specified domain
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_WrPkgConfig_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8Index, uint16_t u16Param,
+    uint32_t u32Value, uint8_t u8WriteLen, uint8_t* cc)
+{
+    int peci_fd = -1;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    ret = peci_WrPkgConfig_seq_dom(target, domainId, u8Index, u16Param,
+                                   u32Value, u8WriteLen, peci_fd, cc);
+
+    peci_Close(peci_fd);
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function allows sequential WrPkgConfig with the provided
+ * peci file descriptor.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_WrPkgConfig_seq(uint8_t target, uint8_t u8Index,
+                                 uint16_t u16Param, uint32_t u32Value,
+                                 uint8_t u8WriteLen, int peci_fd, uint8_t* cc)
+{
+    //  Default to domain ID 0
+    return peci_WrPkgConfig_seq_dom(target, 0, u8Index, u16Param, u32Value,
+                                    u8WriteLen, peci_fd, cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function allows sequential WrPkgConfig with the provided
+ * peci file descriptor in the specified domain.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_WrPkgConfig_seq_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8Index, uint16_t u16Param,
+    uint32_t u32Value, uint8_t u8WriteLen, int peci_fd, uint8_t* cc)
+{
+    struct peci_wr_pkg_cfg_msg cmd = {0};
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // Per the PECI spec, the write length must be a byte, word, or dword
+    if ((u8WriteLen != 1) && (u8WriteLen != 2) && (u8WriteLen != 4))
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    cmd.addr = target;
+    cmd.index = u8Index;  // RdPkgConfig index
+    cmd.param = u16Param; // parameter value
+    cmd.tx_len = u8WriteLen;
+    cmd.value = u32Value;
+    cmd.domain_id = domainId;
+
+    ret = HW_peci_issue_cmd(PECI_IOC_WR_PKG_CFG, (char*)&cmd, peci_fd);
+    *cc = cmd.cc;
+
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides read access to Model Specific Registers
+ * defined in the processor doc.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdIAMSR(uint8_t target, uint8_t threadID, uint16_t MSRAddress,
+                         uint64_t* u64MsrVal, uint8_t* cc)
+{
+    //  Default to domain ID 0
+    return peci_RdIAMSR_dom(target, 0, threadID, MSRAddress, u64MsrVal, cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides read access to Model Specific Registers
+ * defined in the processor doc in the specified domain.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdIAMSR_dom(uint8_t target, uint8_t domainId, uint8_t threadID,
+                             uint16_t MSRAddress, uint64_t* u64MsrVal,
+                             uint8_t* cc)
+{
+    int peci_fd = -1;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (u64MsrVal == NULL || cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    ret = peci_RdIAMSR_seq_dom(target, domainId, threadID, MSRAddress,
+                               u64MsrVal, peci_fd, cc);
+
+    peci_Close(peci_fd);
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function allows sequential RdIAMSR with the provided
+ * peci file descriptor in the specified domain.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdIAMSR_seq_dom(
+    uint8_t target, uint8_t domainId, uint8_t threadID, uint16_t MSRAddress,
+    uint64_t* u64MsrVal, int peci_fd, uint8_t* cc)
+{
+    struct peci_rd_ia_msr_msg cmd = {0};
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (u64MsrVal == NULL || cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    cmd.addr = target;
+    cmd.thread_id = threadID; // request byte for thread ID
+    cmd.address = MSRAddress; // MSR Address
+    cmd.domain_id = domainId;
+
+    ret = HW_peci_issue_cmd(PECI_IOC_RD_IA_MSR, (char*)&cmd, peci_fd);
+    *cc = cmd.cc;
+    if (ret == PECI_CC_SUCCESS)
+    {
+        *u64MsrVal = cmd.value;
+    }
+
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides read access to the PCI configuration space at
+ * the requested PCI configuration address.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdPCIConfig(uint8_t target, uint8_t u8Bus, uint8_t u8Device,
+                             uint8_t u8Fcn, uint16_t u16Reg, uint8_t* pPCIData,
+                             uint8_t* cc)
+{
+    //  Default to domain ID 0
+    return peci_RdPCIConfig_dom(target, 0, u8Bus, u8Device, u8Fcn, u16Reg,
+                                pPCIData, cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides read access to the PCI configuration space at
+ * the requested PCI configuration address in the specified domain.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdPCIConfig_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8Bus, uint8_t u8Device,
+    uint8_t u8Fcn, uint16_t u16Reg, uint8_t* pPCIData, uint8_t* cc)
+{
+    int peci_fd = -1;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (pPCIData == NULL || cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    ret = peci_RdPCIConfig_seq_dom(target, domainId, u8Bus, u8Device, u8Fcn,
+                                   u16Reg, pPCIData, peci_fd, cc);
+
+    peci_Close(peci_fd);
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function allows sequential RdPCIConfig with the provided
+ * peci file descriptor.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdPCIConfig_seq(
+    uint8_t target, uint8_t u8Bus, uint8_t u8Device, uint8_t u8Fcn,
+    uint16_t u16Reg, uint8_t* pPCIData, int peci_fd, uint8_t* cc)
+{
+    //  Default to domain ID 0
+    return peci_RdPCIConfig_seq_dom(target, 0, u8Bus, u8Device, u8Fcn, u16Reg,
+                                    pPCIData, peci_fd, cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function allows sequential RdPCIConfig with the provided
+ * peci file descriptor in the specified domain.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdPCIConfig_seq_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8Bus, uint8_t u8Device,
+    uint8_t u8Fcn, uint16_t u16Reg, uint8_t* pPCIData, int peci_fd, uint8_t* cc)
+{
+    struct peci_rd_pci_cfg_msg cmd = {0};
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (pPCIData == NULL || cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The PECI buffer must be large enough to hold the PCI data
+    if (sizeof(cmd.pci_config) < 4)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    cmd.addr = target;
+    cmd.bus = u8Bus;
+    cmd.device = u8Device;
+    cmd.function = u8Fcn;
+    cmd.reg = u16Reg;
+    cmd.domain_id = domainId;
+
+    ret = HW_peci_issue_cmd(PECI_IOC_RD_PCI_CFG, (char*)&cmd, peci_fd);
+    *cc = cmd.cc;
+
+    if (ret == PECI_CC_SUCCESS)
+    {
+        memcpy(pPCIData, cmd.pci_config, 4);
+    }
+
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides read access to the local PCI configuration space
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdPCIConfigLocal(
+    uint8_t target, uint8_t u8Bus, uint8_t u8Device, uint8_t u8Fcn,
+    uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIReg, uint8_t* cc)
+{
+    //  Default to domain ID 0
+    return peci_RdPCIConfigLocal_dom(target, 0, u8Bus, u8Device, u8Fcn, u16Reg,
+                                     u8ReadLen, pPCIReg, cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides read access to the local PCI configuration space in
+ * the specified domain
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdPCIConfigLocal_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8Bus, uint8_t u8Device,
+    uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIReg,
+    uint8_t* cc)
+{
+    int peci_fd = -1;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (pPCIReg == NULL || cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    ret =
+        peci_RdPCIConfigLocal_seq_dom(target, domainId, u8Bus, u8Device, u8Fcn,
+                                      u16Reg, u8ReadLen, pPCIReg, peci_fd, cc);
+
+    peci_Close(peci_fd);
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function allows sequential RdPCIConfigLocal with the provided
+ * peci file descriptor.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdPCIConfigLocal_seq(
+    uint8_t target, uint8_t u8Bus, uint8_t u8Device, uint8_t u8Fcn,
+    uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIReg, int peci_fd,
+    uint8_t* cc)
+{
+    //  Default to domain ID 0
+    return peci_RdPCIConfigLocal_seq_dom(
+        target, 0, u8Bus, u8Device, u8Fcn, u16Reg, u8ReadLen, pPCIReg, peci_fd,
+        cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function allows sequential RdPCIConfigLocal with the provided
+ * peci file descriptor in the specified domain.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdPCIConfigLocal_seq_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8Bus, uint8_t u8Device,
+    uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIReg,
+    int peci_fd, uint8_t* cc)
+{
+    struct peci_rd_pci_cfg_local_msg cmd = {0};
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (pPCIReg == NULL || cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // Per the PECI spec, the read length must be a byte, word, or dword
+    if (u8ReadLen != 1 && u8ReadLen != 2 && u8ReadLen != 4)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The PECI buffer must be large enough to hold the requested data
+    if (sizeof(cmd.pci_config) < u8ReadLen)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    cmd.addr = target;
+    cmd.bus = u8Bus;
+    cmd.device = u8Device;
+    cmd.function = u8Fcn;
+    cmd.reg = u16Reg;
+    cmd.rx_len = u8ReadLen;
+    cmd.domain_id = domainId;
+
+    ret = HW_peci_issue_cmd(PECI_IOC_RD_PCI_CFG_LOCAL, (char*)&cmd, peci_fd);
+    *cc = cmd.cc;
+
+    if (ret == PECI_CC_SUCCESS)
+    {
+        memcpy(pPCIReg, cmd.pci_config, u8ReadLen);
+    }
+
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides write access to the local PCI configuration space
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_WrPCIConfigLocal(
+    uint8_t target, uint8_t u8Bus, uint8_t u8Device, uint8_t u8Fcn,
+    uint16_t u16Reg, uint8_t DataLen, uint32_t DataVal, uint8_t* cc)
+{
+    //  Default to domain ID 0
+    return peci_WrPCIConfigLocal_dom(target, 0, u8Bus, u8Device, u8Fcn, u16Reg,
+                                     DataLen, DataVal, cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides write access to the local PCI configuration space in
+ * the specified domain
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_WrPCIConfigLocal_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8Bus, uint8_t u8Device,
+    uint8_t u8Fcn, uint16_t u16Reg, uint8_t DataLen, uint32_t DataVal,
+    uint8_t* cc)
+{
+    int peci_fd = -1;
+    struct peci_wr_pci_cfg_local_msg cmd = {0};
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+
+    // Per the PECI spec, the write length must be a byte, word, or dword
+    if (DataLen != 1 && DataLen != 2 && DataLen != 4)
+    {
+        peci_Close(peci_fd);
+        return PECI_CC_INVALID_REQ;
+    }
+
+    cmd.addr = target;
+    cmd.bus = u8Bus;
+    cmd.device = u8Device;
+    cmd.function = u8Fcn;
+    cmd.reg = u16Reg;
+    cmd.tx_len = DataLen;
+    cmd.value = DataVal;
+    cmd.domain_id = domainId;
+
+    ret = HW_peci_issue_cmd(PECI_IOC_WR_PCI_CFG_LOCAL, (char*)&cmd, peci_fd);
+    *cc = cmd.cc;
+
+    peci_Close(peci_fd);
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This internal function is the common interface for RdEndPointConfig to PCI in
+ * the specified domain
+ *------------------------------------------------------------------------*/
+static EPECIStatus peci_RdEndPointConfigPciCommon_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8MsgType, uint8_t u8Seg,
+    uint8_t u8Bus, uint8_t u8Device, uint8_t u8Fcn, uint16_t u16Reg,
+    uint8_t u8ReadLen, uint8_t* pPCIData, int peci_fd, uint8_t* cc)
+{
+    struct peci_rd_end_pt_cfg_msg cmd = {0};
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (pPCIData == NULL || cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The PECI buffer must be large enough to hold the requested data
+    if (sizeof(cmd.data) < u8ReadLen)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    cmd.addr = target;
+    cmd.msg_type = u8MsgType;
+    cmd.params.pci_cfg.seg = u8Seg;
+    cmd.params.pci_cfg.bus = u8Bus;
+    cmd.params.pci_cfg.device = u8Device;
+    cmd.params.pci_cfg.function = u8Fcn;
+    cmd.params.pci_cfg.reg = u16Reg;
+    cmd.rx_len = u8ReadLen;
+    cmd.domain_id = domainId;
+
+    ret = HW_peci_issue_cmd(PECI_IOC_RD_END_PT_CFG, (char*)&cmd, peci_fd);
+    *cc = cmd.cc;
+
+    if (ret == PECI_CC_SUCCESS)
+    {
+        memcpy(pPCIData, cmd.data, u8ReadLen);
+    }
+    else
+    {
+        ret = PECI_CC_DRIVER_ERR;
+    }
+
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides read access to the PCI configuration space at
+ * the requested PCI configuration address.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdEndPointConfigPci(
+    uint8_t target, uint8_t u8Seg, uint8_t u8Bus, uint8_t u8Device,
+    uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIData,
+    uint8_t* cc)
+{
+    //  Default to domain ID 0
+    return peci_RdEndPointConfigPci_dom(target, 0, u8Seg, u8Bus, u8Device,
+                                        u8Fcn, u16Reg, u8ReadLen, pPCIData, cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides read access to the PCI configuration space at
+ * the requested PCI configuration address in the specified domain.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdEndPointConfigPci_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8Seg, uint8_t u8Bus,
+    uint8_t u8Device, uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen,
+    uint8_t* pPCIData, uint8_t* cc)
+{
+    int peci_fd = -1;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (pPCIData == NULL || cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    ret = peci_RdEndPointConfigPci_seq_dom(
+        target, domainId, u8Seg, u8Bus, u8Device, u8Fcn, u16Reg, u8ReadLen,
+        pPCIData, peci_fd, cc);
+    peci_Close(peci_fd);
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function allows sequential RdEndPointConfig to PCI with the provided
+ * peci file descriptor.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdEndPointConfigPci_seq(
+    uint8_t target, uint8_t u8Seg, uint8_t u8Bus, uint8_t u8Device,
+    uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIData,
+    int peci_fd, uint8_t* cc)
+{
+    //  Default to domain ID 0
+    return peci_RdEndPointConfigPci_seq_dom(
+        target, 0, u8Seg, u8Bus, u8Device, u8Fcn, u16Reg, u8ReadLen, pPCIData,
+        peci_fd, cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function allows sequential RdEndPointConfig to PCI with the provided
+ * peci file descriptor in the specified domain.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdEndPointConfigPci_seq_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8Seg, uint8_t u8Bus,
+    uint8_t u8Device, uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen,
+    uint8_t* pPCIData, int peci_fd, uint8_t* cc)
+{
+    if (pPCIData == NULL || cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // Per the PECI spec, the read length must be a byte, word, or dword
+    if (u8ReadLen != 1 && u8ReadLen != 2 && u8ReadLen != 4)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    return peci_RdEndPointConfigPciCommon_dom(
+        target, domainId, PECI_ENDPTCFG_TYPE_PCI, u8Seg, u8Bus, u8Device, u8Fcn,
+        u16Reg, u8ReadLen, pPCIData, peci_fd, cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides read access to the Local PCI configuration space at
+ * the requested PCI configuration address.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdEndPointConfigPciLocal(
+    uint8_t target, uint8_t u8Seg, uint8_t u8Bus, uint8_t u8Device,
+    uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIData,
+    uint8_t* cc)
+{
+    //  Default to domain ID 0
+    return peci_RdEndPointConfigPciLocal_dom(
+        target, 0, u8Seg, u8Bus, u8Device, u8Fcn, u16Reg, u8ReadLen, pPCIData,
+        cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides read access to the Local PCI configuration space at
+ * the requested PCI configuration address in the specified domain.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdEndPointConfigPciLocal_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8Seg, uint8_t u8Bus,
+    uint8_t u8Device, uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen,
+    uint8_t* pPCIData, uint8_t* cc)
+{
+    int peci_fd = -1;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (pPCIData == NULL || cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    ret = peci_RdEndPointConfigPciLocal_seq_dom(
+        target, domainId, u8Seg, u8Bus, u8Device, u8Fcn, u16Reg, u8ReadLen,
+        pPCIData, peci_fd, cc);
+    peci_Close(peci_fd);
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function allows sequential RdEndPointConfig to PCI Local with the
+ * provided peci file descriptor.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdEndPointConfigPciLocal_seq(
+    uint8_t target, uint8_t u8Seg, uint8_t u8Bus, uint8_t u8Device,
+    uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIData,
+    int peci_fd, uint8_t* cc)
+{
+    //  Default to domain ID 0
+    return peci_RdEndPointConfigPciLocal_seq_dom(
+        target, 0, u8Seg, u8Bus, u8Device, u8Fcn, u16Reg, u8ReadLen, pPCIData,
+        peci_fd, cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function allows sequential RdEndPointConfig to PCI Local with the
+ * provided peci file descriptor in the specified domain.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdEndPointConfigPciLocal_seq_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8Seg, uint8_t u8Bus,
+    uint8_t u8Device, uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen,
+    uint8_t* pPCIData, int peci_fd, uint8_t* cc)
+{
+    if (pPCIData == NULL || cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // Per the PECI spec, the read length must be a byte, word, or dword
+    if (u8ReadLen != 1 && u8ReadLen != 2 && u8ReadLen != 4)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    return peci_RdEndPointConfigPciCommon_dom(
+        target, domainId, PECI_ENDPTCFG_TYPE_LOCAL_PCI, u8Seg, u8Bus, u8Device,
+        u8Fcn, u16Reg, u8ReadLen, pPCIData, peci_fd, cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides read access to PCI MMIO space at
+ * the requested PCI configuration address.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdEndPointConfigMmio(
+    uint8_t target, uint8_t u8Seg, uint8_t u8Bus, uint8_t u8Device,
+    uint8_t u8Fcn, uint8_t u8Bar, uint8_t u8AddrType, uint64_t u64Offset,
+    uint8_t u8ReadLen, uint8_t* pMmioData, uint8_t* cc)
+{
+    //  Default to domain ID 0
+    return peci_RdEndPointConfigMmio_dom(
+        target, 0, u8Seg, u8Bus, u8Device, u8Fcn, u8Bar, u8AddrType, u64Offset,
+        u8ReadLen, pMmioData, cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides read access to PCI MMIO space at
+ * the requested PCI configuration address in the specified domain.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdEndPointConfigMmio_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8Seg, uint8_t u8Bus,
+    uint8_t u8Device, uint8_t u8Fcn, uint8_t u8Bar, uint8_t u8AddrType,
+    uint64_t u64Offset, uint8_t u8ReadLen, uint8_t* pMmioData, uint8_t* cc)
+{
+    int peci_fd = -1;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (pMmioData == NULL || cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    ret = peci_RdEndPointConfigMmio_seq_dom(
+        target, domainId, u8Seg, u8Bus, u8Device, u8Fcn, u8Bar, u8AddrType,
+        u64Offset, u8ReadLen, pMmioData, peci_fd, cc);
+    peci_Close(peci_fd);
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function allows sequential RdEndPointConfig to PCI MMIO with the
+ * provided peci file descriptor.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdEndPointConfigMmio_seq(
+    uint8_t target, uint8_t u8Seg, uint8_t u8Bus, uint8_t u8Device,
+    uint8_t u8Fcn, uint8_t u8Bar, uint8_t u8AddrType, uint64_t u64Offset,
+    uint8_t u8ReadLen, uint8_t* pMmioData, int peci_fd, uint8_t* cc)
+{
+    //  Default to domain ID 0
+    return peci_RdEndPointConfigMmio_seq_dom(
+        target, 0, u8Seg, u8Bus, u8Device, u8Fcn, u8Bar, u8AddrType, u64Offset,
+        u8ReadLen, pMmioData, peci_fd, cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function allows sequential RdEndPointConfig to PCI MMIO with the
+ * provided peci file descriptor in the specified domain.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RdEndPointConfigMmio_seq_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8Seg, uint8_t u8Bus,
+    uint8_t u8Device, uint8_t u8Fcn, uint8_t u8Bar, uint8_t u8AddrType,
+    uint64_t u64Offset, uint8_t u8ReadLen, uint8_t* pMmioData, int peci_fd,
+    uint8_t* cc)
+{
+    struct peci_rd_end_pt_cfg_msg cmd = {0};
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (pMmioData == NULL || cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // Per the PECI spec, the read length must be a byte, word, dword, or qword
+    if (u8ReadLen != 1 && u8ReadLen != 2 && u8ReadLen != 4 && u8ReadLen != 8)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The PECI buffer must be large enough to hold the requested data
+    if (sizeof(cmd.data) < u8ReadLen)
+    {
+        return PECI_CC_INVALID_REQ;
     }
 
     cmd.addr = target;
-    cmd.index = u8Index;  // RdPkgConfig index
-    cmd.param = u16Param; // parameter value
-    cmd.tx_len = u8WriteLen;
-    cmd.value = u32Value;
+    cmd.msg_type = PECI_ENDPTCFG_TYPE_MMIO;
+    cmd.params.mmio.seg = u8Seg;
+    cmd.params.mmio.bus = u8Bus;
+    cmd.params.mmio.device = u8Device;
+    cmd.params.mmio.function = u8Fcn;
+    cmd.params.mmio.bar = u8Bar;
+    cmd.params.mmio.addr_type = u8AddrType;
+    cmd.params.mmio.offset = u64Offset;
+    cmd.rx_len = u8ReadLen;
     cmd.domain_id = domainId;
 
-    ret = HW_peci_issue_cmd(PECI_IOC_WR_PKG_CFG, (char*)&cmd, peci_fd);
+    ret = HW_peci_issue_cmd(PECI_IOC_RD_END_PT_CFG, (char*)&cmd, peci_fd);
     *cc = cmd.cc;
 
+    if (ret == PECI_CC_SUCCESS)
+    {
+        memcpy(pMmioData, cmd.data, u8ReadLen);
+    }
+    else
+    {
+        ret = PECI_CC_DRIVER_ERR;
+    }
+
     return ret;
 }
 
 /*-------------------------------------------------------------------------
- * This function provides read access to Model Specific Registers
- * defined in the processor doc.
+ * This function allows sequential peci_WrEndPointConfig to PCI EndPoint with
+ * the provided peci file descriptor.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdIAMSR(uint8_t target, uint8_t threadID, uint16_t MSRAddress,
-                         uint64_t* u64MsrVal, uint8_t* cc)
+EPECIStatus peci_WrEndPointConfig_seq(
+    uint8_t target, uint8_t u8MsgType, uint8_t u8Seg, uint8_t u8Bus,
+    uint8_t u8Device, uint8_t u8Fcn, uint16_t u16Reg, uint8_t DataLen,
+    uint32_t DataVal, int peci_fd, uint8_t* cc)
 {
     //  Default to domain ID 0
-    return peci_RdIAMSR_dom(target, 0, threadID, MSRAddress, u64MsrVal, cc);
+    return peci_WrEndPointConfig_seq_dom(
+        target, 0, u8MsgType, u8Seg, u8Bus, u8Device, u8Fcn, u16Reg, DataLen,
+        DataVal, peci_fd, cc);
 }
 
 /*-------------------------------------------------------------------------
- * This function provides read access to Model Specific Registers
- * defined in the processor doc in the specified domain.
+ * This function allows sequential peci_WrEndPointConfig to PCI EndPoint with
+ * the provided peci file descriptor in the specified domain.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdIAMSR_dom(uint8_t target, uint8_t domainId, uint8_t threadID,
-                             uint16_t MSRAddress, uint64_t* u64MsrVal,
-                             uint8_t* cc)
+EPECIStatus peci_WrEndPointConfig_seq_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8MsgType, uint8_t u8Seg,
+    uint8_t u8Bus, uint8_t u8Device, uint8_t u8Fcn, uint16_t u16Reg,
+    uint8_t DataLen, uint32_t DataVal, int peci_fd, uint8_t* cc)
 {
-    int peci_fd = -1;
-    struct peci_rd_ia_msr_msg cmd = {0};
+    struct peci_wr_end_pt_cfg_msg cmd = {0};
     EPECIStatus ret = PECI_CC_SUCCESS;
 
-    if (u64MsrVal == NULL || cc == NULL)
+    if (cc == NULL)
     {
         return PECI_CC_INVALID_REQ;
     }
@@ -632,52 +2623,130 @@ EPECIStatus peci_RdIAMSR_dom(uint8_t target, uint8_t domainId, uint8_t threadID,
         return PECI_CC_INVALID_REQ;
     }
 
+    // Per the PECI spec, the write length must be a byte, word, or dword
+    if (DataLen != 1 && DataLen != 2 && DataLen != 4)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    cmd.addr = target;
+    cmd.msg_type = u8MsgType;
+    cmd.params.pci_cfg.seg = u8Seg;
+    cmd.params.pci_cfg.bus = u8Bus;
+    cmd.params.pci_cfg.device = u8Device;
+    cmd.params.pci_cfg.function = u8Fcn;
+    cmd.params.pci_cfg.reg = u16Reg;
+    cmd.tx_len = DataLen;
+    cmd.value = DataVal;
+    cmd.domain_id = domainId;
+
+    ret = HW_peci_issue_cmd(PECI_IOC_WR_END_PT_CFG, (char*)&cmd, peci_fd);
+    *cc = cmd.cc;
+
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides write access to the EP local PCI configuration space
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_WrEndPointPCIConfigLocal(
+    uint8_t target, uint8_t u8Seg, uint8_t u8Bus, uint8_t u8Device,
+    uint8_t u8Fcn, uint16_t u16Reg, uint8_t DataLen, uint32_t DataVal,
+    uint8_t* cc)
+{
+    //  Default to domain ID 0
+    return peci_WrEndPointPCIConfigLocal_dom(
+        target, 0, u8Seg, u8Bus, u8Device, u8Fcn, u16Reg, DataLen, DataVal, cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides write access to the EP local PCI configuration space
+ * in the specified domain
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_WrEndPointPCIConfigLocal_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8Seg, uint8_t u8Bus,
+    uint8_t u8Device, uint8_t u8Fcn, uint16_t u16Reg, uint8_t DataLen,
+    uint32_t DataVal, uint8_t* cc)
+{
+    int peci_fd = -1;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+
+    ret = peci_WrEndPointConfig_seq_dom(
+        target, domainId, PECI_ENDPTCFG_TYPE_LOCAL_PCI, u8Seg, u8Bus, u8Device,
+        u8Fcn, u16Reg, DataLen, DataVal, peci_fd, cc);
+    peci_Close(peci_fd);
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides write access to the EP local PCI configuration space
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_WrEndPointPCIConfig(
+    uint8_t target, uint8_t u8Seg, uint8_t u8Bus, uint8_t u8Device,
+    uint8_t u8Fcn, uint16_t u16Reg, uint8_t DataLen, uint32_t DataVal,
+    uint8_t* cc)
+{
+    //  Default to domain ID 0
+    return peci_WrEndPointPCIConfig_dom(target, 0, u8Seg, u8Bus, u8Device,
+                                        u8Fcn, u16Reg, DataLen, DataVal, cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function provides write access to the EP local PCI configuration space
+ * in the specified domain
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_WrEndPointPCIConfig_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8Seg, uint8_t u8Bus,
+    uint8_t u8Device, uint8_t u8Fcn, uint16_t u16Reg, uint8_t DataLen,
+    uint32_t DataVal, uint8_t* cc)
+{
+    int peci_fd = -1;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
     if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
     {
         return PECI_CC_DRIVER_ERR;
     }
-
-    cmd.addr = target;
-    cmd.thread_id = threadID; // request byte for thread ID
-    cmd.address = MSRAddress; // MSR Address
-    cmd.domain_id = domainId;
-
-    ret = HW_peci_issue_cmd(PECI_IOC_RD_IA_MSR, (char*)&cmd, peci_fd);
-    *cc = cmd.cc;
-    if (ret == PECI_CC_SUCCESS)
-    {
-        *u64MsrVal = cmd.value;
-    }
-
+    ret = peci_WrEndPointConfig_seq_dom(
+        target, domainId, PECI_ENDPTCFG_TYPE_PCI, u8Seg, u8Bus, u8Device, u8Fcn,
+        u16Reg, DataLen, DataVal, peci_fd, cc);
     peci_Close(peci_fd);
     return ret;
 }
 
 /*-------------------------------------------------------------------------
- * This function provides read access to the PCI configuration space at
+ * This function provides write access to PCI MMIO space at
  * the requested PCI configuration address.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdPCIConfig(uint8_t target, uint8_t u8Bus, uint8_t u8Device,
-                             uint8_t u8Fcn, uint16_t u16Reg, uint8_t* pPCIData,
-                             uint8_t* cc)
+EPECIStatus peci_WrEndPointConfigMmio(
+    uint8_t target, uint8_t u8Seg, uint8_t u8Bus, uint8_t u8Device,
+    uint8_t u8Fcn, uint8_t u8Bar, uint8_t u8AddrType, uint64_t u64Offset,
+    uint8_t u8DataLen, uint64_t u64DataVal, uint8_t* cc)
 {
     //  Default to domain ID 0
-    return peci_RdPCIConfig_dom(target, 0, u8Bus, u8Device, u8Fcn, u16Reg,
-                                pPCIData, cc);
+    return peci_WrEndPointConfigMmio_dom(
+        target, 0, u8Seg, u8Bus, u8Device, u8Fcn, u8Bar, u8AddrType, u64Offset,
+        u8DataLen, u64DataVal, cc);
 }
 
 /*-------------------------------------------------------------------------
- * This function provides read access to the PCI configuration space at
+ * This function provides write access to PCI MMIO space at
  * the requested PCI configuration address in the specified domain.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdPCIConfig_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8Bus, uint8_t u8Device,
-    uint8_t u8Fcn, uint16_t u16Reg, uint8_t* pPCIData, uint8_t* cc)
+EPECIStatus peci_WrEndPointConfigMmio_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8Seg, uint8_t u8Bus,
+    uint8_t u8Device, uint8_t u8Fcn, uint8_t u8Bar, uint8_t u8AddrType,
+    uint64_t u64Offset, uint8_t u8DataLen, uint64_t u64DataVal, uint8_t* cc)
 {
     int peci_fd = -1;
     EPECIStatus ret = PECI_CC_SUCCESS;
 
-    if (pPCIData == NULL || cc == NULL)
+    if (cc == NULL)
     {
         return PECI_CC_INVALID_REQ;
     }
@@ -692,38 +2761,42 @@ EPECIStatus peci_RdPCIConfig_dom(
     {
         return PECI_CC_DRIVER_ERR;
     }
-    ret = peci_RdPCIConfig_seq_dom(target, domainId, u8Bus, u8Device, u8Fcn,
-                                   u16Reg, pPCIData, peci_fd, cc);
-
+    ret = peci_WrEndPointConfigMmio_seq_dom(
+        target, domainId, u8Seg, u8Bus, u8Device, u8Fcn, u8Bar, u8AddrType,
+        u64Offset, u8DataLen, u64DataVal, peci_fd, cc);
     peci_Close(peci_fd);
     return ret;
 }
 
 /*-------------------------------------------------------------------------
- * This function allows sequential RdPCIConfig with the provided
- * peci file descriptor.
+ * This function allows sequential WrEndPointConfig to PCI MMIO with the
+ * provided peci file descriptor.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdPCIConfig_seq(
-    uint8_t target, uint8_t u8Bus, uint8_t u8Device, uint8_t u8Fcn,
-    uint16_t u16Reg, uint8_t* pPCIData, int peci_fd, uint8_t* cc)
+EPECIStatus peci_WrEndPointConfigMmio_seq(
+    uint8_t target, uint8_t u8Seg, uint8_t u8Bus, uint8_t u8Device,
+    uint8_t u8Fcn, uint8_t u8Bar, uint8_t u8AddrType, uint64_t u64Offset,
+    uint8_t u8DataLen, uint64_t u64DataVal, int peci_fd, uint8_t* cc)
 {
     //  Default to domain ID 0
-    return peci_RdPCIConfig_seq_dom(target, 0, u8Bus, u8Device, u8Fcn, u16Reg,
-                                    pPCIData, peci_fd, cc);
+    return peci_WrEndPointConfigMmio_seq_dom(
+        target, 0, u8Seg, u8Bus, u8Device, u8Fcn, u8Bar, u8AddrType, u64Offset,
+        u8DataLen, u64DataVal, peci_fd, cc);
 }
 
 /*-------------------------------------------------------------------------
- * This function allows sequential RdPCIConfig with the provided
- * peci file descriptor in the specified domain.
+ * This function allows sequential WrEndPointConfig to PCI MMIO with the
+ * provided peci file descriptor in the specified domain.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdPCIConfig_seq_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8Bus, uint8_t u8Device,
-    uint8_t u8Fcn, uint16_t u16Reg, uint8_t* pPCIData, int peci_fd, uint8_t* cc)
+EPECIStatus peci_WrEndPointConfigMmio_seq_dom(
+    uint8_t target, uint8_t domainId, uint8_t u8Seg, uint8_t u8Bus,
+    uint8_t u8Device, uint8_t u8Fcn, uint8_t u8Bar, uint8_t u8AddrType,
+    uint64_t u64Offset, uint8_t u8DataLen, uint64_t u64DataVal, int peci_fd,
+    uint8_t* cc)
 {
-    struct peci_rd_pci_cfg_msg cmd = {0};
+    struct peci_wr_end_pt_cfg_msg cmd = {0};
     EPECIStatus ret = PECI_CC_SUCCESS;
 
-    if (pPCIData == NULL || cc == NULL)
+    if (cc == NULL)
     {
         return PECI_CC_INVALID_REQ;
     }
@@ -734,55 +2807,56 @@ EPECIStatus peci_RdPCIConfig_seq_dom(
         return PECI_CC_INVALID_REQ;
     }
 
-    // The PECI buffer must be large enough to hold the PCI data
-    if (sizeof(cmd.pci_config) < 4)
+    // Per the PECI spec, the read length must be a byte, word, dword, or qword
+    if (u8DataLen != 1 && u8DataLen != 2 && u8DataLen != 4 && u8DataLen != 8)
     {
         return PECI_CC_INVALID_REQ;
     }
 
     cmd.addr = target;
-    cmd.bus = u8Bus;
-    cmd.device = u8Device;
-    cmd.function = u8Fcn;
-    cmd.reg = u16Reg;
+    cmd.msg_type = PECI_ENDPTCFG_TYPE_MMIO;
+    cmd.params.mmio.seg = u8Seg;
+    cmd.params.mmio.bus = u8Bus;
+    cmd.params.mmio.device = u8Device;
+    cmd.params.mmio.function = u8Fcn;
+    cmd.params.mmio.bar = u8Bar;
+    cmd.params.mmio.addr_type = u8AddrType;
+    cmd.params.mmio.offset = u64Offset;
+    cmd.tx_len = u8DataLen;
+    cmd.value = u64DataVal;
     cmd.domain_id = domainId;
 
-    ret = HW_peci_issue_cmd(PECI_IOC_RD_PCI_CFG, (char*)&cmd, peci_fd);
+    ret = HW_peci_issue_cmd(PECI_IOC_WR_END_PT_CFG, (char*)&cmd, peci_fd);
     *cc = cmd.cc;
 
-    if (ret == PECI_CC_SUCCESS)
-    {
-        memcpy(pPCIData, cmd.pci_config, 4);
-    }
-
     return ret;
 }
 
 /*-------------------------------------------------------------------------
- * This function provides read access to the local PCI configuration space
+ * This function provides crashdump discovery data over PECI
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdPCIConfigLocal(
-    uint8_t target, uint8_t u8Bus, uint8_t u8Device, uint8_t u8Fcn,
-    uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIReg, uint8_t* cc)
+EPECIStatus peci_CrashDump_Discovery(
+    uint8_t target, uint8_t subopcode, uint8_t param0, uint16_t param1,
+    uint8_t param2, uint8_t u8ReadLen, uint8_t* pData, uint8_t* cc)
 {
     //  Default to domain ID 0
-    return peci_RdPCIConfigLocal_dom(target, 0, u8Bus, u8Device, u8Fcn, u16Reg,
-                                     u8ReadLen, pPCIReg, cc);
+    return peci_CrashDump_Discovery_dom(target, 0, subopcode, param0, param1,
+                                        param2, u8ReadLen, pData, cc);
 }
 
 /*-------------------------------------------------------------------------
- * This function provides read access to the local PCI configuration space in
- * the specified domain
+ * This function provides crashdump discovery data over PECI in the specified
+ * domain
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdPCIConfigLocal_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8Bus, uint8_t u8Device,
-    uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIReg,
+EPECIStatus peci_CrashDump_Discovery_dom(
+    uint8_t target, uint8_t domainId, uint8_t subopcode, uint8_t param0,
+    uint16_t param1, uint8_t param2, uint8_t u8ReadLen, uint8_t* pData,
     uint8_t* cc)
 {
     int peci_fd = -1;
     EPECIStatus ret = PECI_CC_SUCCESS;
 
-    if (pPCIReg == NULL || cc == NULL)
+    if (pData == NULL || cc == NULL)
     {
         return PECI_CC_INVALID_REQ;
     }
@@ -793,46 +2867,37 @@ EPECIStatus peci_RdPCIConfigLocal_dom(
         return PECI_CC_INVALID_REQ;
     }
 
+    // Per the PECI spec, the read length must be a byte, word, or qword
+    if (u8ReadLen != 1 && u8ReadLen != 2 && u8ReadLen != 8)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
     if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
     {
         return PECI_CC_DRIVER_ERR;
     }
-    ret =
-        peci_RdPCIConfigLocal_seq_dom(target, domainId, u8Bus, u8Device, u8Fcn,
-                                      u16Reg, u8ReadLen, pPCIReg, peci_fd, cc);
+    ret = peci_CrashDump_Discovery_seq_dom(target, domainId, subopcode,
+                                           param0, param1, param2, u8ReadLen,
+                                           pData, peci_fd, cc);
 
     peci_Close(peci_fd);
     return ret;
 }
 
 /*-------------------------------------------------------------------------
- * This function allows sequential RdPCIConfigLocal with the provided
- * peci file descriptor.
- *------------------------------------------------------------------------*/
-EPECIStatus peci_RdPCIConfigLocal_seq(
-    uint8_t target, uint8_t u8Bus, uint8_t u8Device, uint8_t u8Fcn,
-    uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIReg, int peci_fd,
-    uint8_t* cc)
-{
-    //  Default to domain ID 0
-    return peci_RdPCIConfigLocal_seq_dom(
-        target, 0, u8Bus, u8Device, u8Fcn, u16Reg, u8ReadLen, pPCIReg, peci_fd,
-        cc);
-}
-
-/*-------------------------------------------------------------------------
- * This function allows sequential RdPCIConfigLocal with the provided
- * peci file descriptor in the specified domain.
+ * This function allows sequential crashdump discovery with the provided
+ * peci file descriptor in the specified domain
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdPCIConfigLocal_seq_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8Bus, uint8_t u8Device,
-    uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIReg,
+EPECIStatus peci_CrashDump_Discovery_seq_dom(
+    uint8_t target, uint8_t domainId, uint8_t subopcode, uint8_t param0,
+    uint16_t param1, uint8_t param2, uint8_t u8ReadLen, uint8_t* pData,
     int peci_fd, uint8_t* cc)
 {
-    struct peci_rd_pci_cfg_local_msg cmd = {0};
+    struct peci_crashdump_disc_msg cmd = {0};
     EPECIStatus ret = PECI_CC_SUCCESS;
 
-    if (pPCIReg == NULL || cc == NULL)
+    if (pData == NULL || cc == NULL)
     {
         return PECI_CC_INVALID_REQ;
     }
@@ -843,63 +2908,64 @@ EPECIStatus peci_RdPCIConfigLocal_seq_dom(
         return PECI_CC_INVALID_REQ;
     }
 
-    // Per the PECI spec, the read length must be a byte, word, or dword
-    if (u8ReadLen != 1 && u8ReadLen != 2 && u8ReadLen != 4)
+    // Per the PECI spec, the read length must be a byte, word, or qword
+    if (u8ReadLen != 1 && u8ReadLen != 2 && u8ReadLen != 8)
     {
         return PECI_CC_INVALID_REQ;
     }
 
     // The PECI buffer must be large enough to hold the requested data
-    if (sizeof(cmd.pci_config) < u8ReadLen)
+    if (sizeof(cmd.data) < u8ReadLen)
     {
         return PECI_CC_INVALID_REQ;
     }
 
     cmd.addr = target;
-    cmd.bus = u8Bus;
-    cmd.device = u8Device;
-    cmd.function = u8Fcn;
-    cmd.reg = u16Reg;
+    cmd.subopcode = subopcode;
+    cmd.param0 = param0;
+    cmd.param1 = param1;
+    cmd.param2 = param2;
     cmd.rx_len = u8ReadLen;
     cmd.domain_id = domainId;
 
-    ret = HW_peci_issue_cmd(PECI_IOC_RD_PCI_CFG_LOCAL, (char*)&cmd, peci_fd);
+    ret = HW_peci_issue_cmd(PECI_IOC_CRASHDUMP_DISC, (char*)&cmd, peci_fd);
     *cc = cmd.cc;
-
     if (ret == PECI_CC_SUCCESS)
     {
-        memcpy(pPCIReg, cmd.pci_config, u8ReadLen);
+        memcpy(pData, cmd.data, u8ReadLen);
+    }
+    else
+    {
+        ret = PECI_CC_DRIVER_ERR;
     }
 
     return ret;
 }
 
 /*-------------------------------------------------------------------------
- * This function provides write access to the local PCI configuration space
+ * This function provides crashdump GetFrame data over PECI
  *------------------------------------------------------------------------*/
-EPECIStatus peci_WrPCIConfigLocal(
-    uint8_t target, uint8_t u8Bus, uint8_t u8Device, uint8_t u8Fcn,
-    uint16_t u16Reg, uint8_t DataLen, uint32_t DataVal, uint8_t* cc)
+EPECIStatus peci_CrashDump_GetFrame(
+    uint8_t target, uint16_t param0, uint16_t param1, uint16_t param2,
+    uint8_t u8ReadLen, uint8_t* pData, uint8_t* cc)
 {
     //  Default to domain ID 0
-    return peci_WrPCIConfigLocal_dom(target, 0, u8Bus, u8Device, u8Fcn, u16Reg,
-                                     DataLen, DataVal, cc);
+    return peci_CrashDump_GetFrame_dom(target, 0, param0, param1, param2,
+                                       u8ReadLen, pData, cc);
 }
 
 /*-------------------------------------------------------------------------
- * This function provides write access to the local PCI configuration space in
- * the specified domain
+ * This function provides crashdump GetFrame data over PECI in the specified
+ * domain
  *------------------------------------------------------------------------*/
-EPECIStatus peci_WrPCIConfigLocal_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8Bus, uint8_t u8Device,
-    uint8_t u8Fcn, uint16_t u16Reg, uint8_t DataLen, uint32_t DataVal,
-    uint8_t* cc)
+EPECIStatus peci_CrashDump_GetFrame_dom(
+    uint8_t target, uint8_t domainId, uint16_t param0, uint16_t param1,
+    uint16_t param2, uint8_t u8ReadLen, uint8_t* pData, uint8_t* cc)
 {
     int peci_fd = -1;
-    struct peci_wr_pci_cfg_local_msg cmd = {0};
     EPECIStatus ret = PECI_CC_SUCCESS;
 
-    if (cc == NULL)
+    if (pData == NULL || cc == NULL)
     {
         return PECI_CC_INVALID_REQ;
     }
@@ -910,53 +2976,49 @@ EPECIStatus peci_WrPCIConfigLocal_dom(
         return PECI_CC_INVALID_REQ;
     }
 
-    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    // Per the PECI spec, the read length must be a qword or dqword
+    if (u8ReadLen != 8 && u8ReadLen != 16)
     {
-        return PECI_CC_DRIVER_ERR;
+        return PECI_CC_INVALID_REQ;
     }
 
-    // Per the PECI spec, the write length must be a byte, word, or dword
-    if (DataLen != 1 && DataLen != 2 && DataLen != 4)
+    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
     {
-        peci_Close(peci_fd);
-        return PECI_CC_INVALID_REQ;
+        return PECI_CC_DRIVER_ERR;
     }
-
-    cmd.addr = target;
-    cmd.bus = u8Bus;
-    cmd.device = u8Device;
-    cmd.function = u8Fcn;
-    cmd.reg = u16Reg;
-    cmd.tx_len = DataLen;
-    cmd.value = DataVal;
-    cmd.domain_id = domainId;
-
-    ret = HW_peci_issue_cmd(PECI_IOC_WR_PCI_CFG_LOCAL, (char*)&cmd, peci_fd);
-    *cc = cmd.cc;
+    ret = peci_CrashDump_GetFrame_seq_dom(target, domainId, param0, param1,
+                                          param2, u8ReadLen, pData, peci_fd,
+                                          cc);
 
     peci_Close(peci_fd);
     return ret;
 }
 
 /*-------------------------------------------------------------------------
- * This internal function is the common interface for RdEndPointConfig to PCI in
- * the specified domain
+ * This function allows sequential crashdump GetFrame with the provided
+ * peci file descriptor in the specified domain
  *------------------------------------------------------------------------*/
-static EPECIStatus peci_RdEndPointConfigPciCommon_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8MsgType, uint8_t u8Seg,
-    uint8_t u8Bus, uint8_t u8Device, uint8_t u8Fcn, uint16_t u16Reg,
-    uint8_t u8ReadLen, uint8_t* pPCIData, int peci_fd, uint8_t* cc)
+EPECIStatus peci_CrashDump_GetFrame_seq_dom(
+    uint8_t target, uint8_t domainId, uint16_t param0, uint16_t param1,
+    uint16_t param2, uint8_t u8ReadLen, uint8_t* pData, int peci_fd,
+    uint8_t* cc)
 {
-    struct peci_rd_end_pt_cfg_msg cmd = {0};
+    struct peci_crashdump_get_frame_msg cmd = {0};
     EPECIStatus ret = PECI_CC_SUCCESS;
 
-    if (pPCIData == NULL || cc == NULL)
+    if (pData == NULL || cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
     {
         return PECI_CC_INVALID_REQ;
     }
 
-    // The target address must be in the valid range
-    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    // Per the PECI spec, the read length must be a qword or dqword
+    if (u8ReadLen != 8 && u8ReadLen != 16)
     {
         return PECI_CC_INVALID_REQ;
     }
@@ -968,21 +3030,17 @@ static EPECIStatus peci_RdEndPointConfigPciCommon_dom(
     }
 
     cmd.addr = target;
-    cmd.msg_type = u8MsgType;
-    cmd.params.pci_cfg.seg = u8Seg;
-    cmd.params.pci_cfg.bus = u8Bus;
-    cmd.params.pci_cfg.device = u8Device;
-    cmd.params.pci_cfg.function = u8Fcn;
-    cmd.params.pci_cfg.reg = u16Reg;
+    cmd.param0 = param0;
+    cmd.param1 = param1;
+    cmd.param2 = param2;
     cmd.rx_len = u8ReadLen;
     cmd.domain_id = domainId;
 
-    ret = HW_peci_issue_cmd(PECI_IOC_RD_END_PT_CFG, (char*)&cmd, peci_fd);
+    ret = HW_peci_issue_cmd(PECI_IOC_CRASHDUMP_GET_FRAME, (char*)&cmd, peci_fd);
     *cc = cmd.cc;
-
     if (ret == PECI_CC_SUCCESS)
     {
-        memcpy(pPCIData, cmd.data, u8ReadLen);
+        memcpy(pData, cmd.data, u8ReadLen);
     }
     else
     {
@@ -993,32 +3051,14 @@ static EPECIStatus peci_RdEndPointConfigPciCommon_dom(
 }
 
 /*-------------------------------------------------------------------------
- * This function provides read access to the PCI configuration space at
- * the requested PCI configuration address.
- *------------------------------------------------------------------------*/
-EPECIStatus peci_RdEndPointConfigPci(
-    uint8_t target, uint8_t u8Seg, uint8_t u8Bus, uint8_t u8Device,
-    uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIData,
-    uint8_t* cc)
-{
-    //  Default to domain ID 0
-    return peci_RdEndPointConfigPci_dom(target, 0, u8Seg, u8Bus, u8Device,
-                                        u8Fcn, u16Reg, u8ReadLen, pPCIData, cc);
-}
-
-/*-------------------------------------------------------------------------
- * This function provides read access to the PCI configuration space at
- * the requested PCI configuration address in the specified domain.
+ *  This function provides raw PECI command access
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdEndPointConfigPci_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8Seg, uint8_t u8Bus,
-    uint8_t u8Device, uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen,
-    uint8_t* pPCIData, uint8_t* cc)
+EPECIStatus peci_raw(uint8_t target, uint8_t u8ReadLen, const uint8_t* pRawCmd,
+                     const uint32_t cmdSize, uint8_t* pRawResp,
+                     uint32_t respSize)
 {
     int peci_fd = -1;
-    EPECIStatus ret = PECI_CC_SUCCESS;
-
-    if (pPCIData == NULL || cc == NULL)
+    if (u8ReadLen && pRawResp == NULL)
     {
         return PECI_CC_INVALID_REQ;
     }
@@ -1033,38 +3073,26 @@ EPECIStatus peci_RdEndPointConfigPci_dom(
     {
         return PECI_CC_DRIVER_ERR;
     }
-    ret = peci_RdEndPointConfigPci_seq_dom(
-        target, domainId, u8Seg, u8Bus, u8Device, u8Fcn, u16Reg, u8ReadLen,
-        pPCIData, peci_fd, cc);
+
+    EPECIStatus ret = peci_raw_seq(target, u8ReadLen, pRawCmd, cmdSize,
+                                   pRawResp, respSize, peci_fd);
     peci_Close(peci_fd);
     return ret;
 }
 
 /*-------------------------------------------------------------------------
- * This function allows sequential RdEndPointConfig to PCI with the provided
- * peci file descriptor.
+ *  This function provides sequential raw PECI command access
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdEndPointConfigPci_seq(
-    uint8_t target, uint8_t u8Seg, uint8_t u8Bus, uint8_t u8Device,
-    uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIData,
-    int peci_fd, uint8_t* cc)
+EPECIStatus peci_raw_seq(uint8_t target, uint8_t u8ReadLen,
+                         const uint8_t* pRawCmd, const uint32_t cmdSize,
+                         uint8_t* pRawResp, uint32_t respSize, int peci_fd)
 {
-    //  Default to domain ID 0
-    return peci_RdEndPointConfigPci_seq_dom(
-        target, 0, u8Seg, u8Bus, u8Device, u8Fcn, u16Reg, u8ReadLen, pPCIData,
-        peci_fd, cc);
-}
+    struct peci_xfer_msg cmd = {0};
+    uint8_t u8TxBuf[PECI_BUFFER_SIZE] = {0};
+    uint8_t u8RxBuf[PECI_BUFFER_SIZE] = {0};
+    EPECIStatus ret = PECI_CC_SUCCESS;
 
-/*-------------------------------------------------------------------------
- * This function allows sequential RdEndPointConfig to PCI with the provided
- * peci file descriptor in the specified domain.
- *------------------------------------------------------------------------*/
-EPECIStatus peci_RdEndPointConfigPci_seq_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8Seg, uint8_t u8Bus,
-    uint8_t u8Device, uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen,
-    uint8_t* pPCIData, int peci_fd, uint8_t* cc)
-{
-    if (pPCIData == NULL || cc == NULL)
+    if (u8ReadLen && pRawResp == NULL)
     {
         return PECI_CC_INVALID_REQ;
     }
@@ -1075,358 +3103,493 @@ EPECIStatus peci_RdEndPointConfigPci_seq_dom(
         return PECI_CC_INVALID_REQ;
     }
 
-    // Per the PECI spec, the read length must be a byte, word, or dword
-    if (u8ReadLen != 1 && u8ReadLen != 2 && u8ReadLen != 4)
+    // Check for valid buffer sizes
+    if (cmdSize > PECI_BUFFER_SIZE || respSize < u8ReadLen ||
+        u8ReadLen >
+            (PECI_BUFFER_SIZE - 1)) // response buffer is data + 1 status byte
     {
         return PECI_CC_INVALID_REQ;
     }
 
-    return peci_RdEndPointConfigPciCommon_dom(
-        target, domainId, PECI_ENDPTCFG_TYPE_PCI, u8Seg, u8Bus, u8Device, u8Fcn,
-        u16Reg, u8ReadLen, pPCIData, peci_fd, cc);
-}
+    cmd.addr = target;
+    cmd.tx_len = (uint8_t)cmdSize;
+    cmd.rx_len = u8ReadLen;
 
-/*-------------------------------------------------------------------------
- * This function provides read access to the Local PCI configuration space at
- * the requested PCI configuration address.
- *------------------------------------------------------------------------*/
-EPECIStatus peci_RdEndPointConfigPciLocal(
-    uint8_t target, uint8_t u8Seg, uint8_t u8Bus, uint8_t u8Device,
-    uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIData,
-    uint8_t* cc)
-{
-    //  Default to domain ID 0
-    return peci_RdEndPointConfigPciLocal_dom(
-        target, 0, u8Seg, u8Bus, u8Device, u8Fcn, u16Reg, u8ReadLen, pPCIData,
-        cc);
+    memcpy(u8TxBuf, pRawCmd, cmdSize);
+
+    cmd.tx_buf = u8TxBuf;
+    cmd.rx_buf = u8RxBuf;
+    ret = HW_peci_issue_cmd(PECI_IOC_XFER, (char*)&cmd, peci_fd);
+
+    if (ret == PECI_CC_SUCCESS || ret == PECI_CC_TIMEOUT)
+    {
+        memcpy(pRawResp, u8RxBuf, u8ReadLen);
+    }
+
+    return ret;
 }
 
 /*-------------------------------------------------------------------------
- * This function provides read access to the Local PCI configuration space at
- * the requested PCI configuration address in the specified domain.
+ * This function returns the CPUID (Model and stepping) for the given PECI
+ * client address
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdEndPointConfigPciLocal_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8Seg, uint8_t u8Bus,
-    uint8_t u8Device, uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen,
-    uint8_t* pPCIData, uint8_t* cc)
+EPECIStatus peci_GetCPUID(const uint8_t clientAddr, CPUModel* cpuModel,
+                          uint8_t* stepping, uint8_t* cc)
 {
-    int peci_fd = -1;
     EPECIStatus ret = PECI_CC_SUCCESS;
+    uint32_t cpuid = 0;
 
-    if (pPCIData == NULL || cc == NULL)
+    if (cpuModel == NULL || stepping == NULL || cc == NULL)
     {
         return PECI_CC_INVALID_REQ;
     }
 
-    // The target address must be in the valid range
-    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    // The client address must be in the valid range
+    if (clientAddr < MIN_CLIENT_ADDR || clientAddr > MAX_CLIENT_ADDR)
     {
         return PECI_CC_INVALID_REQ;
     }
 
-    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    if (peci_Ping(clientAddr) != PECI_CC_SUCCESS)
     {
-        return PECI_CC_DRIVER_ERR;
+        return PECI_CC_CPU_NOT_PRESENT;
     }
-    ret = peci_RdEndPointConfigPciLocal_seq_dom(
-        target, domainId, u8Seg, u8Bus, u8Device, u8Fcn, u16Reg, u8ReadLen,
-        pPCIData, peci_fd, cc);
-    peci_Close(peci_fd);
+
+    ret =
+        peci_RdPkgConfig(clientAddr, PECI_MBX_INDEX_CPU_ID, PECI_PKG_ID_CPU_ID,
+                         sizeof(uint32_t), (uint8_t*)&cpuid, cc);
+
+    // Separate out the model and stepping (bits 3:0) from the CPUID
+    *cpuModel = cpuid & 0xFFFFFFF0;
+    *stepping = (uint8_t)(cpuid & 0x0000000F);
     return ret;
 }
 
+static pthread_mutex_t peci_topology_lock = PTHREAD_MUTEX_INITIALIZER;
+// Signalled when a probe finishes.  The probe runs without the lock held,
+// so cached lookups are not held up by the bus.
+static pthread_cond_t peci_topology_cond = PTHREAD_COND_INITIALIZER;
+static bool peci_topology_probing;
+static const struct peci_dev_config* peci_topology_config;
+static PECITopology peci_topology;
+// Model operations of each client in peci_topology
+static const PECIModelOps* peci_model_ops[MAX_CPUS];
+// A client that was missing or of an unsupported model when the topology
+// was probed is probed for again at most this often
+#define PECI_TOPOLOGY_REPROBE_MS 1000
+static uint64_t peci_topology_reprobe_ns;
+
 /*-------------------------------------------------------------------------
- * This function allows sequential RdEndPointConfig to PCI Local with the
- * provided peci file descriptor.
+ * This function reads local PCI config space through the local PCI form of
+ * RdEndPointConfig, which replaces RdPCIConfigLocal from Ice Lake on
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdEndPointConfigPciLocal_seq(
-    uint8_t target, uint8_t u8Seg, uint8_t u8Bus, uint8_t u8Device,
-    uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIData,
+static EPECIStatus peci_RdEndPointConfigPciLocalSeg0(
+    uint8_t target, uint8_t domainId, uint8_t u8Bus, uint8_t u8Device,
+    uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIReg,
     int peci_fd, uint8_t* cc)
 {
-    //  Default to domain ID 0
-    return peci_RdEndPointConfigPciLocal_seq_dom(
-        target, 0, u8Seg, u8Bus, u8Device, u8Fcn, u16Reg, u8ReadLen, pPCIData,
-        peci_fd, cc);
+    return peci_RdEndPointConfigPciLocal_seq_dom(target, domainId, 0, u8Bus,
+                                                 u8Device, u8Fcn, u16Reg,
+                                                 u8ReadLen, pPCIReg, peci_fd,
+                                                 cc);
 }
 
+// Operations of every supported CPU model
+static const PECIModelOps peci_models[] = {
+    {skylake, "Skylake", 1, peci_RdPCIConfigLocal_seq_dom},
+    {iceLake, "Ice Lake", PECI_MAX_DOMAINS,
+     peci_RdEndPointConfigPciLocalSeg0},
+    {iceLakeD, "Ice Lake-D", PECI_MAX_DOMAINS,
+     peci_RdEndPointConfigPciLocalSeg0},
+    {sapphireRapids, "Sapphire Rapids", PECI_MAX_DOMAINS,
+     peci_RdEndPointConfigPciLocalSeg0},
+    {emeraldRapids, "Emerald Rapids", PECI_MAX_DOMAINS,
+     peci_RdEndPointConfigPciLocalSeg0},
+    {graniteRapids, "Granite Rapids", PECI_MAX_DOMAINS,
+     peci_RdEndPointConfigPciLocalSeg0},
+    {graniteRapidsD, "Granite Rapids-D", PECI_MAX_DOMAINS,
+     peci_RdEndPointConfigPciLocalSeg0},
+    {sierraForest, "Sierra Forest", PECI_MAX_DOMAINS,
+     peci_RdEndPointConfigPciLocalSeg0},
+};
+
 /*-------------------------------------------------------------------------
- * This function allows sequential RdEndPointConfig to PCI Local with the
- * provided peci file descriptor in the specified domain.
+ * This function returns the operations of a CPU model, or null if the model
+ * is not supported
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdEndPointConfigPciLocal_seq_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8Seg, uint8_t u8Bus,
-    uint8_t u8Device, uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen,
-    uint8_t* pPCIData, int peci_fd, uint8_t* cc)
+static const PECIModelOps* peci_FindModelOps(CPUModel cpuModel)
 {
-    if (pPCIData == NULL || cc == NULL)
-    {
-        return PECI_CC_INVALID_REQ;
-    }
-
-    // The target address must be in the valid range
-    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
-    {
-        return PECI_CC_INVALID_REQ;
-    }
-
-    // Per the PECI spec, the read length must be a byte, word, or dword
-    if (u8ReadLen != 1 && u8ReadLen != 2 && u8ReadLen != 4)
+    for (size_t i = 0; i < sizeof(peci_models) / sizeof(peci_models[0]); i++)
     {
-        return PECI_CC_INVALID_REQ;
+        if (peci_models[i].cpuModel == cpuModel)
+        {
+            return &peci_models[i];
+        }
     }
-
-    return peci_RdEndPointConfigPciCommon_dom(
-        target, domainId, PECI_ENDPTCFG_TYPE_LOCAL_PCI, u8Seg, u8Bus, u8Device,
-        u8Fcn, u16Reg, u8ReadLen, pPCIData, peci_fd, cc);
+    return NULL;
 }
 
 /*-------------------------------------------------------------------------
- * This function provides read access to PCI MMIO space at
- * the requested PCI configuration address.
+ * This function resolves the model operations of every client in the
+ * topology. The topology lock must be held.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdEndPointConfigMmio(
-    uint8_t target, uint8_t u8Seg, uint8_t u8Bus, uint8_t u8Device,
-    uint8_t u8Fcn, uint8_t u8Bar, uint8_t u8AddrType, uint64_t u64Offset,
-    uint8_t u8ReadLen, uint8_t* pMmioData, uint8_t* cc)
+static void peci_ResolveModelOps(const PECITopology* topology)
 {
-    //  Default to domain ID 0
-    return peci_RdEndPointConfigMmio_dom(
-        target, 0, u8Seg, u8Bus, u8Device, u8Fcn, u8Bar, u8AddrType, u64Offset,
-        u8ReadLen, pMmioData, cc);
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+        peci_model_ops[cpu] = NULL;
+        if (topology->presentMask & (1 << cpu))
+        {
+            peci_model_ops[cpu] =
+                peci_FindModelOps(topology->clients[cpu].cpuModel);
+        }
+    }
 }
 
 /*-------------------------------------------------------------------------
- * This function provides read access to PCI MMIO space at
- * the requested PCI configuration address in the specified domain.
+ * This function probes every client address and the domains of every
+ * present client with the provided peci file descriptor. It fails if no
+ * client answered and a ping failed for a reason other than a timeout, as
+ * the bus could not be probed.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdEndPointConfigMmio_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8Seg, uint8_t u8Bus,
-    uint8_t u8Device, uint8_t u8Fcn, uint8_t u8Bar, uint8_t u8AddrType,
-    uint64_t u64Offset, uint8_t u8ReadLen, uint8_t* pMmioData, uint8_t* cc)
+static EPECIStatus peci_ProbeTopology(PECITopology* topology, int peci_fd)
 {
-    int peci_fd = -1;
-    EPECIStatus ret = PECI_CC_SUCCESS;
+    EPECIStatus error = PECI_CC_SUCCESS;
 
-    if (pMmioData == NULL || cc == NULL)
-    {
-        return PECI_CC_INVALID_REQ;
-    }
+    memset(topology, 0, sizeof(*topology));
 
-    // The target address must be in the valid range
-    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    for (uint8_t target = MIN_CLIENT_ADDR; target <= MAX_CLIENT_ADDR; target++)
     {
-        return PECI_CC_INVALID_REQ;
-    }
+        PECIClientInfo* client = &topology->clients[target - MIN_CLIENT_ADDR];
+        const PECIModelOps* ops = NULL;
+        uint8_t domains = PECI_MAX_DOMAINS;
+        uint32_t cpuid = 0;
+        uint8_t cc = 0;
+
+        EPECIStatus ret = peci_Ping_seq(target, peci_fd);
+        if (ret != PECI_CC_SUCCESS)
+        {
+            if (ret != PECI_CC_TIMEOUT)
+            {
+                error = ret;
+            }
+            continue;
+        }
+        topology->presentMask |= (uint8_t)(1 << (target - MIN_CLIENT_ADDR));
+        peci_GetDIB_seq(target, &client->dib, peci_fd);
+
+        if (peci_RdPkgConfig_seq(target, PECI_MBX_INDEX_CPU_ID,
+                                 PECI_PKG_ID_CPU_ID, sizeof(uint32_t),
+                                 (uint8_t*)&cpuid, peci_fd,
+                                 &cc) != PECI_CC_SUCCESS ||
+            cc != PECI_DEV_CC_SUCCESS)
+        {
+            continue;
+        }
+        client->cpuModel = cpuid & 0xFFFFFFF0;
+        client->stepping = (uint8_t)(cpuid & 0x0000000F);
+        client->domainMask = 1;
 
-    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
-    {
-        return PECI_CC_DRIVER_ERR;
+        // Models the library does not know are probed for every domain
+        ops = peci_FindModelOps(client->cpuModel);
+        if (ops != NULL)
+        {
+            domains = ops->domains;
+        }
+        // Domains are numbered contiguously, so stop at the first one that
+        // does not answer
+        for (uint8_t domainId = 1; domainId < domains; domainId++)
+        {
+            if (peci_RdPkgConfig_seq_dom(target, domainId,
+                                         PECI_MBX_INDEX_CPU_ID,
+                                         PECI_PKG_ID_CPU_ID, sizeof(uint32_t),
+                                         (uint8_t*)&cpuid, peci_fd,
+                                         &cc) != PECI_CC_SUCCESS ||
+                cc != PECI_DEV_CC_SUCCESS)
+            {
+                break;
+            }
+            client->domainMask |= (uint8_t)(1 << domainId);
+        }
     }
-    ret = peci_RdEndPointConfigMmio_seq_dom(
-        target, domainId, u8Seg, u8Bus, u8Device, u8Fcn, u8Bar, u8AddrType,
-        u64Offset, u8ReadLen, pMmioData, peci_fd, cc);
-    peci_Close(peci_fd);
-    return ret;
+
+    return topology->presentMask == 0 ? error : PECI_CC_SUCCESS;
 }
 
 /*-------------------------------------------------------------------------
- * This function allows sequential RdEndPointConfig to PCI MMIO with the
- * provided peci file descriptor.
+ * This function copies the cached topology if it is valid for the device
+ * configuration. The topology lock must be held.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdEndPointConfigMmio_seq(
-    uint8_t target, uint8_t u8Seg, uint8_t u8Bus, uint8_t u8Device,
-    uint8_t u8Fcn, uint8_t u8Bar, uint8_t u8AddrType, uint64_t u64Offset,
-    uint8_t u8ReadLen, uint8_t* pMmioData, int peci_fd, uint8_t* cc)
+static bool peci_CachedTopology(PECITopology* topology,
+                                const struct peci_dev_config* config)
 {
-    //  Default to domain ID 0
-    return peci_RdEndPointConfigMmio_seq_dom(
-        target, 0, u8Seg, u8Bus, u8Device, u8Fcn, u8Bar, u8AddrType, u64Offset,
-        u8ReadLen, pMmioData, peci_fd, cc);
+    if (peci_topology_config != config)
+    {
+        return false;
+    }
+    memcpy(topology, &peci_topology, sizeof(*topology));
+    return true;
 }
 
 /*-------------------------------------------------------------------------
- * This function allows sequential RdEndPointConfig to PCI MMIO with the
- * provided peci file descriptor in the specified domain.
+ * This function gets the topology of the PECI bus, probing it with the
+ * provided peci file descriptor if it is not cached or refresh is set.
+ * Callers that need a probe while one is running wait for its result. A
+ * failed probe is returned to its caller and not cached.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_RdEndPointConfigMmio_seq_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8Seg, uint8_t u8Bus,
-    uint8_t u8Device, uint8_t u8Fcn, uint8_t u8Bar, uint8_t u8AddrType,
-    uint64_t u64Offset, uint8_t u8ReadLen, uint8_t* pMmioData, int peci_fd,
-    uint8_t* cc)
+EPECIStatus peci_GetTopology_seq(PECITopology* topology, bool refresh,
+                                 int peci_fd)
 {
-    struct peci_rd_end_pt_cfg_msg cmd = {0};
+    const struct peci_dev_config* config = peci_GetDevConfig();
     EPECIStatus ret = PECI_CC_SUCCESS;
+    PECITopology probed;
 
-    if (pMmioData == NULL || cc == NULL)
+    if (topology == NULL)
     {
         return PECI_CC_INVALID_REQ;
     }
 
-    // The target address must be in the valid range
-    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    pthread_mutex_lock(&peci_topology_lock);
+    if (!refresh && peci_CachedTopology(topology, config))
     {
-        return PECI_CC_INVALID_REQ;
+        pthread_mutex_unlock(&peci_topology_lock);
+        return PECI_CC_SUCCESS;
     }
-
-    // Per the PECI spec, the read length must be a byte, word, dword, or qword
-    if (u8ReadLen != 1 && u8ReadLen != 2 && u8ReadLen != 4 && u8ReadLen != 8)
+    while (peci_topology_probing)
     {
-        return PECI_CC_INVALID_REQ;
+        pthread_cond_wait(&peci_topology_cond, &peci_topology_lock);
     }
+    // A refresh always probes again, but otherwise the probe just finished
+    // may have answered the call
+    if (!refresh && peci_CachedTopology(topology, config))
+    {
+        pthread_mutex_unlock(&peci_topology_lock);
+        return PECI_CC_SUCCESS;
+    }
+    peci_topology_probing = true;
+    pthread_mutex_unlock(&peci_topology_lock);
 
-    // The PECI buffer must be large enough to hold the requested data
-    if (sizeof(cmd.data) < u8ReadLen)
+    ret = peci_ProbeTopology(&probed, peci_fd);
+
+    pthread_mutex_lock(&peci_topology_lock);
+    if (ret == PECI_CC_SUCCESS)
     {
-        return PECI_CC_INVALID_REQ;
+        probed.generation = peci_topology.generation;
+        if (peci_topology_config != config ||
+            memcmp(&probed, &peci_topology, sizeof(probed)) != 0)
+        {
+            probed.generation++;
+            // A client that came, went or changed may have been reset
+            for (int cpu = 0; cpu < MAX_CPUS; cpu++)
+            {
+                if (((probed.presentMask ^ peci_topology.presentMask) &
+                     (1 << cpu)) ||
+                    memcmp(&probed.clients[cpu], &peci_topology.clients[cpu],
+                           sizeof(probed.clients[cpu])) != 0)
+                {
+                    peci_CacheInvalidate((uint8_t)(MIN_CLIENT_ADDR + cpu));
+                }
+            }
+        }
+        memcpy(&peci_topology, &probed, sizeof(probed));
+        peci_topology_config = config;
+        peci_ResolveModelOps(&peci_topology);
+        peci_CachedTopology(topology, config);
     }
+    peci_topology_probing = false;
+    pthread_cond_broadcast(&peci_topology_cond);
+    pthread_mutex_unlock(&peci_topology_lock);
 
-    cmd.addr = target;
-    cmd.msg_type = PECI_ENDPTCFG_TYPE_MMIO;
-    cmd.params.mmio.seg = u8Seg;
-    cmd.params.mmio.bus = u8Bus;
-    cmd.params.mmio.device = u8Device;
-    cmd.params.mmio.function = u8Fcn;
-    cmd.params.mmio.bar = u8Bar;
-    cmd.params.mmio.addr_type = u8AddrType;
-    cmd.params.mmio.offset = u64Offset;
-    cmd.rx_len = u8ReadLen;
-    cmd.domain_id = domainId;
+    return ret;
+}
 
-    ret = HW_peci_issue_cmd(PECI_IOC_RD_END_PT_CFG, (char*)&cmd, peci_fd);
-    *cc = cmd.cc;
+/*-------------------------------------------------------------------------
+ * This function gets the topology of the PECI bus. The device is only
+ * opened if the topology has to be probed.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_GetTopology(PECITopology* topology, bool refresh)
+{
+    const struct peci_dev_config* config = peci_GetDevConfig();
+    int peci_fd = -1;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+    bool cached = false;
 
-    if (ret == PECI_CC_SUCCESS)
+    if (topology == NULL)
     {
-        memcpy(pMmioData, cmd.data, u8ReadLen);
+        return PECI_CC_INVALID_REQ;
     }
-    else
+
+    if (!refresh)
     {
-        ret = PECI_CC_DRIVER_ERR;
+        pthread_mutex_lock(&peci_topology_lock);
+        cached = peci_CachedTopology(topology, config);
+        pthread_mutex_unlock(&peci_topology_lock);
+        if (cached)
+        {
+            return PECI_CC_SUCCESS;
+        }
+    }
+
+    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    {
+        return PECI_CC_DRIVER_ERR;
     }
+    ret = peci_GetTopology_seq(topology, refresh, peci_fd);
 
+    peci_Close(peci_fd);
     return ret;
 }
 
 /*-------------------------------------------------------------------------
- * This function allows sequential peci_WrEndPointConfig to PCI EndPoint with
- * the provided peci file descriptor.
+ * This function checks whether the topology has to be probed before the
+ * model operations of a client are looked up: when it is not cached for the
+ * device configuration, or when the client was missing or of an unsupported
+ * model and it was not probed in the last PECI_TOPOLOGY_REPROBE_MS. The
+ * topology lock must be held.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_WrEndPointConfig_seq(
-    uint8_t target, uint8_t u8MsgType, uint8_t u8Seg, uint8_t u8Bus,
-    uint8_t u8Device, uint8_t u8Fcn, uint16_t u16Reg, uint8_t DataLen,
-    uint32_t DataVal, int peci_fd, uint8_t* cc)
+static bool peci_ModelOpsProbeDue(int cpu,
+                                  const struct peci_dev_config* config,
+                                  bool* refresh)
 {
-    //  Default to domain ID 0
-    return peci_WrEndPointConfig_seq_dom(
-        target, 0, u8MsgType, u8Seg, u8Bus, u8Device, u8Fcn, u16Reg, DataLen,
-        DataVal, peci_fd, cc);
+    *refresh = false;
+    if (peci_topology_config != config)
+    {
+        return true;
+    }
+    if (peci_model_ops[cpu] != NULL)
+    {
+        return false;
+    }
+    *refresh = peci_now_ns() - peci_topology_reprobe_ns >=
+               (uint64_t)PECI_TOPOLOGY_REPROBE_MS * 1000000;
+    return *refresh;
 }
 
 /*-------------------------------------------------------------------------
- * This function allows sequential peci_WrEndPointConfig to PCI EndPoint with
- * the provided peci file descriptor in the specified domain.
+ * This function gets the model operations of a client with the provided
+ * peci file descriptor. It fails with PECI_CC_CPU_NOT_PRESENT if the client
+ * is not present and PECI_CC_INVALID_REQ if its model is not supported.
+ * The topology is probed again, rate-limited, for a client that was missing
+ * or of an unsupported model, as it may have been powered on since.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_WrEndPointConfig_seq_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8MsgType, uint8_t u8Seg,
-    uint8_t u8Bus, uint8_t u8Device, uint8_t u8Fcn, uint16_t u16Reg,
-    uint8_t DataLen, uint32_t DataVal, int peci_fd, uint8_t* cc)
+static EPECIStatus peci_ClientModelOps(uint8_t target, int peci_fd,
+                                       const PECIModelOps** ops)
 {
-    struct peci_wr_end_pt_cfg_msg cmd = {0};
+    const struct peci_dev_config* config = peci_GetDevConfig();
     EPECIStatus ret = PECI_CC_SUCCESS;
+    PECITopology topology;
+    int cpu = target - MIN_CLIENT_ADDR;
+    bool refresh = false;
 
-    if (cc == NULL)
+    *ops = NULL;
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
     {
         return PECI_CC_INVALID_REQ;
     }
 
-    // The target address must be in the valid range
-    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    pthread_mutex_lock(&peci_topology_lock);
+    bool probe = peci_ModelOpsProbeDue(cpu, config, &refresh);
+    if (probe)
     {
-        return PECI_CC_INVALID_REQ;
+        peci_topology_reprobe_ns = peci_now_ns();
     }
-
-    // Per the PECI spec, the write length must be a byte, word, or dword
-    if (DataLen != 1 && DataLen != 2 && DataLen != 4)
+    pthread_mutex_unlock(&peci_topology_lock);
+    if (probe)
     {
-        return PECI_CC_INVALID_REQ;
+        ret = peci_GetTopology_seq(&topology, refresh, peci_fd);
+        if (ret != PECI_CC_SUCCESS)
+        {
+            return ret;
+        }
     }
 
-    cmd.addr = target;
-    cmd.msg_type = u8MsgType;
-    cmd.params.pci_cfg.seg = u8Seg;
-    cmd.params.pci_cfg.bus = u8Bus;
-    cmd.params.pci_cfg.device = u8Device;
-    cmd.params.pci_cfg.function = u8Fcn;
-    cmd.params.pci_cfg.reg = u16Reg;
-    cmd.tx_len = DataLen;
-    cmd.value = DataVal;
-    cmd.domain_id = domainId;
-
-    ret = HW_peci_issue_cmd(PECI_IOC_WR_END_PT_CFG, (char*)&cmd, peci_fd);
-    *cc = cmd.cc;
-
-    return ret;
+    pthread_mutex_lock(&peci_topology_lock);
+    bool present = (peci_topology.presentMask & (1 << cpu)) != 0;
+    *ops = peci_model_ops[cpu];
+    pthread_mutex_unlock(&peci_topology_lock);
+    if (!present)
+    {
+        return PECI_CC_CPU_NOT_PRESENT;
+    }
+    return *ops == NULL ? PECI_CC_INVALID_REQ : PECI_CC_SUCCESS;
 }
 
 /*-------------------------------------------------------------------------
- * This function provides write access to the EP local PCI configuration space
+ * This function gets the model operations of a client, probing the
+ * topology with the provided peci file descriptor if it is not cached
  *------------------------------------------------------------------------*/
-EPECIStatus peci_WrEndPointPCIConfigLocal(
-    uint8_t target, uint8_t u8Seg, uint8_t u8Bus, uint8_t u8Device,
-    uint8_t u8Fcn, uint16_t u16Reg, uint8_t DataLen, uint32_t DataVal,
-    uint8_t* cc)
+const PECIModelOps* peci_GetModelOps_seq(uint8_t target, int peci_fd)
 {
-    //  Default to domain ID 0
-    return peci_WrEndPointPCIConfigLocal_dom(
-        target, 0, u8Seg, u8Bus, u8Device, u8Fcn, u16Reg, DataLen, DataVal, cc);
+    const PECIModelOps* ops = NULL;
+
+    peci_ClientModelOps(target, peci_fd, &ops);
+    return ops;
 }
 
 /*-------------------------------------------------------------------------
- * This function provides write access to the EP local PCI configuration space
- * in the specified domain
+ * This function gets the model operations of a client. The device is only
+ * opened if the topology has to be probed or the client is due a re-probe.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_WrEndPointPCIConfigLocal_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8Seg, uint8_t u8Bus,
-    uint8_t u8Device, uint8_t u8Fcn, uint16_t u16Reg, uint8_t DataLen,
-    uint32_t DataVal, uint8_t* cc)
+const PECIModelOps* peci_GetModelOps(uint8_t target)
 {
+    const struct peci_dev_config* config = peci_GetDevConfig();
+    const PECIModelOps* ops = NULL;
     int peci_fd = -1;
-    EPECIStatus ret = PECI_CC_SUCCESS;
+    bool refresh = false;
+
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&peci_topology_lock);
+    bool probe =
+        peci_ModelOpsProbeDue(target - MIN_CLIENT_ADDR, config, &refresh);
+    ops = peci_model_ops[target - MIN_CLIENT_ADDR];
+    pthread_mutex_unlock(&peci_topology_lock);
+    if (!probe)
+    {
+        return ops;
+    }
 
     if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
     {
-        return PECI_CC_DRIVER_ERR;
+        return NULL;
     }
+    ops = peci_GetModelOps_seq(target, peci_fd);
 
-    ret = peci_WrEndPointConfig_seq_dom(
-        target, domainId, PECI_ENDPTCFG_TYPE_LOCAL_PCI, u8Seg, u8Bus, u8Device,
-        u8Fcn, u16Reg, DataLen, DataVal, peci_fd, cc);
     peci_Close(peci_fd);
-    return ret;
+    return ops;
 }
 
 /*-------------------------------------------------------------------------
- * This function provides write access to the EP local PCI configuration space
+ * This function reads local PCI config space with the provided peci file
+ * descriptor, using the command the client's CPU model requires
  *------------------------------------------------------------------------*/
-EPECIStatus peci_WrEndPointPCIConfig(
-    uint8_t target, uint8_t u8Seg, uint8_t u8Bus, uint8_t u8Device,
-    uint8_t u8Fcn, uint16_t u16Reg, uint8_t DataLen, uint32_t DataVal,
-    uint8_t* cc)
+EPECIStatus peci_ModelRdPCIConfigLocal_seq(
+    uint8_t target, uint8_t domainId, uint8_t u8Bus, uint8_t u8Device,
+    uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIReg,
+    int peci_fd, uint8_t* cc)
 {
-    //  Default to domain ID 0
-    return peci_WrEndPointPCIConfig_dom(target, 0, u8Seg, u8Bus, u8Device,
-                                        u8Fcn, u16Reg, DataLen, DataVal, cc);
+    const PECIModelOps* ops = NULL;
+    EPECIStatus ret = peci_ClientModelOps(target, peci_fd, &ops);
+
+    if (ret != PECI_CC_SUCCESS)
+    {
+        return ret;
+    }
+    return ops->rdPCIConfigLocal(target, domainId, u8Bus, u8Device, u8Fcn,
+                                 u16Reg, u8ReadLen, pPCIReg, peci_fd, cc);
 }
 
 /*-------------------------------------------------------------------------
- * This function provides write access to the EP local PCI configuration space
- * in the specified domain
+ * This function reads local PCI config space using the command the
+ * client's CPU model requires
  *------------------------------------------------------------------------*/
-EPECIStatus peci_WrEndPointPCIConfig_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8Seg, uint8_t u8Bus,
-    uint8_t u8Device, uint8_t u8Fcn, uint16_t u16Reg, uint8_t DataLen,
-    uint32_t DataVal, uint8_t* cc)
+EPECIStatus peci_ModelRdPCIConfigLocal(
+    uint8_t target, uint8_t domainId, uint8_t u8Bus, uint8_t u8Device,
+    uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIReg,
+    uint8_t* cc)
 {
     int peci_fd = -1;
     EPECIStatus ret = PECI_CC_SUCCESS;
@@ -1435,285 +3598,442 @@ EPECIStatus peci_WrEndPointPCIConfig_dom(
     {
         return PECI_CC_DRIVER_ERR;
     }
-    ret = peci_WrEndPointConfig_seq_dom(
-        target, domainId, PECI_ENDPTCFG_TYPE_PCI, u8Seg, u8Bus, u8Device, u8Fcn,
-        u16Reg, DataLen, DataVal, peci_fd, cc);
+    ret = peci_ModelRdPCIConfigLocal_seq(target, domainId, u8Bus, u8Device,
+                                         u8Fcn, u16Reg, u8ReadLen, pPCIReg,
+                                         peci_fd, cc);
+
     peci_Close(peci_fd);
     return ret;
 }
 
+// Package config reads that make up a socket inventory, in validMask order
+static const struct
+{
+    uint8_t index;
+    uint16_t param;
+    size_t offset;
+} peci_inventory_reads[] = {
+    {PECI_MBX_INDEX_CPU_ID, PECI_PKG_ID_CPU_ID,
+     offsetof(PECISocketInventory, cpuId)},
+    {PECI_MBX_INDEX_CPU_ID, PECI_PKG_ID_PLATFORM_ID,
+     offsetof(PECISocketInventory, platformId)},
+    {PECI_MBX_INDEX_CPU_ID, PECI_PKG_ID_MICROCODE_REV,
+     offsetof(PECISocketInventory, microcodeRev)},
+    {PECI_MBX_INDEX_CPU_ID, PECI_PKG_ID_MAX_THREAD_ID,
+     offsetof(PECISocketInventory, maxThreadId)},
+    {PECI_MBX_INDEX_TDP, 0, offsetof(PECISocketInventory, tdp)},
+    {PECI_MBX_INDEX_TDP_UNITS, 0, offsetof(PECISocketInventory, tdpUnits)},
+    {PECI_MBX_INDEX_CFG_TDP_LEVELS, 0,
+     offsetof(PECISocketInventory, tdpLevels)},
+    {PECI_MBX_INDEX_TURBO_RATIO_LIMIT, 0,
+     offsetof(PECISocketInventory, turboRatioLimit)},
+};
+
+#define PECI_INVENTORY_FIELDS                                                  \
+    (sizeof(peci_inventory_reads) / sizeof(peci_inventory_reads[0]))
+#define PECI_INVENTORY_VALID ((1U << PECI_INVENTORY_FIELDS) - 1)
+
+static pthread_mutex_t peci_inventory_lock = PTHREAD_MUTEX_INITIALIZER;
+static const struct peci_dev_config* peci_inventory_config;
+static PECIInventory peci_inventory;
+// Set once every field of every present socket has been read
+static bool peci_inventory_complete;
+
 /*-------------------------------------------------------------------------
- * This function provides write access to PCI MMIO space at
- * the requested PCI configuration address.
+ * This function copies the cached inventory if it was read for the current
+ * topology, and sets *complete if it has every field. The inventory lock
+ * must be held.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_WrEndPointConfigMmio(
-    uint8_t target, uint8_t u8Seg, uint8_t u8Bus, uint8_t u8Device,
-    uint8_t u8Fcn, uint8_t u8Bar, uint8_t u8AddrType, uint64_t u64Offset,
-    uint8_t u8DataLen, uint64_t u64DataVal, uint8_t* cc)
+static bool peci_CachedInventory(PECIInventory* inventory,
+                                 const struct peci_dev_config* config,
+                                 bool* complete)
 {
-    //  Default to domain ID 0
-    return peci_WrEndPointConfigMmio_dom(
-        target, 0, u8Seg, u8Bus, u8Device, u8Fcn, u8Bar, u8AddrType, u64Offset,
-        u8DataLen, u64DataVal, cc);
+    bool valid = false;
+
+    pthread_mutex_lock(&peci_topology_lock);
+    valid = peci_inventory_config == config &&
+            peci_topology_config == config &&
+            peci_inventory.generation == peci_topology.generation;
+    pthread_mutex_unlock(&peci_topology_lock);
+    if (valid)
+    {
+        memcpy(inventory, &peci_inventory, sizeof(*inventory));
+    }
+    *complete = valid && peci_inventory_complete;
+    return valid;
 }
 
 /*-------------------------------------------------------------------------
- * This function provides write access to PCI MMIO space at
- * the requested PCI configuration address in the specified domain.
+ * This function reads the inventory of every present socket with the
+ * provided peci file descriptor. The inventory is cached, and only read
+ * again when refresh is set or the topology changes. Fields that could not
+ * be read are read again on the next call.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_WrEndPointConfigMmio_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8Seg, uint8_t u8Bus,
-    uint8_t u8Device, uint8_t u8Fcn, uint8_t u8Bar, uint8_t u8AddrType,
-    uint64_t u64Offset, uint8_t u8DataLen, uint64_t u64DataVal, uint8_t* cc)
+EPECIStatus peci_GetInventory_seq(PECIInventory* inventory, bool refresh,
+                                  int peci_fd)
 {
-    int peci_fd = -1;
-    EPECIStatus ret = PECI_CC_SUCCESS;
+    const struct peci_dev_config* config = peci_GetDevConfig();
+    PECITopology topology;
+    bool complete = false;
 
-    if (cc == NULL)
+    if (inventory == NULL)
     {
         return PECI_CC_INVALID_REQ;
     }
 
-    // The target address must be in the valid range
-    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    pthread_mutex_lock(&peci_inventory_lock);
+    EPECIStatus ret = peci_GetTopology_seq(&topology, refresh, peci_fd);
+    if (ret != PECI_CC_SUCCESS)
     {
-        return PECI_CC_INVALID_REQ;
+        pthread_mutex_unlock(&peci_inventory_lock);
+        return ret;
+    }
+    // A partial inventory is kept, and only its missing fields are read
+    if (refresh || !peci_CachedInventory(inventory, config, &complete))
+    {
+        memset(inventory, 0, sizeof(*inventory));
+        inventory->generation = topology.generation;
+        inventory->presentMask = topology.presentMask;
+    }
+    else if (complete)
+    {
+        pthread_mutex_unlock(&peci_inventory_lock);
+        return PECI_CC_SUCCESS;
     }
 
-    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    complete = true;
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++)
     {
-        return PECI_CC_DRIVER_ERR;
+        PECISocketInventory* socket = &inventory->sockets[cpu];
+
+        if (!(topology.presentMask & (1 << cpu)))
+        {
+            continue;
+        }
+        for (size_t i = 0; i < PECI_INVENTORY_FIELDS; i++)
+        {
+            uint32_t value = 0;
+            uint8_t cc = 0;
+
+            if (socket->validMask & (1 << i))
+            {
+                continue;
+            }
+            if (peci_RdPkgConfig_seq((uint8_t)(MIN_CLIENT_ADDR + cpu),
+                                     peci_inventory_reads[i].index,
+                                     peci_inventory_reads[i].param,
+                                     sizeof(value), (uint8_t*)&value,
+                                     peci_fd, &cc) != PECI_CC_SUCCESS ||
+                cc != PECI_DEV_CC_SUCCESS)
+            {
+                continue;
+            }
+            memcpy((uint8_t*)socket + peci_inventory_reads[i].offset, &value,
+                   sizeof(value));
+            socket->validMask |= (uint16_t)(1 << i);
+        }
+        if (socket->validMask != PECI_INVENTORY_VALID)
+        {
+            complete = false;
+        }
     }
-    ret = peci_WrEndPointConfigMmio_seq_dom(
-        target, domainId, u8Seg, u8Bus, u8Device, u8Fcn, u8Bar, u8AddrType,
-        u64Offset, u8DataLen, u64DataVal, peci_fd, cc);
-    peci_Close(peci_fd);
-    return ret;
-}
 
-/*-------------------------------------------------------------------------
- * This function allows sequential WrEndPointConfig to PCI MMIO with the
- * provided peci file descriptor.
- *------------------------------------------------------------------------*/
-EPECIStatus peci_WrEndPointConfigMmio_seq(
-    uint8_t target, uint8_t u8Seg, uint8_t u8Bus, uint8_t u8Device,
-    uint8_t u8Fcn, uint8_t u8Bar, uint8_t u8AddrType, uint64_t u64Offset,
-    uint8_t u8DataLen, uint64_t u64DataVal, int peci_fd, uint8_t* cc)
-{
-    //  Default to domain ID 0
-    return peci_WrEndPointConfigMmio_seq_dom(
-        target, 0, u8Seg, u8Bus, u8Device, u8Fcn, u8Bar, u8AddrType, u64Offset,
-        u8DataLen, u64DataVal, peci_fd, cc);
+    memcpy(&peci_inventory, inventory, sizeof(*inventory));
+    peci_inventory_config = config;
+    peci_inventory_complete = complete;
+    pthread_mutex_unlock(&peci_inventory_lock);
+    return PECI_CC_SUCCESS;
 }
 
 /*-------------------------------------------------------------------------
- * This function allows sequential WrEndPointConfig to PCI MMIO with the
- * provided peci file descriptor in the specified domain.
+ * This function reads the inventory of every present socket on a single
+ * open of the device. The device is not opened at all if the cached
+ * inventory is still valid.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_WrEndPointConfigMmio_seq_dom(
-    uint8_t target, uint8_t domainId, uint8_t u8Seg, uint8_t u8Bus,
-    uint8_t u8Device, uint8_t u8Fcn, uint8_t u8Bar, uint8_t u8AddrType,
-    uint64_t u64Offset, uint8_t u8DataLen, uint64_t u64DataVal, int peci_fd,
-    uint8_t* cc)
+EPECIStatus peci_GetInventory(PECIInventory* inventory, bool refresh)
 {
-    struct peci_wr_end_pt_cfg_msg cmd = {0};
+    const struct peci_dev_config* config = peci_GetDevConfig();
+    int peci_fd = -1;
     EPECIStatus ret = PECI_CC_SUCCESS;
+    bool complete = false;
 
-    if (cc == NULL)
-    {
-        return PECI_CC_INVALID_REQ;
-    }
-
-    // The target address must be in the valid range
-    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
-    {
-        return PECI_CC_INVALID_REQ;
-    }
-
-    // Per the PECI spec, the read length must be a byte, word, dword, or qword
-    if (u8DataLen != 1 && u8DataLen != 2 && u8DataLen != 4 && u8DataLen != 8)
+    if (inventory == NULL)
     {
         return PECI_CC_INVALID_REQ;
     }
 
-    cmd.addr = target;
-    cmd.msg_type = PECI_ENDPTCFG_TYPE_MMIO;
-    cmd.params.mmio.seg = u8Seg;
-    cmd.params.mmio.bus = u8Bus;
-    cmd.params.mmio.device = u8Device;
-    cmd.params.mmio.function = u8Fcn;
-    cmd.params.mmio.bar = u8Bar;
-    cmd.params.mmio.addr_type = u8AddrType;
-    cmd.params.mmio.offset = u64Offset;
-    cmd.tx_len = u8DataLen;
-    cmd.value = u64DataVal;
-    cmd.domain_id = domainId;
+    if (!refresh)
+    {
+        pthread_mutex_lock(&peci_inventory_lock);
+        peci_CachedInventory(inventory, config, &complete);
+        pthread_mutex_unlock(&peci_inventory_lock);
+        if (complete)
+        {
+            return PECI_CC_SUCCESS;
+        }
+    }
 
-    ret = HW_peci_issue_cmd(PECI_IOC_WR_END_PT_CFG, (char*)&cmd, peci_fd);
-    *cc = cmd.cc;
+    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    ret = peci_GetInventory_seq(inventory, refresh, peci_fd);
 
+    peci_Close(peci_fd);
     return ret;
 }
 
 /*-------------------------------------------------------------------------
- * This function provides crashdump discovery data over PECI
+ * This function returns true if the VCU sequence deadline has passed
  *------------------------------------------------------------------------*/
-EPECIStatus peci_CrashDump_Discovery(
-    uint8_t target, uint8_t subopcode, uint8_t param0, uint16_t param1,
-    uint8_t param2, uint8_t u8ReadLen, uint8_t* pData, uint8_t* cc)
+static bool peci_VCUExpired(const PECIVCUSequence* seq)
 {
-    //  Default to domain ID 0
-    return peci_CrashDump_Discovery_dom(target, 0, subopcode, param0, param1,
-                                        param2, u8ReadLen, pData, cc);
+    return seq->deadline_ns != 0 && peci_now_ns() > seq->deadline_ns;
 }
 
 /*-------------------------------------------------------------------------
- * This function provides crashdump discovery data over PECI in the specified
- * domain
+ * This function issues a VCU mailbox write for the open sequence and
+ * aborts the sequence if it fails
  *------------------------------------------------------------------------*/
-EPECIStatus peci_CrashDump_Discovery_dom(
-    uint8_t target, uint8_t domainId, uint8_t subopcode, uint8_t param0,
-    uint16_t param1, uint8_t param2, uint8_t u8ReadLen, uint8_t* pData,
-    uint8_t* cc)
+static EPECIStatus peci_VCUWrite(PECIVCUSequence* seq, uint16_t u16Param,
+                                 uint32_t u32Value, uint8_t* cc)
 {
-    int peci_fd = -1;
-    struct peci_crashdump_disc_msg cmd = {0};
     EPECIStatus ret = PECI_CC_SUCCESS;
 
-    if (pData == NULL || cc == NULL)
+    if (peci_VCUExpired(seq))
     {
-        return PECI_CC_INVALID_REQ;
+        peci_VCUAbort(seq);
+        return PECI_CC_TIMEOUT;
     }
 
-    // The target address must be in the valid range
-    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    ret = peci_WrPkgConfig_seq_dom(seq->target, seq->domainId, MBX_INDEX_VCU,
+                                   u16Param, u32Value, sizeof(uint32_t),
+                                   seq->peci_fd, cc);
+    if (ret != PECI_CC_SUCCESS || *cc != PECI_DEV_CC_SUCCESS)
     {
-        return PECI_CC_INVALID_REQ;
+        peci_VCUAbort(seq);
     }
+    return ret;
+}
 
-    // Per the PECI spec, the read length must be a byte, word, or qword
-    if (u8ReadLen != 1 && u8ReadLen != 2 && u8ReadLen != 8)
+/*-------------------------------------------------------------------------
+ * This function opens a VCU sequence with the provided peci file
+ * descriptor. If timeout_ms is not PECI_WAIT_FOREVER, the sequence is
+ * aborted by any step that starts after the timeout has passed.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_VCUOpen_seq(PECIVCUSequence* seq, uint8_t target,
+                             uint8_t domainId, EPECISequence seqId,
+                             int timeout_ms, int peci_fd, uint8_t* cc)
+{
+    if (seq == NULL)
     {
         return PECI_CC_INVALID_REQ;
     }
+    // Leave the sequence closed if it cannot be opened
+    memset(seq, 0, sizeof(*seq));
 
-    // The PECI buffer must be large enough to hold the requested data
-    if (sizeof(cmd.data) < u8ReadLen)
+    // The target address must be in the valid range
+    if (cc == NULL || target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
     {
         return PECI_CC_INVALID_REQ;
     }
 
-    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    seq->peci_fd = peci_fd;
+    seq->target = target;
+    seq->domainId = domainId;
+    seq->seqId = (uint32_t)seqId;
+    if (timeout_ms > 0)
     {
-        return PECI_CC_DRIVER_ERR;
+        seq->deadline_ns = peci_now_ns() + (uint64_t)timeout_ms * 1000000;
     }
+    seq->open = true;
 
-    cmd.addr = target;
-    cmd.subopcode = subopcode;
-    cmd.param0 = param0;
-    cmd.param1 = param1;
-    cmd.param2 = param2;
-    cmd.rx_len = u8ReadLen;
-    cmd.domain_id = domainId;
+    return peci_VCUWrite(seq, VCU_OPEN_SEQ, seq->seqId, cc);
+}
 
-    ret = HW_peci_issue_cmd(PECI_IOC_CRASHDUMP_DISC, (char*)&cmd, peci_fd);
-    *cc = cmd.cc;
-    if (ret == PECI_CC_SUCCESS)
-    {
-        memcpy(pData, cmd.data, u8ReadLen);
-    }
-    else
+/*-------------------------------------------------------------------------
+ * This function sets the next parameter of an open VCU sequence
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_VCUSetParam(PECIVCUSequence* seq, uint32_t u32Param,
+                             uint8_t* cc)
+{
+    if (seq == NULL || cc == NULL || !seq->open)
     {
-        ret = PECI_CC_DRIVER_ERR;
+        return PECI_CC_INVALID_REQ;
     }
 
-    peci_Close(peci_fd);
-    return ret;
+    return peci_VCUWrite(seq, VCU_SET_PARAM, u32Param, cc);
 }
 
 /*-------------------------------------------------------------------------
- * This function provides crashdump GetFrame data over PECI
+ * This function reads up to count dwords from an open VCU sequence. The
+ * reads are issued back to back with a single prepared command, and
+ * *readCount is set to the number of dwords read. The sequence is aborted
+ * on the first failed read, unless the completion code asks for a retry.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_CrashDump_GetFrame(
-    uint8_t target, uint16_t param0, uint16_t param1, uint16_t param2,
-    uint8_t u8ReadLen, uint8_t* pData, uint8_t* cc)
+EPECIStatus peci_VCURead(PECIVCUSequence* seq, uint32_t* pData, size_t count,
+                         size_t* readCount, uint8_t* cc)
 {
-    //  Default to domain ID 0
-    return peci_CrashDump_GetFrame_dom(target, 0, param0, param1, param2,
-                                       u8ReadLen, pData, cc);
+    struct peci_rd_pkg_cfg_msg cmd = {0};
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (seq == NULL || pData == NULL || readCount == NULL || cc == NULL ||
+        !seq->open)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    cmd.addr = seq->target;
+    cmd.index = MBX_INDEX_VCU;
+    cmd.param = VCU_READ;
+    cmd.rx_len = sizeof(uint32_t);
+    cmd.domain_id = seq->domainId;
+
+    *readCount = 0;
+    *cc = PECI_DEV_CC_SUCCESS;
+    while (*readCount < count)
+    {
+        if (peci_VCUExpired(seq))
+        {
+            peci_VCUAbort(seq);
+            return PECI_CC_TIMEOUT;
+        }
+
+        // Clear the previous response so every request is identical
+        cmd.cc = 0;
+        memset(cmd.pkg_config, 0, sizeof(cmd.pkg_config));
+        ret = HW_peci_issue_cmd(PECI_IOC_RD_PKG_CFG, (char*)&cmd,
+                                seq->peci_fd);
+        *cc = cmd.cc;
+        // The read can be retried later if the CPU asked for a retry, so
+        // leave the sequence open
+        if ((cmd.cc & PECI_DEV_CC_RETRY_CHECK_MASK) == PECI_DEV_CC_NEED_RETRY)
+        {
+            return ret;
+        }
+        if (ret != PECI_CC_SUCCESS || cmd.cc != PECI_DEV_CC_SUCCESS)
+        {
+            peci_VCUAbort(seq);
+            return ret;
+        }
+        memcpy(&pData[*readCount], cmd.pkg_config, sizeof(uint32_t));
+        (*readCount)++;
+    }
+
+    return PECI_CC_SUCCESS;
 }
 
 /*-------------------------------------------------------------------------
- * This function provides crashdump GetFrame data over PECI in the specified
- * domain
+ * This function closes an open VCU sequence
  *------------------------------------------------------------------------*/
-EPECIStatus peci_CrashDump_GetFrame_dom(
-    uint8_t target, uint8_t domainId, uint16_t param0, uint16_t param1,
-    uint16_t param2, uint8_t u8ReadLen, uint8_t* pData, uint8_t* cc)
+EPECIStatus peci_VCUClose(PECIVCUSequence* seq, uint8_t* cc)
 {
-    int peci_fd = -1;
-    struct peci_crashdump_get_frame_msg cmd = {0};
     EPECIStatus ret = PECI_CC_SUCCESS;
 
-    if (pData == NULL || cc == NULL)
+    if (seq == NULL || cc == NULL || !seq->open)
     {
         return PECI_CC_INVALID_REQ;
     }
 
-    // The target address must be in the valid range
-    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
-    {
-        return PECI_CC_INVALID_REQ;
-    }
+    ret = peci_VCUWrite(seq, VCU_CLOSE_SEQ, seq->seqId, cc);
+    seq->open = false;
+    return ret;
+}
 
-    // Per the PECI spec, the read length must be a qword or dqword
-    if (u8ReadLen != 8 && u8ReadLen != 16)
+/*-------------------------------------------------------------------------
+ * This function aborts an open VCU sequence. It does nothing if the
+ * sequence is not open.
+ *------------------------------------------------------------------------*/
+void peci_VCUAbort(PECIVCUSequence* seq)
+{
+    uint8_t cc = 0;
+
+    if (seq == NULL || !seq->open)
     {
-        return PECI_CC_INVALID_REQ;
+        return;
     }
 
-    // The PECI buffer must be large enough to hold the requested data
-    if (sizeof(cmd.data) < u8ReadLen)
+    // Mark the sequence closed first, since nothing more can be done with
+    // it even if the abort itself fails
+    seq->open = false;
+    peci_WrPkgConfig_seq_dom(seq->target, seq->domainId, MBX_INDEX_VCU,
+                             VCU_ABORT_SEQ, seq->seqId, sizeof(uint32_t),
+                             seq->peci_fd, &cc);
+}
+
+// Reads of a whole sequence that the CPU asks to retry are retried this many
+// times, waiting VCU_RETRY_DELAY_MS doubled on each attempt
+#define VCU_READ_RETRIES 6
+#define VCU_RETRY_DELAY_MS 10
+
+/*-------------------------------------------------------------------------
+ * This function runs a complete VCU sequence with the provided peci file
+ * descriptor: open, set each parameter, read readLen dwords and close. Any
+ * failure aborts the sequence. Reads the CPU asks to retry are retried with
+ * backoff, and if fewer than readLen dwords could be read the sequence is
+ * aborted and PECI_CC_TIMEOUT returned. On return, *cc holds the completion
+ * code of the last command issued.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_VCURunSequence_seq(
+    uint8_t target, uint8_t domainId, EPECISequence seqId,
+    const uint32_t* params, size_t paramCount, uint32_t* pData,
+    size_t readLen, int timeout_ms, int peci_fd, uint8_t* cc)
+{
+    PECIVCUSequence seq = {0};
+    EPECIStatus ret = PECI_CC_SUCCESS;
+    size_t readCount = 0;
+
+    if ((paramCount && params == NULL) || (readLen && pData == NULL))
     {
         return PECI_CC_INVALID_REQ;
     }
 
-    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
+    ret = peci_VCUOpen_seq(&seq, target, domainId, seqId, timeout_ms, peci_fd,
+                           cc);
+    for (size_t i = 0; i < paramCount && seq.open; i++)
     {
-        return PECI_CC_DRIVER_ERR;
+        ret = peci_VCUSetParam(&seq, params[i], cc);
     }
-
-    cmd.addr = target;
-    cmd.param0 = param0;
-    cmd.param1 = param1;
-    cmd.param2 = param2;
-    cmd.rx_len = u8ReadLen;
-    cmd.domain_id = domainId;
-
-    ret = HW_peci_issue_cmd(PECI_IOC_CRASHDUMP_GET_FRAME, (char*)&cmd, peci_fd);
-    *cc = cmd.cc;
-    if (ret == PECI_CC_SUCCESS)
+    for (uint32_t retries = 0; readLen && seq.open; retries++)
     {
-        memcpy(pData, cmd.data, u8ReadLen);
+        size_t count = 0;
+        ret = peci_VCURead(&seq, &pData[readCount], readLen - readCount,
+                           &count, cc);
+        readCount += count;
+        if (readCount == readLen || !seq.open)
+        {
+            break;
+        }
+        // The CPU asked for a retry
+        if (retries == VCU_READ_RETRIES)
+        {
+            peci_VCUAbort(&seq);
+            return PECI_CC_TIMEOUT;
+        }
+        long delay_ms = VCU_RETRY_DELAY_MS << retries;
+        struct timespec delay = {.tv_sec = delay_ms / 1000,
+                                 .tv_nsec = (delay_ms % 1000) * 1000000};
+        nanosleep(&delay, NULL);
     }
-    else
+    if (seq.open)
     {
-        ret = PECI_CC_DRIVER_ERR;
+        ret = peci_VCUClose(&seq, cc);
     }
-
-    peci_Close(peci_fd);
     return ret;
 }
 
 /*-------------------------------------------------------------------------
- *  This function provides raw PECI command access
+ * This function runs a complete VCU sequence in the specified domain
  *------------------------------------------------------------------------*/
-EPECIStatus peci_raw(uint8_t target, uint8_t u8ReadLen, const uint8_t* pRawCmd,
-                     const uint32_t cmdSize, uint8_t* pRawResp,
-                     uint32_t respSize)
+EPECIStatus peci_VCURunSequence(
+    uint8_t target, uint8_t domainId, EPECISequence seqId,
+    const uint32_t* params, size_t paramCount, uint32_t* pData,
+    size_t readLen, int timeout_ms, uint8_t* cc)
 {
     int peci_fd = -1;
-    if (u8ReadLen && pRawResp == NULL)
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (cc == NULL)
     {
         return PECI_CC_INVALID_REQ;
     }
@@ -1728,94 +4048,114 @@ EPECIStatus peci_raw(uint8_t target, uint8_t u8ReadLen, const uint8_t* pRawCmd,
     {
         return PECI_CC_DRIVER_ERR;
     }
+    ret = peci_VCURunSequence_seq(target, domainId, seqId, params, paramCount,
+                                  pData, readLen, timeout_ms, peci_fd, cc);
 
-    EPECIStatus ret = peci_raw_seq(target, u8ReadLen, pRawCmd, cmdSize,
-                                   pRawResp, respSize, peci_fd);
     peci_Close(peci_fd);
     return ret;
 }
 
 /*-------------------------------------------------------------------------
- *  This function provides sequential raw PECI command access
+ * This function issues every command recorded in a trace, in order, on the
+ * current PECI device and compares the results with the recorded ones.
+ * Combined with peci_SimStart, this replays production traffic offline.
  *------------------------------------------------------------------------*/
-EPECIStatus peci_raw_seq(uint8_t target, uint8_t u8ReadLen,
-                         const uint8_t* pRawCmd, const uint32_t cmdSize,
-                         uint8_t* pRawResp, uint32_t respSize, int peci_fd)
+EPECIStatus peci_TraceReplay(const char* tracePath, bool realTime,
+                             PECITraceReplayStats* stats)
 {
-    struct peci_xfer_msg cmd = {0};
-    uint8_t u8TxBuf[PECI_BUFFER_SIZE] = {0};
-    uint8_t u8RxBuf[PECI_BUFFER_SIZE] = {0};
-    EPECIStatus ret = PECI_CC_SUCCESS;
+    const struct peci_trace_record* rec = NULL;
+    const uint8_t* base = NULL;
+    size_t size = 0;
+    size_t pos = 0;
+    int peci_fd = -1;
+    uint64_t first_ns = 0;
+    uint64_t replay_start_ns = 0;
 
-    if (u8ReadLen && pRawResp == NULL)
+    if (tracePath == NULL || stats == NULL)
     {
         return PECI_CC_INVALID_REQ;
     }
+    memset(stats, 0, sizeof(*stats));
 
-    // The target address must be in the valid range
-    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    if (peci_trace_map(tracePath, &base, &size) != 0)
     {
         return PECI_CC_INVALID_REQ;
     }
-
-    // Check for valid buffer sizes
-    if (cmdSize > PECI_BUFFER_SIZE || respSize < u8ReadLen ||
-        u8ReadLen >
-            (PECI_BUFFER_SIZE - 1)) // response buffer is data + 1 status byte
+    if (peci_Open(&peci_fd) != PECI_CC_SUCCESS)
     {
-        return PECI_CC_INVALID_REQ;
+        peci_trace_unmap(base, size);
+        return PECI_CC_DRIVER_ERR;
     }
 
-    cmd.addr = target;
-    cmd.tx_len = (uint8_t)cmdSize;
-    cmd.rx_len = u8ReadLen;
-
-    memcpy(u8TxBuf, pRawCmd, cmdSize);
-
-    cmd.tx_buf = u8TxBuf;
-    cmd.rx_buf = u8RxBuf;
-    ret = HW_peci_issue_cmd(PECI_IOC_XFER, (char*)&cmd, peci_fd);
-
-    if (ret == PECI_CC_SUCCESS || ret == PECI_CC_TIMEOUT)
+    replay_start_ns = peci_now_ns();
+    while ((rec = peci_trace_next(base, size, &pos)) != NULL)
     {
-        memcpy(pRawResp, u8RxBuf, u8ReadLen);
-    }
+        char msg[PECI_TRACE_MAX_MSG] = {0};
+        uint8_t tx[PECI_BUFFER_SIZE] = {0};
+        uint8_t rx[PECI_BUFFER_SIZE] = {0};
+        bool match = true;
+
+        if (rec->msg_len != _IOC_SIZE(rec->ioctl_cmd) ||
+            rec->msg_len > sizeof(msg) || rec->tx_len > sizeof(tx) ||
+            rec->rx_len > sizeof(rx))
+        {
+            stats->skipped++;
+            continue;
+        }
 
-    return ret;
-}
+        if (first_ns == 0)
+        {
+            first_ns = rec->start_ns;
+        }
+        stats->recorded_ns = rec->end_ns - first_ns;
 
-/*-------------------------------------------------------------------------
- * This function returns the CPUID (Model and stepping) for the given PECI
- * client address
- *------------------------------------------------------------------------*/
-EPECIStatus peci_GetCPUID(const uint8_t clientAddr, CPUModel* cpuModel,
-                          uint8_t* stepping, uint8_t* cc)
-{
-    EPECIStatus ret = PECI_CC_SUCCESS;
-    uint32_t cpuid = 0;
+        // Keep the recorded spacing between commands
+        if (realTime)
+        {
+            uint64_t offset = rec->start_ns - first_ns;
+            uint64_t elapsed = peci_now_ns() - replay_start_ns;
+            if (offset > elapsed)
+            {
+                struct timespec delay = {
+                    .tv_sec = (time_t)((offset - elapsed) / 1000000000ULL),
+                    .tv_nsec = (long)((offset - elapsed) % 1000000000ULL),
+                };
+                nanosleep(&delay, NULL);
+            }
+        }
 
-    if (cpuModel == NULL || stepping == NULL || cc == NULL)
-    {
-        return PECI_CC_INVALID_REQ;
-    }
+        memcpy(msg, peci_trace_req(rec), rec->msg_len);
+        if (rec->ioctl_cmd == PECI_IOC_XFER)
+        {
+            struct peci_xfer_msg* xfer = (void*)msg;
+            memcpy(tx, peci_trace_tx(rec), rec->tx_len);
+            xfer->tx_buf = tx;
+            xfer->rx_buf = rx;
+        }
 
-    // The client address must be in the valid range
-    if (clientAddr < MIN_CLIENT_ADDR || clientAddr > MAX_CLIENT_ADDR)
-    {
-        return PECI_CC_INVALID_REQ;
-    }
+        EPECIStatus ret = HW_peci_issue_cmd(rec->ioctl_cmd, msg, peci_fd);
 
-    if (peci_Ping(clientAddr) != PECI_CC_SUCCESS)
-    {
-        return PECI_CC_CPU_NOT_PRESENT;
+        if ((int32_t)ret != rec->status)
+        {
+            match = false;
+        }
+        else if (rec->ioctl_cmd == PECI_IOC_XFER)
+        {
+            match = memcmp(rx, peci_trace_rx(rec), rec->rx_len) == 0;
+        }
+        else
+        {
+            match = memcmp(msg, peci_trace_resp(rec), rec->msg_len) == 0;
+        }
+        stats->commands++;
+        if (!match)
+        {
+            stats->mismatches++;
+        }
     }
+    stats->elapsed_ns = peci_now_ns() - replay_start_ns;
 
-    ret =
-        peci_RdPkgConfig(clientAddr, PECI_MBX_INDEX_CPU_ID, PECI_PKG_ID_CPU_ID,
-                         sizeof(uint32_t), (uint8_t*)&cpuid, cc);
-
-    // Separate out the model and stepping (bits 3:0) from the CPUID
-    *cpuModel = cpuid & 0xFFFFFFF0;
-    *stepping = (uint8_t)(cpuid & 0x0000000F);
-    return ret;
+    peci_Close(peci_fd);
+    peci_trace_unmap(base, size);
+    return PECI_CC_SUCCESS;
 }
@@ -20,6 +20,21 @@ extern "C"
 #endif
 #include <inttypes.h>
 #include <stdbool.h>
+#include <stddef.h>
+
+// Thread safety
+//
+// Every function in this library may be called concurrently from multiple
+// threads without external locking, and threads working on different PECI
+// devices do not serialize each other.  The functions that take no peci_fd
+// open and close the device for each call.  The _seq functions use the
+// caller's peci_fd, and calls that share a peci_fd must be serialized by
+// the caller.
+//
+// peci_SetDevName atomically publishes a new process-wide device name.
+// Commands already in progress finish on the device they opened.
+// peci_SetThreadDevName only affects the calling thread, and peci_LockDev
+// only affects the returned peci_fd.
 
 // PECI Client Address List
 #define MIN_CLIENT_ADDR 0x30
@@ -52,6 +67,7 @@ typedef enum
     PECI_CC_CPU_NOT_PRESENT,
     PECI_CC_MEM_ERR,
     PECI_CC_TIMEOUT,
+    PECI_CC_CIRCUIT_OPEN, // target failed fast, see peci_SetCircuitBreaker
 } EPECIStatus;
 
 // PECI Timeout Options
@@ -92,6 +108,77 @@ typedef enum
 
 #define MBX_INDEX_VCU 128 // VCU Index
 
+// State of an open VCU sequence
+typedef struct
+{
+    int peci_fd;
+    uint8_t target;
+    uint8_t domainId;
+    uint32_t seqId;
+    uint64_t deadline_ns; // CLOCK_MONOTONIC, 0 for no deadline
+    bool open;
+} PECIVCUSequence;
+
+// Topology of the PECI bus as returned by peci_GetTopology
+#define PECI_MAX_DOMAINS 8
+
+typedef struct
+{
+    uint64_t dib;
+    CPUModel cpuModel;
+    uint8_t stepping;
+    uint8_t domainMask; // bit n is set if domain n answered
+} PECIClientInfo;
+
+typedef struct
+{
+    uint32_t generation; // changes whenever the discovered topology changes
+    uint8_t presentMask; // bit n is set if MIN_CLIENT_ADDR + n is present
+    PECIClientInfo clients[MAX_CPUS]; // indexed by address - MIN_CLIENT_ADDR
+} PECITopology;
+
+// Operations that differ between CPU models, resolved for each client when
+// the topology is probed so callers need not check the model or read the
+// CPUID themselves
+typedef struct
+{
+    CPUModel cpuModel;
+    const char* name;
+    // Number of domains a client of the model can have.  Clients before
+    // Ice Lake do not decode the domain ID, so only domain 0 is probed.
+    uint8_t domains;
+    // Reads local PCI config space: RdPCIConfigLocal on Skylake, the local
+    // PCI form of RdEndPointConfig (segment 0) from Ice Lake on
+    EPECIStatus (*rdPCIConfigLocal)(uint8_t target, uint8_t domainId,
+                                    uint8_t u8Bus, uint8_t u8Device,
+                                    uint8_t u8Fcn, uint16_t u16Reg,
+                                    uint8_t u8ReadLen, uint8_t* pPCIReg,
+                                    int peci_fd, uint8_t* cc);
+} PECIModelOps;
+
+// Static identity of one socket.  Bit n of validMask is set if the nth
+// field was read.  The TDP level and turbo ratio limit fields hold
+// parameter 0 of their indices.
+typedef struct
+{
+    uint32_t cpuId;
+    uint32_t platformId;
+    uint32_t microcodeRev;
+    uint32_t maxThreadId;
+    uint32_t tdp;
+    uint32_t tdpUnits;
+    uint32_t tdpLevels;
+    uint32_t turboRatioLimit;
+    uint16_t validMask;
+} PECISocketInventory;
+
+typedef struct
+{
+    uint32_t generation; // topology generation the inventory was read for
+    uint8_t presentMask; // as in PECITopology
+    PECISocketInventory sockets[MAX_CPUS]; // indexed as in PECITopology
+} PECIInventory;
+
 typedef enum
 {
     MMIO_DWORD_OFFSET = 0x05,
@@ -105,6 +192,10 @@ EPECIStatus FindBusNumber(uint8_t u8Bus, uint8_t u8Cpu, uint8_t* pu8BusValue);
 // Expressed in signed fixed point value of 1/64 degrees celsius
 EPECIStatus peci_GetTemp(uint8_t target, int16_t* temperature);
 
+// Allows sequential GetTemp with the provided peci file descriptor
+EPECIStatus peci_GetTemp_seq(uint8_t target, int16_t* temperature,
+                             int peci_fd);
+
 // Provides read access to the package configuration space within the
 // processor
 EPECIStatus peci_RdPkgConfig(uint8_t target, uint8_t u8Index, uint16_t u16Value,
@@ -160,6 +251,12 @@ EPECIStatus peci_RdIAMSR_dom(uint8_t target, uint8_t domainId, uint8_t threadID,
                              uint16_t MSRAddress, uint64_t* u64MsrVal,
                              uint8_t* cc);
 
+// Allows sequential RdIAMSR with the provided peci file descriptor in the
+// specified domain
+EPECIStatus peci_RdIAMSR_seq_dom(
+    uint8_t target, uint8_t domainId, uint8_t threadID, uint16_t MSRAddress,
+    uint64_t* u64MsrVal, int peci_fd, uint8_t* cc);
+
 // Provides read access to PCI Configuration space
 EPECIStatus peci_RdPCIConfig(uint8_t target, uint8_t u8Bus, uint8_t u8Device,
                              uint8_t u8Fcn, uint16_t u16Reg, uint8_t* pPCIReg,
@@ -372,6 +469,13 @@ EPECIStatus peci_CrashDump_Discovery_dom(
     uint16_t param1, uint8_t param2, uint8_t u8ReadLen, uint8_t* pData,
     uint8_t* cc);
 
+// Allows sequential Crashdump Discovery with the provided peci file
+// descriptor in the specified domain
+EPECIStatus peci_CrashDump_Discovery_seq_dom(
+    uint8_t target, uint8_t domainId, uint8_t subopcode, uint8_t param0,
+    uint16_t param1, uint8_t param2, uint8_t u8ReadLen, uint8_t* pData,
+    int peci_fd, uint8_t* cc);
+
 // Provides access to the Crashdump GetFrame API
 EPECIStatus peci_CrashDump_GetFrame(
     uint8_t target, uint16_t param0, uint16_t param1, uint16_t param2,
@@ -382,6 +486,13 @@ EPECIStatus peci_CrashDump_GetFrame_dom(
     uint8_t target, uint8_t domainId, uint16_t param0, uint16_t param1,
     uint16_t param2, uint8_t u8ReadLen, uint8_t* pData, uint8_t* cc);
 
+// Allows sequential Crashdump GetFrame with the provided peci file
+// descriptor in the specified domain
+EPECIStatus peci_CrashDump_GetFrame_seq_dom(
+    uint8_t target, uint8_t domainId, uint16_t param0, uint16_t param1,
+    uint16_t param2, uint8_t u8ReadLen, uint8_t* pData, int peci_fd,
+    uint8_t* cc);
+
 // Provides raw PECI command access
 EPECIStatus peci_raw(uint8_t target, uint8_t u8ReadLen, const uint8_t* pRawCmd,
                      const uint32_t cmdSize, uint8_t* pRawResp,
@@ -393,13 +504,708 @@ EPECIStatus peci_raw_seq(uint8_t target, uint8_t u8ReadLen,
                          uint8_t* pRawResp, uint32_t respSize, int peci_fd);
 
 EPECIStatus peci_Lock(int* peci_fd, int timeout_ms);
+// Locks the given PECI device without changing the device set by
+// peci_SetDevName, for use with the _seq functions
+EPECIStatus peci_LockDev(const char* peci_dev, int* peci_fd, int timeout_ms);
 void peci_Unlock(int peci_fd);
 EPECIStatus peci_Ping(uint8_t target);
 EPECIStatus peci_Ping_seq(uint8_t target, int peci_fd);
+// Gets the Device Info Byte (DIB) of the target
+EPECIStatus peci_GetDIB(uint8_t target, uint64_t* dib);
+EPECIStatus peci_GetDIB_seq(uint8_t target, uint64_t* dib, int peci_fd);
 EPECIStatus peci_GetCPUID(const uint8_t clientAddr, CPUModel* cpuModel,
                           uint8_t* stepping, uint8_t* cc);
 void peci_SetDevName(char* peci_dev);
 
+// Circuit breaker settings.  After failureThreshold consecutive timeouts or
+// driver errors from a target, commands to it fail fast with
+// PECI_CC_CIRCUIT_OPEN.  The target is pinged after probeMinMs, doubling up
+// to probeMaxMs between pings, and the circuit closes when it answers.
+typedef struct
+{
+    uint32_t failureThreshold;
+    uint32_t probeMinMs;
+    uint32_t probeMaxMs;
+} PECICircuitBreakerConfig;
+
+// Enables the per-target circuit breaker for every PECI device used by the
+// process, or disables it if config is null
+void peci_SetCircuitBreaker(const PECICircuitBreakerConfig* config);
+// Returns true if commands to the target are failing fast on any device
+bool peci_CircuitOpen(uint8_t target);
+// Closes the circuit for the target on every device
+void peci_ResetCircuit(uint8_t target);
+
+// Coalescing settings.  Identical GetTemp and RdPkgConfig reads issued by
+// different threads while one of them is on the bus share its result, and
+// so do reads issued up to freshnessMs after it succeeded.  A freshnessMs of
+// zero only shares reads that are in flight.  Only package config reads
+// without side effects, such as the CPU ID, temperatures, energy counters
+// and TDP values, are shared.  Reads in flight are only joined by _seq
+// calls on a shared peci file descriptor; the plain wrappers hold the
+// device for each call, so they only share results within freshnessMs.
+typedef struct
+{
+    uint32_t freshnessMs;
+} PECICoalesceConfig;
+
+// Enables coalescing of identical reads for every PECI device used by the
+// process, or disables it if config is null
+void peci_SetCoalescing(const PECICoalesceConfig* config);
+
+// Read-through cache for package config values.  A rule gives how long the
+// value of an index, and optionally a single parameter, may be reused.
+// Built-in rules cache the CPU ID, platform ID, max thread ID, microcode
+// revision, TDP, TDP unit, TDP level and turbo ratio limit reads until the
+// host resets.  Rules passed in are checked first, and a ttlMs of zero
+// turns caching off for a built-in rule.
+#define PECI_CACHE_UNTIL_RESET UINT32_MAX
+
+typedef struct
+{
+    uint8_t index;
+    uint16_t param;
+    bool anyParam;
+    uint32_t ttlMs;
+} PECICacheRule;
+
+typedef struct
+{
+    const PECICacheRule* rules;
+    size_t ruleCount;
+} PECICacheConfig;
+
+// Enables the cache for every PECI device used by the process, or disables
+// it if config is null.  Values are kept per device.  A target's values on a
+// device are dropped when a command to it times out or finds it absent, and
+// on every device when its topology changes.
+EPECIStatus peci_SetCache(const PECICacheConfig* config);
+// Drops the cached values of a target on every device, for callers that
+// know the host reset
+void peci_CacheInvalidate(uint8_t target);
+
+// Cross-process arbitration for the PECI device.  Processes that enable it
+// queue for the device in a shared-memory region of its own, named after
+// the resolved device path (/dev/shm/peci-arbiter-dev-peci-0 for
+// /dev/peci-0), before opening it.  The device goes to the waiter with the
+// most urgent priority class, first come first served within a class, and
+// a waiter moves up one class for every agingMs it has waited (zero turns
+// aging off).  If a holder or waiter dies, its place is reclaimed.  Setting
+// PECI_PRIORITY=critical, normal or bulk in the environment enables it with
+// that class on first use.
+#define PECI_ARBITRATION_SHM "/peci-arbiter"
+#define PECI_ARBITRATION_MAX_WAITERS 32
+#define PECI_PRIORITY_COUNT 3
+
+typedef enum
+{
+    PECI_PRIORITY_DEFAULT = -1, // the process class, for thread overrides
+    PECI_PRIORITY_CRITICAL = 0, // control loops such as fan control
+    PECI_PRIORITY_NORMAL = 1,
+    PECI_PRIORITY_BULK = 2, // crashdump and other diagnostics
+} EPECIPriority;
+
+typedef struct
+{
+    EPECIPriority priority;
+    uint32_t agingMs;
+} PECIArbitrationConfig;
+
+typedef struct
+{
+    int32_t pid;
+    int32_t tid;
+    char comm[16];
+    EPECIPriority priority;
+    uint64_t elapsed_ns; // time held, or waited so far
+} PECIArbitrationClient;
+
+typedef struct
+{
+    uint64_t acquired;
+    uint64_t timeouts;
+    uint64_t wait_ns; // total wait of acquired locks
+    uint64_t maxWait_ns;
+} PECIArbitrationClassStats;
+
+typedef struct
+{
+    bool held;
+    PECIArbitrationClient holder;
+    uint32_t waiterCount;
+    PECIArbitrationClient waiters[PECI_ARBITRATION_MAX_WAITERS];
+    uint64_t reclaimed; // holds taken back from dead processes
+    PECIArbitrationClassStats classes[PECI_PRIORITY_COUNT];
+} PECIArbitrationStatus;
+
+// Enables arbitration for every device lock taken by the process, or
+// disables it if config is null
+EPECIStatus peci_SetArbitration(const PECIArbitrationConfig* config);
+// Sets the priority class of locks taken by the calling thread.
+// PECI_PRIORITY_DEFAULT reverts to the process class.
+void peci_SetThreadPriority(EPECIPriority priority);
+// Gets the current holder, the waiters and per-class statistics of the
+// queue of the calling thread's device.  Works without enabling
+// arbitration, for monitoring tools.
+EPECIStatus peci_GetArbitrationStatus(PECIArbitrationStatus* status);
+
+// Device lock profiling.  Processes that enable it record each lock of the
+// PECI device in a shared-memory region (/dev/shm/peci-lockprof): the locks
+// waiting or held right now, and the last PECI_LOCKPROF_HISTORY finished
+// locks with their holder, wait time and hold time.  Threads can tag their
+// locks to tell callers within a process apart.  A lock that fails reports
+// the current holder of the same device in its busy message.  Setting
+// PECI_LOCKPROF=1 in the environment enables it on first use.
+#define PECI_LOCKPROF_SHM "/peci-lockprof"
+#define PECI_LOCKPROF_MAX_LIVE 64
+#define PECI_LOCKPROF_HISTORY 256
+#define PECI_LOCK_TAG_LEN 16
+
+typedef enum
+{
+    PECI_LOCK_WAITING,
+    PECI_LOCK_HELD,
+    PECI_LOCK_RELEASED,
+    PECI_LOCK_BUSY, // the wait timed out
+} EPECILockState;
+
+typedef struct
+{
+    int32_t pid;
+    int32_t tid;
+    char comm[16];
+    char tag[PECI_LOCK_TAG_LEN];
+    EPECILockState state;
+    uint64_t wait_ns; // time waited, so far if still waiting
+    uint64_t hold_ns; // time held, so far if still held
+    uint64_t end_ns;  // monotonic time the lock finished, zero if live
+} PECILockRecord;
+
+typedef struct
+{
+    uint32_t liveCount;
+    PECILockRecord live[PECI_LOCKPROF_MAX_LIVE];
+    uint32_t historyCount;
+    PECILockRecord history[PECI_LOCKPROF_HISTORY]; // oldest first
+    uint64_t locks;   // locks taken since the region was created
+    uint64_t busy;    // locks that timed out
+    uint64_t dropped; // locks not recorded because the tables were full
+    uint64_t reaped;  // live locks of processes that died
+} PECILockProfile;
+
+// Enables or disables profiling of every device lock taken by the process
+EPECIStatus peci_SetLockProfiling(bool enable);
+// Tags the device locks taken by the calling thread, or clears the tag if
+// tag is null.  Tags are truncated to PECI_LOCK_TAG_LEN - 1 characters.
+void peci_SetLockTag(const char* tag);
+// Gets the live and recent locks of every profiled process.  Works without
+// enabling profiling, for monitoring tools.
+EPECIStatus peci_GetLockProfile(PECILockProfile* profile);
+
+// Gets the presence, DIB, CPU model and domains of every client on the bus.
+// The result is cached per process and only probed again when refresh is
+// set or the device name changes.  Fails without caching anything if no
+// client answered because of driver errors.
+EPECIStatus peci_GetTopology(PECITopology* topology, bool refresh);
+
+// Gets the topology, probing it with the provided peci file descriptor if
+// needed
+EPECIStatus peci_GetTopology_seq(PECITopology* topology, bool refresh,
+                                 int peci_fd);
+
+// Reads the static identity of every present socket in one pass on a single
+// open of the device.  The result is cached per process and only read again
+// when refresh is set or the topology changes.  Fields that could not be
+// read, left clear in validMask, are read again on the next call.
+EPECIStatus peci_GetInventory(PECIInventory* inventory, bool refresh);
+// Reads the inventory with the provided peci file descriptor
+EPECIStatus peci_GetInventory_seq(PECIInventory* inventory, bool refresh,
+                                  int peci_fd);
+
+// Gets the operations for the CPU model of a client, probing the topology
+// if it is not cached.  Returns null if the client is not present or its
+// model is not supported, in which case the topology is probed again on a
+// later call, at most once a second, in case the client has come up since.
+const PECIModelOps* peci_GetModelOps(uint8_t target);
+// Gets the model operations, probing with the provided peci file descriptor
+// if needed
+const PECIModelOps* peci_GetModelOps_seq(uint8_t target, int peci_fd);
+
+// Reads local PCI config space with the command the client's model
+// requires.  Fails with PECI_CC_CPU_NOT_PRESENT if the client is not
+// present, or PECI_CC_INVALID_REQ if its model is not supported.
+EPECIStatus peci_ModelRdPCIConfigLocal(
+    uint8_t target, uint8_t domainId, uint8_t u8Bus, uint8_t u8Device,
+    uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIReg,
+    uint8_t* cc);
+// Allows sequential model local PCI reads with the provided peci file
+// descriptor
+EPECIStatus peci_ModelRdPCIConfigLocal_seq(
+    uint8_t target, uint8_t domainId, uint8_t u8Bus, uint8_t u8Device,
+    uint8_t u8Fcn, uint16_t u16Reg, uint8_t u8ReadLen, uint8_t* pPCIReg,
+    int peci_fd, uint8_t* cc);
+
+// Sets the PECI device used by the calling thread, overriding
+// peci_SetDevName.  A null name reverts to the process-wide device.
+void peci_SetThreadDevName(const char* peci_dev);
+
+// Opens a VCU sequence on the provided peci file descriptor.  Every step
+// after timeout_ms has passed aborts the sequence and returns
+// PECI_CC_TIMEOUT.  Any failed step (driver error or completion code other
+// than PECI_DEV_CC_SUCCESS) aborts the sequence automatically.
+EPECIStatus peci_VCUOpen_seq(PECIVCUSequence* seq, uint8_t target,
+                             uint8_t domainId, EPECISequence seqId,
+                             int timeout_ms, int peci_fd, uint8_t* cc);
+// Sets the next parameter of an open VCU sequence
+EPECIStatus peci_VCUSetParam(PECIVCUSequence* seq, uint32_t u32Param,
+                             uint8_t* cc);
+// Reads up to count dwords from an open VCU sequence.  A read that fails
+// with a completion code asking for a retry (0x8x) stops the loop but
+// leaves the sequence open so the read can be retried.
+EPECIStatus peci_VCURead(PECIVCUSequence* seq, uint32_t* pData, size_t count,
+                         size_t* readCount, uint8_t* cc);
+// Closes an open VCU sequence
+EPECIStatus peci_VCUClose(PECIVCUSequence* seq, uint8_t* cc);
+// Aborts an open VCU sequence
+void peci_VCUAbort(PECIVCUSequence* seq);
+
+// Runs a complete open/set parameters/read/close VCU sequence.  Reads the
+// CPU asks to retry are retried with backoff, and if readLen dwords still
+// cannot be read the sequence is aborted and PECI_CC_TIMEOUT returned.
+EPECIStatus peci_VCURunSequence(
+    uint8_t target, uint8_t domainId, EPECISequence seqId,
+    const uint32_t* params, size_t paramCount, uint32_t* pData,
+    size_t readLen, int timeout_ms, uint8_t* cc);
+
+// Runs a complete VCU sequence with the provided peci file descriptor
+EPECIStatus peci_VCURunSequence_seq(
+    uint8_t target, uint8_t domainId, EPECISequence seqId,
+    const uint32_t* params, size_t paramCount, uint32_t* pData,
+    size_t readLen, int timeout_ms, int peci_fd, uint8_t* cc);
+
+// Bump allocator for batch working memory and results.  Memory comes from
+// a caller buffer, or from a single allocation made by peci_ArenaInit, and
+// is handed out in order and released all at once.  APIs that take an arena
+// do not allocate, so a preallocated arena keeps allocations out of the
+// threads that run them.
+#define PECI_ARENA_ALIGN 16
+// Arena space for count objects of size bytes.  Add PECI_ARENA_ALIGN for a
+// caller buffer that is not aligned to it.
+#define PECI_ARENA_SIZE(count, size)                                          \
+    ((count) * (((size) + PECI_ARENA_ALIGN - 1) &                              \
+                ~(size_t)(PECI_ARENA_ALIGN - 1)))
+
+typedef struct
+{
+    uint8_t* base;
+    size_t size;
+    size_t used;
+    bool owned; // base was allocated by peci_ArenaInit
+} PECIArena;
+
+// Sets up an arena over buf, or over one allocation of size bytes if buf is
+// null
+EPECIStatus peci_ArenaInit(PECIArena* arena, void* buf, size_t size);
+// Returns size zeroed bytes aligned to PECI_ARENA_ALIGN, or null if the
+// arena is full
+void* peci_ArenaAlloc(PECIArena* arena, size_t size);
+// Releases everything handed out from the arena
+void peci_ArenaReset(PECIArena* arena);
+// Frees the arena's memory if peci_ArenaInit allocated it
+void peci_ArenaFree(PECIArena* arena);
+
+// Streaming collector for dump sequences such as VCU_ARRAY_DUMP_SEQ and
+// VCU_SCAN_DUMP_SEQ
+#define PECI_DUMP_BUF_DWORDS 1024
+
+typedef struct
+{
+    uint64_t dwordsDone;
+    uint64_t dwordsTotal;
+    uint64_t bytesWritten;
+    uint64_t elapsed_ns;
+    uint64_t bytesPerSec;
+    uint32_t retries; // reads the CPU asked to retry
+} PECIDumpProgress;
+
+typedef void (*PECIDumpProgressCb)(const PECIDumpProgress* progress,
+                                   void* ctx);
+
+typedef struct
+{
+    // Set by peci_DumpInit
+    uint8_t target;
+    uint8_t domainId;
+    EPECISequence seqId;
+    uint64_t dwordCount; // dwords to collect
+    int out_fd;          // dump data is written here as it is collected
+    // Optional, may be changed after peci_DumpInit
+    const uint32_t* params; // sequence parameters
+    size_t paramCount;
+    int timeout_ms;      // deadline for the whole dump, from the first run
+    uint32_t maxRetries; // consecutive retries of one read before giving up
+    PECIDumpProgressCb progressCb; // called after every write
+    void* cbCtx;
+    // Collector state
+    PECIVCUSequence seq;
+    PECIDumpProgress progress;
+    uint64_t start_ns;
+    size_t bufCount;
+    uint32_t buf[PECI_DUMP_BUF_DWORDS];
+} PECIDumpCollector;
+
+// Initializes a dump collector that writes dwordCount dwords from the
+// sequence to out_fd
+EPECIStatus peci_DumpInit(PECIDumpCollector* dump, uint8_t target,
+                          uint8_t domainId, EPECISequence seqId,
+                          uint64_t dwordCount, int out_fd);
+
+// Collects the dump, or resumes it if a previous run returned
+// PECI_CC_TIMEOUT after the CPU kept asking for retries
+EPECIStatus peci_DumpRun(PECIDumpCollector* dump, uint8_t* cc);
+
+// Collects or resumes the dump with the provided peci file descriptor
+EPECIStatus peci_DumpRun_seq(PECIDumpCollector* dump, int peci_fd,
+                             uint8_t* cc);
+
+// Aborts a dump that is not going to be resumed
+void peci_DumpAbort(PECIDumpCollector* dump, int peci_fd);
+
+// Uncore debug capture container: a PECICaptureHeader followed by records
+// back to back.  Each record is a PECICaptureRecord followed by dwordCount
+// dwords of sequence output, padded with a zero dword to keep the next record
+// 8 byte aligned.  The output of one sequence may be split over
+// several records, which are interleaved with the records of other sockets
+// and domains.
+#define PECI_CAPTURE_MAGIC "PECICAP1"
+#define PECI_CAPTURE_VERSION 1
+#define PECI_CAPTURE_CHUNK_DWORDS 64
+#define PECI_CAPTURE_LAST 0x01  // last record of the sequence
+#define PECI_CAPTURE_ERROR 0x02 // the sequence failed, see status and cc
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t hdr_size;
+} PECICaptureHeader;
+
+typedef struct
+{
+    uint32_t dwordCount; // dwords following this record
+    uint32_t seqId;
+    uint32_t offset; // dword offset of this chunk in the sequence output
+    uint8_t target;
+    uint8_t domainId;
+    uint8_t cc;
+    uint8_t flags;
+    int32_t status; // EPECIStatus of the failed step
+    uint32_t reserved;
+    uint64_t timestamp_ns; // CLOCK_MONOTONIC when the chunk was read
+} PECICaptureRecord;
+
+// A sequence to capture from every present socket
+typedef struct
+{
+    EPECISequence seqId;
+    const uint32_t* params;
+    size_t paramCount;
+    uint32_t dwordCount;
+    uint8_t domainCount; // 1 for sequences that only run on domain 0
+} PECICaptureSeq;
+
+typedef struct
+{
+    uint8_t socketMask; // bit n is set if MIN_CLIENT_ADDR + n responded
+    uint32_t sequences; // sequences run across all sockets and domains
+    uint32_t failed;
+    uint64_t dwords;
+    uint64_t bytesWritten;
+    uint64_t elapsed_ns;
+} PECICaptureStats;
+
+// Runs the sequences (e.g. VCU_TOR_DUMP_SEQ, VCU_SQ_DUMP_SEQ and
+// VCU_UNCORE_CRASHDUMP_SEQ) on every present socket and domain, and writes
+// the output to out_fd as a capture container
+EPECIStatus peci_UncoreCapture(const PECICaptureSeq* seqs, size_t seqCount,
+                               int out_fd, int timeout_ms,
+                               PECICaptureStats* stats);
+
+// Runs the capture with the provided peci file descriptor
+EPECIStatus peci_UncoreCapture_seq(const PECICaptureSeq* seqs,
+                                   size_t seqCount, int out_fd,
+                                   int timeout_ms, int peci_fd,
+                                   PECICaptureStats* stats);
+
+// Gets the arena space a capture of the sequences needs
+size_t peci_UncoreCaptureArenaSize(const PECICaptureSeq* seqs,
+                                   size_t seqCount);
+
+// Runs the capture with its working memory taken from arena instead of the
+// heap.  Everything it takes from the arena is given back on return.
+EPECIStatus peci_UncoreCaptureArena_seq(
+    const PECICaptureSeq* seqs, size_t seqCount, int out_fd, int timeout_ms,
+    int peci_fd, PECIArena* arena, PECICaptureStats* stats);
+
+// Command graphs: a small DAG of PECI commands run on one session, where
+// arguments of later commands are taken from the results of earlier ones.
+#define PECI_GRAPH_MAX_NODES 64
+// Most edges and bindings a graph may have, so no node can depend on more
+// than a 16-bit count of others
+#define PECI_GRAPH_MAX_EDGES 1024
+#define PECI_GRAPH_MAX_BINDINGS 1024
+#define PECI_GRAPH_MAX_ARGS 6
+#define PECI_GRAPH_MAX_DATA 16
+
+// Node operations and the meaning of their arguments.  Results are returned
+// in the little-endian byte order of the command.
+typedef enum
+{
+    PECI_GRAPH_PING,                   // no arguments, no data
+    PECI_GRAPH_GET_TEMP,               // no arguments, 2 bytes
+    PECI_GRAPH_RD_PKG_CONFIG,          // index, param, len
+    PECI_GRAPH_WR_PKG_CONFIG,          // index, param, value, len
+    PECI_GRAPH_RD_IA_MSR,              // thread, MSR address; 8 bytes
+    PECI_GRAPH_RD_PCI_CONFIG,          // bus, dev, fcn, reg; 4 bytes
+    PECI_GRAPH_RD_PCI_CONFIG_LOCAL,    // bus, dev, fcn, reg, len
+    PECI_GRAPH_RD_END_POINT_PCI_LOCAL, // seg, bus, dev, fcn, reg, len
+    PECI_GRAPH_RD_MODEL_PCI_LOCAL,     // bus, dev, fcn, reg, len; by model
+    PECI_GRAPH_CRASHDUMP_DISCOVERY,    // subopcode, param0-2, len
+    PECI_GRAPH_CRASHDUMP_GET_FRAME,    // param0-2, len
+} EPECIGraphOp;
+
+typedef struct
+{
+    EPECIGraphOp op;
+    uint8_t target;
+    uint8_t domainId;
+    uint32_t args[PECI_GRAPH_MAX_ARGS];
+} PECIGraphNode;
+
+// Conditions on the result of the node an edge comes from.  A node succeeds
+// if its command returns PECI_CC_SUCCESS and, if the command has a
+// completion code, PECI_DEV_CC_SUCCESS.
+typedef enum
+{
+    PECI_GRAPH_ALWAYS,     // the node ran, whatever the result
+    PECI_GRAPH_ON_SUCCESS, // the node succeeded
+    PECI_GRAPH_ON_FAILURE, // the node ran and did not succeed
+    PECI_GRAPH_ON_CC,      // the command returned (cc & mask) == value
+    PECI_GRAPH_ON_DATA,    // the node succeeded and (dword 0 & mask) == value
+} EPECIGraphCondition;
+
+// A node only runs once every node it depends on has run or been skipped,
+// and every edge into it holds.  Edges from a skipped node never hold, so
+// skipping a node also skips the nodes that depend on it.
+typedef struct
+{
+    uint16_t from;
+    uint16_t to;
+    EPECIGraphCondition when;
+    uint32_t mask;
+    uint32_t value;
+} PECIGraphEdge;
+
+// Sets argument arg of node "to" before it runs, from width (1 to 4) bytes
+// of the result of node "from" starting at offset, shifted right by shift
+// and masked with mask (zero for all bits).  Implies a PECI_GRAPH_ON_SUCCESS
+// edge.
+typedef struct
+{
+    uint16_t from;
+    uint16_t to;
+    uint8_t arg;
+    uint8_t offset;
+    uint8_t width;
+    uint8_t shift;
+    uint32_t mask;
+} PECIGraphBinding;
+
+typedef struct
+{
+    const PECIGraphNode* nodes;
+    size_t nodeCount;
+    const PECIGraphEdge* edges;
+    size_t edgeCount;
+    const PECIGraphBinding* bindings;
+    size_t bindingCount;
+} PECIGraph;
+
+typedef enum
+{
+    PECI_GRAPH_NOT_RUN,
+    PECI_GRAPH_RAN,
+    PECI_GRAPH_SKIPPED,
+} EPECIGraphState;
+
+typedef struct
+{
+    EPECIGraphState state;
+    EPECIStatus status;
+    uint8_t cc;  // zero if the command failed or has no completion code
+    uint8_t len; // bytes of data returned
+    uint8_t data[PECI_GRAPH_MAX_DATA];
+} PECIGraphResult;
+
+// Runs a command graph on a single open of the device, with one result per
+// node.  Ready nodes are run in turns across targets, so independent
+// branches for different sockets are interleaved.  Returns
+// PECI_CC_INVALID_REQ without running anything if the graph has a cycle,
+// too many nodes, edges or bindings, or an out of range node, argument or
+// byte.
+EPECIStatus peci_RunGraph(const PECIGraph* graph, PECIGraphResult* results);
+
+// Runs a command graph with the provided peci file descriptor
+EPECIStatus peci_RunGraph_seq(const PECIGraph* graph,
+                              PECIGraphResult* results, int peci_fd);
+
+// Sends PECI commands through the PECI broker listening on the Unix socket
+// path (/run/peci-broker.sock by default) instead of opening the PECI
+// device.  A null path goes back to using the device directly.  Setting
+// PECI_BROKER in the environment does the same on first use.
+EPECIStatus peci_SetBroker(const char* path);
+
+// Shared-memory submission and completion rings between a client and the
+// process that owns the PECI device.  The client queues raw PECI commands
+// (in the peci_raw format) on the submission ring and reaps their results
+// from the completion ring.  Eventfd doorbells are only rung when the other
+// side is idle, so a batch of commands costs at most one syscall each way.
+#define PECI_RING_MAX_DATA 32
+#define PECI_RING_MAX_ENTRIES 4096
+
+typedef struct
+{
+    uint64_t user_data; // returned in the completion
+    uint8_t target;
+    uint8_t txLen;
+    uint8_t rxLen;
+    uint8_t reserved;
+    uint8_t tx[PECI_RING_MAX_DATA];
+} PECIRingSqe;
+
+typedef struct
+{
+    uint64_t user_data;
+    int32_t status; // EPECIStatus
+    uint8_t rxLen;
+    uint8_t reserved[3];
+    uint8_t rx[PECI_RING_MAX_DATA];
+} PECIRingCqe;
+
+typedef struct peci_ring PECIRing;
+
+// Creates a ring with room for entries commands (a power of two) that runs
+// commands on the provided peci file descriptor
+EPECIStatus peci_RingCreate(uint32_t entries, int peci_fd, PECIRing** ring);
+// Gets the descriptors a client needs to attach to the ring
+void peci_RingGetFds(const PECIRing* ring, int* shm_fd, int* sq_efd,
+                     int* cq_efd);
+// Runs up to max queued commands and returns how many ran.  Call it when
+// sq_efd is readable, and again while it returns max.
+size_t peci_RingProcess(PECIRing* ring, size_t max);
+
+// Attaches to a ring created by another process.  The descriptors are
+// duplicated, so the caller may close its copies.
+EPECIStatus peci_RingAttach(int shm_fd, int sq_efd, int cq_efd,
+                            PECIRing** ring);
+// Asks the PECI broker for a ring on the calling thread's PECI device
+EPECIStatus peci_RingConnect(uint32_t entries, PECIRing** ring);
+// Queues up to count commands and sets *submitted to the number queued.  No
+// more than the ring size may be in flight before they are reaped.
+EPECIStatus peci_RingSubmit(PECIRing* ring, const PECIRingSqe* sqes,
+                            size_t count, size_t* submitted);
+// Copies up to max completions and returns how many were copied
+size_t peci_RingReap(PECIRing* ring, PECIRingCqe* cqes, size_t max);
+// Waits until at least minComplete completions are ready to reap
+EPECIStatus peci_RingWait(PECIRing* ring, size_t minComplete, int timeout_ms);
+
+// Detaches from or destroys the ring
+void peci_RingClose(PECIRing* ring);
+
+// Sampled values published in shared memory (/dev/shm) for other processes.
+// One writer samples the bus and publishes each value under a key, and any
+// number of readers get the latest value with its timestamp and age without
+// system calls or bus traffic.  Each record is guarded by its own sequence
+// lock, so the writer never waits on readers.  Only one thread may publish
+// to a region.
+#define PECI_SNAPSHOT_DEFAULT "/peci-snapshot"
+#define PECI_SNAPSHOT_MAX_RECORDS 4096
+
+// Suggested keys, so daemons sharing a region agree on what each value is
+#define PECI_SNAPSHOT_KEY(kind, target, index)                                 \
+    (((uint32_t)(kind) << 24) | ((uint32_t)(target) << 16) | (uint16_t)(index))
+
+typedef enum
+{
+    PECI_SNAPSHOT_PKG_TEMP = 1,   // peci_GetTemp, index 0
+    PECI_SNAPSHOT_PKG_ENERGY,     // package energy counter, index 0
+    PECI_SNAPSHOT_DRAM_ENERGY,    // DRAM energy counter, index 0
+    PECI_SNAPSHOT_CORE_TEMP,      // per core DTS margin, index is the core
+    PECI_SNAPSHOT_DIMM_TEMP,      // index is the DIMM
+    PECI_SNAPSHOT_USER = 0x80,    // first kind free for private use
+} EPECISnapshotKind;
+
+typedef struct
+{
+    uint32_t key;
+    uint64_t value;
+    uint64_t timestamp_ns; // CLOCK_MONOTONIC time the value was published
+    uint64_t age_ns;       // time since it was published
+} PECISnapshotValue;
+
+typedef struct peci_snapshot PECISnapshot;
+
+// Creates the region (PECI_SNAPSHOT_DEFAULT if name is null) for publishing
+// up to capacity values, replacing any earlier region under the name
+EPECIStatus peci_SnapshotCreate(const char* name, uint32_t capacity,
+                                PECISnapshot** snap);
+// Publishes value under key, stamped with the current time
+EPECIStatus peci_SnapshotPublish(PECISnapshot* snap, uint32_t key,
+                                 uint64_t value);
+
+// Opens a region read-only (PECI_SNAPSHOT_DEFAULT if name is null)
+EPECIStatus peci_SnapshotOpen(const char* name, PECISnapshot** snap);
+// Returns the number of values published so far
+uint32_t peci_SnapshotCount(const PECISnapshot* snap);
+// Reads the value at index, from 0 to the count
+EPECIStatus peci_SnapshotRead(const PECISnapshot* snap, uint32_t index,
+                              PECISnapshotValue* value);
+// Reads the value published under key
+EPECIStatus peci_SnapshotLookup(const PECISnapshot* snap, uint32_t key,
+                                PECISnapshotValue* value);
+
+// Unmaps the region, which stays published for other readers
+void peci_SnapshotClose(PECISnapshot* snap);
+
+// Starts recording every PECI command issued by this process to a binary
+// trace file.  Setting PECI_TRACE in the environment does the same on first
+// use.
+EPECIStatus peci_TraceStart(const char* path);
+// Writes the trace records buffered by the calling thread
+void peci_TraceFlush(void);
+// Flushes the calling thread's records and stops recording
+void peci_TraceStop(void);
+
+// Serves PECI commands from a recorded trace instead of the PECI device,
+// optionally taking as long as each recorded command took
+EPECIStatus peci_SimStart(const char* tracePath, bool realTime);
+void peci_SimStop(void);
+
+typedef struct
+{
+    uint64_t commands;    // commands replayed
+    uint64_t mismatches;  // commands whose result differed from the trace
+    uint64_t skipped;     // records that could not be replayed
+    uint64_t elapsed_ns;  // time taken by the replay
+    uint64_t recorded_ns; // time taken by the recorded traffic
+} PECITraceReplayStats;
+
+// Issues the commands recorded in a trace, in order, on the current PECI
+// device and compares the results, optionally keeping the recorded spacing
+// between commands
+EPECIStatus peci_TraceReplay(const char* tracePath, bool realTime,
+                             PECITraceReplayStats* stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,783 @@
+/*
+// Copyright (c) 2026 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include "peci_arbiter.h"
+
+#include "peci_trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PECI_ARB_MAGIC 0x41434550 // "PECA"
+#define PECI_ARB_VERSION 1
+
+// Waiters look for a dead holder this often
+#define PECI_ARB_CHECK_MS 50
+// How long to wait for another process to finish creating a region
+#define PECI_SHM_INIT_WAIT_MS 1000
+
+// Descriptors of one process that can hold the device at once
+#define PECI_ARB_MAX_HELD 16
+// Devices one process can queue for
+#define PECI_ARB_MAX_DEVICES 8
+
+struct peci_arb_client
+{
+    int32_t pid;
+    int32_t tid;
+    uint64_t ticket;
+    uint64_t since_ns;
+    uint32_t agingMs;
+    uint8_t priority;
+    char comm[16];
+};
+
+// Shared region.  The header's condition is broadcast whenever the device
+// is released.
+struct peci_arb_region
+{
+    struct peci_shm_header hdr;
+    uint64_t nextTicket;
+    bool held;
+    struct peci_arb_client holder;
+    uint32_t waiterCount;
+    struct peci_arb_client waiters[PECI_ARBITRATION_MAX_WAITERS];
+    uint64_t reclaimed;
+    PECIArbitrationClassStats classes[PECI_PRIORITY_COUNT];
+};
+
+atomic_bool peci_arb_on = false;
+
+static pthread_mutex_t peci_arb_map_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct
+{
+    char name[NAME_MAX + 1];
+    struct peci_arb_region* region;
+} peci_arb_regions[PECI_ARB_MAX_DEVICES];
+static unsigned int peci_arb_region_count;
+static atomic_int peci_arb_priority = PECI_PRIORITY_NORMAL;
+static atomic_uint peci_arb_aging_ms;
+static __thread int peci_arb_thread_priority = PECI_PRIORITY_DEFAULT;
+
+static pthread_mutex_t peci_arb_fd_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct
+{
+    int fd;
+    struct peci_arb_hold hold;
+} peci_arb_fds[PECI_ARB_MAX_HELD];
+static atomic_uint peci_arb_fd_count;
+
+static void peci_ShmSleepMs(long ms)
+{
+    struct timespec delay = {.tv_sec = 0, .tv_nsec = ms * 1000 * 1000};
+    nanosleep(&delay, NULL);
+}
+
+/*-------------------------------------------------------------------------
+ * This function initializes the header of a region this process created
+ *------------------------------------------------------------------------*/
+static bool peci_ShmInit(struct peci_shm_header* hdr, uint32_t magic,
+                         uint32_t version)
+{
+    pthread_mutexattr_t mattr;
+    pthread_condattr_t cattr;
+    bool ok = true;
+
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    if (pthread_mutex_init(&hdr->mutex, &mattr) != 0 ||
+        pthread_cond_init(&hdr->cond, &cattr) != 0)
+    {
+        ok = false;
+    }
+    pthread_condattr_destroy(&cattr);
+    pthread_mutexattr_destroy(&mattr);
+
+    hdr->version = version;
+    if (ok)
+    {
+        atomic_store_explicit(&hdr->magic, magic, memory_order_release);
+    }
+    return ok;
+}
+
+/*-------------------------------------------------------------------------
+ * This function removes a region whose creator died before initializing
+ * it, unless another process has already replaced it
+ *------------------------------------------------------------------------*/
+static void peci_ShmUnlinkStale(const char* name, int fd)
+{
+    struct stat ours;
+    struct stat named;
+
+    // Processes that find the same stale region take turns, so only the
+    // first one removes it and the others find its replacement
+    if (flock(fd, LOCK_EX) != 0)
+    {
+        return;
+    }
+    int current = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (current >= 0)
+    {
+        if (fstat(fd, &ours) == 0 && fstat(current, &named) == 0 &&
+            ours.st_dev == named.st_dev && ours.st_ino == named.st_ino)
+        {
+            syslog(LOG_WARNING, "PECI shared region %s left uninitialized\n",
+                   name);
+            shm_unlink(name);
+        }
+        close(current);
+    }
+    flock(fd, LOCK_UN);
+}
+
+/*-------------------------------------------------------------------------
+ * This function maps a shared region, creating it if it does not exist.
+ * stale is set if the region was left uninitialized by its creator.
+ *------------------------------------------------------------------------*/
+static void* peci_ShmMapOnce(const char* name, size_t size, uint32_t magic,
+                             uint32_t version, bool* stale)
+{
+    struct peci_shm_header* hdr = NULL;
+    struct stat st;
+
+    *stale = false;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+                      PECI_SHM_MODE);
+    bool creator = fd >= 0;
+    if (!creator && errno == EEXIST)
+    {
+        fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+    }
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    if (creator)
+    {
+        // Set the mode again, as shm_open applies the umask to it
+        if (fchmod(fd, PECI_SHM_MODE) != 0 || ftruncate(fd, (off_t)size) != 0)
+        {
+            shm_unlink(name);
+            goto Fail;
+        }
+    }
+    else
+    {
+        // The creator may not have sized the region yet
+        for (int waited = 0; fstat(fd, &st) == 0 && (size_t)st.st_size < size;
+             waited += PECI_TIMEOUT_RESOLUTION_MS)
+        {
+            if (waited >= PECI_SHM_INIT_WAIT_MS)
+            {
+                // A region sized for another layout is left alone
+                *stale = st.st_size == 0;
+                goto Fail;
+            }
+            peci_ShmSleepMs(PECI_TIMEOUT_RESOLUTION_MS);
+        }
+    }
+
+    hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED)
+    {
+        hdr = NULL;
+        goto Fail;
+    }
+
+    if (creator && !peci_ShmInit(hdr, magic, version))
+    {
+        shm_unlink(name);
+        goto Fail;
+    }
+    for (int waited = 0;; waited += PECI_TIMEOUT_RESOLUTION_MS)
+    {
+        uint32_t seen = atomic_load_explicit(&hdr->magic, memory_order_acquire);
+        if (seen == magic)
+        {
+            break;
+        }
+        // A region of some other kind is left alone
+        if (seen != 0 || waited >= PECI_SHM_INIT_WAIT_MS)
+        {
+            *stale = seen == 0;
+            goto Fail;
+        }
+        peci_ShmSleepMs(PECI_TIMEOUT_RESOLUTION_MS);
+    }
+    if (hdr->version != version)
+    {
+        goto Fail;
+    }
+    close(fd);
+    return hdr;
+
+Fail:
+    if (hdr != NULL)
+    {
+        munmap(hdr, size);
+    }
+    if (*stale)
+    {
+        peci_ShmUnlinkStale(name, fd);
+    }
+    close(fd);
+    return NULL;
+}
+
+/*-------------------------------------------------------------------------
+ * This function maps a shared region that starts with a peci_shm_header,
+ * creating it if this is the first process to use it.  A region whose
+ * creator died before initializing it is replaced.
+ *------------------------------------------------------------------------*/
+void* peci_shm_map(const char* name, size_t size, uint32_t magic,
+                   uint32_t version)
+{
+    bool stale = false;
+
+    void* hdr = peci_ShmMapOnce(name, size, magic, version, &stale);
+    if (hdr == NULL && stale)
+    {
+        hdr = peci_ShmMapOnce(name, size, magic, version, &stale);
+    }
+    if (hdr == NULL)
+    {
+        syslog(LOG_ERR, "PECI shared region %s unavailable\n", name);
+    }
+    return hdr;
+}
+
+/*-------------------------------------------------------------------------
+ * This function locks a shared region.  A lock left by a process that died
+ * holding it is taken over, and users of the region clean up after the
+ * dead process themselves.
+ *------------------------------------------------------------------------*/
+void peci_shm_lock(struct peci_shm_header* hdr)
+{
+    if (pthread_mutex_lock(&hdr->mutex) == EOWNERDEAD)
+    {
+        pthread_mutex_consistent(&hdr->mutex);
+    }
+}
+
+void peci_shm_unlock(struct peci_shm_header* hdr)
+{
+    pthread_mutex_unlock(&hdr->mutex);
+}
+
+bool peci_shm_alive(int32_t pid)
+{
+    return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+/*-------------------------------------------------------------------------
+ * This function names the arbitration region of a device after the path
+ * the lock will open, resolved so every name of a device shares its queue
+ *------------------------------------------------------------------------*/
+static bool peci_ArbName(const char* const* devices, char* name, size_t len)
+{
+    char path[PATH_MAX];
+    const char* device = devices[0];
+
+    if (realpath(devices[0], path) != NULL ||
+        (errno == ENOENT && devices[1] != NULL &&
+         realpath(devices[1], path) != NULL))
+    {
+        device = path;
+    }
+    int written = snprintf(name, len, "%s%s", PECI_ARBITRATION_SHM, device);
+    if (written < 0 || (size_t)written >= len)
+    {
+        return false;
+    }
+    for (char* c = name + 1; *c != '\0'; c++)
+    {
+        if (*c == '/')
+        {
+            *c = '-';
+        }
+    }
+    return true;
+}
+
+/*-------------------------------------------------------------------------
+ * This function maps the arbitration region of a device once per process
+ *------------------------------------------------------------------------*/
+static struct peci_arb_region* peci_ArbMap(const char* const* devices)
+{
+    char name[NAME_MAX + 1];
+    struct peci_arb_region* region = NULL;
+
+    if (!peci_ArbName(devices, name, sizeof(name)))
+    {
+        return NULL;
+    }
+    pthread_mutex_lock(&peci_arb_map_lock);
+    for (unsigned int i = 0; i < peci_arb_region_count; i++)
+    {
+        if (strcmp(peci_arb_regions[i].name, name) == 0)
+        {
+            region = peci_arb_regions[i].region;
+            break;
+        }
+    }
+    if (region == NULL)
+    {
+        if (peci_arb_region_count == PECI_ARB_MAX_DEVICES)
+        {
+            syslog(LOG_ERR, "PECI arbitration devices exhausted\n");
+        }
+        else
+        {
+            region = peci_shm_map(name, sizeof(*region), PECI_ARB_MAGIC,
+                                  PECI_ARB_VERSION);
+        }
+        if (region != NULL)
+        {
+            strcpy(peci_arb_regions[peci_arb_region_count].name, name);
+            peci_arb_regions[peci_arb_region_count].region = region;
+            peci_arb_region_count++;
+        }
+    }
+    pthread_mutex_unlock(&peci_arb_map_lock);
+    return region;
+}
+
+static bool peci_ArbAlive(const struct peci_arb_client* client)
+{
+    // Descriptors belong to the process, so a hold outlives its thread
+    return peci_shm_alive(client->pid);
+}
+
+static void peci_ArbRemove(struct peci_arb_region* region, uint32_t index)
+{
+    region->waiterCount--;
+    memmove(&region->waiters[index], &region->waiters[index + 1],
+            (region->waiterCount - index) * sizeof(region->waiters[0]));
+}
+
+/*-------------------------------------------------------------------------
+ * This function takes back the device and queue places of dead processes
+ *------------------------------------------------------------------------*/
+static void peci_ArbReap(struct peci_arb_region* region)
+{
+    if (region->held && !peci_ArbAlive(&region->holder))
+    {
+        region->held = false;
+        region->reclaimed++;
+        pthread_cond_broadcast(&region->hdr.cond);
+    }
+    // Guard against a corrupt count from a process that died mid-update
+    if (region->waiterCount > PECI_ARBITRATION_MAX_WAITERS)
+    {
+        region->waiterCount = PECI_ARBITRATION_MAX_WAITERS;
+    }
+    for (uint32_t i = 0; i < region->waiterCount;)
+    {
+        if (peci_ArbAlive(&region->waiters[i]))
+        {
+            i++;
+            continue;
+        }
+        peci_ArbRemove(region, i);
+    }
+}
+
+// Priority class of a waiter after aging
+static uint32_t peci_ArbEffective(const struct peci_arb_client* client,
+                                  uint64_t now_ns)
+{
+    uint32_t priority = client->priority;
+
+    if (client->agingMs != 0)
+    {
+        uint64_t steps =
+            (now_ns - client->since_ns) / (client->agingMs * 1000000ULL);
+        priority = steps >= priority ? 0 : priority - (uint32_t)steps;
+    }
+    return priority;
+}
+
+/*-------------------------------------------------------------------------
+ * This function returns the index of the waiter the device goes to next:
+ * the most urgent class after aging, then the oldest ticket
+ *------------------------------------------------------------------------*/
+static uint32_t peci_ArbNext(const struct peci_arb_region* region,
+                             uint64_t now_ns)
+{
+    uint32_t next = 0;
+
+    for (uint32_t i = 1; i < region->waiterCount; i++)
+    {
+        uint32_t p = peci_ArbEffective(&region->waiters[i], now_ns);
+        uint32_t best = peci_ArbEffective(&region->waiters[next], now_ns);
+        if (p < best || (p == best && region->waiters[i].ticket <
+                                          region->waiters[next].ticket))
+        {
+            next = i;
+        }
+    }
+    return next;
+}
+
+static int32_t peci_ArbFind(const struct peci_arb_region* region,
+                            uint64_t ticket)
+{
+    for (uint32_t i = 0; i < region->waiterCount; i++)
+    {
+        if (region->waiters[i].ticket == ticket)
+        {
+            return (int32_t)i;
+        }
+    }
+    return -1;
+}
+
+static struct timespec peci_ArbTimespec(uint64_t ns)
+{
+    struct timespec ts = {.tv_sec = (time_t)(ns / 1000000000ULL),
+                          .tv_nsec = (long)(ns % 1000000000ULL)};
+    return ts;
+}
+
+/*-------------------------------------------------------------------------
+ * This function waits in the shared queue of the device until it is
+ * granted to the calling thread
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_arb_acquire(const char* const* devices, int timeout_ms,
+                             struct peci_arb_hold* hold)
+{
+    struct peci_arb_region* region = peci_ArbMap(devices);
+    struct peci_arb_client me = {0};
+    uint64_t start_ns = peci_now_ns();
+    uint64_t deadline_ns = start_ns;
+
+    if (timeout_ms > 0)
+    {
+        deadline_ns += (uint64_t)timeout_ms * 1000000;
+    }
+
+    hold->region = NULL;
+    hold->ticket = 0;
+    if (region == NULL)
+    {
+        // Fall back to the device's own exclusive open
+        return PECI_CC_SUCCESS;
+    }
+
+    int priority = peci_arb_thread_priority;
+    if (priority == PECI_PRIORITY_DEFAULT)
+    {
+        priority =
+            atomic_load_explicit(&peci_arb_priority, memory_order_relaxed);
+    }
+    me.pid = getpid();
+    me.tid = (int32_t)syscall(SYS_gettid);
+    me.since_ns = start_ns;
+    me.agingMs =
+        atomic_load_explicit(&peci_arb_aging_ms, memory_order_relaxed);
+    me.priority = (uint8_t)priority;
+    prctl(PR_GET_NAME, me.comm, 0, 0, 0);
+
+    peci_shm_lock(&region->hdr);
+    peci_ArbReap(region);
+    if (region->waiterCount == PECI_ARBITRATION_MAX_WAITERS)
+    {
+        peci_shm_unlock(&region->hdr);
+        return PECI_CC_SUCCESS;
+    }
+    me.ticket = ++region->nextTicket;
+    region->waiters[region->waiterCount++] = me;
+
+    for (;;)
+    {
+        uint64_t now_ns = peci_now_ns();
+        PECIArbitrationClassStats* stats = &region->classes[me.priority];
+
+        peci_ArbReap(region);
+        int32_t index = peci_ArbFind(region, me.ticket);
+        if (index < 0)
+        {
+            // Another process took our place as dead, so queue again
+            if (region->waiterCount == PECI_ARBITRATION_MAX_WAITERS)
+            {
+                peci_shm_unlock(&region->hdr);
+                return PECI_CC_SUCCESS;
+            }
+            index = (int32_t)region->waiterCount++;
+            region->waiters[index] = me;
+        }
+        if (!region->held && peci_ArbNext(region, now_ns) == (uint32_t)index)
+        {
+            peci_ArbRemove(region, (uint32_t)index);
+            region->held = true;
+            region->holder = me;
+            region->holder.since_ns = now_ns;
+            stats->acquired++;
+            stats->wait_ns += now_ns - start_ns;
+            if (now_ns - start_ns > stats->maxWait_ns)
+            {
+                stats->maxWait_ns = now_ns - start_ns;
+            }
+            peci_shm_unlock(&region->hdr);
+            hold->region = region;
+            hold->ticket = me.ticket;
+            return PECI_CC_SUCCESS;
+        }
+        if (timeout_ms != PECI_WAIT_FOREVER && now_ns >= deadline_ns)
+        {
+            peci_ArbRemove(region, (uint32_t)index);
+            stats->timeouts++;
+            // Waiters behind us may be next now
+            pthread_cond_broadcast(&region->hdr.cond);
+            peci_shm_unlock(&region->hdr);
+            return PECI_CC_TIMEOUT;
+        }
+
+        uint64_t wake_ns = now_ns + PECI_ARB_CHECK_MS * 1000000ULL;
+        if (timeout_ms != PECI_WAIT_FOREVER && deadline_ns < wake_ns)
+        {
+            wake_ns = deadline_ns;
+        }
+        struct timespec wake = peci_ArbTimespec(wake_ns);
+        if (pthread_cond_timedwait(&region->hdr.cond, &region->hdr.mutex,
+                                   &wake) == EOWNERDEAD)
+        {
+            // The queue is cleaned of the dead process by peci_ArbReap
+            pthread_mutex_consistent(&region->hdr.mutex);
+        }
+    }
+}
+
+/*-------------------------------------------------------------------------
+ * This function gives the device to the next waiter
+ *------------------------------------------------------------------------*/
+void peci_arb_release(const struct peci_arb_hold* hold)
+{
+    struct peci_arb_region* region = hold->region;
+
+    if (hold->ticket == 0 || region == NULL)
+    {
+        return;
+    }
+    peci_shm_lock(&region->hdr);
+    if (region->held && region->holder.ticket == hold->ticket)
+    {
+        region->held = false;
+        pthread_cond_broadcast(&region->hdr.cond);
+    }
+    peci_shm_unlock(&region->hdr);
+}
+
+/*-------------------------------------------------------------------------
+ * This function records that the descriptor holds the place
+ *------------------------------------------------------------------------*/
+void peci_arb_bind(int peci_fd, const struct peci_arb_hold* hold)
+{
+    bool bound = false;
+
+    if (hold->ticket == 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&peci_arb_fd_lock);
+    unsigned int count =
+        atomic_load_explicit(&peci_arb_fd_count, memory_order_relaxed);
+    if (count < PECI_ARB_MAX_HELD)
+    {
+        peci_arb_fds[count].fd = peci_fd;
+        peci_arb_fds[count].hold = *hold;
+        atomic_store_explicit(&peci_arb_fd_count, count + 1,
+                              memory_order_relaxed);
+        bound = true;
+    }
+    pthread_mutex_unlock(&peci_arb_fd_lock);
+
+    if (!bound)
+    {
+        // The hold could never be released, so give it up now and keep the
+        // device on its exclusive open alone
+        syslog(LOG_ERR, "PECI arbitration holds exhausted\n");
+        peci_arb_release(hold);
+    }
+}
+
+/*-------------------------------------------------------------------------
+ * This function returns the place held by the descriptor and forgets it
+ *------------------------------------------------------------------------*/
+struct peci_arb_hold peci_arb_unbind(int peci_fd)
+{
+    struct peci_arb_hold hold = {0};
+
+    if (atomic_load_explicit(&peci_arb_fd_count, memory_order_relaxed) == 0)
+    {
+        return hold;
+    }
+    pthread_mutex_lock(&peci_arb_fd_lock);
+    unsigned int count =
+        atomic_load_explicit(&peci_arb_fd_count, memory_order_relaxed);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (peci_arb_fds[i].fd == peci_fd)
+        {
+            hold = peci_arb_fds[i].hold;
+            peci_arb_fds[i] = peci_arb_fds[count - 1];
+            atomic_store_explicit(&peci_arb_fd_count, count - 1,
+                                  memory_order_relaxed);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&peci_arb_fd_lock);
+    return hold;
+}
+
+/*-------------------------------------------------------------------------
+ * This function enables arbitration, checking that the queue of the given
+ * device can be used
+ *------------------------------------------------------------------------*/
+static EPECIStatus peci_ArbEnable(const PECIArbitrationConfig* config,
+                                  const char* const* devices)
+{
+    if (config->priority < PECI_PRIORITY_CRITICAL ||
+        config->priority >= PECI_PRIORITY_COUNT)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+    if (peci_ArbMap(devices) == NULL)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    atomic_store_explicit(&peci_arb_priority, config->priority,
+                          memory_order_relaxed);
+    atomic_store_explicit(&peci_arb_aging_ms, config->agingMs,
+                          memory_order_relaxed);
+    atomic_store_explicit(&peci_arb_on, true, memory_order_relaxed);
+    return PECI_CC_SUCCESS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function enables arbitration for every device lock taken by the
+ * process, or disables it if config is null
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_SetArbitration(const PECIArbitrationConfig* config)
+{
+    if (config == NULL)
+    {
+        atomic_store_explicit(&peci_arb_on, false, memory_order_relaxed);
+        return PECI_CC_SUCCESS;
+    }
+    return peci_ArbEnable(config, peci_dev_names());
+}
+
+/*-------------------------------------------------------------------------
+ * This function enables arbitration with the class named in the
+ * environment, for the device named in the environment
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_arb_set_env(const char* priority, const char* const* devices)
+{
+    static const char* const names[PECI_PRIORITY_COUNT] = {"critical",
+                                                           "normal", "bulk"};
+    PECIArbitrationConfig config = {0};
+
+    for (int i = 0; i < PECI_PRIORITY_COUNT; i++)
+    {
+        if (strcmp(priority, names[i]) == 0)
+        {
+            config.priority = (EPECIPriority)i;
+            return peci_ArbEnable(&config, devices);
+        }
+    }
+    return PECI_CC_INVALID_REQ;
+}
+
+/*-------------------------------------------------------------------------
+ * This function sets the priority class of locks taken by the calling
+ * thread
+ *------------------------------------------------------------------------*/
+void peci_SetThreadPriority(EPECIPriority priority)
+{
+    if (priority < PECI_PRIORITY_DEFAULT || priority >= PECI_PRIORITY_COUNT)
+    {
+        return;
+    }
+    peci_arb_thread_priority = priority;
+}
+
+static void peci_ArbCopyClient(PECIArbitrationClient* out,
+                               const struct peci_arb_client* client,
+                               uint64_t now_ns)
+{
+    out->pid = client->pid;
+    out->tid = client->tid;
+    memcpy(out->comm, client->comm, sizeof(out->comm));
+    out->comm[sizeof(out->comm) - 1] = '\0';
+    out->priority = (EPECIPriority)client->priority;
+    out->elapsed_ns = now_ns - client->since_ns;
+}
+
+/*-------------------------------------------------------------------------
+ * This function gets the current holder, the waiters and the per-class
+ * statistics of the shared queue of the calling thread's device
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_GetArbitrationStatus(PECIArbitrationStatus* status)
+{
+    if (status == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+    struct peci_arb_region* region = peci_ArbMap(peci_dev_names());
+    if (region == NULL)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+
+    memset(status, 0, sizeof(*status));
+    peci_shm_lock(&region->hdr);
+    peci_ArbReap(region);
+    uint64_t now_ns = peci_now_ns();
+    status->held = region->held;
+    if (region->held)
+    {
+        peci_ArbCopyClient(&status->holder, &region->holder, now_ns);
+    }
+    status->waiterCount = region->waiterCount;
+    for (uint32_t i = 0; i < region->waiterCount; i++)
+    {
+        peci_ArbCopyClient(&status->waiters[i], &region->waiters[i], now_ns);
+    }
+    status->reclaimed = region->reclaimed;
+    memcpy(status->classes, region->classes, sizeof(status->classes));
+    peci_shm_unlock(&region->hdr);
+    return PECI_CC_SUCCESS;
+}
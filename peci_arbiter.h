@@ -0,0 +1,90 @@
+/*
+// Copyright (c) 2026 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#pragma once
+#include <peci.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Internal interface between the device lock and the cross-process
+// arbiter and lock profiler.  Not installed.
+
+// Regions shared between processes under /dev/shm are created with this
+// mode whatever the umask, so the owner and group of the creating process
+// can use them
+#define PECI_SHM_MODE 0660
+
+// Regions shared between processes under /dev/shm start with this header.
+// Everything after it is protected by mutex, which is robust so a process
+// that dies while holding it does not wedge the others.
+struct peci_shm_header
+{
+    atomic_uint magic; // set once the region is initialized
+    uint32_t version;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // uses CLOCK_MONOTONIC
+};
+
+void* peci_shm_map(const char* name, size_t size, uint32_t magic,
+                   uint32_t version);
+void peci_shm_lock(struct peci_shm_header* hdr);
+void peci_shm_unlock(struct peci_shm_header* hdr);
+// Returns false once the process is known to be gone
+bool peci_shm_alive(int32_t pid);
+
+extern atomic_bool peci_arb_on;
+
+// Enables arbitration with the class named by PECI_PRIORITY.  Takes the
+// device from peci_InitOnce, which runs before peci_dev_names can.
+EPECIStatus peci_arb_set_env(const char* priority, const char* const* devices);
+
+// Names of the device used by the calling thread, from peci.c
+const char* const* peci_dev_names(void);
+
+struct peci_arb_region;
+
+// A place in the shared queue of one device.  ticket is zero if the lock
+// is not arbitrated.
+struct peci_arb_hold
+{
+    struct peci_arb_region* region;
+    uint64_t ticket;
+};
+
+// Waits for the device in its shared queue.  The hold is left empty if the
+// lock is not arbitrated, such as when the queue is full.
+EPECIStatus peci_arb_acquire(const char* const* devices, int timeout_ms,
+                             struct peci_arb_hold* hold);
+void peci_arb_release(const struct peci_arb_hold* hold);
+
+// Tracks which descriptor holds a place, so peci_Unlock can release it
+void peci_arb_bind(int peci_fd, const struct peci_arb_hold* hold);
+struct peci_arb_hold peci_arb_unbind(int peci_fd);
+
+extern atomic_bool peci_lockprof_on;
+
+// Records that the calling thread starts waiting for the device, as
+// identified by peci_DeviceStat.  Returns the id of the lock for
+// peci_lockprof_locked, or zero if it is not recorded.
+uint64_t peci_lockprof_wait(uint64_t device);
+// Records the outcome of the wait.  A successful lock is tracked under
+// peci_fd until peci_lockprof_unbind.
+void peci_lockprof_locked(uint64_t id, int peci_fd, EPECIStatus status);
+// Returns the lock held by the descriptor and forgets it, so it is done
+// before the descriptor is closed and can be reused
+uint64_t peci_lockprof_unbind(int peci_fd);
+void peci_lockprof_unlocked(uint64_t id);
+// Describes the profiled process holding the device, or empties buf
+void peci_lockprof_holder(uint64_t device, char* buf, size_t len);
@@ -0,0 +1,101 @@
+/*
+// Copyright (c) 2026 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <peci.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*-------------------------------------------------------------------------
+ * This function sets up an arena over the caller's buffer, or over one
+ * allocation of size bytes if buf is null
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_ArenaInit(PECIArena* arena, void* buf, size_t size)
+{
+    if (arena == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    arena->owned = buf == NULL;
+    if (arena->owned)
+    {
+        buf = aligned_alloc(PECI_ARENA_ALIGN, PECI_ARENA_SIZE(1, size));
+        if (buf == NULL)
+        {
+            return PECI_CC_MEM_ERR;
+        }
+    }
+    arena->base = buf;
+    arena->size = size;
+    arena->used = 0;
+    return PECI_CC_SUCCESS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function hands out size zeroed bytes from the arena, aligned to
+ * PECI_ARENA_ALIGN.  It returns null once the arena is full and never
+ * allocates.
+ *------------------------------------------------------------------------*/
+void* peci_ArenaAlloc(PECIArena* arena, size_t size)
+{
+    if (arena == NULL || arena->base == NULL)
+    {
+        return NULL;
+    }
+
+    // Caller buffers are only as aligned as the caller made them
+    uintptr_t addr = (uintptr_t)arena->base + arena->used;
+    size_t pad = (PECI_ARENA_ALIGN - addr % PECI_ARENA_ALIGN) %
+                 PECI_ARENA_ALIGN;
+    if (pad > arena->size - arena->used ||
+        size > arena->size - arena->used - pad)
+    {
+        return NULL;
+    }
+
+    uint8_t* ptr = arena->base + arena->used + pad;
+    arena->used += pad + size;
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+/*-------------------------------------------------------------------------
+ * This function releases everything handed out from the arena
+ *------------------------------------------------------------------------*/
+void peci_ArenaReset(PECIArena* arena)
+{
+    if (arena != NULL)
+    {
+        arena->used = 0;
+    }
+}
+
+/*-------------------------------------------------------------------------
+ * This function frees the arena's memory if peci_ArenaInit allocated it
+ *------------------------------------------------------------------------*/
+void peci_ArenaFree(PECIArena* arena)
+{
+    if (arena == NULL)
+    {
+        return;
+    }
+    if (arena->owned)
+    {
+        free(arena->base);
+    }
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
@@ -0,0 +1,372 @@
+/*
+// Copyright (c) 2026 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include "peci_broker.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcpp"
+#pragma GCC diagnostic ignored "-Wvariadic-macros"
+#include <linux/peci-ioctl.h>
+#pragma GCC diagnostic pop
+
+atomic_bool peci_broker_on;
+
+static pthread_mutex_t peci_broker_lock = PTHREAD_MUTEX_INITIALIZER;
+static char peci_broker_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+
+// Request ids only need to be unique per connection, and a connection is
+// only used by one thread at a time
+static __thread uint32_t peci_broker_id;
+
+/*-------------------------------------------------------------------------
+ * This function sets the Unix socket path of the broker, or stops using the
+ * broker if the path is null
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_broker_set_path(const char* path)
+{
+    if (path != NULL && strlen(path) >= sizeof(peci_broker_path))
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    pthread_mutex_lock(&peci_broker_lock);
+    if (path != NULL)
+    {
+        strcpy(peci_broker_path, path);
+    }
+    atomic_store_explicit(&peci_broker_on, path != NULL, memory_order_relaxed);
+    pthread_mutex_unlock(&peci_broker_lock);
+    return PECI_CC_SUCCESS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function writes the whole buffer to the broker connection
+ *------------------------------------------------------------------------*/
+static int peci_broker_write(int fd, const void* buf, size_t len)
+{
+    const uint8_t* data = buf;
+
+    while (len > 0)
+    {
+        ssize_t written = send(fd, data, len, MSG_NOSIGNAL);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        len -= (size_t)written;
+    }
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+ * This function reads exactly len bytes from the broker connection
+ *------------------------------------------------------------------------*/
+static int peci_broker_read(int fd, void* buf, size_t len)
+{
+    uint8_t* data = buf;
+
+    while (len > 0)
+    {
+        ssize_t got = read(fd, data, len);
+        if (got <= 0)
+        {
+            if (got < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        data += got;
+        len -= (size_t)got;
+    }
+    return 0;
+}
+
+/*-------------------------------------------------------------------------
+ * This function connects to the broker and selects the PECI device. It
+ * returns -1 with errno set to ECONNREFUSED or ENOENT if no broker is
+ * listening, so the caller can wait for the broker to start.
+ *------------------------------------------------------------------------*/
+int peci_broker_open(const char* const* devices)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    struct
+    {
+        struct peci_broker_hello hdr;
+        char names[PECI_BROKER_MAX_NAMES];
+    } hello = {0};
+    struct peci_broker_hello_resp resp = {0};
+    size_t name_len = 0;
+
+    for (int i = 0; i < 2 && devices[i] != NULL; i++)
+    {
+        size_t len = strlen(devices[i]) + 1;
+        if (name_len + len > sizeof(hello.names))
+        {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy(&hello.names[name_len], devices[i], len);
+        name_len += len;
+    }
+    hello.hdr.magic = PECI_BROKER_MAGIC;
+    hello.hdr.version = PECI_BROKER_VERSION;
+    hello.hdr.name_len = (uint16_t)name_len;
+
+    pthread_mutex_lock(&peci_broker_lock);
+    strcpy(addr.sun_path, peci_broker_path);
+    pthread_mutex_unlock(&peci_broker_lock);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    if (peci_broker_write(fd, &hello, sizeof(hello.hdr) + name_len) != 0 ||
+        peci_broker_read(fd, &resp, sizeof(resp)) != 0 ||
+        resp.magic != PECI_BROKER_MAGIC || resp.status != PECI_CC_SUCCESS)
+    {
+        close(fd);
+        errno = EIO;
+        return -1;
+    }
+    return fd;
+}
+
+/*-------------------------------------------------------------------------
+ * This function sends one ioctl message to the broker and waits for its
+ * response
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_broker_issue_cmd(unsigned int cmd, char* cmdPtr, int peci_fd)
+{
+    struct
+    {
+        struct peci_broker_req hdr;
+        uint8_t data[PECI_BROKER_MAX_MSG + PECI_BROKER_MAX_XFER];
+    } req = {0};
+    struct peci_broker_resp resp = {0};
+    uint8_t data[PECI_BROKER_MAX_MSG + PECI_BROKER_MAX_XFER];
+    struct peci_xfer_msg* xfer = NULL;
+    size_t msg_len = _IOC_SIZE(cmd);
+
+    if (msg_len > PECI_BROKER_MAX_MSG)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    req.hdr.id = ++peci_broker_id;
+    req.hdr.ioctl_cmd = cmd;
+    req.hdr.msg_len = (uint16_t)msg_len;
+    memcpy(req.data, cmdPtr, msg_len);
+    if (cmd == PECI_IOC_XFER)
+    {
+        // The buffers are sent inline, the broker supplies its own pointers
+        xfer = (struct peci_xfer_msg*)cmdPtr;
+        req.hdr.tx_len = xfer->tx_len;
+        req.hdr.rx_len = xfer->rx_len;
+        memcpy(&req.data[msg_len], xfer->tx_buf, xfer->tx_len);
+    }
+
+    if (peci_broker_write(peci_fd, &req,
+                          sizeof(req.hdr) + msg_len + req.hdr.tx_len) != 0)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+
+    // Skip any response left over from an earlier request that failed
+    do
+    {
+        if (peci_broker_read(peci_fd, &resp, sizeof(resp)) != 0 ||
+            resp.msg_len > PECI_BROKER_MAX_MSG ||
+            resp.rx_len > PECI_BROKER_MAX_XFER ||
+            peci_broker_read(peci_fd, data,
+                             (size_t)resp.msg_len + resp.rx_len) != 0)
+        {
+            return PECI_CC_DRIVER_ERR;
+        }
+    } while (resp.id != req.hdr.id);
+
+    if (resp.msg_len != msg_len)
+    {
+        return resp.status == PECI_CC_SUCCESS ? PECI_CC_DRIVER_ERR
+                                              : (EPECIStatus)resp.status;
+    }
+    if (xfer != NULL)
+    {
+        memcpy(xfer->rx_buf, &data[msg_len],
+               resp.rx_len < xfer->rx_len ? resp.rx_len : xfer->rx_len);
+    }
+    else
+    {
+        memcpy(cmdPtr, data, msg_len);
+    }
+    return (EPECIStatus)resp.status;
+}
+
+/*-------------------------------------------------------------------------
+ * This function asks the broker for a shared-memory ring and receives its
+ * shm, submission doorbell and completion doorbell descriptors
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_broker_ring(int peci_fd, uint32_t entries, int fds[3])
+{
+    struct
+    {
+        struct peci_broker_req hdr;
+        struct peci_broker_ring_req ring;
+    } req = {0};
+    struct peci_broker_resp resp = {0};
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } control = {0};
+    struct iovec iov = {.iov_base = &resp, .iov_len = sizeof(resp)};
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+
+    req.hdr.id = ++peci_broker_id;
+    req.hdr.ioctl_cmd = PECI_BROKER_RING_CMD;
+    req.hdr.msg_len = sizeof(req.ring);
+    req.ring.entries = entries;
+    if (peci_broker_write(peci_fd, &req, sizeof(req)) != 0)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+
+    ssize_t got = 0;
+    do
+    {
+        got = recvmsg(peci_fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (got < 0 && errno == EINTR);
+    if (got < 0)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+
+    // Take every descriptor that was passed, so none are leaked when the
+    // response is not the one expected
+    int passed[3] = {-1, -1, -1};
+    size_t count = 0;
+    bool extra = (msg.msg_flags & MSG_CTRUNC) != 0;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        {
+            continue;
+        }
+        size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < n; i++)
+        {
+            int fd = -1;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+            if (count < 3)
+            {
+                passed[count++] = fd;
+            }
+            else
+            {
+                close(fd);
+                extra = true;
+            }
+        }
+    }
+
+    bool matched = got == sizeof(resp) && resp.id == req.hdr.id;
+    if (!matched || resp.status != PECI_CC_SUCCESS || count != 3 || extra)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            close(passed[i]);
+        }
+        return matched && resp.status != PECI_CC_SUCCESS
+                   ? (EPECIStatus)resp.status
+                   : PECI_CC_DRIVER_ERR;
+    }
+    memcpy(fds, passed, sizeof(passed));
+    return PECI_CC_SUCCESS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function takes or gives up the connection's exclusive hold on its
+ * device, waiting up to timeout_ms for another client to give it up
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_broker_hold(int peci_fd, bool hold, int timeout_ms)
+{
+    struct
+    {
+        struct peci_broker_req hdr;
+        struct peci_broker_hold_req hold;
+    } req = {0};
+    struct peci_broker_resp resp = {0};
+    uint8_t data[PECI_BROKER_MAX_MSG + PECI_BROKER_MAX_XFER];
+    struct pollfd pfd = {.fd = peci_fd, .events = POLLIN};
+
+    req.hdr.id = ++peci_broker_id;
+    req.hdr.ioctl_cmd = PECI_BROKER_HOLD_CMD;
+    req.hdr.msg_len = sizeof(req.hold);
+    req.hold.hold = hold;
+    if (peci_broker_write(peci_fd, &req, sizeof(req)) != 0)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+
+    do
+    {
+        // Only the wait for the broker is bounded, a response that has
+        // started arriving is read whole
+        int ready = 0;
+        do
+        {
+            ready = poll(&pfd, 1, timeout_ms);
+        } while (ready < 0 && errno == EINTR);
+        if (ready == 0)
+        {
+            return PECI_CC_TIMEOUT;
+        }
+        if (ready < 0 || peci_broker_read(peci_fd, &resp, sizeof(resp)) != 0 ||
+            resp.msg_len > PECI_BROKER_MAX_MSG ||
+            resp.rx_len > PECI_BROKER_MAX_XFER ||
+            peci_broker_read(peci_fd, data,
+                             (size_t)resp.msg_len + resp.rx_len) != 0)
+        {
+            return PECI_CC_DRIVER_ERR;
+        }
+    } while (resp.id != req.hdr.id);
+    return (EPECIStatus)resp.status;
+}
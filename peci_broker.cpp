@@ -0,0 +1,838 @@
+/*
+// Copyright (c) 2026 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include "peci_broker.h"
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcpp"
+#pragma GCC diagnostic ignored "-Wvariadic-macros"
+#include <linux/peci-ioctl.h>
+#pragma GCC diagnostic pop
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+using boost::asio::local::stream_protocol;
+
+// Requests a client may have queued before the broker stops reading from it
+constexpr size_t maxPending = 64;
+
+// Ring commands a client runs per turn before the next client gets the bus
+constexpr size_t ringChunkSize = 16;
+
+// The broker runs with more privileges than its clients, so it only opens
+// PECI device nodes on their behalf: /dev/peci-default or /dev/peci-<N>
+bool allowedDevice(std::string_view name)
+{
+    constexpr std::string_view prefix = "/dev/peci-";
+    if (!name.starts_with(prefix))
+    {
+        return false;
+    }
+    name.remove_prefix(prefix.size());
+    if (name == "default")
+    {
+        return true;
+    }
+    return !name.empty() && name.size() <= 3 &&
+           std::ranges::all_of(name, [](char c) {
+               return std::isdigit(static_cast<unsigned char>(c)) != 0;
+           });
+}
+
+// Clients must run as root, as the broker's user or in the broker's group.
+// The socket's mode already limits who can connect, this keeps a socket
+// left with a looser mode from opening the bus to everyone.
+bool allowedPeer(int fd)
+{
+    ucred cred{};
+    socklen_t len = sizeof(cred);
+    if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+    {
+        return false;
+    }
+    return cred.uid == 0 || cred.uid == ::geteuid() || cred.gid == ::getegid();
+}
+
+struct Request
+{
+    peci_broker_req hdr{};
+    // The message struct followed by the raw transmit bytes
+    std::vector<uint8_t> data;
+};
+
+// An encoded response, and the descriptors to pass with it
+struct Response
+{
+    std::vector<uint8_t> buf;
+    std::vector<int> fds;
+};
+
+Response encodeResponse(const peci_broker_resp& resp, const uint8_t* msg,
+                        const uint8_t* rx)
+{
+    Response out;
+    out.buf.resize(sizeof(resp) + resp.msg_len + resp.rx_len);
+    std::memcpy(out.buf.data(), &resp, sizeof(resp));
+    std::memcpy(out.buf.data() + sizeof(resp), msg, resp.msg_len);
+    std::memcpy(out.buf.data() + sizeof(resp) + resp.msg_len, rx,
+                resp.rx_len);
+    return out;
+}
+
+bool validRequest(const peci_broker_req& hdr)
+{
+    if (_IOC_TYPE(hdr.ioctl_cmd) != PECI_IOC_BASE ||
+        _IOC_SIZE(hdr.ioctl_cmd) != hdr.msg_len ||
+        hdr.msg_len > PECI_BROKER_MAX_MSG)
+    {
+        return false;
+    }
+    if (hdr.ioctl_cmd == PECI_IOC_XFER)
+    {
+        return hdr.tx_len <= PECI_BROKER_MAX_XFER &&
+               hdr.rx_len <= PECI_BROKER_MAX_XFER;
+    }
+    return hdr.tx_len == 0 && hdr.rx_len == 0;
+}
+
+// Issues the request on the PECI device, or on the simulated device, and
+// returns the encoded response
+Response execute(int peciFd, const Request& req, bool simulated)
+{
+    peci_broker_resp resp{req.hdr.id, PECI_CC_SUCCESS, req.hdr.msg_len, 0};
+    alignas(8) std::array<uint8_t, PECI_BROKER_MAX_MSG> msg{};
+    std::array<uint8_t, PECI_BROKER_MAX_XFER> tx{};
+    std::array<uint8_t, PECI_BROKER_MAX_XFER> rx{};
+
+    if (!validRequest(req.hdr))
+    {
+        resp.status = PECI_CC_INVALID_REQ;
+        resp.msg_len = 0;
+    }
+    else
+    {
+        std::memcpy(msg.data(), req.data.data(), req.hdr.msg_len);
+        if (req.hdr.ioctl_cmd == PECI_IOC_XFER)
+        {
+            // Point the transfer at our own copies of the raw buffers
+            peci_xfer_msg xfer{};
+            std::memcpy(&xfer, msg.data(), sizeof(xfer));
+            std::memcpy(tx.data(), req.data.data() + req.hdr.msg_len,
+                        req.hdr.tx_len);
+            xfer.tx_len = static_cast<uint8_t>(req.hdr.tx_len);
+            xfer.rx_len = static_cast<uint8_t>(req.hdr.rx_len);
+            xfer.tx_buf = tx.data();
+            xfer.rx_buf = rx.data();
+            std::memcpy(msg.data(), &xfer, sizeof(xfer));
+            resp.rx_len = req.hdr.rx_len;
+        }
+        if (simulated)
+        {
+            resp.status = peci_sim_issue_cmd(
+                req.hdr.ioctl_cmd, reinterpret_cast<char*>(msg.data()));
+        }
+        else if (ioctl(peciFd, req.hdr.ioctl_cmd, msg.data()) != 0)
+        {
+            resp.status = errno == ETIMEDOUT ? PECI_CC_TIMEOUT
+                                             : PECI_CC_DRIVER_ERR;
+        }
+    }
+
+    return encodeResponse(resp, msg.data(), rx.data());
+}
+
+class Broker;
+
+// One client connection.  Requests are read ahead into a bounded queue and
+// run by the broker one at a time, in turn with the other clients.  A client
+// may also have a shared-memory ring, which gets turns the same way.  While
+// a client holds its device, other clients of the device wait for it.
+class Client : public std::enable_shared_from_this<Client>
+{
+  public:
+    Client(stream_protocol::socket&& socket, Broker& broker) :
+        socket(std::move(socket)), broker(broker),
+        ringDoorbell(this->socket.get_executor())
+    {}
+
+    ~Client();
+
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    void start()
+    {
+        readHello();
+    }
+
+    bool hasPending() const
+    {
+        return !pending.empty() || ringReady;
+    }
+
+    int device() const
+    {
+        return peciFd;
+    }
+
+    void runOne();
+
+    // Set while the client is in the broker's ready list, or waiting for
+    // another client's hold on its device
+    bool ready = false;
+
+  private:
+    void readHello();
+    void readNames();
+    void readRequest();
+    void readPayload();
+    void setupRing(const Request& req);
+    Response holdDevice(const Request& req);
+    void waitRing();
+    void send(Response&& resp);
+    void writeNext();
+    void sendFds();
+    void close();
+
+    stream_protocol::socket socket;
+    Broker& broker;
+    int peciFd = -1;
+    bool reading = false;
+    bool closed = false;
+    peci_broker_hello hello{};
+    std::vector<char> names;
+    Request next;
+    std::deque<Request> pending;
+    std::deque<Response> writes;
+    PECIRing* ring = nullptr;
+    boost::asio::posix::stream_descriptor ringDoorbell;
+    bool ringReady = false;
+};
+
+class Broker
+{
+  public:
+    Broker(boost::asio::io_context& io) : io(io), acceptor(io) {}
+
+    // Serves every device from the simulated device started with
+    // peci_SimStart, so clients can be tested without hardware
+    void simulate()
+    {
+        simulated = true;
+    }
+
+    bool isSimulated() const
+    {
+        return simulated;
+    }
+
+    bool listen(const std::string& path)
+    {
+        boost::system::error_code ec;
+        ::unlink(path.c_str());
+        acceptor.open(stream_protocol(), ec);
+        if (!ec)
+        {
+            acceptor.bind(stream_protocol::endpoint(path), ec);
+        }
+        // Only the broker's user and group may connect, whatever the umask
+        if (!ec && ::chmod(path.c_str(), 0660) != 0)
+        {
+            ec.assign(errno, boost::system::system_category());
+        }
+        if (!ec)
+        {
+            acceptor.listen(boost::asio::socket_base::max_listen_connections,
+                            ec);
+        }
+        if (ec)
+        {
+            std::cerr << "Unable to listen on " << path << ": "
+                      << ec.message() << "\n";
+            return false;
+        }
+        accept();
+        return true;
+    }
+
+    // Returns the PECI device for the names sent by a client, opening it on
+    // first use, or -1 if a name is not a PECI device.  Each client holds a
+    // reference until releaseDevice.
+    int openDevice(const std::vector<std::string>& devNames)
+    {
+        for (const std::string& name : devNames)
+        {
+            if (!allowedDevice(name))
+            {
+                return -1;
+            }
+            auto it = devices.find(name);
+            if (it != devices.end())
+            {
+                it->second.users++;
+                return it->second.fd;
+            }
+            int fd = simulated ? peci_sim_open()
+                               : ::open(name.c_str(), O_RDWR | O_CLOEXEC);
+            if (fd >= 0)
+            {
+                struct stat st{};
+                if (::fstat(fd, &st) != 0 || !S_ISCHR(st.st_mode))
+                {
+                    ::close(fd);
+                    return -1;
+                }
+                devices.emplace(name, Device{fd, 1, nullptr, {}});
+                return fd;
+            }
+            if (errno != ENOENT)
+            {
+                break;
+            }
+        }
+        return -1;
+    }
+
+    // Gives the client an exclusive hold on its device, or lets go of it.
+    // Clients only run while no other client holds their device, so the
+    // device is free whenever a hold is asked for.
+    void hold(const Client* client, int fd, bool take)
+    {
+        Device* device = findDevice(fd);
+        if (device == nullptr)
+        {
+            return;
+        }
+        if (take)
+        {
+            device->holder = client;
+            return;
+        }
+        if (device->holder != client)
+        {
+            return;
+        }
+        device->holder = nullptr;
+        for (std::shared_ptr<Client>& waiter : device->held)
+        {
+            waiter->ready = false;
+            schedule(waiter);
+        }
+        device->held.clear();
+    }
+
+    // Drops a client's reference to a device, closing it once no client
+    // uses it so other processes can open it
+    void releaseDevice(const Client* client, int fd)
+    {
+        hold(client, fd, false);
+        for (auto it = devices.begin(); it != devices.end(); it++)
+        {
+            if (it->second.fd == fd)
+            {
+                if (--it->second.users == 0)
+                {
+                    ::close(fd);
+                    devices.erase(it);
+                }
+                return;
+            }
+        }
+    }
+
+    // Queues the client for a turn on the bus
+    void schedule(const std::shared_ptr<Client>& client)
+    {
+        if (client->ready)
+        {
+            return;
+        }
+        client->ready = true;
+        readyList.push_back(client);
+        if (!dispatching)
+        {
+            dispatching = true;
+            boost::asio::post(io, [this]() { dispatch(); });
+        }
+    }
+
+  private:
+    void accept()
+    {
+        acceptor.async_accept([this](const boost::system::error_code& ec,
+                                     stream_protocol::socket socket) {
+            if (!ec && allowedPeer(socket.native_handle()))
+            {
+                std::make_shared<Client>(std::move(socket), *this)->start();
+            }
+            accept();
+        });
+    }
+
+    // Runs one command for the client at the front of the ready list, then
+    // yields to the event loop so new requests and other clients get a turn.
+    // A client whose device another client holds is set aside until the
+    // hold is let go, staying marked ready so it is not queued twice.
+    void dispatch()
+    {
+        std::shared_ptr<Client> client = std::move(readyList.front());
+        readyList.pop_front();
+
+        Device* device = findDevice(client->device());
+        if (device != nullptr && device->holder != nullptr &&
+            device->holder != client.get())
+        {
+            device->held.push_back(std::move(client));
+        }
+        else
+        {
+            client->ready = false;
+            client->runOne();
+            if (client->hasPending())
+            {
+                client->ready = true;
+                readyList.push_back(std::move(client));
+            }
+        }
+
+        if (readyList.empty())
+        {
+            dispatching = false;
+            return;
+        }
+        boost::asio::post(io, [this]() { dispatch(); });
+    }
+
+    struct Device
+    {
+        int fd;
+        size_t users;
+        // Client with an exclusive hold, and the clients waiting for it
+        const Client* holder = nullptr;
+        std::vector<std::shared_ptr<Client>> held;
+    };
+
+    Device* findDevice(int fd)
+    {
+        for (auto& [name, device] : devices)
+        {
+            if (device.fd == fd)
+            {
+                return &device;
+            }
+        }
+        return nullptr;
+    }
+
+    boost::asio::io_context& io;
+    stream_protocol::acceptor acceptor;
+    std::map<std::string, Device> devices;
+    std::deque<std::shared_ptr<Client>> readyList;
+    bool dispatching = false;
+    bool simulated = false;
+};
+
+Client::~Client()
+{
+    // The ring runs commands on the device, so it goes first
+    peci_RingClose(ring);
+    if (peciFd >= 0)
+    {
+        broker.releaseDevice(this, peciFd);
+    }
+}
+
+void Client::readHello()
+{
+    boost::asio::async_read(
+        socket, boost::asio::buffer(&hello, sizeof(hello)),
+        [self = shared_from_this()](const boost::system::error_code& ec,
+                                    size_t) {
+            if (ec || self->hello.magic != PECI_BROKER_MAGIC ||
+                self->hello.version != PECI_BROKER_VERSION ||
+                self->hello.name_len > PECI_BROKER_MAX_NAMES)
+            {
+                self->close();
+                return;
+            }
+            self->readNames();
+        });
+}
+
+void Client::readNames()
+{
+    names.resize(hello.name_len);
+    boost::asio::async_read(
+        socket, boost::asio::buffer(names),
+        [self = shared_from_this()](const boost::system::error_code& ec,
+                                    size_t) {
+            if (ec)
+            {
+                self->close();
+                return;
+            }
+
+            std::vector<std::string> devNames;
+            for (size_t pos = 0; pos < self->names.size();)
+            {
+                size_t len =
+                    strnlen(&self->names[pos], self->names.size() - pos);
+                devNames.emplace_back(&self->names[pos], len);
+                pos += len + 1;
+            }
+            self->peciFd = self->broker.openDevice(devNames);
+
+            Response hello;
+            peci_broker_hello_resp resp{
+                PECI_BROKER_MAGIC,
+                self->peciFd < 0 ? PECI_CC_DRIVER_ERR : PECI_CC_SUCCESS};
+            hello.buf.resize(sizeof(resp));
+            std::memcpy(hello.buf.data(), &resp, sizeof(resp));
+            self->send(std::move(hello));
+            if (self->peciFd >= 0)
+            {
+                self->readRequest();
+            }
+        });
+}
+
+void Client::readRequest()
+{
+    reading = true;
+    boost::asio::async_read(
+        socket, boost::asio::buffer(&next.hdr, sizeof(next.hdr)),
+        [self = shared_from_this()](const boost::system::error_code& ec,
+                                    size_t) {
+            self->reading = false;
+            if (ec || self->next.hdr.msg_len > PECI_BROKER_MAX_MSG ||
+                self->next.hdr.tx_len > PECI_BROKER_MAX_XFER)
+            {
+                self->close();
+                return;
+            }
+            self->readPayload();
+        });
+}
+
+void Client::readPayload()
+{
+    reading = true;
+    next.data.resize(static_cast<size_t>(next.hdr.msg_len) + next.hdr.tx_len);
+    boost::asio::async_read(
+        socket, boost::asio::buffer(next.data),
+        [self = shared_from_this()](const boost::system::error_code& ec,
+                                    size_t) {
+            self->reading = false;
+            if (ec)
+            {
+                self->close();
+                return;
+            }
+            if (self->next.hdr.ioctl_cmd == PECI_BROKER_RING_CMD)
+            {
+                self->setupRing(self->next);
+            }
+            else
+            {
+                self->pending.push_back(std::move(self->next));
+                self->broker.schedule(self);
+            }
+            self->next = Request();
+            // Stop reading ahead once the queue is full, runOne resumes it
+            if (self->pending.size() < maxPending)
+            {
+                self->readRequest();
+            }
+        });
+}
+
+// Creates the client's shared-memory ring and passes its descriptors back
+// with the response
+void Client::setupRing(const Request& req)
+{
+    peci_broker_resp resp{req.hdr.id, PECI_CC_SUCCESS, 0, 0};
+    peci_broker_ring_req ringReq{};
+    Response out;
+
+    if (ring != nullptr || req.hdr.msg_len != sizeof(ringReq))
+    {
+        resp.status = PECI_CC_INVALID_REQ;
+    }
+    else
+    {
+        std::memcpy(&ringReq, req.data.data(), sizeof(ringReq));
+        resp.status = peci_RingCreate(ringReq.entries, peciFd, &ring);
+    }
+    if (resp.status == PECI_CC_SUCCESS)
+    {
+        int shmFd = -1;
+        int sqFd = -1;
+        int cqFd = -1;
+        peci_RingGetFds(ring, &shmFd, &sqFd, &cqFd);
+        out.fds = {shmFd, sqFd, cqFd};
+        ringDoorbell.assign(::dup(sqFd));
+        waitRing();
+    }
+    out.buf.resize(sizeof(resp));
+    std::memcpy(out.buf.data(), &resp, sizeof(resp));
+    send(std::move(out));
+}
+
+// Waits for the client to ring the submission doorbell
+void Client::waitRing()
+{
+    ringDoorbell.async_wait(
+        boost::asio::posix::stream_descriptor::wait_read,
+        [self = shared_from_this()](const boost::system::error_code& ec) {
+            if (ec || self->closed)
+            {
+                return;
+            }
+            self->ringReady = true;
+            self->broker.schedule(self);
+        });
+}
+
+// Takes or lets go of the exclusive hold on the client's device
+Response Client::holdDevice(const Request& req)
+{
+    peci_broker_resp resp{req.hdr.id, PECI_CC_SUCCESS, 0, 0};
+    peci_broker_hold_req holdReq{};
+    Response out;
+
+    if (req.hdr.msg_len != sizeof(holdReq) || req.hdr.tx_len != 0)
+    {
+        resp.status = PECI_CC_INVALID_REQ;
+    }
+    else
+    {
+        std::memcpy(&holdReq, req.data.data(), sizeof(holdReq));
+        broker.hold(this, peciFd, holdReq.hold != 0);
+    }
+    out.buf.resize(sizeof(resp));
+    std::memcpy(out.buf.data(), &resp, sizeof(resp));
+    return out;
+}
+
+void Client::runOne()
+{
+    if (closed)
+    {
+        pending.clear();
+        ringReady = false;
+        return;
+    }
+    if (ringReady)
+    {
+        // Keep the turn short, and only wait for the doorbell again once
+        // the ring has been drained
+        if (peci_RingProcess(ring, ringChunkSize) < ringChunkSize)
+        {
+            ringReady = false;
+            waitRing();
+        }
+    }
+    if (!pending.empty())
+    {
+        Request req = std::move(pending.front());
+        pending.pop_front();
+        if (req.hdr.ioctl_cmd == PECI_BROKER_HOLD_CMD)
+        {
+            send(holdDevice(req));
+        }
+        else
+        {
+            send(execute(peciFd, req, broker.isSimulated()));
+        }
+    }
+    if (!reading && !closed && pending.size() < maxPending)
+    {
+        readRequest();
+    }
+}
+
+void Client::send(Response&& resp)
+{
+    writes.push_back(std::move(resp));
+    if (writes.size() == 1)
+    {
+        writeNext();
+    }
+}
+
+void Client::writeNext()
+{
+    if (!writes.front().fds.empty())
+    {
+        // Descriptors can only be passed with sendmsg, so wait until the
+        // socket can take more and send them without blocking
+        socket.async_wait(
+            stream_protocol::socket::wait_write,
+            [self = shared_from_this()](const boost::system::error_code& ec) {
+                if (ec || self->closed)
+                {
+                    self->close();
+                    return;
+                }
+                self->sendFds();
+            });
+        return;
+    }
+
+    boost::asio::async_write(
+        socket, boost::asio::buffer(writes.front().buf),
+        [self = shared_from_this()](const boost::system::error_code& ec,
+                                    size_t) {
+            if (ec)
+            {
+                self->close();
+                return;
+            }
+            self->writes.pop_front();
+            if (!self->writes.empty())
+            {
+                self->writeNext();
+            }
+        });
+}
+
+// Sends the front response with its descriptors.  The descriptors travel
+// with the first byte sent, and anything left over is written as usual.
+void Client::sendFds()
+{
+    Response& front = writes.front();
+    std::vector<char> control(CMSG_SPACE(front.fds.size() * sizeof(int)));
+    iovec iov{front.buf.data(), front.buf.size()};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(front.fds.size() * sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), front.fds.data(),
+                front.fds.size() * sizeof(int));
+
+    ssize_t sent = ::sendmsg(socket.native_handle(), &msg,
+                             MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent < 0)
+    {
+        if (errno == EAGAIN || errno == EINTR)
+        {
+            writeNext();
+            return;
+        }
+        close();
+        return;
+    }
+
+    // The descriptors belong to the ring, so they are only forgotten here
+    front.fds.clear();
+    front.buf.erase(front.buf.begin(), front.buf.begin() + sent);
+    if (front.buf.empty())
+    {
+        writes.pop_front();
+    }
+    if (!writes.empty())
+    {
+        writeNext();
+    }
+}
+
+void Client::close()
+{
+    if (closed)
+    {
+        return;
+    }
+    closed = true;
+    pending.clear();
+    // Clients waiting for the device need not wait for the last reference
+    // to this one to go
+    if (peciFd >= 0)
+    {
+        broker.hold(this, peciFd, false);
+    }
+    boost::system::error_code ec;
+    socket.close(ec);
+    ringDoorbell.close(ec);
+}
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    boost::asio::io_context io;
+    Broker broker(io);
+
+    std::string path = PECI_BROKER_SOCKET;
+
+    // The broker owns the device, so its own commands must not be sent to a
+    // broker
+    peci_SetBroker(nullptr);
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--sim" && i + 1 < argc)
+        {
+            // Serve a recorded trace (see peci_TraceStart) in place of the
+            // PECI devices, for testing clients without hardware
+            if (peci_SimStart(argv[++i], false) != PECI_CC_SUCCESS)
+            {
+                std::cerr << "Unable to simulate " << argv[i] << "\n";
+                return 1;
+            }
+            broker.simulate();
+        }
+        else
+        {
+            path = arg;
+        }
+    }
+
+    if (!broker.listen(path))
+    {
+        return 1;
+    }
+    io.run();
+    return 0;
+}
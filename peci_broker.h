@@ -0,0 +1,124 @@
+/*
+// Copyright (c) 2026 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#pragma once
+#include <peci.h>
+
+// Wire protocol between libpeci and the PECI broker daemon.  Not installed.
+//
+// A client connects to the broker's Unix socket and sends a
+// peci_broker_hello followed by name_len bytes holding up to two PECI
+// device names, each terminated by a null.  The broker opens the first
+// device, or the second if the first does not exist, and answers with a
+// peci_broker_hello_resp.
+//
+// After that the client may send requests back to back without waiting for
+// the responses.  Each request is a peci_broker_req followed by the ioctl
+// message struct and, for PECI_IOC_XFER, the raw transmit bytes.  Each
+// response is a peci_broker_resp followed by the message struct as returned
+// by the driver and, for PECI_IOC_XFER, the raw receive bytes.  Responses
+// carry the id of their request and may arrive in any order.  All fields are
+// in host byte order.
+#define PECI_BROKER_SOCKET "/run/peci-broker.sock"
+#define PECI_BROKER_MAGIC 0x42434550 // "PECB"
+#define PECI_BROKER_VERSION 2
+
+// Largest message struct and raw transfer the broker accepts
+#define PECI_BROKER_MAX_MSG 128
+#define PECI_BROKER_MAX_XFER 255
+#define PECI_BROKER_MAX_NAMES 128
+
+struct peci_broker_hello
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t name_len;
+};
+
+struct peci_broker_hello_resp
+{
+    uint32_t magic;
+    int32_t status; // EPECIStatus
+};
+
+struct peci_broker_req
+{
+    uint32_t id;
+    uint32_t ioctl_cmd; // PECI_IOC_* number
+    uint16_t msg_len;
+    uint16_t tx_len;
+    uint16_t rx_len;
+    uint16_t reserved;
+};
+
+struct peci_broker_resp
+{
+    uint32_t id;
+    int32_t status; // EPECIStatus
+    uint16_t msg_len;
+    uint16_t rx_len;
+};
+
+// A request with this ioctl_cmd asks for a shared-memory ring (see
+// peci_RingConnect) instead of running a command.  Its message is a
+// peci_broker_ring_req, and the response carries the ring's shm,
+// submission doorbell and completion doorbell descriptors as SCM_RIGHTS.
+// The ring lives until the connection is closed.
+#define PECI_BROKER_RING_CMD 0
+
+struct peci_broker_ring_req
+{
+    uint32_t entries;
+    uint32_t reserved;
+};
+
+// A request with this ioctl_cmd takes (hold set) or gives up (hold zero) an
+// exclusive hold on the connection's device.  The response to a take is
+// sent once the hold is granted, and until the hold is given up or the
+// connection is closed the broker runs no other connection's requests or
+// ring entries on the device.  This keeps sequences such as a VCU open,
+// read and close from being interleaved with other clients' commands, as
+// they are not when each process opens the device exclusively.
+#define PECI_BROKER_HOLD_CMD 1
+
+struct peci_broker_hold_req
+{
+    uint32_t hold;
+    uint32_t reserved;
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+// Simulated device from peci_trace.c, served by peci-broker --sim
+int peci_sim_open(void);
+EPECIStatus peci_sim_issue_cmd(unsigned int cmd, char* cmdPtr);
+#ifdef __cplusplus
+}
+#endif
+
+#ifndef __cplusplus
+#include <stdatomic.h>
+
+// Client backend used by libpeci when a broker is configured
+extern atomic_bool peci_broker_on;
+
+EPECIStatus peci_broker_set_path(const char* path);
+int peci_broker_open(const char* const* devices);
+EPECIStatus peci_broker_issue_cmd(unsigned int cmd, char* cmdPtr, int peci_fd);
+EPECIStatus peci_broker_ring(int peci_fd, uint32_t entries, int fds[3]);
+EPECIStatus peci_broker_hold(int peci_fd, bool hold, int timeout_ms);
+#endif
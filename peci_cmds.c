@@ -15,6 +15,7 @@
 */
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <peci.h>
@@ -29,8 +30,6 @@
 
 #define CC_COUNT 256 // CC is a byte so only has 256 possible values
 
-extern EPECIStatus peci_GetDIB(uint8_t target, uint64_t* dib);
-
 double getTimeDifference(const struct timespec begin)
 {
     double timeDiff = 0.0;
@@ -76,6 +75,10 @@ void Usage(char* progname)
     printf("\t%-28s%s\n", "Ping", "Ping the target");
     printf("\t%-28s%s\n", "GetTemp", "Get the temperature");
     printf("\t%-28s%s\n", "GetDIB", "Get the DIB");
+    printf("\t%-28s%s\n", "GetTopology",
+           "Get the presence, DIB, CPU model and domains of every client");
+    printf("\t%-28s%s\n", "GetInventory",
+           "Get the CPU ID, microcode, TDP and turbo limits of every socket");
     printf("\t%-28s%s\n", "RdPkgConfig",
            "Read Package Config <Index Parameter>");
     printf("\t%-28s%s\n", "WrPkgConfig",
@@ -99,9 +102,121 @@ void Usage(char* progname)
     printf("\t%-28s%s\n", "WrEndpointConfigMMIO",
            "Endpoint MMIO Write <AType Bar Seg Bus Dev Func Reg Data>");
     printf("\t%-28s%s\n", "raw", "Raw PECI command in bytes");
+    printf("\t%-28s%s\n", "Replay",
+           "Replay a PECI trace through a simulated device <Trace [realtime]>");
+    printf("\t%-28s%s\n", "UncoreCapture",
+           "TOR, SQ and uncore crashdump capture from all sockets "
+           "<File TorDwords SqDwords UncoreDwords [Domains]>");
+    printf("\t%-28s%s\n", "Snapshot",
+           "Print the values published in a shared snapshot <[Name]>");
+    printf("\t%-28s%s\n", "Arbitration",
+           "Print the holder, waiters and statistics of the device queue");
+    printf("\t%-28s%s\n", "Locks",
+           "Print live and recent device locks, and their wait and hold "
+           "times per caller (-v lists every lock)");
     printf("\n");
 }
 
+static const char* lockStateName(EPECILockState state)
+{
+    static const char* const names[] = {"waiting", "held", "released",
+                                        "busy"};
+
+    return (unsigned int)state < sizeof(names) / sizeof(names[0])
+               ? names[state]
+               : "unknown";
+}
+
+static const char* priorityName(EPECIPriority priority)
+{
+    static const char* const names[PECI_PRIORITY_COUNT] = {"critical",
+                                                           "normal", "bulk"};
+
+    // The class comes from shared memory any process can write
+    return (unsigned int)priority < PECI_PRIORITY_COUNT ? names[priority]
+                                                        : "unknown";
+}
+
+static void printLockRecord(const char* prefix, const PECILockRecord* record)
+{
+    printf("   %s: pid %d tid %d (%s) tag \"%s\" %s, wait %lf s hold %lf s\n",
+           prefix, record->pid, record->tid, record->comm, record->tag,
+           lockStateName(record->state), (double)record->wait_ns * 1e-9,
+           (double)record->hold_ns * 1e-9);
+}
+
+/*-------------------------------------------------------------------------
+ * This function prints the wait and hold times of the recent locks, summed
+ * per process name and tag
+ *------------------------------------------------------------------------*/
+static void printLockSummary(const PECILockProfile* profile)
+{
+    struct
+    {
+        const char* comm;
+        const char* tag;
+        uint64_t locks;
+        uint64_t busy;
+        uint64_t wait_ns;
+        uint64_t maxWait_ns;
+        uint64_t hold_ns;
+        uint64_t maxHold_ns;
+    } callers[PECI_LOCKPROF_HISTORY];
+    uint32_t callerCount = 0;
+
+    for (uint32_t i = 0; i < profile->historyCount; i++)
+    {
+        const PECILockRecord* record = &profile->history[i];
+        uint32_t c = 0;
+        while (c < callerCount && (strcmp(callers[c].comm, record->comm) != 0 ||
+                                   strcmp(callers[c].tag, record->tag) != 0))
+        {
+            c++;
+        }
+        if (c == callerCount)
+        {
+            memset(&callers[c], 0, sizeof(callers[c]));
+            callers[c].comm = record->comm;
+            callers[c].tag = record->tag;
+            callerCount++;
+        }
+        if (record->state == PECI_LOCK_BUSY)
+        {
+            callers[c].busy++;
+        }
+        else
+        {
+            callers[c].locks++;
+        }
+        callers[c].wait_ns += record->wait_ns;
+        callers[c].hold_ns += record->hold_ns;
+        if (record->wait_ns > callers[c].maxWait_ns)
+        {
+            callers[c].maxWait_ns = record->wait_ns;
+        }
+        if (record->hold_ns > callers[c].maxHold_ns)
+        {
+            callers[c].maxHold_ns = record->hold_ns;
+        }
+    }
+
+    for (uint32_t c = 0; c < callerCount; c++)
+    {
+        uint64_t count = callers[c].locks + callers[c].busy;
+        printf("   %s \"%s\": locks %" PRIu64 " busy %" PRIu64
+               " avg wait %lf s max wait %lf s avg hold %lf s"
+               " max hold %lf s\n",
+               callers[c].comm, callers[c].tag, callers[c].locks,
+               callers[c].busy,
+               (double)callers[c].wait_ns / (double)count * 1e-9,
+               (double)callers[c].maxWait_ns * 1e-9,
+               callers[c].locks ? (double)callers[c].hold_ns /
+                                      (double)callers[c].locks * 1e-9
+                                : 0.0,
+               (double)callers[c].maxHold_ns * 1e-9);
+    }
+}
+
 static void printLoopSummary(uint32_t* ccCounts)
 {
     printf("Completion code counts:\n");
@@ -329,7 +444,103 @@ int main(int argc, char* argv[])
             }
         }
     }
+    else if (strcmp(cmd, "gettopology") == 0)
+    {
+        PECITopology topology;
 
+        if (verbose)
+        {
+            printf("GetTopology\n");
+        }
+        while (loops--)
+        {
+            clock_gettime(CLOCK_REALTIME, &begin);
+            ret = peci_GetTopology(&topology, true);
+            timeSpent = getTimeDifference(begin);
+            if (verbose && measureTime)
+            {
+                printf("\nTime taken in iteration %d = %lf s\n",
+                       (loopCount - loops), timeSpent);
+            }
+            totalTimeSpent += timeSpent;
+
+            if (verbose || loops == 0)
+            {
+                if (0 != ret)
+                {
+                    printf("ERROR %d: Retrieving topology failed\n", ret);
+                    continue;
+                }
+                printf("   Generation %u\n", topology.generation);
+                for (int cpu = 0; cpu < MAX_CPUS; cpu++)
+                {
+                    const PECIClientInfo* client = &topology.clients[cpu];
+                    const PECIModelOps* ops = NULL;
+
+                    if (!(topology.presentMask & (1 << cpu)))
+                    {
+                        continue;
+                    }
+                    ops = peci_GetModelOps((uint8_t)(MIN_CLIENT_ADDR + cpu));
+                    printf("   0x%02x: DIB 0x%" PRIx64
+                           " CPU 0x%08x (%s) stepping %u domains 0x%02x\n",
+                           MIN_CLIENT_ADDR + cpu, client->dib,
+                           client->cpuModel, ops ? ops->name : "unknown",
+                           client->stepping, client->domainMask);
+                }
+            }
+        }
+    }
+
+    else if (strcmp(cmd, "getinventory") == 0)
+    {
+        PECIInventory inventory;
+
+        if (verbose)
+        {
+            printf("GetInventory\n");
+        }
+        while (loops--)
+        {
+            clock_gettime(CLOCK_REALTIME, &begin);
+            ret = peci_GetInventory(&inventory, true);
+            timeSpent = getTimeDifference(begin);
+            if (verbose && measureTime)
+            {
+                printf("\nTime taken in iteration %d = %lf s\n",
+                       (loopCount - loops), timeSpent);
+            }
+            totalTimeSpent += timeSpent;
+
+            if (verbose || loops == 0)
+            {
+                if (0 != ret)
+                {
+                    printf("ERROR %d: Retrieving inventory failed\n", ret);
+                    continue;
+                }
+                for (int cpu = 0; cpu < MAX_CPUS; cpu++)
+                {
+                    const PECISocketInventory* socket =
+                        &inventory.sockets[cpu];
+
+                    if (!(inventory.presentMask & (1 << cpu)))
+                    {
+                        continue;
+                    }
+                    printf("   0x%02x: CPU 0x%08x platform 0x%08x "
+                           "microcode 0x%08x max thread 0x%08x\n",
+                           MIN_CLIENT_ADDR + cpu, socket->cpuId,
+                           socket->platformId, socket->microcodeRev,
+                           socket->maxThreadId);
+                    printf("         TDP 0x%08x units 0x%08x levels 0x%08x "
+                           "turbo 0x%08x valid 0x%02x\n",
+                           socket->tdp, socket->tdpUnits, socket->tdpLevels,
+                           socket->turboRatioLimit, socket->validMask);
+                }
+            }
+        }
+    }
     else if (strcmp(cmd, "gettemp") == 0)
     {
         if (verbose)
@@ -1084,13 +1295,10 @@ int main(int argc, char* argv[])
             printf("ERROR: Incorrect write length for raw command\n");
             goto ErrorExit;
         }
-        uint8_t* rawCmd = (uint8_t*)calloc(writeLength, sizeof(uint8_t));
-        if (rawCmd == NULL)
-        {
-            // calloc failed, abort the sequence
-            printf("Raw command memory allocation failed\n");
-            return 1;
-        }
+        // The command and response are both at most 255 bytes, so they are
+        // kept on the stack
+        uint8_t rawCmd[UINT8_MAX] = {0};
+        uint8_t rawResp[UINT8_MAX] = {0};
         for (i = 0; i < (argc - optind); i++)
         {
             rawCmd[i] = (uint8_t)strtoul(argv[i + optind], NULL, 0);
@@ -1106,14 +1314,6 @@ int main(int argc, char* argv[])
             printf("\n");
         }
 
-        uint8_t* rawResp = (uint8_t*)calloc(readLength, sizeof(uint8_t));
-        if (rawResp == NULL)
-        {
-            // calloc failed, abort the sequence
-            printf("Raw command memory allocation failed\n");
-            free(rawCmd);
-            return 1;
-        }
         while (loops--)
         {
             clock_gettime(CLOCK_REALTIME, &begin);
@@ -1156,9 +1356,203 @@ int main(int argc, char* argv[])
         {
             printLoopSummary(ccCounts);
         }
+    }
+    else if (strcmp(cmd, "replay") == 0)
+    {
+        PECITraceReplayStats stats;
+        bool realTime = false;
+
+        if ((argc - optind) < 1)
+        {
+            printf("ERROR: Unsupported arguments for Replay\n");
+            goto ErrorExit;
+        }
+        char* tracePath = argv[optind++];
+        if ((argc - optind) > 0)
+        {
+            realTime = strcmp(argv[optind], "realtime") == 0;
+        }
+
+        ret = peci_SimStart(tracePath, realTime);
+        if (ret != PECI_CC_SUCCESS)
+        {
+            printf("ERROR %d: Unable to load trace %s\n", ret, tracePath);
+            return 1;
+        }
+        while (loops--)
+        {
+            ret = peci_TraceReplay(tracePath, realTime, &stats);
+            if (ret != PECI_CC_SUCCESS)
+            {
+                printf("ERROR %d: Replay failed\n", ret);
+                break;
+            }
+            printf("Replayed %" PRIu64 " commands (%" PRIu64
+                   " mismatched, %" PRIu64 " skipped)\n",
+                   stats.commands, stats.mismatches, stats.skipped);
+            printf("   Recorded time %lf s, replay time %lf s\n",
+                   (double)stats.recorded_ns * 1e-9,
+                   (double)stats.elapsed_ns * 1e-9);
+        }
+        peci_SimStop();
+    }
+    else if (strcmp(cmd, "snapshot") == 0)
+    {
+        PECISnapshot* snapshot = NULL;
+        PECISnapshotValue value;
+        const char* snapshotName = NULL;
+
+        if ((argc - optind) > 0)
+        {
+            snapshotName = argv[optind];
+        }
+        ret = peci_SnapshotOpen(snapshotName, &snapshot);
+        if (ret != PECI_CC_SUCCESS)
+        {
+            printf("ERROR %d: Unable to open snapshot\n", ret);
+            return 1;
+        }
+        uint32_t count = peci_SnapshotCount(snapshot);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (peci_SnapshotRead(snapshot, i, &value) != PECI_CC_SUCCESS)
+            {
+                printf("   %u: busy\n", i);
+                continue;
+            }
+            printf("   key 0x%08x: 0x%" PRIx64 " age %lf s\n", value.key,
+                   value.value, (double)value.age_ns * 1e-9);
+        }
+        peci_SnapshotClose(snapshot);
+    }
+    else if (strcmp(cmd, "arbitration") == 0)
+    {
+        PECIArbitrationStatus status;
 
-        free(rawCmd);
-        free(rawResp);
+        ret = peci_GetArbitrationStatus(&status);
+        if (ret != PECI_CC_SUCCESS)
+        {
+            printf("ERROR %d: Unable to read arbitration status\n", ret);
+            return 1;
+        }
+        if (status.held)
+        {
+            printf("   holder: pid %d tid %d (%s) %s, held %lf s\n",
+                   status.holder.pid, status.holder.tid, status.holder.comm,
+                   priorityName(status.holder.priority),
+                   (double)status.holder.elapsed_ns * 1e-9);
+        }
+        else
+        {
+            printf("   holder: none\n");
+        }
+        for (uint32_t i = 0; i < status.waiterCount; i++)
+        {
+            printf("   waiter: pid %d tid %d (%s) %s, waiting %lf s\n",
+                   status.waiters[i].pid, status.waiters[i].tid,
+                   status.waiters[i].comm,
+                   priorityName(status.waiters[i].priority),
+                   (double)status.waiters[i].elapsed_ns * 1e-9);
+        }
+        for (int c = 0; c < PECI_PRIORITY_COUNT; c++)
+        {
+            const PECIArbitrationClassStats* stats = &status.classes[c];
+            printf("   %-8s acquired %" PRIu64 " timeouts %" PRIu64
+                   " avg wait %lf s max wait %lf s\n",
+                   priorityName((EPECIPriority)c), stats->acquired,
+                   stats->timeouts,
+                   stats->acquired
+                       ? (double)stats->wait_ns / (double)stats->acquired * 1e-9
+                       : 0.0,
+                   (double)stats->maxWait_ns * 1e-9);
+        }
+        printf("   reclaimed from dead processes: %" PRIu64 "\n",
+               status.reclaimed);
+    }
+    else if (strcmp(cmd, "locks") == 0)
+    {
+        PECILockProfile* profile = malloc(sizeof(*profile));
+
+        if (profile == NULL)
+        {
+            printf("ERROR: Unable to allocate the lock profile\n");
+            return 1;
+        }
+        ret = peci_GetLockProfile(profile);
+        if (ret != PECI_CC_SUCCESS)
+        {
+            printf("ERROR %d: Unable to read lock profile\n", ret);
+            free(profile);
+            return 1;
+        }
+        for (uint32_t i = 0; i < profile->liveCount; i++)
+        {
+            printLockRecord("live", &profile->live[i]);
+        }
+        if (verbose)
+        {
+            for (uint32_t i = 0; i < profile->historyCount; i++)
+            {
+                printLockRecord("past", &profile->history[i]);
+            }
+        }
+        printf("   last %u locks:\n", profile->historyCount);
+        printLockSummary(profile);
+        printf("   locks %" PRIu64 " busy %" PRIu64 " dropped %" PRIu64
+               " reaped %" PRIu64 "\n",
+               profile->locks, profile->busy, profile->dropped,
+               profile->reaped);
+        free(profile);
+    }
+    else if (strcmp(cmd, "uncorecapture") == 0)
+    {
+        PECICaptureSeq seqs[] = {
+            {.seqId = VCU_TOR_DUMP_SEQ},
+            {.seqId = VCU_SQ_DUMP_SEQ},
+            {.seqId = VCU_UNCORE_CRASHDUMP_SEQ},
+        };
+        PECICaptureStats stats;
+        uint8_t domainCount = 1;
+
+        if ((argc - optind) < 4)
+        {
+            printf("ERROR: Unsupported arguments for UncoreCapture\n");
+            goto ErrorExit;
+        }
+        char* capturePath = argv[optind++];
+        for (size_t n = 0; n < sizeof(seqs) / sizeof(seqs[0]); n++)
+        {
+            seqs[n].dwordCount = (uint32_t)strtoul(argv[optind++], NULL, 0);
+        }
+        if ((argc - optind) > 0)
+        {
+            domainCount = (uint8_t)strtoul(argv[optind], NULL, 0);
+        }
+        // The TOR and SQ dumps are per domain, the uncore crashdump is not
+        seqs[0].domainCount = domainCount;
+        seqs[1].domainCount = domainCount;
+        seqs[2].domainCount = 1;
+
+        int captureFd =
+            open(capturePath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (captureFd < 0)
+        {
+            printf("ERROR %d: Unable to open %s\n", errno, capturePath);
+            return 1;
+        }
+        ret = peci_UncoreCapture(seqs, sizeof(seqs) / sizeof(seqs[0]),
+                                 captureFd, PECI_WAIT_FOREVER, &stats);
+        close(captureFd);
+        if (ret != PECI_CC_SUCCESS)
+        {
+            printf("ERROR %d: Capture failed\n", ret);
+            return 1;
+        }
+        printf("Captured %u sequences (%u failed) from sockets 0x%02x\n",
+               stats.sequences, stats.failed, stats.socketMask);
+        printf("   %" PRIu64 " dwords, %" PRIu64 " bytes in %lf s\n",
+               stats.dwords, stats.bytesWritten,
+               (double)stats.elapsed_ns * 1e-9);
     }
     else
     {
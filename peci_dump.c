@@ -0,0 +1,682 @@
+/*
+// Copyright (c) 2026 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include "peci_trace.h"
+
+#include <errno.h>
+#include <peci.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Backoff between retries of a read the CPU asked to retry
+#define DUMP_RETRY_DELAY_MS 10
+#define DUMP_RETRY_DELAY_MAX_MS 160
+#define DUMP_MAX_RETRIES 8
+
+// Capture records are batched in a buffer of this size before each write
+#define CAPTURE_BUF_SIZE 16384
+
+// Record data is padded to an even number of dwords to keep every record
+// 8 byte aligned
+static inline size_t peci_CaptureRecordSize(uint32_t dwordCount)
+{
+    return sizeof(PECICaptureRecord) +
+           ((dwordCount + 1) & ~1U) * sizeof(uint32_t);
+}
+
+/*-------------------------------------------------------------------------
+ * This function initializes a dump collector for the specified sequence
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_DumpInit(PECIDumpCollector* dump, uint8_t target,
+                          uint8_t domainId, EPECISequence seqId,
+                          uint64_t dwordCount, int out_fd)
+{
+    if (dump == NULL || out_fd < 0)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // The target address must be in the valid range
+    if (target < MIN_CLIENT_ADDR || target > MAX_CLIENT_ADDR)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    memset(dump, 0, sizeof(*dump));
+    dump->target = target;
+    dump->domainId = domainId;
+    dump->seqId = seqId;
+    dump->dwordCount = dwordCount;
+    dump->out_fd = out_fd;
+    dump->timeout_ms = PECI_WAIT_FOREVER;
+    dump->maxRetries = DUMP_MAX_RETRIES;
+    dump->progress.dwordsTotal = dwordCount;
+    return PECI_CC_SUCCESS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function writes the buffered dwords to the output file descriptor
+ *------------------------------------------------------------------------*/
+static EPECIStatus peci_DumpFlush(PECIDumpCollector* dump)
+{
+    const uint8_t* data = (const uint8_t*)dump->buf;
+    size_t len = dump->bufCount * sizeof(uint32_t);
+
+    while (len > 0)
+    {
+        ssize_t written = write(dump->out_fd, data, len);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return PECI_CC_MEM_ERR;
+        }
+        data += written;
+        len -= (size_t)written;
+        dump->progress.bytesWritten += (uint64_t)written;
+    }
+    dump->bufCount = 0;
+
+    dump->progress.elapsed_ns = peci_now_ns() - dump->start_ns;
+    if (dump->progress.elapsed_ns)
+    {
+        dump->progress.bytesPerSec = dump->progress.bytesWritten *
+                                     1000000000ULL /
+                                     dump->progress.elapsed_ns;
+    }
+    if (dump->progressCb != NULL)
+    {
+        dump->progressCb(&dump->progress, dump->cbCtx);
+    }
+    return PECI_CC_SUCCESS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function waits before retrying a read, doubling the delay on each
+ * attempt
+ *------------------------------------------------------------------------*/
+static void peci_DumpBackoff(uint32_t attempt)
+{
+    uint32_t delay_ms = DUMP_RETRY_DELAY_MS;
+
+    while (attempt-- > 0 && delay_ms < DUMP_RETRY_DELAY_MAX_MS)
+    {
+        delay_ms *= 2;
+    }
+    struct timespec delay = {
+        .tv_sec = delay_ms / 1000,
+        .tv_nsec = (long)(delay_ms % 1000) * 1000000,
+    };
+    nanosleep(&delay, NULL);
+}
+
+/*-------------------------------------------------------------------------
+ * This function collects a dump with the provided peci file descriptor,
+ * streaming it to the output file descriptor through a fixed size buffer.
+ * Reads the CPU asks to retry are retried with backoff up to maxRetries
+ * times in a row. If they still fail, the sequence is left open and
+ * PECI_CC_TIMEOUT is returned, and calling this function again resumes the
+ * dump where it stopped. Any other failure aborts the sequence.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_DumpRun_seq(PECIDumpCollector* dump, int peci_fd, uint8_t* cc)
+{
+    EPECIStatus ret = PECI_CC_SUCCESS;
+    uint32_t attempts = 0;
+
+    if (dump == NULL || cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    if (!dump->seq.open)
+    {
+        if (dump->progress.dwordsDone != 0)
+        {
+            // The sequence was aborted or finished, so it can't be resumed
+            return PECI_CC_INVALID_REQ;
+        }
+        dump->start_ns = peci_now_ns();
+        ret = peci_VCUOpen_seq(&dump->seq, dump->target, dump->domainId,
+                               dump->seqId, dump->timeout_ms, peci_fd, cc);
+        for (size_t i = 0; i < dump->paramCount && dump->seq.open; i++)
+        {
+            ret = peci_VCUSetParam(&dump->seq, dump->params[i], cc);
+        }
+        if (!dump->seq.open)
+        {
+            return ret;
+        }
+    }
+    // The session may have been reopened since the last call
+    dump->seq.peci_fd = peci_fd;
+
+    while (dump->progress.dwordsDone < dump->dwordCount)
+    {
+        size_t space = PECI_DUMP_BUF_DWORDS - dump->bufCount;
+        uint64_t left = dump->dwordCount - dump->progress.dwordsDone;
+        size_t count = left < space ? (size_t)left : space;
+        size_t readCount = 0;
+
+        ret = peci_VCURead(&dump->seq, &dump->buf[dump->bufCount], count,
+                           &readCount, cc);
+        dump->bufCount += readCount;
+        dump->progress.dwordsDone += readCount;
+        if (readCount)
+        {
+            attempts = 0;
+        }
+
+        if (!dump->seq.open)
+        {
+            // Keep what was collected before the failure
+            peci_DumpFlush(dump);
+            return ret;
+        }
+        if (readCount < count)
+        {
+            // The CPU asked for a retry
+            dump->progress.retries++;
+            if (attempts >= dump->maxRetries)
+            {
+                peci_DumpFlush(dump);
+                return PECI_CC_TIMEOUT;
+            }
+            peci_DumpBackoff(attempts++);
+            continue;
+        }
+
+        if (dump->bufCount == PECI_DUMP_BUF_DWORDS ||
+            dump->progress.dwordsDone == dump->dwordCount)
+        {
+            ret = peci_DumpFlush(dump);
+            if (ret != PECI_CC_SUCCESS)
+            {
+                peci_VCUAbort(&dump->seq);
+                return ret;
+            }
+        }
+    }
+
+    return peci_VCUClose(&dump->seq, cc);
+}
+
+/*-------------------------------------------------------------------------
+ * This function aborts a dump that was left open by peci_DumpRun_seq
+ *------------------------------------------------------------------------*/
+void peci_DumpAbort(PECIDumpCollector* dump, int peci_fd)
+{
+    if (dump == NULL)
+    {
+        return;
+    }
+    dump->seq.peci_fd = peci_fd;
+    peci_VCUAbort(&dump->seq);
+}
+
+/*-------------------------------------------------------------------------
+ * This function collects a dump, locking the PECI device for the duration
+ * of the call
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_DumpRun(PECIDumpCollector* dump, uint8_t* cc)
+{
+    int peci_fd = -1;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (dump == NULL || cc == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    if (peci_Lock(&peci_fd, PECI_TIMEOUT_MS) != PECI_CC_SUCCESS)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    ret = peci_DumpRun_seq(dump, peci_fd, cc);
+
+    peci_Unlock(peci_fd);
+    return ret;
+}
+
+// One sequence on one socket and domain.  VCU_READ does not name the
+// sequence it reads from, so only one sequence may be open on a socket and
+// domain at a time.  Streams of the same socket and domain form a lane and
+// run one after another.
+struct peci_capture_stream
+{
+    PECIVCUSequence seq;
+    const PECICaptureSeq* spec;
+    uint32_t seqId;
+    uint32_t dwordCount;
+    uint32_t dwordsDone;
+    uint32_t attempts;
+    uint8_t target;
+    uint8_t domainId;
+    bool started;
+    bool done;
+};
+
+struct peci_capture_out
+{
+    int out_fd;
+    size_t len;
+    PECICaptureStats* stats;
+    uint8_t buf[CAPTURE_BUF_SIZE];
+};
+
+/*-------------------------------------------------------------------------
+ * This function writes the batched capture records to the output file
+ * descriptor
+ *------------------------------------------------------------------------*/
+static EPECIStatus peci_CaptureFlush(struct peci_capture_out* out)
+{
+    const uint8_t* data = out->buf;
+    size_t len = out->len;
+
+    while (len > 0)
+    {
+        ssize_t written = write(out->out_fd, data, len);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return PECI_CC_MEM_ERR;
+        }
+        data += written;
+        len -= (size_t)written;
+        out->stats->bytesWritten += (uint64_t)written;
+    }
+    out->len = 0;
+    return PECI_CC_SUCCESS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function reserves zeroed space for a record and dwordCount dwords in
+ * the output buffer, flushing it first if needed
+ *------------------------------------------------------------------------*/
+static PECICaptureRecord* peci_CaptureReserve(struct peci_capture_out* out,
+                                              uint32_t dwordCount)
+{
+    size_t len = peci_CaptureRecordSize(dwordCount);
+
+    if (out->len + len > sizeof(out->buf) &&
+        peci_CaptureFlush(out) != PECI_CC_SUCCESS)
+    {
+        return NULL;
+    }
+    PECICaptureRecord* rec = (PECICaptureRecord*)(out->buf + out->len);
+    memset(rec, 0, len);
+    return rec;
+}
+
+/*-------------------------------------------------------------------------
+ * This function commits a record reserved with peci_CaptureReserve
+ *------------------------------------------------------------------------*/
+static void peci_CaptureCommit(struct peci_capture_out* out,
+                               const struct peci_capture_stream* stream,
+                               PECICaptureRecord* rec, uint32_t dwordCount)
+{
+    rec->dwordCount = dwordCount;
+    rec->seqId = stream->seqId;
+    rec->offset = stream->dwordsDone - dwordCount;
+    rec->target = stream->target;
+    rec->domainId = stream->domainId;
+    rec->timestamp_ns = peci_now_ns();
+    out->len += peci_CaptureRecordSize(dwordCount);
+    out->stats->dwords += dwordCount;
+    if (rec->flags & PECI_CAPTURE_ERROR)
+    {
+        out->stats->failed++;
+    }
+}
+
+/*-------------------------------------------------------------------------
+ * This function reads the next chunk of a capture stream into the output
+ * buffer. It returns false once the stream is finished.
+ *------------------------------------------------------------------------*/
+static bool peci_CaptureStep(struct peci_capture_out* out,
+                             struct peci_capture_stream* stream,
+                             bool* progressed)
+{
+    uint32_t left = stream->dwordCount - stream->dwordsDone;
+    uint32_t count =
+        left < PECI_CAPTURE_CHUNK_DWORDS ? left : PECI_CAPTURE_CHUNK_DWORDS;
+    size_t readCount = 0;
+    uint8_t cc = 0;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    PECICaptureRecord* rec = peci_CaptureReserve(out, count);
+    if (rec == NULL)
+    {
+        peci_VCUAbort(&stream->seq);
+        return false;
+    }
+
+    if (count > 0)
+    {
+        ret = peci_VCURead(&stream->seq, (uint32_t*)(rec + 1), count,
+                           &readCount, &cc);
+    }
+    stream->dwordsDone += (uint32_t)readCount;
+    if (readCount)
+    {
+        stream->attempts = 0;
+        *progressed = true;
+    }
+
+    if (stream->seq.open && readCount < count)
+    {
+        // The CPU asked for a retry, so give the other streams a turn
+        if (++stream->attempts > DUMP_MAX_RETRIES)
+        {
+            peci_VCUAbort(&stream->seq);
+            ret = PECI_CC_TIMEOUT;
+        }
+        else if (readCount == 0)
+        {
+            return true;
+        }
+    }
+    if (stream->seq.open && stream->dwordsDone == stream->dwordCount)
+    {
+        ret = peci_VCUClose(&stream->seq, &cc);
+        rec->flags |= PECI_CAPTURE_LAST;
+    }
+    if (!stream->seq.open && !(rec->flags & PECI_CAPTURE_LAST))
+    {
+        rec->flags |= PECI_CAPTURE_ERROR | PECI_CAPTURE_LAST;
+    }
+    if (rec->flags & PECI_CAPTURE_LAST)
+    {
+        rec->status = ret;
+        rec->cc = cc;
+        if (ret != PECI_CC_SUCCESS || cc != PECI_DEV_CC_SUCCESS)
+        {
+            rec->flags |= PECI_CAPTURE_ERROR;
+        }
+    }
+    peci_CaptureCommit(out, stream, rec, (uint32_t)readCount);
+    return !(rec->flags & PECI_CAPTURE_LAST);
+}
+
+/*-------------------------------------------------------------------------
+ * This function opens the sequence of a capture stream. A sequence that
+ * fails to open is recorded as failed and its stream finished.
+ *------------------------------------------------------------------------*/
+static EPECIStatus peci_CaptureOpen(struct peci_capture_out* out,
+                                    struct peci_capture_stream* stream,
+                                    int timeout_ms, int peci_fd)
+{
+    const PECICaptureSeq* spec = stream->spec;
+    uint8_t cc = 0;
+
+    stream->started = true;
+    out->stats->sequences++;
+    EPECIStatus ret = peci_VCUOpen_seq(&stream->seq, stream->target,
+                                       stream->domainId, spec->seqId,
+                                       timeout_ms, peci_fd, &cc);
+    for (size_t p = 0; p < spec->paramCount && stream->seq.open; p++)
+    {
+        ret = peci_VCUSetParam(&stream->seq, spec->params[p], &cc);
+    }
+    if (stream->seq.open)
+    {
+        return PECI_CC_SUCCESS;
+    }
+
+    // Record the failure so the capture shows what is missing
+    stream->done = true;
+    PECICaptureRecord* rec = peci_CaptureReserve(out, 0);
+    if (rec == NULL)
+    {
+        return PECI_CC_MEM_ERR;
+    }
+    rec->flags = PECI_CAPTURE_ERROR | PECI_CAPTURE_LAST;
+    rec->status = ret;
+    rec->cc = cc;
+    peci_CaptureCommit(out, stream, rec, 0);
+    return PECI_CC_SUCCESS;
+}
+
+// Streams a capture of the sequences can run, one per socket and domain
+static size_t peci_CaptureMaxStreams(const PECICaptureSeq* seqs,
+                                     size_t seqCount)
+{
+    size_t maxStreams = 0;
+
+    for (size_t i = 0; i < seqCount; i++)
+    {
+        maxStreams += seqs[i].domainCount ? seqs[i].domainCount : 1;
+    }
+    return maxStreams * MAX_CPUS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function gets the arena space a capture of the sequences needs
+ *------------------------------------------------------------------------*/
+size_t peci_UncoreCaptureArenaSize(const PECICaptureSeq* seqs,
+                                   size_t seqCount)
+{
+    if (seqs == NULL)
+    {
+        return 0;
+    }
+    return PECI_ARENA_SIZE(peci_CaptureMaxStreams(seqs, seqCount),
+                           sizeof(struct peci_capture_stream)) +
+           PECI_ARENA_SIZE(1, sizeof(struct peci_capture_out));
+}
+
+/*-------------------------------------------------------------------------
+ * This function runs the capture sequences on every present socket and
+ * domain with the provided peci file descriptor, in one allocation
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_UncoreCapture_seq(const PECICaptureSeq* seqs,
+                                   size_t seqCount, int out_fd,
+                                   int timeout_ms, int peci_fd,
+                                   PECICaptureStats* stats)
+{
+    PECIArena arena;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (seqs == NULL || seqCount == 0 || out_fd < 0 || stats == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    if (peci_ArenaInit(&arena, NULL,
+                       peci_UncoreCaptureArenaSize(seqs, seqCount)) !=
+        PECI_CC_SUCCESS)
+    {
+        return PECI_CC_MEM_ERR;
+    }
+    ret = peci_UncoreCaptureArena_seq(seqs, seqCount, out_fd, timeout_ms,
+                                      peci_fd, &arena, stats);
+    peci_ArenaFree(&arena);
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function runs the capture sequences on every present socket and
+ * domain with the provided peci file descriptor, taking its working memory
+ * from the arena. The sequences of each socket and domain run one after
+ * another, since VCU_READ does not name the sequence it reads from, while
+ * different sockets and domains take turns a chunk at a time. That keeps
+ * the bus busy with one socket while another asks for a retry, and the
+ * output is written as interleaved records through a fixed size buffer.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_UncoreCaptureArena_seq(
+    const PECICaptureSeq* seqs, size_t seqCount, int out_fd, int timeout_ms,
+    int peci_fd, PECIArena* arena, PECICaptureStats* stats)
+{
+    struct peci_capture_stream* streams = NULL;
+    struct peci_capture_out* out = NULL;
+    size_t streamCount = 0;
+    size_t maxStreams = 0;
+    size_t active = 0;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (seqs == NULL || seqCount == 0 || out_fd < 0 || arena == NULL ||
+        stats == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    uint64_t start_ns = peci_now_ns();
+
+    for (uint8_t target = MIN_CLIENT_ADDR; target <= MAX_CLIENT_ADDR; target++)
+    {
+        if (peci_Ping_seq(target, peci_fd) == PECI_CC_SUCCESS)
+        {
+            stats->socketMask |= (uint8_t)(1 << (target - MIN_CLIENT_ADDR));
+        }
+    }
+    if (stats->socketMask == 0)
+    {
+        return PECI_CC_CPU_NOT_PRESENT;
+    }
+
+    size_t mark = arena->used;
+    maxStreams = peci_CaptureMaxStreams(seqs, seqCount);
+    streams = peci_ArenaAlloc(arena, maxStreams * sizeof(*streams));
+    out = peci_ArenaAlloc(arena, sizeof(*out));
+    if (streams == NULL || out == NULL)
+    {
+        arena->used = mark;
+        return PECI_CC_MEM_ERR;
+    }
+    out->out_fd = out_fd;
+    out->stats = stats;
+
+    PECICaptureHeader* hdr = (PECICaptureHeader*)out->buf;
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, PECI_CAPTURE_MAGIC, sizeof(hdr->magic));
+    hdr->version = PECI_CAPTURE_VERSION;
+    hdr->hdr_size = sizeof(*hdr);
+    out->len = sizeof(*hdr);
+
+    // List the streams lane by lane, in the order each lane runs them
+    for (uint8_t target = MIN_CLIENT_ADDR; target <= MAX_CLIENT_ADDR; target++)
+    {
+        if (!(stats->socketMask & (1 << (target - MIN_CLIENT_ADDR))))
+        {
+            continue;
+        }
+        for (uint32_t domainId = 0; domainId <= UINT8_MAX; domainId++)
+        {
+            for (size_t i = 0; i < seqCount; i++)
+            {
+                uint8_t domainCount = seqs[i].domainCount
+                                          ? seqs[i].domainCount
+                                          : 1;
+                if (domainId >= domainCount)
+                {
+                    continue;
+                }
+                struct peci_capture_stream* stream = &streams[streamCount++];
+                stream->spec = &seqs[i];
+                stream->seqId = (uint32_t)seqs[i].seqId;
+                stream->dwordCount = seqs[i].dwordCount;
+                stream->target = target;
+                stream->domainId = (uint8_t)domainId;
+                active++;
+            }
+        }
+    }
+
+    // Take a turn on each lane until every stream is finished.  A lane's
+    // turn goes to its first unfinished stream, which is opened on its first
+    // turn and read a chunk at a time after that.
+    for (uint32_t idle = 0; active > 0;)
+    {
+        bool progressed = false;
+        int lane = -1;
+
+        for (size_t i = 0; i < streamCount; i++)
+        {
+            struct peci_capture_stream* stream = &streams[i];
+            int streamLane = stream->target << 8 | stream->domainId;
+
+            if (stream->done || streamLane == lane)
+            {
+                continue;
+            }
+            lane = streamLane;
+            if (!stream->started)
+            {
+                ret = peci_CaptureOpen(out, stream, timeout_ms, peci_fd);
+                if (ret == PECI_CC_MEM_ERR)
+                {
+                    goto Exit;
+                }
+                progressed = true;
+            }
+            else if (!peci_CaptureStep(out, stream, &progressed))
+            {
+                stream->done = true;
+            }
+            if (stream->done)
+            {
+                active--;
+            }
+        }
+        if (!progressed && active > 0)
+        {
+            // Every open sequence asked for a retry
+            peci_DumpBackoff(idle++);
+        }
+        else
+        {
+            idle = 0;
+        }
+    }
+    ret = peci_CaptureFlush(out);
+
+Exit:
+    for (size_t i = 0; i < streamCount; i++)
+    {
+        peci_VCUAbort(&streams[i].seq);
+    }
+    stats->elapsed_ns = peci_now_ns() - start_ns;
+    arena->used = mark;
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function runs the capture sequences on every present socket and
+ * domain
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_UncoreCapture(const PECICaptureSeq* seqs, size_t seqCount,
+                               int out_fd, int timeout_ms,
+                               PECICaptureStats* stats)
+{
+    int peci_fd = -1;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (peci_Lock(&peci_fd, PECI_TIMEOUT_MS) != PECI_CC_SUCCESS)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    ret = peci_UncoreCapture_seq(seqs, seqCount, out_fd, timeout_ms, peci_fd,
+                                 stats);
+
+    peci_Unlock(peci_fd);
+    return ret;
+}
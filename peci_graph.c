@@ -0,0 +1,393 @@
+/*
+// Copyright (c) 2026 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include <peci.h>
+#include <string.h>
+
+// Index of the read length argument of each operation, or -1 if it has
+// none, and whether the command returns a completion code
+static const struct
+{
+    int8_t lenArg;
+    bool cc;
+} peci_graph_ops[] = {
+    [PECI_GRAPH_PING] = {-1, false},
+    [PECI_GRAPH_GET_TEMP] = {-1, false},
+    [PECI_GRAPH_RD_PKG_CONFIG] = {2, true},
+    [PECI_GRAPH_WR_PKG_CONFIG] = {-1, true},
+    [PECI_GRAPH_RD_IA_MSR] = {-1, true},
+    [PECI_GRAPH_RD_PCI_CONFIG] = {-1, true},
+    [PECI_GRAPH_RD_PCI_CONFIG_LOCAL] = {4, true},
+    [PECI_GRAPH_RD_END_POINT_PCI_LOCAL] = {5, true},
+    [PECI_GRAPH_RD_MODEL_PCI_LOCAL] = {4, true},
+    [PECI_GRAPH_CRASHDUMP_DISCOVERY] = {4, true},
+    [PECI_GRAPH_CRASHDUMP_GET_FRAME] = {3, true},
+};
+
+#define PECI_GRAPH_OP_COUNT (sizeof(peci_graph_ops) / sizeof(peci_graph_ops[0]))
+
+static uint32_t peci_GraphBytes(const uint8_t* data, uint8_t offset,
+                                uint8_t width)
+{
+    uint32_t value = 0;
+
+    for (uint8_t i = 0; i < width; i++)
+    {
+        value |= (uint32_t)data[offset + i] << (8 * i);
+    }
+    return value;
+}
+
+static bool peci_GraphSucceeded(const PECIGraphNode* node,
+                                const PECIGraphResult* result)
+{
+    return result->state == PECI_GRAPH_RAN &&
+           result->status == PECI_CC_SUCCESS &&
+           (!peci_graph_ops[node->op].cc || result->cc == PECI_DEV_CC_SUCCESS);
+}
+
+static bool peci_GraphEdgeHolds(const PECIGraphEdge* edge,
+                                const PECIGraphNode* node,
+                                const PECIGraphResult* from)
+{
+    if (from->state != PECI_GRAPH_RAN)
+    {
+        return false;
+    }
+    switch (edge->when)
+    {
+        case PECI_GRAPH_ALWAYS:
+            return true;
+        case PECI_GRAPH_ON_SUCCESS:
+            return peci_GraphSucceeded(node, from);
+        case PECI_GRAPH_ON_FAILURE:
+            return !peci_GraphSucceeded(node, from);
+        case PECI_GRAPH_ON_CC:
+            return peci_graph_ops[node->op].cc &&
+                   from->status == PECI_CC_SUCCESS &&
+                   (from->cc & edge->mask) == edge->value;
+        case PECI_GRAPH_ON_DATA:
+            return peci_GraphSucceeded(node, from) &&
+                   (peci_GraphBytes(from->data, 0, 4) & edge->mask) ==
+                       edge->value;
+    }
+    return false;
+}
+
+/*-------------------------------------------------------------------------
+ * This function checks that every index in the graph is in range and that
+ * it has no cycles, and counts the dependencies of each node
+ *------------------------------------------------------------------------*/
+static EPECIStatus peci_GraphCheck(const PECIGraph* graph, uint16_t* pending)
+{
+    uint16_t ready[PECI_GRAPH_MAX_NODES];
+    uint16_t count[PECI_GRAPH_MAX_NODES] = {0};
+    size_t readyCount = 0;
+    size_t seen = 0;
+
+    if (graph == NULL || graph->nodes == NULL || graph->nodeCount == 0 ||
+        graph->nodeCount > PECI_GRAPH_MAX_NODES ||
+        graph->edgeCount > PECI_GRAPH_MAX_EDGES ||
+        graph->bindingCount > PECI_GRAPH_MAX_BINDINGS ||
+        (graph->edgeCount != 0 && graph->edges == NULL) ||
+        (graph->bindingCount != 0 && graph->bindings == NULL))
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    for (size_t i = 0; i < graph->nodeCount; i++)
+    {
+        if ((size_t)graph->nodes[i].op >= PECI_GRAPH_OP_COUNT)
+        {
+            return PECI_CC_INVALID_REQ;
+        }
+    }
+    for (size_t i = 0; i < graph->edgeCount; i++)
+    {
+        const PECIGraphEdge* edge = &graph->edges[i];
+        if (edge->from >= graph->nodeCount || edge->to >= graph->nodeCount ||
+            edge->when > PECI_GRAPH_ON_DATA)
+        {
+            return PECI_CC_INVALID_REQ;
+        }
+        count[edge->to]++;
+    }
+    for (size_t i = 0; i < graph->bindingCount; i++)
+    {
+        const PECIGraphBinding* binding = &graph->bindings[i];
+        if (binding->from >= graph->nodeCount ||
+            binding->to >= graph->nodeCount ||
+            binding->arg >= PECI_GRAPH_MAX_ARGS || binding->width == 0 ||
+            binding->width > 4 ||
+            binding->offset + binding->width > PECI_GRAPH_MAX_DATA ||
+            binding->shift >= 32)
+        {
+            return PECI_CC_INVALID_REQ;
+        }
+        count[binding->to]++;
+    }
+    memcpy(pending, count, sizeof(count));
+
+    // Peel off nodes with no unresolved dependencies.  Any left over are on
+    // a cycle.
+    for (uint16_t i = 0; i < graph->nodeCount; i++)
+    {
+        if (count[i] == 0)
+        {
+            ready[readyCount++] = i;
+        }
+    }
+    while (readyCount > 0)
+    {
+        uint16_t node = ready[--readyCount];
+        seen++;
+        for (size_t i = 0; i < graph->edgeCount; i++)
+        {
+            if (graph->edges[i].from == node &&
+                --count[graph->edges[i].to] == 0)
+            {
+                ready[readyCount++] = graph->edges[i].to;
+            }
+        }
+        for (size_t i = 0; i < graph->bindingCount; i++)
+        {
+            if (graph->bindings[i].from == node &&
+                --count[graph->bindings[i].to] == 0)
+            {
+                ready[readyCount++] = graph->bindings[i].to;
+            }
+        }
+    }
+    return seen == graph->nodeCount ? PECI_CC_SUCCESS : PECI_CC_INVALID_REQ;
+}
+
+/*-------------------------------------------------------------------------
+ * This function issues the command of one node
+ *------------------------------------------------------------------------*/
+static EPECIStatus peci_GraphIssue(const PECIGraphNode* node,
+                                   PECIGraphResult* result, int peci_fd)
+{
+    const uint32_t* a = node->args;
+    uint8_t* data = result->data;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+    int16_t temp = 0;
+    uint64_t msr = 0;
+
+    int8_t lenArg = peci_graph_ops[node->op].lenArg;
+    if (lenArg >= 0 && a[lenArg] > PECI_GRAPH_MAX_DATA)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // Only commands that return a completion code set it
+    result->cc = 0;
+    result->len = lenArg >= 0 ? (uint8_t)a[lenArg] : 0;
+    switch (node->op)
+    {
+        case PECI_GRAPH_PING:
+            ret = peci_Ping_seq(node->target, peci_fd);
+            break;
+        case PECI_GRAPH_GET_TEMP:
+            ret = peci_GetTemp_seq(node->target, &temp, peci_fd);
+            data[0] = (uint8_t)temp;
+            data[1] = (uint8_t)((uint16_t)temp >> 8);
+            result->len = 2;
+            break;
+        case PECI_GRAPH_RD_PKG_CONFIG:
+            ret = peci_RdPkgConfig_seq_dom(
+                node->target, node->domainId, (uint8_t)a[0], (uint16_t)a[1],
+                (uint8_t)a[2], data, peci_fd, &result->cc);
+            break;
+        case PECI_GRAPH_WR_PKG_CONFIG:
+            ret = peci_WrPkgConfig_seq_dom(
+                node->target, node->domainId, (uint8_t)a[0], (uint16_t)a[1],
+                a[2], (uint8_t)a[3], peci_fd, &result->cc);
+            break;
+        case PECI_GRAPH_RD_IA_MSR:
+            ret = peci_RdIAMSR_seq_dom(node->target, node->domainId,
+                                       (uint8_t)a[0], (uint16_t)a[1], &msr,
+                                       peci_fd, &result->cc);
+            for (uint8_t i = 0; i < sizeof(msr); i++)
+            {
+                data[i] = (uint8_t)(msr >> (8 * i));
+            }
+            result->len = sizeof(msr);
+            break;
+        case PECI_GRAPH_RD_PCI_CONFIG:
+            ret = peci_RdPCIConfig_seq_dom(
+                node->target, node->domainId, (uint8_t)a[0], (uint8_t)a[1],
+                (uint8_t)a[2], (uint16_t)a[3], data, peci_fd, &result->cc);
+            result->len = 4;
+            break;
+        case PECI_GRAPH_RD_PCI_CONFIG_LOCAL:
+            ret = peci_RdPCIConfigLocal_seq_dom(
+                node->target, node->domainId, (uint8_t)a[0], (uint8_t)a[1],
+                (uint8_t)a[2], (uint16_t)a[3], (uint8_t)a[4], data, peci_fd,
+                &result->cc);
+            break;
+        case PECI_GRAPH_RD_END_POINT_PCI_LOCAL:
+            ret = peci_RdEndPointConfigPciLocal_seq_dom(
+                node->target, node->domainId, (uint8_t)a[0], (uint8_t)a[1],
+                (uint8_t)a[2], (uint8_t)a[3], (uint16_t)a[4], (uint8_t)a[5],
+                data, peci_fd, &result->cc);
+            break;
+        case PECI_GRAPH_RD_MODEL_PCI_LOCAL:
+            ret = peci_ModelRdPCIConfigLocal_seq(
+                node->target, node->domainId, (uint8_t)a[0], (uint8_t)a[1],
+                (uint8_t)a[2], (uint16_t)a[3], (uint8_t)a[4], data, peci_fd,
+                &result->cc);
+            break;
+        case PECI_GRAPH_CRASHDUMP_DISCOVERY:
+            ret = peci_CrashDump_Discovery_seq_dom(
+                node->target, node->domainId, (uint8_t)a[0], (uint8_t)a[1],
+                (uint16_t)a[2], (uint8_t)a[3], (uint8_t)a[4], data, peci_fd,
+                &result->cc);
+            break;
+        case PECI_GRAPH_CRASHDUMP_GET_FRAME:
+            ret = peci_CrashDump_GetFrame_seq_dom(
+                node->target, node->domainId, (uint16_t)a[0], (uint16_t)a[1],
+                (uint16_t)a[2], (uint8_t)a[3], data, peci_fd, &result->cc);
+            break;
+    }
+    if (ret != PECI_CC_SUCCESS)
+    {
+        result->cc = 0;
+        result->len = 0;
+    }
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function applies the edges and bindings into a node and runs it, or
+ * marks it skipped if any of them does not hold
+ *------------------------------------------------------------------------*/
+static void peci_GraphRunNode(const PECIGraph* graph, uint16_t index,
+                              PECIGraphResult* results, int peci_fd)
+{
+    PECIGraphNode node = graph->nodes[index];
+    PECIGraphResult* result = &results[index];
+
+    for (size_t i = 0; i < graph->edgeCount; i++)
+    {
+        const PECIGraphEdge* edge = &graph->edges[i];
+        if (edge->to == index &&
+            !peci_GraphEdgeHolds(edge, &graph->nodes[edge->from],
+                                 &results[edge->from]))
+        {
+            result->state = PECI_GRAPH_SKIPPED;
+            return;
+        }
+    }
+    for (size_t i = 0; i < graph->bindingCount; i++)
+    {
+        const PECIGraphBinding* binding = &graph->bindings[i];
+        if (binding->to != index)
+        {
+            continue;
+        }
+        const PECIGraphResult* from = &results[binding->from];
+        if (!peci_GraphSucceeded(&graph->nodes[binding->from], from))
+        {
+            result->state = PECI_GRAPH_SKIPPED;
+            return;
+        }
+        uint32_t value =
+            peci_GraphBytes(from->data, binding->offset, binding->width) >>
+            binding->shift;
+        if (binding->mask != 0)
+        {
+            value &= binding->mask;
+        }
+        node.args[binding->arg] = value;
+    }
+
+    result->state = PECI_GRAPH_RAN;
+    result->status = peci_GraphIssue(&node, result, peci_fd);
+}
+
+/*-------------------------------------------------------------------------
+ * This function runs a command graph with the provided peci file descriptor
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RunGraph_seq(const PECIGraph* graph,
+                              PECIGraphResult* results, int peci_fd)
+{
+    uint16_t pending[PECI_GRAPH_MAX_NODES];
+    uint8_t lastTarget = 0;
+
+    if (results == NULL || peci_GraphCheck(graph, pending) != PECI_CC_SUCCESS)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+    memset(results, 0, graph->nodeCount * sizeof(*results));
+
+    for (size_t done = 0; done < graph->nodeCount; done++)
+    {
+        // Of the nodes that are ready, take the one whose target comes next
+        // after the last target served, so each socket gets a turn
+        uint16_t next = 0;
+        unsigned int best = UINT8_MAX + 1;
+        for (uint16_t i = 0; i < graph->nodeCount; i++)
+        {
+            if (results[i].state != PECI_GRAPH_NOT_RUN || pending[i] != 0)
+            {
+                continue;
+            }
+            unsigned int distance =
+                (uint8_t)(graph->nodes[i].target - lastTarget - 1);
+            if (distance < best)
+            {
+                best = distance;
+                next = i;
+            }
+        }
+        lastTarget = graph->nodes[next].target;
+
+        peci_GraphRunNode(graph, next, results, peci_fd);
+
+        for (size_t i = 0; i < graph->edgeCount; i++)
+        {
+            if (graph->edges[i].from == next)
+            {
+                pending[graph->edges[i].to]--;
+            }
+        }
+        for (size_t i = 0; i < graph->bindingCount; i++)
+        {
+            if (graph->bindings[i].from == next)
+            {
+                pending[graph->bindings[i].to]--;
+            }
+        }
+    }
+    return PECI_CC_SUCCESS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function runs a command graph on a single open of the device
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RunGraph(const PECIGraph* graph, PECIGraphResult* results)
+{
+    int peci_fd = -1;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (peci_Lock(&peci_fd, PECI_TIMEOUT_MS) != PECI_CC_SUCCESS)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    ret = peci_RunGraph_seq(graph, results, peci_fd);
+
+    peci_Unlock(peci_fd);
+    return ret;
+}
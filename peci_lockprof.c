@@ -0,0 +1,446 @@
+/*
+// Copyright (c) 2026 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include "peci_arbiter.h"
+
+#include "peci_trace.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#define PECI_LOCKPROF_MAGIC 0x4c434550 // "PECL"
+#define PECI_LOCKPROF_VERSION 2
+
+// Descriptors of one process that can hold the device at once
+#define PECI_LOCKPROF_MAX_HELD 16
+
+// A lock is waiting while locked_ns is zero, held until end_ns is set
+struct peci_lockprof_entry
+{
+    uint64_t id;
+    uint64_t device;
+    int32_t pid;
+    int32_t tid;
+    char comm[16];
+    char tag[PECI_LOCK_TAG_LEN];
+    uint8_t state; // EPECILockState
+    uint64_t start_ns;
+    uint64_t locked_ns;
+    uint64_t end_ns;
+};
+
+struct peci_lockprof_region
+{
+    struct peci_shm_header hdr;
+    uint64_t nextId;
+    uint32_t liveCount;
+    struct peci_lockprof_entry live[PECI_LOCKPROF_MAX_LIVE];
+    uint32_t historyNext; // oldest record once the ring is full
+    uint32_t historyCount;
+    struct peci_lockprof_entry history[PECI_LOCKPROF_HISTORY];
+    uint64_t locks;
+    uint64_t busy;
+    uint64_t dropped;
+    uint64_t reaped;
+};
+
+atomic_bool peci_lockprof_on = false;
+
+static pthread_mutex_t peci_lockprof_map_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct peci_lockprof_region* _Atomic peci_lockprof_region;
+static __thread char peci_lockprof_tag[PECI_LOCK_TAG_LEN];
+
+static pthread_mutex_t peci_lockprof_fd_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct
+{
+    int fd;
+    uint64_t id;
+} peci_lockprof_fds[PECI_LOCKPROF_MAX_HELD];
+static atomic_uint peci_lockprof_fd_count;
+
+/*-------------------------------------------------------------------------
+ * This function maps the profiling region once per process
+ *------------------------------------------------------------------------*/
+static struct peci_lockprof_region* peci_LockProfMap(void)
+{
+    struct peci_lockprof_region* region =
+        atomic_load_explicit(&peci_lockprof_region, memory_order_acquire);
+
+    if (region != NULL)
+    {
+        return region;
+    }
+    pthread_mutex_lock(&peci_lockprof_map_lock);
+    region = atomic_load_explicit(&peci_lockprof_region, memory_order_acquire);
+    if (region == NULL)
+    {
+        region = peci_shm_map(PECI_LOCKPROF_SHM, sizeof(*region),
+                              PECI_LOCKPROF_MAGIC, PECI_LOCKPROF_VERSION);
+        atomic_store_explicit(&peci_lockprof_region, region,
+                              memory_order_release);
+    }
+    pthread_mutex_unlock(&peci_lockprof_map_lock);
+    return region;
+}
+
+static void peci_LockProfRemove(struct peci_lockprof_region* region,
+                                uint32_t index)
+{
+    region->liveCount--;
+    memmove(&region->live[index], &region->live[index + 1],
+            (region->liveCount - index) * sizeof(region->live[0]));
+}
+
+/*-------------------------------------------------------------------------
+ * This function drops the live entries of dead processes.  The kernel
+ * closed any device they held, so their locks are over.
+ *------------------------------------------------------------------------*/
+static void peci_LockProfReap(struct peci_lockprof_region* region)
+{
+    // Guard against corrupt indexes from a process that died mid-update
+    if (region->liveCount > PECI_LOCKPROF_MAX_LIVE)
+    {
+        region->liveCount = PECI_LOCKPROF_MAX_LIVE;
+    }
+    if (region->historyNext >= PECI_LOCKPROF_HISTORY ||
+        region->historyCount > PECI_LOCKPROF_HISTORY)
+    {
+        region->historyNext = 0;
+        region->historyCount = 0;
+    }
+    for (uint32_t i = 0; i < region->liveCount;)
+    {
+        if (peci_shm_alive(region->live[i].pid))
+        {
+            i++;
+            continue;
+        }
+        peci_LockProfRemove(region, i);
+        region->reaped++;
+    }
+}
+
+static int32_t peci_LockProfFind(const struct peci_lockprof_region* region,
+                                 uint64_t id)
+{
+    for (uint32_t i = 0; i < region->liveCount; i++)
+    {
+        if (region->live[i].id == id)
+        {
+            return (int32_t)i;
+        }
+    }
+    return -1;
+}
+
+/*-------------------------------------------------------------------------
+ * This function moves a finished lock from the live table to the history
+ *------------------------------------------------------------------------*/
+static void peci_LockProfFinish(struct peci_lockprof_region* region,
+                                uint32_t index, EPECILockState state)
+{
+    struct peci_lockprof_entry* entry = &region->live[index];
+
+    entry->state = (uint8_t)state;
+    entry->end_ns = peci_now_ns();
+    region->history[region->historyNext] = *entry;
+    region->historyNext = (region->historyNext + 1) % PECI_LOCKPROF_HISTORY;
+    if (region->historyCount < PECI_LOCKPROF_HISTORY)
+    {
+        region->historyCount++;
+    }
+    peci_LockProfRemove(region, index);
+}
+
+/*-------------------------------------------------------------------------
+ * This function records that the calling thread starts waiting for the
+ * device and returns the id of the lock, or zero if it is not recorded
+ *------------------------------------------------------------------------*/
+uint64_t peci_lockprof_wait(uint64_t device)
+{
+    struct peci_lockprof_entry me = {0};
+    uint64_t id = 0;
+
+    if (!atomic_load_explicit(&peci_lockprof_on, memory_order_relaxed))
+    {
+        return 0;
+    }
+    struct peci_lockprof_region* region = peci_LockProfMap();
+    if (region == NULL)
+    {
+        return 0;
+    }
+
+    me.device = device;
+    me.pid = getpid();
+    me.tid = (int32_t)syscall(SYS_gettid);
+    prctl(PR_GET_NAME, me.comm, 0, 0, 0);
+    memcpy(me.tag, peci_lockprof_tag, sizeof(me.tag));
+    me.state = PECI_LOCK_WAITING;
+    me.start_ns = peci_now_ns();
+
+    peci_shm_lock(&region->hdr);
+    peci_LockProfReap(region);
+    if (region->liveCount < PECI_LOCKPROF_MAX_LIVE)
+    {
+        id = me.id = ++region->nextId;
+        region->live[region->liveCount++] = me;
+    }
+    else
+    {
+        region->dropped++;
+    }
+    peci_shm_unlock(&region->hdr);
+    return id;
+}
+
+/*-------------------------------------------------------------------------
+ * This function records the outcome of a wait.  A lock that succeeded is
+ * held by peci_fd until peci_lockprof_unbind, and one that failed goes
+ * to the history as busy.
+ *------------------------------------------------------------------------*/
+void peci_lockprof_locked(uint64_t id, int peci_fd, EPECIStatus status)
+{
+    struct peci_lockprof_region* region =
+        atomic_load_explicit(&peci_lockprof_region, memory_order_acquire);
+    bool bound = false;
+
+    if (id == 0 || region == NULL)
+    {
+        return;
+    }
+    if (status == PECI_CC_SUCCESS)
+    {
+        pthread_mutex_lock(&peci_lockprof_fd_lock);
+        unsigned int count =
+            atomic_load_explicit(&peci_lockprof_fd_count, memory_order_relaxed);
+        if (count < PECI_LOCKPROF_MAX_HELD)
+        {
+            peci_lockprof_fds[count].fd = peci_fd;
+            peci_lockprof_fds[count].id = id;
+            atomic_store_explicit(&peci_lockprof_fd_count, count + 1,
+                                  memory_order_relaxed);
+            bound = true;
+        }
+        pthread_mutex_unlock(&peci_lockprof_fd_lock);
+    }
+
+    peci_shm_lock(&region->hdr);
+    int32_t index = peci_LockProfFind(region, id);
+    if (index >= 0)
+    {
+        if (status != PECI_CC_SUCCESS)
+        {
+            region->busy++;
+            peci_LockProfFinish(region, (uint32_t)index, PECI_LOCK_BUSY);
+        }
+        else if (bound)
+        {
+            region->locks++;
+            region->live[index].state = PECI_LOCK_HELD;
+            region->live[index].locked_ns = peci_now_ns();
+        }
+        else
+        {
+            // The release could never be matched to the lock
+            region->locks++;
+            region->dropped++;
+            peci_LockProfRemove(region, (uint32_t)index);
+        }
+    }
+    peci_shm_unlock(&region->hdr);
+}
+
+/*-------------------------------------------------------------------------
+ * This function returns the lock held by peci_fd and forgets it
+ *------------------------------------------------------------------------*/
+uint64_t peci_lockprof_unbind(int peci_fd)
+{
+    uint64_t id = 0;
+
+    if (atomic_load_explicit(&peci_lockprof_fd_count, memory_order_relaxed) ==
+        0)
+    {
+        return 0;
+    }
+    pthread_mutex_lock(&peci_lockprof_fd_lock);
+    unsigned int count =
+        atomic_load_explicit(&peci_lockprof_fd_count, memory_order_relaxed);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (peci_lockprof_fds[i].fd == peci_fd)
+        {
+            id = peci_lockprof_fds[i].id;
+            peci_lockprof_fds[i] = peci_lockprof_fds[count - 1];
+            atomic_store_explicit(&peci_lockprof_fd_count, count - 1,
+                                  memory_order_relaxed);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&peci_lockprof_fd_lock);
+    return id;
+}
+
+/*-------------------------------------------------------------------------
+ * This function records that the lock was released
+ *------------------------------------------------------------------------*/
+void peci_lockprof_unlocked(uint64_t id)
+{
+    struct peci_lockprof_region* region =
+        atomic_load_explicit(&peci_lockprof_region, memory_order_acquire);
+    if (id == 0 || region == NULL)
+    {
+        return;
+    }
+    peci_shm_lock(&region->hdr);
+    int32_t index = peci_LockProfFind(region, id);
+    if (index >= 0)
+    {
+        peci_LockProfFinish(region, (uint32_t)index, PECI_LOCK_RELEASED);
+    }
+    peci_shm_unlock(&region->hdr);
+}
+
+/*-------------------------------------------------------------------------
+ * This function describes who holds the device, for the busy message.  The
+ * description is empty if no profiled process holds it.
+ *------------------------------------------------------------------------*/
+void peci_lockprof_holder(uint64_t device, char* buf, size_t len)
+{
+    struct peci_lockprof_region* region =
+        atomic_load_explicit(&peci_lockprof_region, memory_order_acquire);
+
+    buf[0] = '\0';
+    if (region == NULL)
+    {
+        return;
+    }
+    peci_shm_lock(&region->hdr);
+    peci_LockProfReap(region);
+    uint64_t now_ns = peci_now_ns();
+    for (uint32_t i = 0; i < region->liveCount; i++)
+    {
+        const struct peci_lockprof_entry* entry = &region->live[i];
+        if (entry->state != PECI_LOCK_HELD || entry->device != device)
+        {
+            continue;
+        }
+        snprintf(buf, len, "held by %.16s[%d] tid %d tag \"%.16s\" for %u ms",
+                 entry->comm, entry->pid, entry->tid, entry->tag,
+                 (unsigned int)((now_ns - entry->locked_ns) / 1000000));
+        break;
+    }
+    peci_shm_unlock(&region->hdr);
+}
+
+/*-------------------------------------------------------------------------
+ * This function enables or disables profiling of the device locks taken by
+ * the process
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_SetLockProfiling(bool enable)
+{
+    if (enable && peci_LockProfMap() == NULL)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    atomic_store_explicit(&peci_lockprof_on, enable, memory_order_relaxed);
+    return PECI_CC_SUCCESS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function tags the device locks taken by the calling thread
+ *------------------------------------------------------------------------*/
+void peci_SetLockTag(const char* tag)
+{
+    memset(peci_lockprof_tag, 0, sizeof(peci_lockprof_tag));
+    if (tag != NULL)
+    {
+        strncpy(peci_lockprof_tag, tag, sizeof(peci_lockprof_tag) - 1);
+    }
+}
+
+static void peci_LockProfCopy(PECILockRecord* out,
+                              const struct peci_lockprof_entry* entry,
+                              uint64_t now_ns)
+{
+    uint64_t end_ns = entry->end_ns != 0 ? entry->end_ns : now_ns;
+
+    out->pid = entry->pid;
+    out->tid = entry->tid;
+    memcpy(out->comm, entry->comm, sizeof(out->comm));
+    out->comm[sizeof(out->comm) - 1] = '\0';
+    memcpy(out->tag, entry->tag, sizeof(out->tag));
+    out->tag[sizeof(out->tag) - 1] = '\0';
+    out->state = (EPECILockState)entry->state;
+    if (entry->locked_ns != 0)
+    {
+        out->wait_ns = entry->locked_ns - entry->start_ns;
+        out->hold_ns = end_ns - entry->locked_ns;
+    }
+    else
+    {
+        out->wait_ns = end_ns - entry->start_ns;
+        out->hold_ns = 0;
+    }
+    out->end_ns = entry->end_ns;
+}
+
+/*-------------------------------------------------------------------------
+ * This function gets the locks in progress and the most recent finished
+ * locks of every profiled process
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_GetLockProfile(PECILockProfile* profile)
+{
+    if (profile == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+    struct peci_lockprof_region* region = peci_LockProfMap();
+    if (region == NULL)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+
+    memset(profile, 0, sizeof(*profile));
+    peci_shm_lock(&region->hdr);
+    peci_LockProfReap(region);
+    uint64_t now_ns = peci_now_ns();
+    profile->liveCount = region->liveCount;
+    for (uint32_t i = 0; i < region->liveCount; i++)
+    {
+        peci_LockProfCopy(&profile->live[i], &region->live[i], now_ns);
+    }
+    profile->historyCount = region->historyCount;
+    uint32_t oldest =
+        (region->historyNext + PECI_LOCKPROF_HISTORY - region->historyCount) %
+        PECI_LOCKPROF_HISTORY;
+    for (uint32_t i = 0; i < region->historyCount; i++)
+    {
+        uint32_t slot = (oldest + i) % PECI_LOCKPROF_HISTORY;
+        peci_LockProfCopy(&profile->history[i], &region->history[slot],
+                          now_ns);
+    }
+    profile->locks = region->locks;
+    profile->busy = region->busy;
+    profile->dropped = region->dropped;
+    profile->reaped = region->reaped;
+    peci_shm_unlock(&region->hdr);
+    return PECI_CC_SUCCESS;
+}
@@ -0,0 +1,506 @@
+/*
+// Copyright (c) 2026 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#define _GNU_SOURCE // memfd_create
+#include "peci_broker.h"
+#include "peci_trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <peci.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PECI_RING_MAGIC 0x52434550 // "PECR"
+
+// The owner has stopped processing and must be woken through sq_efd
+#define PECI_RING_OWNER_IDLE 0x1
+// The client is waiting for completions and must be woken through cq_efd
+#define PECI_RING_CLIENT_WAITING 0x2
+
+// Shared ring header.  Each side only writes the indices on its own cache
+// line.  The submission and completion entries follow, in that order.
+struct peci_ring_shared
+{
+    uint32_t magic;
+    uint32_t entries;
+    // Written by the client
+    _Alignas(64) atomic_uint sq_tail;
+    atomic_uint cq_head;
+    // Written by the owner
+    _Alignas(64) atomic_uint sq_head;
+    atomic_uint cq_tail;
+    // Written by both
+    _Alignas(64) atomic_uint flags;
+};
+
+struct peci_ring
+{
+    struct peci_ring_shared* shared;
+    PECIRingSqe* sqes;
+    PECIRingCqe* cqes;
+    size_t size;
+    uint32_t mask;
+    int shm_fd;
+    int sq_efd;
+    int cq_efd;
+    int peci_fd;  // owner only, the device commands run on
+    int conn_fd;  // client only, the broker connection that owns the ring
+    bool owner;
+};
+
+static size_t peci_RingSize(uint32_t entries)
+{
+    return sizeof(struct peci_ring_shared) + entries * sizeof(PECIRingSqe) +
+           entries * sizeof(PECIRingCqe);
+}
+
+/*-------------------------------------------------------------------------
+ * This function maps the ring memory and takes ownership of the descriptors
+ *------------------------------------------------------------------------*/
+static EPECIStatus peci_RingMap(struct peci_ring* ring, int shm_fd, int sq_efd,
+                                int cq_efd, uint32_t entries)
+{
+    ring->shm_fd = shm_fd;
+    ring->sq_efd = sq_efd;
+    ring->cq_efd = cq_efd;
+    ring->size = peci_RingSize(entries);
+    ring->shared = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        shm_fd, 0);
+    if (ring->shared == MAP_FAILED)
+    {
+        ring->shared = NULL;
+        return PECI_CC_MEM_ERR;
+    }
+    // The other side can write the shared header, so the ring geometry is
+    // kept privately
+    ring->sqes = (PECIRingSqe*)(ring->shared + 1);
+    ring->cqes = (PECIRingCqe*)(ring->sqes + entries);
+    ring->mask = entries - 1;
+    return PECI_CC_SUCCESS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function creates a ring that runs commands on the provided peci file
+ * descriptor
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RingCreate(uint32_t entries, int peci_fd, PECIRing** ring)
+{
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (ring == NULL || entries == 0 || entries > PECI_RING_MAX_ENTRIES ||
+        (entries & (entries - 1)) != 0)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    struct peci_ring* r = calloc(1, sizeof(*r));
+    if (r == NULL)
+    {
+        return PECI_CC_MEM_ERR;
+    }
+    r->owner = true;
+    r->peci_fd = peci_fd;
+    r->conn_fd = -1;
+
+    int shm_fd = memfd_create("peci-ring", MFD_CLOEXEC);
+    int sq_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    int cq_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (shm_fd < 0 || sq_efd < 0 || cq_efd < 0 ||
+        ftruncate(shm_fd, (off_t)peci_RingSize(entries)) != 0)
+    {
+        ret = PECI_CC_MEM_ERR;
+    }
+    else
+    {
+        ret = peci_RingMap(r, shm_fd, sq_efd, cq_efd, entries);
+    }
+    if (ret != PECI_CC_SUCCESS)
+    {
+        r->shm_fd = shm_fd;
+        r->sq_efd = sq_efd;
+        r->cq_efd = cq_efd;
+        peci_RingClose(r);
+        return ret;
+    }
+
+    r->shared->magic = PECI_RING_MAGIC;
+    r->shared->entries = entries;
+    atomic_store(&r->shared->flags, PECI_RING_OWNER_IDLE);
+
+    *ring = r;
+    return PECI_CC_SUCCESS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function gets the descriptors a client needs to attach to the ring
+ *------------------------------------------------------------------------*/
+void peci_RingGetFds(const PECIRing* ring, int* shm_fd, int* sq_efd,
+                     int* cq_efd)
+{
+    *shm_fd = ring->shm_fd;
+    *sq_efd = ring->sq_efd;
+    *cq_efd = ring->cq_efd;
+}
+
+/*-------------------------------------------------------------------------
+ * This function wakes the client if it is waiting for completions
+ *------------------------------------------------------------------------*/
+static void peci_RingWakeClient(struct peci_ring* ring)
+{
+    if (atomic_fetch_and(&ring->shared->flags, ~PECI_RING_CLIENT_WAITING) &
+        PECI_RING_CLIENT_WAITING)
+    {
+        eventfd_write(ring->cq_efd, 1);
+    }
+}
+
+/*-------------------------------------------------------------------------
+ * This function runs up to max queued commands and posts their completions.
+ * The client's indices and entries are in shared memory, so they are
+ * copied and checked before use. When the submission ring is empty the
+ * owner marks itself idle, then checks once more so a submission that
+ * raced with going idle is not missed.
+ *------------------------------------------------------------------------*/
+size_t peci_RingProcess(PECIRing* ring, size_t max)
+{
+    struct peci_ring_shared* shared = NULL;
+    eventfd_t count = 0;
+    uint32_t entries = 0;
+    size_t done = 0;
+
+    if (ring == NULL || !ring->owner)
+    {
+        return 0;
+    }
+    shared = ring->shared;
+    entries = ring->mask + 1;
+
+    eventfd_read(ring->sq_efd, &count);
+    atomic_fetch_and(&shared->flags, ~PECI_RING_OWNER_IDLE);
+
+    uint32_t head = atomic_load_explicit(&shared->sq_head, memory_order_relaxed);
+    uint32_t cqTail =
+        atomic_load_explicit(&shared->cq_tail, memory_order_relaxed);
+    for (;;)
+    {
+        uint32_t tail =
+            atomic_load_explicit(&shared->sq_tail, memory_order_acquire);
+        uint32_t cqHead =
+            atomic_load_explicit(&shared->cq_head, memory_order_acquire);
+
+        if (tail - head > entries)
+        {
+            // The client's index is corrupt
+            break;
+        }
+        // The client never has more commands in flight than the ring
+        // holds, so the completion ring can only be full if it is cheating
+        while (head != tail && done < max &&
+               cqTail - cqHead < entries)
+        {
+            PECIRingSqe sqe = ring->sqes[head & ring->mask];
+            PECIRingCqe* cqe = &ring->cqes[cqTail & ring->mask];
+
+            memset(cqe, 0, sizeof(*cqe));
+            cqe->user_data = sqe.user_data;
+            if (sqe.txLen > PECI_RING_MAX_DATA ||
+                sqe.rxLen > PECI_RING_MAX_DATA)
+            {
+                cqe->status = PECI_CC_INVALID_REQ;
+            }
+            else
+            {
+                cqe->rxLen = sqe.rxLen;
+                cqe->status = peci_raw_seq(sqe.target, sqe.rxLen, sqe.tx,
+                                           sqe.txLen, cqe->rx, sizeof(cqe->rx),
+                                           ring->peci_fd);
+            }
+
+            head++;
+            cqTail++;
+            done++;
+            atomic_store_explicit(&shared->sq_head, head,
+                                  memory_order_release);
+            atomic_store_explicit(&shared->cq_tail, cqTail,
+                                  memory_order_release);
+        }
+        if (head != tail)
+        {
+            // The caller runs the rest in its next call
+            break;
+        }
+
+        atomic_fetch_or(&shared->flags, PECI_RING_OWNER_IDLE);
+        if (atomic_load(&shared->sq_tail) == head)
+        {
+            break;
+        }
+        atomic_fetch_and(&shared->flags, ~PECI_RING_OWNER_IDLE);
+    }
+
+    peci_RingWakeClient(ring);
+    return done;
+}
+
+/*-------------------------------------------------------------------------
+ * This function attaches to a ring created by another process
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RingAttach(int shm_fd, int sq_efd, int cq_efd,
+                            PECIRing** ring)
+{
+    struct peci_ring_shared hdr = {0};
+    struct stat st = {0};
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (ring == NULL || fstat(shm_fd, &st) != 0 ||
+        pread(shm_fd, &hdr, sizeof(hdr.magic) + sizeof(hdr.entries), 0) !=
+            sizeof(hdr.magic) + sizeof(hdr.entries))
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+    if (hdr.magic != PECI_RING_MAGIC || hdr.entries == 0 ||
+        hdr.entries > PECI_RING_MAX_ENTRIES ||
+        (hdr.entries & (hdr.entries - 1)) != 0 ||
+        (size_t)st.st_size != peci_RingSize(hdr.entries))
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    struct peci_ring* r = calloc(1, sizeof(*r));
+    if (r == NULL)
+    {
+        return PECI_CC_MEM_ERR;
+    }
+    r->peci_fd = -1;
+    r->conn_fd = -1;
+    ret = peci_RingMap(r, fcntl(shm_fd, F_DUPFD_CLOEXEC, 0),
+                       fcntl(sq_efd, F_DUPFD_CLOEXEC, 0),
+                       fcntl(cq_efd, F_DUPFD_CLOEXEC, 0), hdr.entries);
+    if (ret != PECI_CC_SUCCESS)
+    {
+        peci_RingClose(r);
+        return ret;
+    }
+    *ring = r;
+    return PECI_CC_SUCCESS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function asks the PECI broker for a ring on the calling thread's
+ * PECI device. The ring is released when it is closed.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RingConnect(uint32_t entries, PECIRing** ring)
+{
+    int peci_fd = -1;
+    int fds[3] = {-1, -1, -1};
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (ring == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+    // Only the broker can serve a ring
+    if (peci_Lock(&peci_fd, PECI_TIMEOUT_MS) != PECI_CC_SUCCESS)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    if (!atomic_load_explicit(&peci_broker_on, memory_order_relaxed))
+    {
+        peci_Unlock(peci_fd);
+        return PECI_CC_INVALID_REQ;
+    }
+
+    // Ring entries are run in turns with other clients, so the ring's
+    // connection does not keep the device to itself
+    ret = peci_broker_hold(peci_fd, false, PECI_TIMEOUT_MS);
+    if (ret == PECI_CC_SUCCESS)
+    {
+        ret = peci_broker_ring(peci_fd, entries, fds);
+    }
+    if (ret == PECI_CC_SUCCESS)
+    {
+        ret = peci_RingAttach(fds[0], fds[1], fds[2], ring);
+        for (int i = 0; i < 3; i++)
+        {
+            close(fds[i]);
+        }
+    }
+    if (ret != PECI_CC_SUCCESS)
+    {
+        peci_Unlock(peci_fd);
+        return ret;
+    }
+    (*ring)->conn_fd = peci_fd;
+    return PECI_CC_SUCCESS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function queues up to count commands. The owner is only woken if it
+ * has gone idle, so a batch costs at most one syscall.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RingSubmit(PECIRing* ring, const PECIRingSqe* sqes,
+                            size_t count, size_t* submitted)
+{
+    struct peci_ring_shared* shared = NULL;
+
+    if (ring == NULL || ring->owner || submitted == NULL ||
+        (sqes == NULL && count > 0))
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+    shared = ring->shared;
+
+    uint32_t tail = atomic_load_explicit(&shared->sq_tail, memory_order_relaxed);
+    uint32_t cqHead =
+        atomic_load_explicit(&shared->cq_head, memory_order_relaxed);
+    // Every command in flight needs a completion entry, so the commands not
+    // yet reaped bound the space on both rings
+    size_t space = ring->mask + 1 - (tail - cqHead);
+
+    *submitted = count < space ? count : space;
+    for (size_t i = 0; i < *submitted; i++)
+    {
+        ring->sqes[(tail + i) & ring->mask] = sqes[i];
+    }
+    if (*submitted == 0)
+    {
+        return PECI_CC_SUCCESS;
+    }
+    atomic_store(&shared->sq_tail, tail + (uint32_t)*submitted);
+
+    if (atomic_load(&shared->flags) & PECI_RING_OWNER_IDLE)
+    {
+        eventfd_write(ring->sq_efd, 1);
+    }
+    return PECI_CC_SUCCESS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function copies up to max completions out of the completion ring
+ *------------------------------------------------------------------------*/
+size_t peci_RingReap(PECIRing* ring, PECIRingCqe* cqes, size_t max)
+{
+    struct peci_ring_shared* shared = NULL;
+    size_t count = 0;
+
+    if (ring == NULL || ring->owner || cqes == NULL)
+    {
+        return 0;
+    }
+    shared = ring->shared;
+
+    uint32_t head = atomic_load_explicit(&shared->cq_head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&shared->cq_tail, memory_order_acquire);
+    for (; head != tail && count < max; head++, count++)
+    {
+        cqes[count] = ring->cqes[head & ring->mask];
+    }
+    atomic_store_explicit(&shared->cq_head, head, memory_order_release);
+    return count;
+}
+
+/*-------------------------------------------------------------------------
+ * This function waits until at least minComplete completions are ready
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_RingWait(PECIRing* ring, size_t minComplete, int timeout_ms)
+{
+    struct peci_ring_shared* shared = NULL;
+    uint64_t deadline_ns = 0;
+
+    if (ring == NULL || ring->owner || minComplete > ring->mask + 1)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+    shared = ring->shared;
+    if (timeout_ms > 0)
+    {
+        deadline_ns = peci_now_ns() + (uint64_t)timeout_ms * 1000000;
+    }
+
+    for (;;)
+    {
+        uint32_t head =
+            atomic_load_explicit(&shared->cq_head, memory_order_relaxed);
+        if (atomic_load(&shared->cq_tail) - head >= minComplete)
+        {
+            return PECI_CC_SUCCESS;
+        }
+        atomic_fetch_or(&shared->flags, PECI_RING_CLIENT_WAITING);
+        if (atomic_load(&shared->cq_tail) - head >= minComplete)
+        {
+            return PECI_CC_SUCCESS;
+        }
+
+        int wait_ms = timeout_ms;
+        if (timeout_ms > 0)
+        {
+            uint64_t now_ns = peci_now_ns();
+            if (now_ns >= deadline_ns)
+            {
+                return PECI_CC_TIMEOUT;
+            }
+            wait_ms = (int)((deadline_ns - now_ns + 999999) / 1000000);
+        }
+        struct pollfd pfd = {.fd = ring->cq_efd, .events = POLLIN};
+        int ready = poll(&pfd, 1, wait_ms);
+        if (ready == 0)
+        {
+            return PECI_CC_TIMEOUT;
+        }
+        if (ready < 0 && errno != EINTR)
+        {
+            return PECI_CC_DRIVER_ERR;
+        }
+        eventfd_t count = 0;
+        eventfd_read(ring->cq_efd, &count);
+    }
+}
+
+/*-------------------------------------------------------------------------
+ * This function detaches from or destroys the ring
+ *------------------------------------------------------------------------*/
+void peci_RingClose(PECIRing* ring)
+{
+    if (ring == NULL)
+    {
+        return;
+    }
+    if (ring->shared != NULL)
+    {
+        munmap(ring->shared, ring->size);
+    }
+    int fds[] = {ring->shm_fd, ring->sq_efd, ring->cq_efd};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++)
+    {
+        if (fds[i] >= 0)
+        {
+            close(fds[i]);
+        }
+    }
+    // The connection was locked by peci_RingConnect, so it is unlocked to
+    // forget its device before the descriptor can be reused
+    if (ring->conn_fd >= 0)
+    {
+        peci_Unlock(ring->conn_fd);
+    }
+    free(ring);
+}
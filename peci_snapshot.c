@@ -0,0 +1,348 @@
+/*
+// Copyright (c) 2026 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include "peci_arbiter.h"
+
+#include "peci_trace.h"
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PECI_SNAPSHOT_MAGIC 0x53434550 // "PECS"
+#define PECI_SNAPSHOT_VERSION 1
+
+// Reads that keep racing the writer this many times give up, since the
+// writer must have died part way through an update
+#define PECI_SNAPSHOT_READ_TRIES 64
+
+// Shared region header, followed by the records
+struct peci_snapshot_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t recordSize;
+    // Records below count have their key set and may be read
+    _Alignas(64) atomic_uint count;
+};
+
+// One record per cache line, so a reader only contends with updates to the
+// record it reads.  Values are split into 32-bit words because 64-bit
+// atomics are not lock-free on every BMC, and readers map the region
+// read-only.
+struct peci_snapshot_record
+{
+    _Alignas(64) atomic_uint seq; // odd while an update is in progress
+    atomic_uint key;
+    atomic_uint valueLo;
+    atomic_uint valueHi;
+    atomic_uint timeLo;
+    atomic_uint timeHi;
+};
+
+struct peci_snapshot
+{
+    struct peci_snapshot_header* header;
+    struct peci_snapshot_record* records;
+    size_t size;
+    uint32_t capacity;
+    bool writer;
+};
+
+static size_t peci_SnapshotSize(uint32_t capacity)
+{
+    return sizeof(struct peci_snapshot_header) +
+           capacity * sizeof(struct peci_snapshot_record);
+}
+
+/*-------------------------------------------------------------------------
+ * This function maps the region and fills in the snapshot handle
+ *------------------------------------------------------------------------*/
+static EPECIStatus peci_SnapshotMap(int fd, uint32_t capacity, bool writer,
+                                    PECISnapshot** snap)
+{
+    struct peci_snapshot* s = calloc(1, sizeof(*s));
+    if (s == NULL)
+    {
+        return PECI_CC_MEM_ERR;
+    }
+    s->size = peci_SnapshotSize(capacity);
+    s->header = mmap(NULL, s->size, writer ? PROT_READ | PROT_WRITE : PROT_READ,
+                     MAP_SHARED, fd, 0);
+    if (s->header == MAP_FAILED)
+    {
+        free(s);
+        return PECI_CC_MEM_ERR;
+    }
+    s->records = (struct peci_snapshot_record*)(s->header + 1);
+    s->capacity = capacity;
+    s->writer = writer;
+    *snap = s;
+    return PECI_CC_SUCCESS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function creates a snapshot region for publishing up to capacity
+ * values.  Any region left under the same name is replaced.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_SnapshotCreate(const char* name, uint32_t capacity,
+                                PECISnapshot** snap)
+{
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (snap == NULL || capacity == 0 ||
+        capacity > PECI_SNAPSHOT_MAX_RECORDS)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+    if (name == NULL)
+    {
+        name = PECI_SNAPSHOT_DEFAULT;
+    }
+
+    // Readers of an old region keep their mapping and see its values age,
+    // so they know to open the new one
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+                      PECI_SHM_MODE);
+    if (fd < 0)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    // Set the mode again, as shm_open applies the umask to it
+    if (fchmod(fd, PECI_SHM_MODE) != 0 ||
+        ftruncate(fd, (off_t)peci_SnapshotSize(capacity)) != 0)
+    {
+        ret = PECI_CC_MEM_ERR;
+    }
+    else
+    {
+        ret = peci_SnapshotMap(fd, capacity, true, snap);
+    }
+    close(fd);
+    if (ret != PECI_CC_SUCCESS)
+    {
+        shm_unlink(name);
+        return ret;
+    }
+
+    struct peci_snapshot_header* header = (*snap)->header;
+    header->version = PECI_SNAPSHOT_VERSION;
+    header->capacity = capacity;
+    header->recordSize = sizeof(struct peci_snapshot_record);
+    atomic_store_explicit(&header->count, 0, memory_order_relaxed);
+    // Readers check the magic last
+    atomic_thread_fence(memory_order_release);
+    header->magic = PECI_SNAPSHOT_MAGIC;
+    return PECI_CC_SUCCESS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function opens a snapshot region read-only
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_SnapshotOpen(const char* name, PECISnapshot** snap)
+{
+    struct peci_snapshot_header header;
+    struct stat st;
+    EPECIStatus ret = PECI_CC_SUCCESS;
+
+    if (snap == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+    if (name == NULL)
+    {
+        name = PECI_SNAPSHOT_DEFAULT;
+    }
+
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    // The header is checked against the size of the object before it is
+    // mapped, so a bad region cannot make the reader fault
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(header) ||
+        pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        header.magic != PECI_SNAPSHOT_MAGIC ||
+        header.version != PECI_SNAPSHOT_VERSION ||
+        header.recordSize != sizeof(struct peci_snapshot_record) ||
+        header.capacity > PECI_SNAPSHOT_MAX_RECORDS ||
+        peci_SnapshotSize(header.capacity) > (size_t)st.st_size)
+    {
+        ret = PECI_CC_INVALID_REQ;
+    }
+    else
+    {
+        ret = peci_SnapshotMap(fd, header.capacity, false, snap);
+    }
+    close(fd);
+    return ret;
+}
+
+/*-------------------------------------------------------------------------
+ * This function publishes a value under key, stamped with the current time.
+ * It never waits on readers.
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_SnapshotPublish(PECISnapshot* snap, uint32_t key,
+                                 uint64_t value)
+{
+    struct peci_snapshot_record* record = NULL;
+
+    if (snap == NULL || !snap->writer)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    uint32_t count =
+        atomic_load_explicit(&snap->header->count, memory_order_relaxed);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (atomic_load_explicit(&snap->records[i].key,
+                                 memory_order_relaxed) == key)
+        {
+            record = &snap->records[i];
+            break;
+        }
+    }
+    if (record == NULL)
+    {
+        if (count == snap->capacity)
+        {
+            return PECI_CC_MEM_ERR;
+        }
+        // The record is filled in before the count makes it visible
+        record = &snap->records[count];
+        atomic_store_explicit(&record->key, key, memory_order_relaxed);
+    }
+
+    uint64_t now = peci_now_ns();
+    uint32_t seq = atomic_load_explicit(&record->seq, memory_order_relaxed);
+    atomic_store_explicit(&record->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&record->valueLo, (uint32_t)value,
+                          memory_order_relaxed);
+    atomic_store_explicit(&record->valueHi, (uint32_t)(value >> 32),
+                          memory_order_relaxed);
+    atomic_store_explicit(&record->timeLo, (uint32_t)now, memory_order_relaxed);
+    atomic_store_explicit(&record->timeHi, (uint32_t)(now >> 32),
+                          memory_order_relaxed);
+    atomic_store_explicit(&record->seq, seq + 2, memory_order_release);
+
+    if (record == &snap->records[count])
+    {
+        atomic_store_explicit(&snap->header->count, count + 1,
+                              memory_order_release);
+    }
+    return PECI_CC_SUCCESS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function returns the number of values published in the region
+ *------------------------------------------------------------------------*/
+uint32_t peci_SnapshotCount(const PECISnapshot* snap)
+{
+    if (snap == NULL)
+    {
+        return 0;
+    }
+    uint32_t count =
+        atomic_load_explicit(&snap->header->count, memory_order_acquire);
+    // The writer's count is not trusted past the mapped records
+    return count < snap->capacity ? count : snap->capacity;
+}
+
+/*-------------------------------------------------------------------------
+ * This function reads a consistent copy of the value at index
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_SnapshotRead(const PECISnapshot* snap, uint32_t index,
+                              PECISnapshotValue* value)
+{
+    if (value == NULL || index >= peci_SnapshotCount(snap))
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    struct peci_snapshot_record* record = &snap->records[index];
+    for (int tries = 0; tries < PECI_SNAPSHOT_READ_TRIES; tries++)
+    {
+        uint32_t seq = atomic_load_explicit(&record->seq, memory_order_acquire);
+        if (seq & 1)
+        {
+            continue;
+        }
+        uint32_t key = atomic_load_explicit(&record->key, memory_order_relaxed);
+        uint64_t val =
+            atomic_load_explicit(&record->valueLo, memory_order_relaxed) |
+            (uint64_t)atomic_load_explicit(&record->valueHi,
+                                           memory_order_relaxed)
+                << 32;
+        uint64_t stamp =
+            atomic_load_explicit(&record->timeLo, memory_order_relaxed) |
+            (uint64_t)atomic_load_explicit(&record->timeHi,
+                                           memory_order_relaxed)
+                << 32;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&record->seq, memory_order_relaxed) != seq)
+        {
+            continue;
+        }
+
+        uint64_t now = peci_now_ns();
+        value->key = key;
+        value->value = val;
+        value->timestamp_ns = stamp;
+        value->age_ns = now > stamp ? now - stamp : 0;
+        return PECI_CC_SUCCESS;
+    }
+    return PECI_CC_TIMEOUT;
+}
+
+/*-------------------------------------------------------------------------
+ * This function reads a consistent copy of the value published under key
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_SnapshotLookup(const PECISnapshot* snap, uint32_t key,
+                                PECISnapshotValue* value)
+{
+    uint32_t count = peci_SnapshotCount(snap);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        // Keys never change once a record is visible
+        if (atomic_load_explicit(&snap->records[i].key,
+                                 memory_order_relaxed) == key)
+        {
+            return peci_SnapshotRead(snap, i, value);
+        }
+    }
+    return PECI_CC_INVALID_REQ;
+}
+
+/*-------------------------------------------------------------------------
+ * This function unmaps the region.  The region itself stays published.
+ *------------------------------------------------------------------------*/
+void peci_SnapshotClose(PECISnapshot* snap)
+{
+    if (snap == NULL)
+    {
+        return;
+    }
+    munmap(snap->header, snap->size);
+    free(snap);
+}
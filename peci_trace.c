@@ -0,0 +1,469 @@
+/*
+// Copyright (c) 2026 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#include "peci_trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcpp"
+#pragma GCC diagnostic ignored "-Wvariadic-macros"
+#include <linux/peci-ioctl.h>
+#pragma GCC diagnostic pop
+
+#define TRACE_BUF_SIZE (64 * 1024)
+#define TRACE_ALIGN(x) (((x) + 7) & ~(size_t)7)
+
+atomic_bool peci_trace_on;
+atomic_bool peci_sim_on;
+
+// The trace file is only written when a thread flushes its buffer, so
+// recording itself is lock-free.  Flushes take the lock shared so the file
+// can't be closed underneath them.
+static pthread_rwlock_t trace_lock = PTHREAD_RWLOCK_INITIALIZER;
+static int trace_fd = -1;
+static atomic_uint trace_gen;
+
+struct trace_buf
+{
+    unsigned int gen;
+    size_t used;
+    uint8_t data[TRACE_BUF_SIZE];
+};
+
+static pthread_key_t trace_buf_key;
+static pthread_once_t trace_buf_once = PTHREAD_ONCE_INIT;
+static __thread struct trace_buf* trace_buf;
+
+/*-------------------------------------------------------------------------
+ * This function returns the monotonic time in nanoseconds
+ *------------------------------------------------------------------------*/
+uint64_t peci_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/*-------------------------------------------------------------------------
+ * This function writes the records buffered by the calling thread to the
+ * trace file. Records from an earlier trace are dropped.
+ *------------------------------------------------------------------------*/
+static void trace_buf_flush(struct trace_buf* buf)
+{
+    if (buf == NULL || buf->used == 0)
+    {
+        return;
+    }
+
+    pthread_rwlock_rdlock(&trace_lock);
+    if (trace_fd >= 0 && buf->gen == atomic_load(&trace_gen))
+    {
+        // O_APPEND keeps each buffer contiguous in the file
+        if (write(trace_fd, buf->data, buf->used) != (ssize_t)buf->used)
+        {
+            syslog(LOG_ERR, "PECI trace write failed: %d\n", errno);
+        }
+    }
+    pthread_rwlock_unlock(&trace_lock);
+    buf->used = 0;
+}
+
+static void trace_buf_destroy(void* ptr)
+{
+    trace_buf_flush(ptr);
+    free(ptr);
+}
+
+static void trace_buf_key_init(void)
+{
+    pthread_key_create(&trace_buf_key, trace_buf_destroy);
+}
+
+/*-------------------------------------------------------------------------
+ * This function appends a command to the calling thread's trace buffer
+ *------------------------------------------------------------------------*/
+void peci_trace_record(unsigned int cmd, const void* req, const void* resp,
+                       size_t msg_len, const uint8_t* tx, size_t tx_len,
+                       const uint8_t* rx, size_t rx_len, uint64_t start_ns,
+                       uint64_t end_ns, EPECIStatus status)
+{
+    struct peci_trace_record rec = {0};
+    size_t size = TRACE_ALIGN(sizeof(rec) + 2 * msg_len + tx_len + rx_len);
+    unsigned int gen = atomic_load(&trace_gen);
+
+    if (trace_buf == NULL)
+    {
+        pthread_once(&trace_buf_once, trace_buf_key_init);
+        trace_buf = calloc(1, sizeof(*trace_buf));
+        if (trace_buf == NULL)
+        {
+            return;
+        }
+        pthread_setspecific(trace_buf_key, trace_buf);
+        trace_buf->gen = gen;
+    }
+    if (trace_buf->gen != gen)
+    {
+        // A new trace was started, so drop anything left from the old one
+        trace_buf->used = 0;
+        trace_buf->gen = gen;
+    }
+    if (TRACE_BUF_SIZE - trace_buf->used < size)
+    {
+        trace_buf_flush(trace_buf);
+    }
+
+    rec.size = (uint32_t)size;
+    rec.ioctl_cmd = cmd;
+    rec.start_ns = start_ns;
+    rec.end_ns = end_ns;
+    rec.tid = (uint32_t)syscall(SYS_gettid);
+    rec.status = status;
+    rec.msg_len = (uint16_t)msg_len;
+    rec.tx_len = (uint16_t)tx_len;
+    rec.rx_len = (uint16_t)rx_len;
+
+    uint8_t* out = &trace_buf->data[trace_buf->used];
+    memset(out, 0, size);
+    memcpy(out, &rec, sizeof(rec));
+    out += sizeof(rec);
+    memcpy(out, req, msg_len);
+    out += msg_len;
+    memcpy(out, resp, msg_len);
+    out += msg_len;
+    if (tx_len)
+    {
+        memcpy(out, tx, tx_len);
+        out += tx_len;
+    }
+    if (rx_len)
+    {
+        memcpy(out, rx, rx_len);
+    }
+    trace_buf->used += size;
+}
+
+/*-------------------------------------------------------------------------
+ * This function starts recording every PECI command issued by this process
+ * to the specified trace file
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_TraceStart(const char* path)
+{
+    struct peci_trace_file_hdr hdr = {0};
+    int fd = -1;
+
+    if (path == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+              0644);
+    if (fd < 0)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+    memcpy(hdr.magic, PECI_TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = PECI_TRACE_VERSION;
+    hdr.hdr_size = sizeof(hdr);
+    if (write(fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr))
+    {
+        close(fd);
+        return PECI_CC_DRIVER_ERR;
+    }
+
+    pthread_rwlock_wrlock(&trace_lock);
+    if (trace_fd >= 0)
+    {
+        close(trace_fd);
+    }
+    trace_fd = fd;
+    atomic_fetch_add(&trace_gen, 1);
+    atomic_store(&peci_trace_on, true);
+    pthread_rwlock_unlock(&trace_lock);
+    return PECI_CC_SUCCESS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function writes the calling thread's buffered trace records
+ *------------------------------------------------------------------------*/
+void peci_TraceFlush(void)
+{
+    trace_buf_flush(trace_buf);
+}
+
+/*-------------------------------------------------------------------------
+ * This function flushes the calling thread's records and stops recording
+ *------------------------------------------------------------------------*/
+void peci_TraceStop(void)
+{
+    trace_buf_flush(trace_buf);
+
+    pthread_rwlock_wrlock(&trace_lock);
+    atomic_store(&peci_trace_on, false);
+    atomic_fetch_add(&trace_gen, 1);
+    if (trace_fd >= 0)
+    {
+        close(trace_fd);
+        trace_fd = -1;
+    }
+    pthread_rwlock_unlock(&trace_lock);
+}
+
+/*-------------------------------------------------------------------------
+ * This function flushes the exiting thread's records when the library is
+ * unloaded, since thread-specific destructors don't run for the main thread
+ *------------------------------------------------------------------------*/
+static void trace_fini(void) __attribute__((destructor));
+static void trace_fini(void)
+{
+    trace_buf_flush(trace_buf);
+}
+
+/*-------------------------------------------------------------------------
+ * This function maps a trace file read-only and checks its header
+ *------------------------------------------------------------------------*/
+int peci_trace_map(const char* path, const uint8_t** base, size_t* size)
+{
+    const struct peci_trace_file_hdr* hdr = NULL;
+    struct stat st;
+    void* map = NULL;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*hdr))
+    {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    hdr = map;
+    if (memcmp(hdr->magic, PECI_TRACE_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != PECI_TRACE_VERSION || hdr->hdr_size < sizeof(*hdr) ||
+        hdr->hdr_size > (size_t)st.st_size)
+    {
+        munmap(map, (size_t)st.st_size);
+        return -1;
+    }
+    *base = map;
+    *size = (size_t)st.st_size;
+    return 0;
+}
+
+void peci_trace_unmap(const uint8_t* base, size_t size)
+{
+    munmap((void*)base, size);
+}
+
+/*-------------------------------------------------------------------------
+ * This function returns the record at *pos and advances *pos past it, or
+ * returns NULL at the end of the trace. Start with *pos set to 0.
+ *------------------------------------------------------------------------*/
+const struct peci_trace_record* peci_trace_next(const uint8_t* base,
+                                                size_t size, size_t* pos)
+{
+    const struct peci_trace_file_hdr* hdr = (const void*)base;
+    const struct peci_trace_record* rec = NULL;
+
+    if (*pos < hdr->hdr_size)
+    {
+        *pos = TRACE_ALIGN(hdr->hdr_size);
+    }
+    if (*pos >= size || size - *pos < sizeof(*rec))
+    {
+        return NULL;
+    }
+    rec = (const void*)&base[*pos];
+    if (rec->size < sizeof(*rec) || rec->size > size - *pos ||
+        sizeof(*rec) + 2 * (size_t)rec->msg_len + rec->tx_len + rec->rx_len >
+            rec->size)
+    {
+        return NULL;
+    }
+    *pos += rec->size;
+    return rec;
+}
+
+// The simulated device answers commands from a mapped trace, serving each
+// request with the next recorded response for the same request
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static const uint8_t* sim_base;
+static size_t sim_size;
+static size_t sim_pos;
+static bool sim_real_time;
+
+/*-------------------------------------------------------------------------
+ * This function starts serving PECI commands from a recorded trace instead
+ * of the PECI device
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_SimStart(const char* tracePath, bool realTime)
+{
+    const uint8_t* base = NULL;
+    size_t size = 0;
+
+    if (tracePath == NULL)
+    {
+        return PECI_CC_INVALID_REQ;
+    }
+    if (peci_trace_map(tracePath, &base, &size) != 0)
+    {
+        return PECI_CC_DRIVER_ERR;
+    }
+
+    pthread_mutex_lock(&sim_lock);
+    if (sim_base != NULL)
+    {
+        peci_trace_unmap(sim_base, sim_size);
+    }
+    sim_base = base;
+    sim_size = size;
+    sim_pos = 0;
+    sim_real_time = realTime;
+    atomic_store(&peci_sim_on, true);
+    pthread_mutex_unlock(&sim_lock);
+    return PECI_CC_SUCCESS;
+}
+
+/*-------------------------------------------------------------------------
+ * This function stops the simulated device
+ *------------------------------------------------------------------------*/
+void peci_SimStop(void)
+{
+    pthread_mutex_lock(&sim_lock);
+    atomic_store(&peci_sim_on, false);
+    if (sim_base != NULL)
+    {
+        peci_trace_unmap(sim_base, sim_size);
+        sim_base = NULL;
+    }
+    pthread_mutex_unlock(&sim_lock);
+}
+
+/*-------------------------------------------------------------------------
+ * This function returns a file descriptor that stands in for the PECI
+ * device while the simulated device is active
+ *------------------------------------------------------------------------*/
+int peci_sim_open(void)
+{
+    return open("/dev/null", O_RDWR | O_CLOEXEC);
+}
+
+static bool sim_match(const struct peci_trace_record* rec, unsigned int cmd,
+                      const char* cmdPtr)
+{
+    if (rec->ioctl_cmd != cmd || rec->msg_len != _IOC_SIZE(cmd))
+    {
+        return false;
+    }
+    if (cmd == PECI_IOC_XFER)
+    {
+        const struct peci_xfer_msg* msg = (const void*)cmdPtr;
+        // Compare the header but not the buffer pointers
+        return memcmp(peci_trace_req(rec), msg,
+                      offsetof(struct peci_xfer_msg, tx_buf)) == 0 &&
+               rec->tx_len == msg->tx_len && rec->rx_len == msg->rx_len &&
+               memcmp(peci_trace_tx(rec), msg->tx_buf, msg->tx_len) == 0;
+    }
+    return memcmp(peci_trace_req(rec), cmdPtr, rec->msg_len) == 0;
+}
+
+static const struct peci_trace_record*
+    sim_find(size_t from, size_t to, unsigned int cmd, const char* cmdPtr,
+             size_t* pos)
+{
+    const struct peci_trace_record* rec = NULL;
+
+    *pos = from;
+    while (*pos < to &&
+           (rec = peci_trace_next(sim_base, sim_size, pos)) != NULL)
+    {
+        if (sim_match(rec, cmd, cmdPtr))
+        {
+            return rec;
+        }
+    }
+    return NULL;
+}
+
+/*-------------------------------------------------------------------------
+ * This function serves a PECI command from the simulated device
+ *------------------------------------------------------------------------*/
+EPECIStatus peci_sim_issue_cmd(unsigned int cmd, char* cmdPtr)
+{
+    const struct peci_trace_record* rec = NULL;
+    EPECIStatus ret = PECI_CC_DRIVER_ERR;
+    uint64_t duration = 0;
+    size_t pos = 0;
+
+    pthread_mutex_lock(&sim_lock);
+    if (sim_base != NULL)
+    {
+        // Search forward from the last served record, then wrap around
+        rec = sim_find(sim_pos, sim_size, cmd, cmdPtr, &pos);
+        if (rec == NULL)
+        {
+            rec = sim_find(0, sim_pos, cmd, cmdPtr, &pos);
+        }
+    }
+    if (rec != NULL)
+    {
+        sim_pos = pos;
+        if (cmd == PECI_IOC_XFER)
+        {
+            struct peci_xfer_msg* msg = (void*)cmdPtr;
+            memcpy(msg->rx_buf, peci_trace_rx(rec), rec->rx_len);
+        }
+        else
+        {
+            memcpy(cmdPtr, peci_trace_resp(rec), rec->msg_len);
+        }
+        ret = rec->status;
+        if (sim_real_time && rec->end_ns > rec->start_ns)
+        {
+            duration = rec->end_ns - rec->start_ns;
+        }
+    }
+    pthread_mutex_unlock(&sim_lock);
+
+    if (duration)
+    {
+        struct timespec delay = {
+            .tv_sec = (time_t)(duration / 1000000000ULL),
+            .tv_nsec = (long)(duration % 1000000000ULL),
+        };
+        nanosleep(&delay, NULL);
+    }
+    return ret;
+}
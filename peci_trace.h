@@ -0,0 +1,95 @@
+/*
+// Copyright (c) 2026 Intel Corporation
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+*/
+#pragma once
+#include <peci.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Internal interface between the PECI command path and the trace recorder
+// and simulated device.  Not installed.
+
+// Trace files start with this header, followed by records back to back.
+// Every record starts on an 8 byte boundary so a mapped trace can be walked
+// in place.
+#define PECI_TRACE_MAGIC "PECITRC1"
+#define PECI_TRACE_VERSION 1
+
+struct peci_trace_file_hdr
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t hdr_size;
+};
+
+struct peci_trace_record
+{
+    uint32_t size;      // total record size including padding
+    uint32_t ioctl_cmd; // PECI_IOC_* number
+    uint64_t start_ns;  // CLOCK_MONOTONIC when the command was issued
+    uint64_t end_ns;    // CLOCK_MONOTONIC when the command returned
+    uint32_t tid;       // issuing thread
+    int32_t status;     // EPECIStatus returned to the caller
+    uint16_t msg_len;   // size of the ioctl message struct
+    uint16_t tx_len;    // raw transmit bytes (PECI_IOC_XFER only)
+    uint16_t rx_len;    // raw receive bytes (PECI_IOC_XFER only)
+    uint16_t reserved;
+    // Followed by the message struct as sent, the message struct as
+    // returned, then the raw transmit and receive bytes
+};
+
+// Largest ioctl message struct that can be traced
+#define PECI_TRACE_MAX_MSG 128
+
+extern atomic_bool peci_trace_on;
+extern atomic_bool peci_sim_on;
+
+uint64_t peci_now_ns(void);
+void peci_trace_record(unsigned int cmd, const void* req, const void* resp,
+                       size_t msg_len, const uint8_t* tx, size_t tx_len,
+                       const uint8_t* rx, size_t rx_len, uint64_t start_ns,
+                       uint64_t end_ns, EPECIStatus status);
+
+// Simulated device backed by a recorded trace
+int peci_sim_open(void);
+EPECIStatus peci_sim_issue_cmd(unsigned int cmd, char* cmdPtr);
+
+// Read-only access to a recorded trace
+int peci_trace_map(const char* path, const uint8_t** base, size_t* size);
+void peci_trace_unmap(const uint8_t* base, size_t size);
+const struct peci_trace_record* peci_trace_next(const uint8_t* base,
+                                                size_t size, size_t* pos);
+
+static inline const uint8_t*
+    peci_trace_req(const struct peci_trace_record* rec)
+{
+    return (const uint8_t*)(rec + 1);
+}
+
+static inline const uint8_t*
+    peci_trace_resp(const struct peci_trace_record* rec)
+{
+    return peci_trace_req(rec) + rec->msg_len;
+}
+
+static inline const uint8_t* peci_trace_tx(const struct peci_trace_record* rec)
+{
+    return peci_trace_resp(rec) + rec->msg_len;
+}
+
+static inline const uint8_t* peci_trace_rx(const struct peci_trace_record* rec)
+{
+    return peci_trace_tx(rec) + rec->tx_len;
+}